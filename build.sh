@@ -7,10 +7,11 @@ set -e  # Exit immediately on error
 
 BUILD_DIR="build"
 MAIN_EXECUTABLE="hopscotch_ht_app"
+BENCH_EXECUTABLE="hopscotch_bench"
 
 # Clean if requested
 if [[ "$1" == "clean" ]]; then
-	rm -rf "$MAIN_EXECUTABLE"
+	rm -rf "$MAIN_EXECUTABLE" "$BENCH_EXECUTABLE"
 	echo "Cleaning build directory..."
 	rm -rf "${BUILD_DIR}"
 	exit 0
@@ -26,7 +27,7 @@ make
 
 # Copy executables to root for easy access
 echo "Preparing binaries..."
-cp "${MAIN_EXECUTABLE}" ..
+cp "${MAIN_EXECUTABLE}" "${BENCH_EXECUTABLE}" ..
 cd ../
 
 echo "Build successfully completed!"
@@ -0,0 +1,762 @@
+#include <getopt.h>
+#include <math.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "hopscotch_ht.h"
+#include "hopscotch_ht_test_misc.h"
+
+//------------------------------------------------------------------------------
+// Workload description.
+//------------------------------------------------------------------------------
+typedef enum {
+	BENCH_OP_READ = 0,
+	BENCH_OP_INSERT,
+	BENCH_OP_UPDATE,
+	BENCH_OP_DELETE,
+	BENCH_OP_TOTAL
+} bench_op_t;
+
+static const char *bench_op_names[BENCH_OP_TOTAL] = {
+	"read", "insert", "update", "delete"
+};
+
+typedef enum {
+	BENCH_DIST_UNIFORM = 0,
+	BENCH_DIST_ZIPFIAN,
+	BENCH_DIST_HOTSPOT
+} bench_dist_t;
+
+static const char *bench_dist_names[] = { "uniform", "zipfian", "hotspot" };
+
+typedef enum {
+	BENCH_FORMAT_TEXT = 0,
+	BENCH_FORMAT_CSV,
+	BENCH_FORMAT_JSON
+} bench_format_t;
+
+typedef struct {
+	const char *workload;
+	unsigned mix[BENCH_OP_TOTAL]; // Percent of the operations, sums to 100.
+	bench_dist_t dist;
+	double theta;                 // Zipfian skew.
+	unsigned hot_set;             // Hotspot: percent of the keys which are hot,
+	unsigned hot_ops;             // and percent of the operations on them.
+	size_t capacity;
+	unsigned load;                // Percent of capacity loaded before the run.
+	size_t threads;
+	double duration;              // Seconds.
+	uint64_t seed;
+	bool fixed;                   // No online resize.
+	bench_format_t format;
+} bench_config_t;
+
+// YCSB core workloads without scans. D reads recently inserted keys in
+// YCSB, here it uses the chosen distribution as the others do.
+static const struct {
+	const char *name;
+	unsigned mix[BENCH_OP_TOTAL];
+} bench_workloads[] = {
+	{ "a", { 50, 0, 50, 0 } }, // Update heavy.
+	{ "b", { 95, 0, 5, 0 } },  // Read mostly.
+	{ "c", { 100, 0, 0, 0 } }, // Read only.
+	{ "d", { 95, 5, 0, 0 } },  // Read latest.
+};
+
+//------------------------------------------------------------------------------
+// Clock.
+//------------------------------------------------------------------------------
+// The TSC where there is one (constant and invariant on any CPU of the last
+// decade), CLOCK_MONOTONIC otherwise. Ticks are converted to ns by the rate
+// measured against CLOCK_MONOTONIC at start.
+static inline uint64_t bench_monotonic_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static inline uint64_t bench_ticks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return bench_monotonic_ns();
+#endif
+}
+
+static double bench_ns_per_tick(void) {
+#if defined(__x86_64__) || defined(__i386__)
+	uint64_t ns0 = bench_monotonic_ns(), t0 = bench_ticks();
+	usleep(100000);
+	uint64_t ns1 = bench_monotonic_ns(), t1 = bench_ticks();
+	return t1 > t0 ? (double)(ns1 - ns0) / (double)(t1 - t0) : 1.0;
+#else
+	return 1.0;
+#endif
+}
+
+//------------------------------------------------------------------------------
+// Latency histogram.
+//------------------------------------------------------------------------------
+// Log-linear buckets as HdrHistogram has them: values below BENCH_HIST_SUB
+// are exact, above every power of two is split into BENCH_HIST_SUB / 2
+// buckets, so a bucket is at most 1 / 64 of its value wide.
+#define BENCH_HIST_SUB_BITS (7)
+#define BENCH_HIST_SUB (1u << BENCH_HIST_SUB_BITS)
+#define BENCH_HIST_HALF (BENCH_HIST_SUB / 2)
+#define BENCH_HIST_BUCKETS \
+	(BENCH_HIST_SUB + (64 - BENCH_HIST_SUB_BITS) * BENCH_HIST_HALF)
+
+typedef struct {
+	uint64_t counts[BENCH_HIST_BUCKETS];
+	uint64_t total;
+	uint64_t sum;
+	uint64_t max;
+} bench_hist_t;
+
+static inline size_t bench_hist_index(uint64_t v) {
+	if(v < BENCH_HIST_SUB) return (size_t)v;
+	unsigned shift = 63 - __builtin_clzll(v) - BENCH_HIST_SUB_BITS + 1;
+	return BENCH_HIST_SUB + (shift - 1) * BENCH_HIST_HALF +
+		((v >> shift) - BENCH_HIST_HALF);
+}
+
+// Highest value of the bucket.
+static uint64_t bench_hist_value(size_t idx) {
+	if(idx < BENCH_HIST_SUB) return idx;
+	size_t k = idx - BENCH_HIST_SUB;
+	unsigned shift = (unsigned)(k / BENCH_HIST_HALF) + 1;
+	uint64_t top = k % BENCH_HIST_HALF + BENCH_HIST_HALF;
+	return ((top + 1) << shift) - 1;
+}
+
+static inline void bench_hist_record(bench_hist_t *h, uint64_t v) {
+	h->counts[bench_hist_index(v)]++;
+	h->total++;
+	h->sum += v;
+	if(v > h->max) h->max = v;
+}
+
+static void bench_hist_merge(bench_hist_t *to, const bench_hist_t *from) {
+	for(size_t i = 0; i < BENCH_HIST_BUCKETS; i++) to->counts[i] += from->counts[i];
+	to->total += from->total;
+	to->sum += from->sum;
+	if(from->max > to->max) to->max = from->max;
+}
+
+// Value at or below which q (0..1) of the samples are.
+static uint64_t bench_hist_quantile(const bench_hist_t *h, double q) {
+	if(!h->total) return 0;
+	uint64_t rank = (uint64_t)ceil(q * (double)h->total);
+	if(rank == 0) rank = 1;
+	uint64_t seen = 0;
+	for(size_t i = 0; i < BENCH_HIST_BUCKETS; i++) {
+		seen += h->counts[i];
+		if(seen >= rank) {
+			uint64_t v = bench_hist_value(i);
+			return v < h->max ? v : h->max;
+		}
+	}
+	return h->max;
+}
+
+//------------------------------------------------------------------------------
+// Keys.
+//------------------------------------------------------------------------------
+// Key id is the first word, the rest are derived from it, so a key is built
+// from its id alone by any thread.
+static inline void bench_key(uint8_t *key, uint64_t id) {
+	uint64_t words[KEY_SIZE / sizeof(uint64_t)];
+	uint64_t x = id;
+	words[0] = id;
+	for(size_t i = 1; i < KEY_SIZE / sizeof(uint64_t); i++) {
+		words[i] = test_splitmix64(&x);
+	}
+	memcpy(key, words, KEY_SIZE);
+}
+
+// YCSB scrambled zipfian (Gray et al., "Quickly generating billion-record
+// synthetic databases"), ranks are spread over the ids by a hash so the hot
+// keys are not neighbours.
+typedef struct {
+	uint64_t items;
+	double theta;
+	double alpha;
+	double zetan;
+	double eta;
+	double half_pow_theta;
+} bench_zipf_t;
+
+static double bench_zeta(uint64_t n, double theta) {
+	double sum = 0;
+	for(uint64_t i = 1; i <= n; i++) sum += 1.0 / pow((double)i, theta);
+	return sum;
+}
+
+static void bench_zipf_init(bench_zipf_t *z, uint64_t items, double theta) {
+	z->items = items;
+	z->theta = theta;
+	z->alpha = 1.0 / (1.0 - theta);
+	z->zetan = bench_zeta(items, theta);
+	double zeta2 = bench_zeta(2, theta);
+	z->eta = (1.0 - pow(2.0 / (double)items, 1.0 - theta)) /
+		(1.0 - zeta2 / z->zetan);
+	z->half_pow_theta = 1.0 + pow(0.5, theta);
+}
+
+static inline uint64_t bench_zipf_next(const bench_zipf_t *z, test_rng_t *rng) {
+	double u = test_rng_double(rng);
+	double uz = u * z->zetan;
+	uint64_t rank;
+	if(uz < 1.0) rank = 0;
+	else if(uz < z->half_pow_theta) rank = 1;
+	else rank = (uint64_t)((double)z->items *
+		pow(z->eta * u - z->eta + 1.0, z->alpha));
+	if(rank >= z->items) rank = z->items - 1;
+	return test_splitmix64(&rank) % z->items;
+}
+
+//------------------------------------------------------------------------------
+// Worker threads.
+//------------------------------------------------------------------------------
+typedef struct {
+	const bench_config_t *config;
+	const bench_zipf_t *zipf;
+	hopscotch_hash_table_t *ht;
+	size_t thread_id;
+	uint64_t records;
+	atomic_uint_fast64_t *next_id;   // Ids below are loaded or inserted.
+	atomic_size_t *ready;
+	atomic_bool *start;
+	atomic_bool *stop;
+	bench_hist_t hist[BENCH_OP_TOTAL];
+	uint64_t hits[BENCH_OP_TOTAL];    // Reads, updates and deletes which found
+	uint64_t misses[BENCH_OP_TOTAL];  // their key, inserts which succeeded.
+} bench_thread_t;
+
+// Zipfian keys are drawn from the loaded records, uniform and hotspot keys
+// from every id handed out so far.
+static inline uint64_t bench_pick(bench_thread_t *t, test_rng_t *rng, uint64_t ids) {
+	const bench_config_t *c = t->config;
+	switch(c->dist) {
+	case BENCH_DIST_ZIPFIAN:
+		return bench_zipf_next(t->zipf, rng);
+	case BENCH_DIST_HOTSPOT: {
+		uint64_t hot = ids * c->hot_set / 100;
+		if(hot == 0) hot = 1;
+		if(hot >= ids || test_rng_next(rng) % 100 < c->hot_ops) {
+			return test_rng_next(rng) % hot;
+		}
+		return hot + test_rng_next(rng) % (ids - hot);
+	}
+	default:
+		return test_rng_next(rng) % ids;
+	}
+}
+
+static int bench_load_worker(void *arg) {
+	bench_thread_t *t = (bench_thread_t *)arg;
+	uint8_t key[KEY_SIZE], value[VALUE_SIZE];
+	memset(value, 0, sizeof(value));
+	size_t threads = t->config->threads;
+	uint64_t start = t->records * t->thread_id / threads;
+	uint64_t end = t->records * (t->thread_id + 1) / threads;
+	for(uint64_t id = start; id < end; id++) {
+		bench_key(key, id);
+		memcpy(value, &id, sizeof(id));
+		if(ht_insert(t->ht, key, value)) t->hits[BENCH_OP_INSERT]++;
+		else t->misses[BENCH_OP_INSERT]++;
+	}
+	return 0;
+}
+
+static int bench_run_worker(void *arg) {
+	bench_thread_t *t = (bench_thread_t *)arg;
+	const bench_config_t *c = t->config;
+	test_rng_t rng;
+	test_rng_seed(&rng, c->seed + t->thread_id * 0x9e3779b97f4a7c15ULL);
+
+	unsigned threshold[BENCH_OP_TOTAL], sum = 0;
+	for(int op = 0; op < BENCH_OP_TOTAL; op++) {
+		sum += c->mix[op];
+		threshold[op] = sum;
+	}
+
+	uint8_t key[KEY_SIZE], value[VALUE_SIZE];
+	memset(value, 0, sizeof(value));
+	uint64_t ids = atomic_load(t->next_id);
+
+	atomic_fetch_add(t->ready, 1);
+	while(!atomic_load(t->start)) thrd_yield();
+
+	for(uint64_t n = 0;; n++) {
+		// The shared words are read once in a while only.
+		if((n & 63) == 0) {
+			if(atomic_load_explicit(t->stop, memory_order_relaxed)) break;
+			ids = atomic_load_explicit(t->next_id, memory_order_relaxed);
+		}
+
+		unsigned dice = (unsigned)(test_rng_next(&rng) % 100);
+		int op = 0;
+		while(dice >= threshold[op]) op++;
+
+		uint64_t id = op == BENCH_OP_INSERT ?
+			atomic_fetch_add_explicit(t->next_id, 1, memory_order_relaxed) :
+			bench_pick(t, &rng, ids);
+		bench_key(key, id);
+		memcpy(value, &n, sizeof(n));
+
+		bool ok = false;
+		uint64_t t0 = bench_ticks();
+		switch(op) {
+		case BENCH_OP_READ:
+			ok = ht_contains_key(t->ht, key, value);
+			break;
+		case BENCH_OP_INSERT:
+			ok = ht_insert(t->ht, key, value);
+			break;
+		case BENCH_OP_UPDATE:
+			ok = ht_replace(t->ht, key, value);
+			break;
+		case BENCH_OP_DELETE:
+			ok = ht_remove_key(t->ht, key);
+			break;
+		}
+		uint64_t t1 = bench_ticks();
+
+		bench_hist_record(&t->hist[op], t1 - t0);
+		if(ok) t->hits[op]++;
+		else t->misses[op]++;
+	}
+	return 0;
+}
+
+//------------------------------------------------------------------------------
+// Report.
+//------------------------------------------------------------------------------
+typedef struct {
+	const char *name;
+	const bench_hist_t *hist;
+	uint64_t hits;
+	uint64_t misses;
+} bench_row_t;
+
+static void bench_print_text(
+	const bench_row_t *rows,
+	size_t nrows,
+	double elapsed,
+	double ns_per_tick
+) {
+	printf("%-7s %12s %14s %8s %10s %10s %10s %10s %10s\n", "op", "count",
+		"ops/sec", "hit%", "mean_ns", "p50_ns", "p99_ns", "p99.9_ns", "max_ns");
+	for(size_t i = 0; i < nrows; i++) {
+		const bench_hist_t *h = rows[i].hist;
+		if(!h->total) continue;
+		printf("%-7s %12lu %14.0f %8.2f %10.1f %10.0f %10.0f %10.0f %10.0f\n",
+			rows[i].name, h->total, h->total / elapsed,
+			100.0 * rows[i].hits / h->total,
+			ns_per_tick * h->sum / h->total,
+			ns_per_tick * bench_hist_quantile(h, 0.5),
+			ns_per_tick * bench_hist_quantile(h, 0.99),
+			ns_per_tick * bench_hist_quantile(h, 0.999),
+			ns_per_tick * h->max);
+	}
+}
+
+static void bench_print_csv(
+	const bench_config_t *c,
+	const bench_row_t *rows,
+	size_t nrows,
+	double elapsed,
+	double ns_per_tick
+) {
+	printf("workload,distribution,threads,capacity,load,op,count,ops_per_sec,"
+		"hits,misses,mean_ns,p50_ns,p99_ns,p999_ns,max_ns\n");
+	for(size_t i = 0; i < nrows; i++) {
+		const bench_hist_t *h = rows[i].hist;
+		if(!h->total) continue;
+		printf("%s,%s,%lu,%lu,%u,%s,%lu,%.0f,%lu,%lu,%.1f,%.0f,%.0f,%.0f,%.0f\n",
+			c->workload, bench_dist_names[c->dist], c->threads, c->capacity,
+			c->load, rows[i].name, h->total, h->total / elapsed,
+			rows[i].hits, rows[i].misses,
+			ns_per_tick * h->sum / h->total,
+			ns_per_tick * bench_hist_quantile(h, 0.5),
+			ns_per_tick * bench_hist_quantile(h, 0.99),
+			ns_per_tick * bench_hist_quantile(h, 0.999),
+			ns_per_tick * h->max);
+	}
+}
+
+static void bench_print_json(
+	const bench_config_t *c,
+	const bench_row_t *rows,
+	size_t nrows,
+	double elapsed,
+	double ns_per_tick,
+	hopscotch_hash_table_t *ht
+) {
+	printf("{\"config\":{\"workload\":\"%s\",\"mix\":{", c->workload);
+	for(int op = 0; op < BENCH_OP_TOTAL; op++) {
+		printf("%s\"%s\":%u", op ? "," : "", bench_op_names[op], c->mix[op]);
+	}
+	printf("},\"distribution\":\"%s\",\"theta\":%.3f,\"hot_set\":%u,"
+		"\"hot_ops\":%u,\"capacity\":%lu,\"load\":%u,\"threads\":%lu,"
+		"\"duration\":%.3f,\"seed\":%lu,\"fixed\":%s},\"elapsed\":%.3f,",
+		bench_dist_names[c->dist], c->theta, c->hot_set, c->hot_ops,
+		c->capacity, c->load, c->threads, c->duration, c->seed,
+		c->fixed ? "true" : "false", elapsed);
+
+	printf("\"ops\":[");
+	bool first = true;
+	for(size_t i = 0; i < nrows; i++) {
+		const bench_hist_t *h = rows[i].hist;
+		if(!h->total) continue;
+		printf("%s{\"op\":\"%s\",\"count\":%lu,\"ops_per_sec\":%.0f,"
+			"\"hits\":%lu,\"misses\":%lu,\"mean_ns\":%.1f,\"p50_ns\":%.0f,"
+			"\"p99_ns\":%.0f,\"p999_ns\":%.0f,\"max_ns\":%.0f}",
+			first ? "" : ",", rows[i].name, h->total, h->total / elapsed,
+			rows[i].hits, rows[i].misses,
+			ns_per_tick * h->sum / h->total,
+			ns_per_tick * bench_hist_quantile(h, 0.5),
+			ns_per_tick * bench_hist_quantile(h, 0.99),
+			ns_per_tick * bench_hist_quantile(h, 0.999),
+			ns_per_tick * h->max);
+		first = false;
+	}
+	printf("],");
+
+	ht_stats_t stats;
+	ht_get_stats(ht, &stats);
+	size_t len = ht_stats_json(&stats, NULL, 0);
+	char *json = malloc(len + 1);
+	if(json) {
+		ht_stats_json(&stats, json, len + 1);
+		printf("\"stats\":%s}\n", json);
+		free(json);
+	} else {
+		printf("\"stats\":null}\n");
+	}
+}
+
+//------------------------------------------------------------------------------
+// Options.
+//------------------------------------------------------------------------------
+static void bench_usage(const char *prog) {
+	printf(
+		"Usage: %s [options]\n"
+		"  -w, --workload a|b|c|d     YCSB mix (a: 50/50 read/update, b: 95/5\n"
+		"                             read/update, c: read only, d: 95/5\n"
+		"                             read/insert), default a\n"
+		"  -r, --read PCT             Read percent\n"
+		"  -i, --insert PCT           Insert percent (new keys)\n"
+		"  -u, --update PCT           Update percent (ht_replace)\n"
+		"  -d, --delete PCT           Delete percent\n"
+		"  -k, --distribution NAME    uniform, zipfian or hotspot, default zipfian\n"
+		"      --theta T              Zipfian skew, default 0.99\n"
+		"      --hot-set PCT          Hotspot keys, default 20\n"
+		"      --hot-ops PCT          Hotspot operations on them, default 80\n"
+		"  -c, --capacity N           Table capacity (power of two), default 0x100000\n"
+		"  -l, --load PCT             Keys loaded before the run, default 75\n"
+		"  -t, --threads N            Worker threads, default 4\n"
+		"  -s, --duration SEC         Run time, default 10\n"
+		"      --seed N               Random seed, default 1\n"
+		"      --fixed                No online resize\n"
+		"  -f, --format text|csv|json Output, default text\n"
+		"  -h, --help\n"
+		"Custom -r/-i/-u/-d percents replace the workload mix and must sum to 100.\n",
+		prog);
+}
+
+static bool bench_parse_name(const char *arg, const char **names, size_t n, int *out) {
+	for(size_t i = 0; i < n; i++) {
+		if(strcmp(arg, names[i]) == 0) {
+			*out = (int)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool bench_parse_options(int argc, char **argv, bench_config_t *c) {
+	enum { OPT_THETA = 256, OPT_HOT_SET, OPT_HOT_OPS, OPT_SEED, OPT_FIXED };
+	static const struct option options[] = {
+		{ "workload", required_argument, NULL, 'w' },
+		{ "read", required_argument, NULL, 'r' },
+		{ "insert", required_argument, NULL, 'i' },
+		{ "update", required_argument, NULL, 'u' },
+		{ "delete", required_argument, NULL, 'd' },
+		{ "distribution", required_argument, NULL, 'k' },
+		{ "theta", required_argument, NULL, OPT_THETA },
+		{ "hot-set", required_argument, NULL, OPT_HOT_SET },
+		{ "hot-ops", required_argument, NULL, OPT_HOT_OPS },
+		{ "capacity", required_argument, NULL, 'c' },
+		{ "load", required_argument, NULL, 'l' },
+		{ "threads", required_argument, NULL, 't' },
+		{ "duration", required_argument, NULL, 's' },
+		{ "seed", required_argument, NULL, OPT_SEED },
+		{ "fixed", no_argument, NULL, OPT_FIXED },
+		{ "format", required_argument, NULL, 'f' },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 }
+	};
+	static const char *formats[] = { "text", "csv", "json" };
+
+	unsigned custom[BENCH_OP_TOTAL] = { 0 };
+	bool has_custom = false;
+	int opt, value;
+	while((opt = getopt_long(argc, argv, "w:r:i:u:d:k:c:l:t:s:f:h", options,
+		NULL)) != -1) {
+		switch(opt) {
+		case 'w': {
+			bool found = false;
+			for(size_t i = 0; i < sizeof(bench_workloads) /
+				sizeof(bench_workloads[0]); i++) {
+				if(strcmp(optarg, bench_workloads[i].name) == 0) {
+					c->workload = bench_workloads[i].name;
+					memcpy(c->mix, bench_workloads[i].mix, sizeof(c->mix));
+					found = true;
+				}
+			}
+			if(!found) {
+				printf("Error: Unknown workload %s\n", optarg);
+				return false;
+			}
+			break;
+		}
+		case 'r': custom[BENCH_OP_READ] = atoi(optarg); has_custom = true; break;
+		case 'i': custom[BENCH_OP_INSERT] = atoi(optarg); has_custom = true; break;
+		case 'u': custom[BENCH_OP_UPDATE] = atoi(optarg); has_custom = true; break;
+		case 'd': custom[BENCH_OP_DELETE] = atoi(optarg); has_custom = true; break;
+		case 'k':
+			if(!bench_parse_name(optarg, bench_dist_names, 3, &value)) {
+				printf("Error: Unknown distribution %s\n", optarg);
+				return false;
+			}
+			c->dist = (bench_dist_t)value;
+			break;
+		case OPT_THETA: c->theta = atof(optarg); break;
+		case OPT_HOT_SET: c->hot_set = atoi(optarg); break;
+		case OPT_HOT_OPS: c->hot_ops = atoi(optarg); break;
+		case 'c': c->capacity = strtoull(optarg, NULL, 0); break;
+		case 'l': c->load = atoi(optarg); break;
+		case 't': c->threads = strtoull(optarg, NULL, 0); break;
+		case 's': c->duration = atof(optarg); break;
+		case OPT_SEED: c->seed = strtoull(optarg, NULL, 0); break;
+		case OPT_FIXED: c->fixed = true; break;
+		case 'f':
+			if(!bench_parse_name(optarg, formats, 3, &value)) {
+				printf("Error: Unknown format %s\n", optarg);
+				return false;
+			}
+			c->format = (bench_format_t)value;
+			break;
+		default:
+			bench_usage(argv[0]);
+			return false;
+		}
+	}
+
+	if(has_custom) {
+		c->workload = "custom";
+		memcpy(c->mix, custom, sizeof(c->mix));
+	}
+	unsigned sum = 0;
+	for(int op = 0; op < BENCH_OP_TOTAL; op++) sum += c->mix[op];
+	if(sum != 100) {
+		printf("Error: Operation mix sums to %u%%, not 100%%\n", sum);
+		return false;
+	}
+	if(c->theta <= 0 || c->theta >= 1) {
+		printf("Error: Zipfian theta must be in (0, 1)\n");
+		return false;
+	}
+	if(c->hot_set > 100 || c->hot_ops > 100 || c->load > 100) {
+		printf("Error: Percent out of range\n");
+		return false;
+	}
+	if(c->capacity == 0 || c->threads == 0 || c->duration <= 0) {
+		printf("Error: Capacity, threads and duration must be positive\n");
+		return false;
+	}
+	c->capacity = round_to_power_of_two(c->capacity);
+	return true;
+}
+
+//------------------------------------------------------------------------------
+// Main.
+//------------------------------------------------------------------------------
+// Starts fn on every thread, calls ready (if any) once they all run and
+// joins them.
+static bool bench_run_threads(
+	bench_thread_t *threads,
+	size_t n,
+	thrd_start_t fn,
+	void (*ready)(bench_thread_t *threads, size_t n)
+) {
+	thrd_t *ids = malloc(sizeof(thrd_t) * n);
+	if(!ids) return false;
+	size_t started = 0;
+	for(; started < n; started++) {
+		if(thrd_create(&ids[started], fn, &threads[started]) != thrd_success) break;
+	}
+	if(ready) {
+		if(started == n) ready(threads, n);
+		atomic_store(threads[0].stop, true);
+		atomic_store(threads[0].start, true);
+	}
+	for(size_t i = 0; i < started; i++) thrd_join(ids[i], NULL);
+	free(ids);
+	return started == n;
+}
+
+// Runs the workers for the configured duration.
+static void bench_timed_run(bench_thread_t *threads, size_t n) {
+	while(atomic_load(threads[0].ready) < n) usleep(1000);
+	atomic_store(threads[0].start, true);
+	usleep((useconds_t)(threads[0].config->duration * 1e6));
+}
+
+int main(int argc, char **argv) {
+	bench_config_t config = {
+		.workload = "a",
+		.mix = { 50, 0, 50, 0 },
+		.dist = BENCH_DIST_ZIPFIAN,
+		.theta = 0.99,
+		.hot_set = 20,
+		.hot_ops = 80,
+		.capacity = 0x100000,
+		.load = 75,
+		.threads = 4,
+		.duration = 10,
+		.seed = 1,
+		.fixed = false,
+		.format = BENCH_FORMAT_TEXT,
+	};
+	if(!bench_parse_options(argc, argv, &config)) return 1;
+
+	hopscotch_hash_table_t *ht = ht_create(config.capacity, murmur_custom_hash,
+		config.seed);
+	if(!ht) {
+		printf("Error: Unable to create Hash table\n");
+		return 1;
+	}
+	if(config.fixed) ht_set_resize_policy(ht, 0, 0);
+
+	uint64_t records = (uint64_t)config.capacity * config.load / 100;
+	if(records == 0) records = 1;
+	bench_zipf_t zipf;
+	bench_zipf_init(&zipf, records, config.theta);
+
+	bench_thread_t *threads = calloc(config.threads, sizeof(bench_thread_t));
+	if(!threads) {
+		printf("Error: Unable to allocate thread data\n");
+		ht_free(ht);
+		return 1;
+	}
+	atomic_uint_fast64_t next_id = records;
+	atomic_size_t ready = 0;
+	atomic_bool start = false, stop = false;
+	for(size_t i = 0; i < config.threads; i++) {
+		threads[i] = (bench_thread_t){
+			.config = &config,
+			.zipf = &zipf,
+			.ht = ht,
+			.thread_id = i,
+			.records = records,
+			.next_id = &next_id,
+			.ready = &ready,
+			.start = &start,
+			.stop = &stop,
+		};
+	}
+	double ns_per_tick = bench_ns_per_tick();
+
+	//--------------------------------------------------------------------------
+	// LOAD.
+	//--------------------------------------------------------------------------
+	uint64_t load_start = bench_monotonic_ns();
+	if(!bench_run_threads(threads, config.threads, bench_load_worker, NULL)) {
+		printf("Error: Unable to start threads\n");
+		free(threads);
+		ht_free(ht);
+		return 1;
+	}
+	double load_elapsed = (bench_monotonic_ns() - load_start) * 1e-9;
+	uint64_t load_failed = 0;
+	for(size_t i = 0; i < config.threads; i++) {
+		load_failed += threads[i].misses[BENCH_OP_INSERT];
+		threads[i].hits[BENCH_OP_INSERT] = threads[i].misses[BENCH_OP_INSERT] = 0;
+	}
+	ht_resize_wait(ht);
+
+	if(config.format == BENCH_FORMAT_TEXT) {
+		printf("Workload %s: read %u%% insert %u%% update %u%% delete %u%%, "
+			"%s keys", config.workload, config.mix[BENCH_OP_READ],
+			config.mix[BENCH_OP_INSERT], config.mix[BENCH_OP_UPDATE],
+			config.mix[BENCH_OP_DELETE], bench_dist_names[config.dist]);
+		if(config.dist == BENCH_DIST_ZIPFIAN) printf(" (theta %.2f)", config.theta);
+		if(config.dist == BENCH_DIST_HOTSPOT) {
+			printf(" (%u%% of ops on %u%% of keys)", config.hot_ops, config.hot_set);
+		}
+		printf("\nTable capacity %lu, %lu keys loaded (%u%%) in %.3f sec, "
+			"%lu failed\n", config.capacity, records, config.load, load_elapsed,
+			load_failed);
+		printf("Threads %lu, duration %.1f sec, seed %lu, %.3f ns per tick\n",
+			config.threads, config.duration, config.seed, ns_per_tick);
+	}
+
+	//--------------------------------------------------------------------------
+	// RUN.
+	//--------------------------------------------------------------------------
+	uint64_t run_start = bench_monotonic_ns();
+	if(!bench_run_threads(threads, config.threads, bench_run_worker,
+		bench_timed_run)) {
+		printf("Error: Unable to start threads\n");
+		free(threads);
+		ht_free(ht);
+		return 1;
+	}
+	double elapsed = (bench_monotonic_ns() - run_start) * 1e-9;
+
+	bench_hist_t *merged = calloc(BENCH_OP_TOTAL + 1, sizeof(bench_hist_t));
+	if(!merged) {
+		printf("Error: Unable to allocate histograms\n");
+		free(threads);
+		ht_free(ht);
+		return 1;
+	}
+	bench_row_t rows[BENCH_OP_TOTAL + 1];
+	memset(rows, 0, sizeof(rows));
+	for(int op = 0; op <= BENCH_OP_TOTAL; op++) {
+		rows[op].name = op < BENCH_OP_TOTAL ? bench_op_names[op] : "total";
+		rows[op].hist = &merged[op];
+	}
+	for(size_t i = 0; i < config.threads; i++) {
+		for(int op = 0; op < BENCH_OP_TOTAL; op++) {
+			bench_hist_merge(&merged[op], &threads[i].hist[op]);
+			bench_hist_merge(&merged[BENCH_OP_TOTAL], &threads[i].hist[op]);
+			rows[op].hits += threads[i].hits[op];
+			rows[op].misses += threads[i].misses[op];
+			rows[BENCH_OP_TOTAL].hits += threads[i].hits[op];
+			rows[BENCH_OP_TOTAL].misses += threads[i].misses[op];
+		}
+	}
+
+	switch(config.format) {
+	case BENCH_FORMAT_CSV:
+		bench_print_csv(&config, rows, BENCH_OP_TOTAL + 1, elapsed, ns_per_tick);
+		break;
+	case BENCH_FORMAT_JSON:
+		bench_print_json(&config, rows, BENCH_OP_TOTAL + 1, elapsed, ns_per_tick, ht);
+		break;
+	default:
+		bench_print_text(rows, BENCH_OP_TOTAL + 1, elapsed, ns_per_tick);
+		printf("Table size %lu, capacity %lu\n", ht_size(ht), ht_capacity(ht));
+		break;
+	}
+
+	free(merged);
+	free(threads);
+	ht_free(ht);
+	return 0;
+}
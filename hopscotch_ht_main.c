@@ -2,12 +2,59 @@
 #include "hopscotch_ht_test_iface.h"
 
 int main() {
-	test_run_concurrent(0x400000, murmur_custom_hash, false, 32);
+	test_run_concurrent(0x400000, murmur_custom_hash, false, 32, 0);
+	printf("\n");
+	test_run_concurrent(0x400000, murmur_custom_hash, false, 32, 4);
 	printf("\n");
 	test_lookup_for_specific_key_value(NULL, murmur_custom_hash, 0x100000);
 	printf("\n");
 	test_insert_remove_elements(0x100000, murmur_custom_hash, false, true, true);
 	printf("\n");
 	test_relocation_and_max_relocation_value();
+	printf("\n");
+	test_online_resize(0x400, 0x40000, murmur_custom_hash, 32);
+	printf("\n");
+	test_layout_benchmark(0x100000, murmur_custom_hash);
+	printf("\n");
+	test_consistent_reads(0x100, murmur_custom_hash, 8, 0x1000);
+	printf("\n");
+	test_high_load_displacement(0x100000, murmur_custom_hash, 95, 8);
+	printf("\n");
+	test_batch_operations(0x400000, murmur_custom_hash);
+	printf("\n");
+	test_variable_length(0x40000, murmur_custom_hash);
+	printf("\n");
+	test_typed_tables(0x100000);
+	printf("\n");
+	test_hash_binding(0x10000);
+	printf("\n");
+	test_hash_kernels(0x100000);
+	printf("\n");
+	test_mmap_table(0x40000, murmur_custom_hash);
+	printf("\n");
+	test_alloc_options(0x80000, murmur_custom_hash);
+	printf("\n");
+	test_epoch_reclamation(0x40000, murmur_custom_hash, 64);
+	printf("\n");
+	test_value_access(0x4000, murmur_custom_hash);
+	printf("\n");
+	test_atomic_updates(0x40000, murmur_custom_hash, 8);
+	printf("\n");
+	test_table_scan(0x40000, murmur_custom_hash, 8);
+	printf("\n");
+	test_bulk_build(0x400000, murmur_custom_hash, 8);
+	printf("\n");
+	test_cache_mode(0x40000, murmur_custom_hash);
+	printf("\n");
+	test_probe_stats(0x100000, murmur_custom_hash);
+	printf("\n");
+	test_data_generation(0x400000);
+	printf("\n");
+	// HT_CHURN_SECONDS sets the churn time, 0 runs it until killed.
+	const char *churn_seconds = getenv("HT_CHURN_SECONDS");
+	test_churn(0x200000, murmur_custom_hash, 32,
+		churn_seconds ? strtoul(churn_seconds, NULL, 0) : 5);
+	printf("\n");
+	test_validate(0x100000, murmur_custom_hash, 8);
 	return 0;
 }
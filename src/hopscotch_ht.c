@@ -1,37 +1,65 @@
 #include "hopscotch_ht.h"
 
+#include <stdarg.h>
+#include <sys/syscall.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
 //------------------------------------------------------------------------------
 // Hash functions related block.
 //------------------------------------------------------------------------------
 // For any hash function no key pointer check to speed-up the performance.
-// MurmurHash3 custom.
-inline uint32_t murmur_custom_hash(const uint8_t* key) {
-	const uint64_t* k = (const uint64_t*)key;
-	uint64_t h = k[0] ^ 0x9E3779B185EBCA87;  // Initial mix
-	// This is not 0xDEADBEEF :)
-	// Process 64-byte key in 8-byte chunks
-	h = (h ^ k[1]) * 0xC6BC279692B5CC83;
-	h = (h ^ k[2]) * 0x9E3779B97F4A7C15;
-	h = (h ^ k[3]) * 0xC6BC279692B5CC83;
-	h = (h ^ k[4]) * 0x9E3779B185EBCA87;
-	h = (h ^ k[5]) * 0xC6BC279692B5CC83;
-	h = (h ^ k[6]) * 0x9E3779B97F4A7C15;
-	h = (h ^ k[7]) * 0xC6BC279692B5CC83;
-
-	// Final mixing for better avalanche
+// MurmurHash3 custom. Keys of KEY_SIZE bytes take the unrolled path, others
+// are processed in 8-byte chunks with the length mixed in.
+inline uint64_t murmur_custom_hash(const uint8_t* key, size_t len, uint64_t seed) {
+	uint64_t h;
+	if(len == 64) {
+		const uint64_t* k = (const uint64_t*)key;
+		h = k[0] ^ 0x9E3779B185EBCA87 ^ seed;  // Initial mix
+		// This is not 0xDEADBEEF :)
+		// Process 64-byte key in 8-byte chunks
+		h = (h ^ k[1]) * 0xC6BC279692B5CC83;
+		h = (h ^ k[2]) * 0x9E3779B97F4A7C15;
+		h = (h ^ k[3]) * 0xC6BC279692B5CC83;
+		h = (h ^ k[4]) * 0x9E3779B185EBCA87;
+		h = (h ^ k[5]) * 0xC6BC279692B5CC83;
+		h = (h ^ k[6]) * 0x9E3779B97F4A7C15;
+		h = (h ^ k[7]) * 0xC6BC279692B5CC83;
+	} else {
+		h = (uint64_t)len ^ 0x9E3779B185EBCA87 ^ seed;
+		size_t i = 0;
+		for(; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t)) {
+			uint64_t k;
+			memcpy(&k, key + i, sizeof(k));
+			h = (h ^ k) * 0xC6BC279692B5CC83;
+			h = (h << 31) | (h >> 33);
+		}
+		if(i < len) {
+			uint64_t k = 0;
+			memcpy(&k, key + i, len - i);
+			h = (h ^ k) * 0x9E3779B97F4A7C15;
+		}
+	}
+
+	// Final mixing for better avalanche, all 64 bits are used.
 	h ^= h >> 33;
 	h *= 0xFF51AFD7ED558CCD;
 	h ^= h >> 33;
+	h *= 0xC4CEB9FE1A85EC53;
+	h ^= h >> 33;
 
-	return (uint32_t)(h ^ (h >> 32));
+	return h;
 }
 
-// Jenkins hash function.
-inline uint32_t jenkins_one_at_a_time_hash(const uint8_t *key) {
-	uint32_t hash = 0;
+// Jenkins hash function. The 32-bit result is repeated in both halves, the
+// tag bits would be constant otherwise.
+inline uint64_t jenkins_one_at_a_time_hash(const uint8_t *key, size_t len, uint64_t seed) {
+	uint32_t hash = (uint32_t)(seed ^ (seed >> 32));
 
 	// This is not 0xBAADF00D :)
-	for(size_t i = 0; i < KEY_SIZE; ++i) {
+	for(size_t i = 0; i < len; ++i) {
 		hash += key[i];
 		hash += (hash << 10);
 		hash ^= (hash >> 6);
@@ -41,391 +69,4588 @@ inline uint32_t jenkins_one_at_a_time_hash(const uint8_t *key) {
 	hash ^= (hash >> 11);
 	hash += (hash << 15);
 
-	return hash;
+	return (uint64_t)hash << 32 | hash;
 }
 
 // Dummy hash function to test collisions.
 // Suppress any warrning related messages.
-inline uint32_t dummy_set_1_hash(const uint8_t *key __attribute__((unused))) {
+inline uint64_t dummy_set_1_hash(
+	const uint8_t *key __attribute__((unused)),
+	size_t len __attribute__((unused)),
+	uint64_t seed __attribute__((unused))
+) {
 	// This is 0xDEADFA11
-	return (uint32_t)1;
+	return (uint64_t)1;
+}
+
+// XXH3-style wide hash. Every 16-byte stripe is folded by a 64x64->128
+// multiply against the secret words, the tail is zero padded.
+static const uint64_t ht_xxh3_secret[8] = {
+	0xBE4BA423396CFEB8, 0x1CAD21F72C81017C,
+	0xDB979083E96DD4DE, 0x1F67B3B7A4A44072,
+	0x78E5C0CC4EE679CB, 0x2172FFCC7DD05A82,
+	0x8E2443F7744608B8, 0x4C263A81E69035E0
+};
+
+static inline uint64_t ht_mul128_fold64(uint64_t a, uint64_t b) {
+	unsigned __int128 r = (unsigned __int128)a * b;
+	return (uint64_t)r ^ (uint64_t)(r >> 64);
+}
+
+inline uint64_t xxh3_custom_hash(const uint8_t *key, size_t len, uint64_t seed) {
+	uint64_t acc = (uint64_t)len * 0x9E3779B185EBCA87;
+	size_t stripe = 0;
+	size_t i = 0;
+	for(; i + 16 <= len; i += 16, stripe = (stripe + 2) & 7) {
+		uint64_t k0, k1;
+		memcpy(&k0, key + i, sizeof(k0));
+		memcpy(&k1, key + i + 8, sizeof(k1));
+		acc += ht_mul128_fold64(k0 ^ (ht_xxh3_secret[stripe] + seed),
+			k1 ^ (ht_xxh3_secret[stripe + 1] - seed));
+	}
+	if(i < len || len == 0) {
+		uint64_t tail[2] = {0, 0};
+		memcpy(tail, key + i, len - i);
+		acc += ht_mul128_fold64(tail[0] ^ (ht_xxh3_secret[stripe] + seed),
+			tail[1] ^ (ht_xxh3_secret[stripe + 1] - seed));
+	}
+
+	// Avalanche, all 64 bits are used.
+	acc ^= acc >> 37;
+	acc *= 0x165667919E3779F9;
+	acc ^= acc >> 32;
+	return acc;
 }
 //------------------------------------------------------------------------------
 
 //------------------------------------------------------------------------------
-// Hash table related functions / API.
+// Hash kernels.
 //------------------------------------------------------------------------------
-void ht_print_debug(const hopscotch_hash_table_t * const ht) {
-	if(!ht) return;
+// CRC32C runs two chains over the key, the second one over the words
+// multiplied by an odd constant so the halves are not linear in each other.
+// The length is mixed into the initial values, the tail is zero padded.
+typedef uint64_t (*ht_crc32c_f)(const uint8_t *, size_t, uint64_t);
+typedef void (*ht_murmur_batch_f)(const uint8_t *const *, size_t, uint64_t, uint64_t *);
 
-	static _Atomic int print_lock = 0;
+static inline uint64_t ht_crc32c_finish(uint32_t lo, uint32_t hi) {
+	uint64_t h = ((uint64_t)hi << 32 | lo) * 0x9E3779B97F4A7C15;
+	return h ^ (h >> 29);
+}
 
-	// Spinlock for thread-safe printing.
-	while (atomic_exchange_explicit(&print_lock, 1, memory_order_acquire)) {
-		thrd_yield();
+static inline uint32_t ht_crc32c_word_soft(uint32_t crc, uint64_t word) {
+	crc ^= (uint32_t)word;
+	for(int bit = 0; bit < 32; bit++) {
+		crc = (crc >> 1) ^ (0x82F63B78 & (0U - (crc & 1)));
+	}
+	crc ^= (uint32_t)(word >> 32);
+	for(int bit = 0; bit < 32; bit++) {
+		crc = (crc >> 1) ^ (0x82F63B78 & (0U - (crc & 1)));
 	}
+	return crc;
+}
 
-	printf("\nHopscotch Hash Table (Capacity: %zu, Size: %zu)\n",
-		   ht->capacity, atomic_load_explicit(&ht->size, memory_order_relaxed));
-	printf("-----------------------------------------------------------------------------------------\n");
-	printf("IDX   Hom->Cur Hash     Hop bits     Key....  Val....  Neighborhood(32)\n");
-	printf("-----------------------------------------------------------------------------------------\n");
+static uint64_t ht_crc32c_soft(const uint8_t *key, size_t len, uint64_t seed) {
+	uint32_t lo = (uint32_t)seed ^ (uint32_t)len;
+	uint32_t hi = (uint32_t)(seed >> 32) ^ ~(uint32_t)len;
+	size_t i = 0;
+	for(; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t)) {
+		uint64_t k;
+		memcpy(&k, key + i, sizeof(k));
+		lo = ht_crc32c_word_soft(lo, k);
+		hi = ht_crc32c_word_soft(hi, k * 0xC6BC279692B5CC83);
+	}
+	if(i < len) {
+		uint64_t k = 0;
+		memcpy(&k, key + i, len - i);
+		lo = ht_crc32c_word_soft(lo, k);
+		hi = ht_crc32c_word_soft(hi, k * 0xC6BC279692B5CC83);
+	}
+	return ht_crc32c_finish(lo, hi);
+}
 
-	for(size_t i = 0; i < ht->capacity; i++) {
-		uint64_t node_info = atomic_load_explicit(&ht->nodes[i].hop_info, memory_order_acquire);
-		uint32_t node_hash = (uint32_t)(node_info >> 32);
+static void ht_murmur_batch_scalar(
+	const uint8_t *const *keys,
+	size_t count,
+	uint64_t seed,
+	uint64_t *hashes
+) {
+	for(size_t i = 0; i < count; i++) {
+		hashes[i] = murmur_custom_hash(keys[i], 64, seed);
+	}
+}
 
-		// Maintaining only occupied buckets.
-		if(node_hash != 0) {  // Only show occupied buckets
-			uint32_t hop_bits = (uint32_t)(node_info & 0xFFFFFFFF);
-			size_t home = node_hash & ht->mask;
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint64_t ht_crc32c_sse42(const uint8_t *key, size_t len, uint64_t seed) {
+	uint64_t lo = (uint32_t)seed ^ (uint32_t)len;
+	uint64_t hi = (uint32_t)(seed >> 32) ^ ~(uint32_t)len;
+	size_t i = 0;
+	for(; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t)) {
+		uint64_t k;
+		memcpy(&k, key + i, sizeof(k));
+		lo = _mm_crc32_u64(lo, k);
+		hi = _mm_crc32_u64(hi, k * 0xC6BC279692B5CC83);
+	}
+	if(i < len) {
+		uint64_t k = 0;
+		memcpy(&k, key + i, len - i);
+		lo = _mm_crc32_u64(lo, k);
+		hi = _mm_crc32_u64(hi, k * 0xC6BC279692B5CC83);
+	}
+	return ht_crc32c_finish((uint32_t)lo, (uint32_t)hi);
+}
 
-			// IDX - Home->Curr - Hash.
-			printf("[%03zu] %03zu->%03zu %08X ", i, home, i, node_hash);
+// Multipliers of the 64-byte murmur path, word 1 to 7.
+static const uint64_t ht_murmur_mult[7] = {
+	0xC6BC279692B5CC83, 0x9E3779B97F4A7C15, 0xC6BC279692B5CC83,
+	0x9E3779B185EBCA87, 0xC6BC279692B5CC83, 0x9E3779B97F4A7C15,
+	0xC6BC279692B5CC83
+};
 
-			// Hop Bits.
-			for(int j = 3; j >= 0; j--) {
-				printf("%02X", (hop_bits >> (j*8)) & 0xFF);
-				if(j > 0) printf(".");
-			}
-			
-			// Key - Value.
-			printf("  %02X%02X...  %02X%02X...  ", 
-				   ht->nodes[i].key[0], ht->nodes[i].key[1],
-				   ht->nodes[i].value[0], ht->nodes[i].value[1]);
-			
-			// Neighborhood (32). Neighborhood visualization.
-			printf("[");
-			uint64_t neighbor_info = atomic_load_explicit(&ht->nodes[i].hop_info, memory_order_relaxed);
-			uint32_t neighbor_hash = (uint32_t)(neighbor_info >> 32);
-			uint32_t hop_info = neighbor_info & 0x00000000FFFFFFFF;
-			
-			for(size_t j = 0; j < HOP_RANGE; j++) {
-				uint32_t mask = 1u << j;
-				if(hop_info & mask) {
-					printf("x");  // Current bucket
-				} else if(neighbor_hash != 0) {
-					 printf(".");
-				} 
+// AVX2 has no 64-bit multiply, it is built from three 32x32->64 ones.
+__attribute__((target("avx2")))
+static inline __m256i ht_mul64_avx2(__m256i a, uint64_t c) {
+	__m256i lo = _mm256_set1_epi64x((long long)c);
+	__m256i hi = _mm256_set1_epi64x((long long)(c >> 32));
+	__m256i cross = _mm256_add_epi64(
+		_mm256_mul_epu32(_mm256_srli_epi64(a, 32), lo),
+		_mm256_mul_epu32(a, hi));
+	return _mm256_add_epi64(_mm256_mul_epu32(a, lo), _mm256_slli_epi64(cross, 32));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i ht_fmix64_avx2(__m256i h) {
+	h = _mm256_xor_si256(h, _mm256_srli_epi64(h, 33));
+	h = ht_mul64_avx2(h, 0xFF51AFD7ED558CCD);
+	h = _mm256_xor_si256(h, _mm256_srli_epi64(h, 33));
+	h = ht_mul64_avx2(h, 0xC4CEB9FE1A85EC53);
+	return _mm256_xor_si256(h, _mm256_srli_epi64(h, 33));
+}
+
+// Word j of 4 keys in w[j]: each half of the keys is loaded as 4 rows of 4
+// words and transposed.
+__attribute__((target("avx2")))
+static inline void ht_murmur_load_avx2(const uint8_t *const *keys, __m256i *w) {
+	for(size_t half = 0; half < 2; half++) {
+		__m256i r0 = _mm256_loadu_si256((const __m256i *)(keys[0] + 32 * half));
+		__m256i r1 = _mm256_loadu_si256((const __m256i *)(keys[1] + 32 * half));
+		__m256i r2 = _mm256_loadu_si256((const __m256i *)(keys[2] + 32 * half));
+		__m256i r3 = _mm256_loadu_si256((const __m256i *)(keys[3] + 32 * half));
+		__m256i t0 = _mm256_unpacklo_epi64(r0, r1);
+		__m256i t1 = _mm256_unpackhi_epi64(r0, r1);
+		__m256i t2 = _mm256_unpacklo_epi64(r2, r3);
+		__m256i t3 = _mm256_unpackhi_epi64(r2, r3);
+		w[4 * half] = _mm256_permute2x128_si256(t0, t2, 0x20);
+		w[4 * half + 1] = _mm256_permute2x128_si256(t1, t3, 0x20);
+		w[4 * half + 2] = _mm256_permute2x128_si256(t0, t2, 0x31);
+		w[4 * half + 3] = _mm256_permute2x128_si256(t1, t3, 0x31);
+	}
+}
+
+// 16 keys per step as 4 independent multiply chains, a single chain of 4
+// keys is bound by the multiply latency. The rest goes 4 keys at a time.
+__attribute__((target("avx2")))
+static void ht_murmur_batch_avx2(
+	const uint8_t *const *keys,
+	size_t count,
+	uint64_t seed,
+	uint64_t *hashes
+) {
+	const __m256i init = _mm256_set1_epi64x((long long)(0x9E3779B185EBCA87 ^ seed));
+	size_t i = 0;
+	while(i + 4 <= count) {
+		size_t chains = count - i >= 16 ? 4 : 1;
+		__m256i w[4][8], h[4];
+		for(size_t c = 0; c < chains; c++) {
+			ht_murmur_load_avx2(keys + i + 4 * c, w[c]);
+			h[c] = _mm256_xor_si256(w[c][0], init);
+		}
+		for(size_t j = 1; j < 8; j++) {
+			for(size_t c = 0; c < chains; c++) {
+				h[c] = ht_mul64_avx2(_mm256_xor_si256(h[c], w[c][j]), ht_murmur_mult[j - 1]);
 			}
-			printf("]\n");
 		}
+		for(size_t c = 0; c < chains; c++) {
+			_mm256_storeu_si256((__m256i *)(hashes + i + 4 * c), ht_fmix64_avx2(h[c]));
+		}
+		i += 4 * chains;
 	}
-	atomic_store_explicit(&print_lock, 0, memory_order_release);
+	ht_murmur_batch_scalar(keys + i, count - i, seed, hashes + i);
 }
 
-void ht_print_stats(const hopscotch_hash_table_t * const ht) {
-	if(!ht) return;
-	size_t size = atomic_load_explicit(&ht->size, memory_order_relaxed);
-	printf("Hash table stats: size=%zu (%.1f%% full)\n", 
-			size, (size * 100.0) / ht->capacity);
+__attribute__((target("avx512f,avx512dq")))
+static inline __m512i ht_fmix64_avx512(__m512i h) {
+	h = _mm512_xor_si512(h, _mm512_srli_epi64(h, 33));
+	h = _mm512_mullo_epi64(h, _mm512_set1_epi64((long long)0xFF51AFD7ED558CCD));
+	h = _mm512_xor_si512(h, _mm512_srli_epi64(h, 33));
+	h = _mm512_mullo_epi64(h, _mm512_set1_epi64((long long)0xC4CEB9FE1A85EC53));
+	return _mm512_xor_si512(h, _mm512_srli_epi64(h, 33));
 }
 
-void ht_zero(hopscotch_hash_table_t *ht) {
-	if(!ht) return;
-	memset(ht->nodes, 0, ht->capacity * sizeof(hash_node_t));
-	atomic_init(&ht->size, 0);
+// Word j of 8 keys in w[j]: the keys are loaded as rows of 8 words and
+// transposed in three shuffle stages.
+__attribute__((target("avx512f,avx512dq")))
+static inline void ht_murmur_load_avx512(const uint8_t *const *keys, __m512i *w) {
+	const __m512i lo_lanes = _mm512_set_epi64(13, 12, 5, 4, 9, 8, 1, 0);
+	const __m512i hi_lanes = _mm512_set_epi64(15, 14, 7, 6, 11, 10, 3, 2);
+	__m512i r[8], t[8], u[8];
+	for(size_t j = 0; j < 8; j++) {
+		r[j] = _mm512_loadu_si512((const void *)keys[j]);
+	}
+	// Two keys: even words in t[j], odd in t[j + 1].
+	for(size_t j = 0; j < 8; j += 2) {
+		t[j] = _mm512_unpacklo_epi64(r[j], r[j + 1]);
+		t[j + 1] = _mm512_unpackhi_epi64(r[j], r[j + 1]);
+	}
+	// Four keys: words 0/4, 2/6, 1/5 and 3/7.
+	for(size_t j = 0; j < 8; j += 4) {
+		u[j] = _mm512_permutex2var_epi64(t[j], lo_lanes, t[j + 2]);
+		u[j + 1] = _mm512_permutex2var_epi64(t[j], hi_lanes, t[j + 2]);
+		u[j + 2] = _mm512_permutex2var_epi64(t[j + 1], lo_lanes, t[j + 3]);
+		u[j + 3] = _mm512_permutex2var_epi64(t[j + 1], hi_lanes, t[j + 3]);
+	}
+	w[0] = _mm512_shuffle_i64x2(u[0], u[4], 0x44);
+	w[4] = _mm512_shuffle_i64x2(u[0], u[4], 0xEE);
+	w[2] = _mm512_shuffle_i64x2(u[1], u[5], 0x44);
+	w[6] = _mm512_shuffle_i64x2(u[1], u[5], 0xEE);
+	w[1] = _mm512_shuffle_i64x2(u[2], u[6], 0x44);
+	w[5] = _mm512_shuffle_i64x2(u[2], u[6], 0xEE);
+	w[3] = _mm512_shuffle_i64x2(u[3], u[7], 0x44);
+	w[7] = _mm512_shuffle_i64x2(u[3], u[7], 0xEE);
 }
 
-hopscotch_hash_table_t *ht_create(size_t capacity) {
-	if(capacity == 0) return NULL;
+// 16 keys per step as 2 independent multiply chains, 8 at a time for the
+// rest. A tail shorter than 8 goes through the AVX2 kernel.
+__attribute__((target("avx512f,avx512dq")))
+static void ht_murmur_batch_avx512(
+	const uint8_t *const *keys,
+	size_t count,
+	uint64_t seed,
+	uint64_t *hashes
+) {
+	const __m512i init = _mm512_set1_epi64((long long)(0x9E3779B185EBCA87 ^ seed));
+	size_t i = 0;
+	while(i + 8 <= count) {
+		size_t chains = count - i >= 16 ? 2 : 1;
+		__m512i w[2][8], h[2];
+		for(size_t c = 0; c < chains; c++) {
+			ht_murmur_load_avx512(keys + i + 8 * c, w[c]);
+			h[c] = _mm512_xor_si512(w[c][0], init);
+		}
+		for(size_t j = 1; j < 8; j++) {
+			__m512i mult = _mm512_set1_epi64((long long)ht_murmur_mult[j - 1]);
+			for(size_t c = 0; c < chains; c++) {
+				h[c] = _mm512_mullo_epi64(_mm512_xor_si512(h[c], w[c][j]), mult);
+			}
+		}
+		for(size_t c = 0; c < chains; c++) {
+			_mm512_storeu_si512((void *)(hashes + i + 8 * c), ht_fmix64_avx512(h[c]));
+		}
+		i += 8 * chains;
+	}
+	ht_murmur_batch_avx2(keys + i, count - i, seed, hashes + i);
+}
+#endif
 
-	// Calculate total memory needed.
-	size_t total_size = sizeof(hopscotch_hash_table_t) +
-						(capacity * sizeof(hash_node_t));
-	
-	// Allocate single contiguous block.
-	uint8_t* buffer = aligned_alloc(64, total_size);
-	if(!buffer) return NULL;
-	
-	hopscotch_hash_table_t *ht = (hopscotch_hash_table_t *)buffer;
-	ht->nodes = (hash_node_t *)(buffer + sizeof(hopscotch_hash_table_t));
-	ht->capacity = capacity;
-	ht->mask = capacity - 1;
+// The kernels in use, swapped as one pointer so a reader never sees the id
+// of one kernel with the functions of another.
+typedef struct {
+	ht_hash_kernel_t kernel;
+	ht_crc32c_f crc32c;
+	ht_murmur_batch_f murmur_batch;
+} ht_hash_kernels_t;
 
-	// Initialize nodes
-	ht_zero(ht);
-	return ht;
-}
+static uint64_t ht_crc32c_resolve(const uint8_t *key, size_t len, uint64_t seed);
+static void ht_murmur_batch_resolve(
+	const uint8_t *const *keys,
+	size_t count,
+	uint64_t seed,
+	uint64_t *hashes
+);
+static const ht_hash_kernels_t ht_hash_kernels_unresolved = {
+	HT_HASH_KERNEL_AUTO, ht_crc32c_resolve, ht_murmur_batch_resolve
+};
+static _Atomic(const ht_hash_kernels_t *) ht_hash_kernels = &ht_hash_kernels_unresolved;
 
-void ht_free(hopscotch_hash_table_t *ht) {
-	if(!ht) return;
+// One entry per kernel, murmur_batch is NULL if the CPU lacks it. Filled
+// once, never written after.
+static ht_hash_kernels_t ht_hash_kernels_supported[HT_HASH_KERNEL_AVX512 + 1];
+static once_flag ht_hash_kernels_detect_once = ONCE_FLAG_INIT;
+static const ht_hash_kernels_t *ht_hash_kernels_auto;
+static once_flag ht_hash_kernels_auto_once = ONCE_FLAG_INIT;
 
-	free(ht);
-	ht = NULL;
+static void ht_hash_kernels_detect(void) {
+	ht_crc32c_f crc = ht_crc32c_soft;
+	ht_hash_kernels_t *k = ht_hash_kernels_supported;
+
+	k[HT_HASH_KERNEL_SCALAR] = (ht_hash_kernels_t){
+		HT_HASH_KERNEL_SCALAR, ht_crc32c_soft, ht_murmur_batch_scalar
+	};
+#if defined(__x86_64__)
+	__builtin_cpu_init();
+	// The hardware CRC32C unless the scalar kernels are asked for.
+	if(__builtin_cpu_supports("sse4.2")) {
+		crc = ht_crc32c_sse42;
+	}
+	if(__builtin_cpu_supports("avx2")) {
+		k[HT_HASH_KERNEL_AVX2] = (ht_hash_kernels_t){
+			HT_HASH_KERNEL_AVX2, crc, ht_murmur_batch_avx2
+		};
+		if(__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512dq")) {
+			k[HT_HASH_KERNEL_AVX512] = (ht_hash_kernels_t){
+				HT_HASH_KERNEL_AVX512, crc, ht_murmur_batch_avx512
+			};
+		}
+	}
+#endif
+	// AUTO keeps the scalar murmur kernel with the hardware CRC32C if
+	// the vector kernels lose.
+	k[HT_HASH_KERNEL_AUTO] = (ht_hash_kernels_t){
+		HT_HASH_KERNEL_SCALAR, crc, ht_murmur_batch_scalar
+	};
 }
 
-bool ht_insert(
-	hopscotch_hash_table_t* ht,
-	hash_function_f hash_key,
-	const uint8_t *key,
-	const uint8_t *value
-) {
-	uint32_t h = hash_key(key);
-	size_t home = INDEX(h, ht->mask); // number of buckets (mask = capacity - 1)
+#if defined(__x86_64__)
+// Vector 64-bit multiplies are slow on some CPUs (and under some
+// hypervisors), the scalar kernel may win. The fastest of a few timed runs
+// over synthetic keys, in nanoseconds.
+static uint64_t ht_murmur_batch_time(ht_murmur_batch_f batch) {
+	uint8_t data[HT_BATCH_GROUP][64];
+	const uint8_t *keys[HT_BATCH_GROUP];
+	uint64_t hashes[HT_BATCH_GROUP];
+	uint64_t best = UINT64_MAX;
 
-	// Check for existing key first.
-	for(size_t i = 0; i < HOP_RANGE; i++) {
-		size_t idx = (home + i) & ht->mask;
-		uint64_t node_info = atomic_load_explicit(
-			&ht->nodes[idx].hop_info, memory_order_acquire);
-		if((node_info >> HASH_HOP_INFO_OFFSET) == h) {
-			if(memcmp(ht->nodes[idx].key, key, KEY_SIZE) == 0) {
-				// Update existing.
-				memcpy(ht->nodes[idx].value, value, VALUE_SIZE);
-				return true;
-			}
+	for(size_t i = 0; i < HT_BATCH_GROUP; i++) {
+		for(size_t j = 0; j < 64; j++) {
+			data[i][j] = (uint8_t)(i * 64 + j);
+		}
+		keys[i] = data[i];
+	}
+	for(size_t round = 0; round < 8; round++) {
+		struct timespec start, end;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for(uint64_t seed = 0; seed < 64; seed++) {
+			batch(keys, HT_BATCH_GROUP, seed, hashes);
 		}
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		uint64_t ns = (uint64_t)(end.tv_sec - start.tv_sec) * 1000000000 +
+			(uint64_t)end.tv_nsec - (uint64_t)start.tv_nsec;
+		if(ns < best) best = ns;
 	}
+	return best;
+}
+#endif
 
-	// Find empty slot in neighborhood.
-	for(size_t i = 0; i < HOP_RANGE; i++) {
-		size_t idx = (home + i) & ht->mask;
-		uint64_t current = atomic_load(&ht->nodes[idx].hop_info);
-		if((current >> HASH_HOP_INFO_OFFSET) == 0) { // Empty slot
-			uint64_t desired = ((uint64_t)h << HASH_HOP_INFO_OFFSET) | (1ULL << i);
-			if(atomic_compare_exchange_weak_explicit(
-				&ht->nodes[idx].hop_info, 
-				&current, 
-				desired,
-				memory_order_release,
-				memory_order_acquire))
-			{
-				memcpy(ht->nodes[idx].key, key, KEY_SIZE);
-				memcpy(ht->nodes[idx].value, value, VALUE_SIZE);
-				atomic_fetch_add(&ht->size, 1);
-				return true;
-			}
+// Times the supported murmur kernels, once per process.
+static void ht_hash_kernels_pick(void) {
+	call_once(&ht_hash_kernels_detect_once, ht_hash_kernels_detect);
+	const ht_hash_kernels_t *best = &ht_hash_kernels_supported[HT_HASH_KERNEL_AUTO];
+#if defined(__x86_64__)
+	uint64_t best_ns = ht_murmur_batch_time(best->murmur_batch);
+	for(int kernel = HT_HASH_KERNEL_AVX2; kernel <= HT_HASH_KERNEL_AVX512; kernel++) {
+		const ht_hash_kernels_t *k = &ht_hash_kernels_supported[kernel];
+		if(!k->murmur_batch) continue;
+		uint64_t ns = ht_murmur_batch_time(k->murmur_batch);
+		if(ns < best_ns) {
+			best_ns = ns;
+			best = k;
 		}
 	}
+#endif
+	ht_hash_kernels_auto = best;
+}
 
-	// Need to relocate entries to make space.
-	size_t free_slot = home;
-	while (
-		(free_slot < ht->capacity) && 
-		(free_slot < home + MAX_RELOCATION_FACTOR * HOP_RANGE))
-	{
-		uint64_t current = atomic_load(&ht->nodes[free_slot].hop_info);
-		if((current >> HASH_HOP_INFO_OFFSET) == 0) break;
-		free_slot++;
+// The kernels in use. The first call resolves AUTO unless a kernel was
+// set in the meantime, that one stays.
+static const ht_hash_kernels_t *ht_hash_kernels_get(void) {
+	const ht_hash_kernels_t *k = atomic_load_explicit(&ht_hash_kernels, memory_order_acquire);
+	if(k != &ht_hash_kernels_unresolved) return k;
+
+	call_once(&ht_hash_kernels_auto_once, ht_hash_kernels_pick);
+	if(atomic_compare_exchange_strong(&ht_hash_kernels, &k, ht_hash_kernels_auto)) {
+		return ht_hash_kernels_auto;
 	}
+	return k;
+}
+
+static uint64_t ht_crc32c_resolve(const uint8_t *key, size_t len, uint64_t seed) {
+	return ht_hash_kernels_get()->crc32c(key, len, seed);
+}
 
-	if(
-		(((free_slot - home) & ht->mask) >= HOP_RANGE) &&
-		(((free_slot - home) & ht->mask) < HOP_RANGE * MAX_RELOCATION_FACTOR)
+static void ht_murmur_batch_resolve(
+	const uint8_t *const *keys,
+	size_t count,
+	uint64_t seed,
+	uint64_t *hashes
+) {
+	ht_hash_kernels_get()->murmur_batch(keys, count, seed, hashes);
+}
 
-	) {
-		// Perform relocation.
-		// TODO: Additional logic but if it is required for the algo.
+bool ht_set_hash_kernel(ht_hash_kernel_t kernel) {
+	const ht_hash_kernels_t *k;
+	if(kernel == HT_HASH_KERNEL_AUTO) {
+		call_once(&ht_hash_kernels_auto_once, ht_hash_kernels_pick);
+		k = ht_hash_kernels_auto;
 	} else {
-		return false; // Table may not be fully full but range is full.
+		if(kernel < HT_HASH_KERNEL_SCALAR || kernel > HT_HASH_KERNEL_AVX512) return false;
+		call_once(&ht_hash_kernels_detect_once, ht_hash_kernels_detect);
+		k = &ht_hash_kernels_supported[kernel];
+		if(!k->murmur_batch) return false;
+	}
+	atomic_store_explicit(&ht_hash_kernels, k, memory_order_release);
+	return true;
+}
+
+ht_hash_kernel_t ht_get_hash_kernel(void) {
+	return ht_hash_kernels_get()->kernel;
+}
+
+const char *ht_hash_kernel_name(ht_hash_kernel_t kernel) {
+	switch(kernel) {
+	case HT_HASH_KERNEL_SCALAR: return "scalar";
+	case HT_HASH_KERNEL_AVX2: return "avx2";
+	case HT_HASH_KERNEL_AVX512: return "avx512";
+	default: return "auto";
+	}
+}
+
+uint64_t crc32c_hash(const uint8_t *key, size_t len, uint64_t seed) {
+	return atomic_load_explicit(&ht_hash_kernels, memory_order_acquire)->crc32c(key, len, seed);
+}
+
+void murmur_custom_hash_batch(
+	const uint8_t *const *keys,
+	size_t count,
+	uint64_t seed,
+	uint64_t *hashes
+) {
+	atomic_load_explicit(&ht_hash_kernels, memory_order_acquire)->murmur_batch(keys, count,
+		seed, hashes);
+}
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Fingerprint tag match kernels.
+//------------------------------------------------------------------------------
+// Every kernel returns a bit mask of the 32 tags equal to tag.
+typedef uint32_t (*ht_tag_match_f)(const uint8_t *, uint8_t);
+
+static uint32_t ht_tag_match_scalar(const uint8_t *tags, uint8_t tag) {
+	uint32_t matches = 0;
+	for(size_t i = 0; i < HOP_RANGE; i++) {
+		matches |= (uint32_t)(tags[i] == tag) << i;
 	}
+	return matches;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse2")))
+static uint32_t ht_tag_match_sse2(const uint8_t *tags, uint8_t tag) {
+	__m128i needle = _mm_set1_epi8((char)tag);
+	__m128i lo = _mm_loadu_si128((const __m128i *)tags);
+	__m128i hi = _mm_loadu_si128((const __m128i *)(tags + 16));
+	uint32_t lo_mask = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(lo, needle));
+	uint32_t hi_mask = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(hi, needle));
+	return lo_mask | (hi_mask << 16);
+}
+
+__attribute__((target("avx2")))
+static uint32_t ht_tag_match_avx2(const uint8_t *tags, uint8_t tag) {
+	__m256i needle = _mm256_set1_epi8((char)tag);
+	__m256i v = _mm256_loadu_si256((const __m256i *)tags);
+	return (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, needle));
+}
+#endif
+
+static uint32_t ht_tag_match_resolve(const uint8_t *tags, uint8_t tag);
+static _Atomic(ht_tag_match_f) ht_tag_match = ht_tag_match_resolve;
+static _Atomic ht_tag_kernel_t ht_tag_kernel = HT_TAG_KERNEL_AUTO;
+
+// The first call picks the best kernel the CPU supports.
+static uint32_t ht_tag_match_resolve(const uint8_t *tags, uint8_t tag) {
+	ht_set_tag_kernel(HT_TAG_KERNEL_AUTO);
+	return atomic_load_explicit(&ht_tag_match, memory_order_relaxed)(tags, tag);
+}
 
-	if(free_slot >= ht->capacity) {
-		// Table is full.
+bool ht_set_tag_kernel(ht_tag_kernel_t kernel) {
+	ht_tag_match_f match = ht_tag_match_scalar;
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	bool has_sse2 = __builtin_cpu_supports("sse2");
+	bool has_avx2 = __builtin_cpu_supports("avx2");
+#else
+	bool has_sse2 = false;
+	bool has_avx2 = false;
+#endif
+
+	if(kernel == HT_TAG_KERNEL_AUTO) {
+		kernel = has_avx2 ? HT_TAG_KERNEL_AVX2 :
+			has_sse2 ? HT_TAG_KERNEL_SSE2 : HT_TAG_KERNEL_SCALAR;
+	}
+	switch(kernel) {
+	case HT_TAG_KERNEL_SCALAR:
+		break;
+#if defined(__x86_64__) || defined(__i386__)
+	case HT_TAG_KERNEL_SSE2:
+		if(!has_sse2) return false;
+		match = ht_tag_match_sse2;
+		break;
+	case HT_TAG_KERNEL_AVX2:
+		if(!has_avx2) return false;
+		match = ht_tag_match_avx2;
+		break;
+#endif
+	default:
 		return false;
 	}
+	atomic_store(&ht_tag_kernel, kernel);
+	atomic_store(&ht_tag_match, match);
+	return true;
+}
 
-	// Perform hopscotch relocation.
-	while (free_slot >= home + MAX_RELOCATION_FACTOR * HOP_RANGE) {
-		bool moved = false;
+ht_tag_kernel_t ht_get_tag_kernel(void) {
+	if(atomic_load(&ht_tag_kernel) == HT_TAG_KERNEL_AUTO) {
+		ht_set_tag_kernel(HT_TAG_KERNEL_AUTO);
+	}
+	return atomic_load(&ht_tag_kernel);
+}
 
-		for(size_t i = 0; i < HOP_RANGE; i++) {
-			size_t candidate = (free_slot - HOP_RANGE + 1 + i) & ht->mask;
-			uint64_t candidate_info = atomic_load_explicit(
-					&ht->nodes[candidate].hop_info,
-					memory_order_acquire);
+const char *ht_tag_kernel_name(ht_tag_kernel_t kernel) {
+	switch(kernel) {
+	case HT_TAG_KERNEL_SCALAR: return "scalar";
+	case HT_TAG_KERNEL_SSE2: return "sse2";
+	case HT_TAG_KERNEL_AVX2: return "avx2";
+	default: return "auto";
+	}
+}
+//------------------------------------------------------------------------------
 
-			// Lower 32 bits (hop bits)
-			uint32_t candidate_hop = candidate_info & HOP_INFO_MASK;
-			
-			if(candidate_hop != 0) {
-				size_t first_hop = __builtin_ctz(candidate_hop);
-				size_t move_from = (candidate + first_hop) & ht->mask;
-				
-				// Load the original hash before moving.
-				uint64_t original_hash = atomic_load_explicit(
-						&ht->nodes[move_from].hop_info,
-						memory_order_acquire) & HASH_MASK;
-				
-				// Move the entry to free slot.
-				memcpy(
-					&ht->nodes[free_slot],
-					&ht->nodes[move_from],
-					sizeof(hash_node_t)
-				);
-				
-				// Update the moved entry's hop_info:
-				// Save original hash (upper 32 bits).
-				// Set new hop bit relative to its home bucket.
-				size_t new_home = (hash_key(ht->nodes[free_slot].key) & ht->mask);
-				uint64_t new_hop_bit = 1ULL << (new_home - 1);
-				atomic_store_explicit(&ht->nodes[free_slot].hop_info,
-									original_hash | new_hop_bit,
-									memory_order_release);
-
-				// Update candidate's hop bitmap.
-				uint64_t old_val, new_val;
-				do {
-					old_val = atomic_load(&ht->nodes[candidate].hop_info);
-					if(free_slot - candidate >= HOP_RANGE) assert(0);
-					uint32_t new_hop = ((old_val & HOP_INFO_MASK) ^ (1UL << first_hop)) | 
-									(1UL << (free_slot - candidate));
-					if(new_hop == 0) assert(0);
-					new_val = (old_val & HASH_MASK) | new_hop;
-				} while (!atomic_compare_exchange_weak_explicit(
-					&ht->nodes[candidate].hop_info,
-					&old_val,
-					new_val,
-					memory_order_release,
-					memory_order_acquire
-				));
+//------------------------------------------------------------------------------
+// Variable-length entries related functions.
+//------------------------------------------------------------------------------
+// A reference to data longer than HT_VAR_INLINE names its storage in bytes
+// 4..7: an arena block, or the caller's buffer for a key only looked up.
+typedef enum {
+	HT_VAR_ARENA = 0,
+	HT_VAR_PROBE
+} ht_var_kind_t;
 
-				// Clear old slot.
-				atomic_store_explicit(&ht->nodes[move_from].hop_info, 0, memory_order_release);
-				memset(&ht->nodes[move_from].key, 0, KEY_SIZE);
-				memset(&ht->nodes[move_from].value, 0, VALUE_SIZE);
+// A copy of the value a lookup hands out of the seqlock section.
+typedef struct {
+	uint8_t *buf;
+	size_t capacity;
+	size_t len;
+} ht_var_out_t;
 
-				free_slot = move_from;
-				moved = true;
-				break;
-			}
-		}
-		if(!moved) {
-			printf("Unable to find a candidate for relocation\n");
-			return false;
-		} else {
-			// Relocation was done without issues.
-			break;
+static inline size_t ht_arena_class(size_t len) {
+	size_t cls = 0;
+	while(((size_t)HT_ARENA_MIN_BLOCK << cls) < len) cls++;
+	return cls;
+}
+
+static void ht_arena_reset(ht_arena_t *arena) {
+	atomic_store(&arena->top, HT_ARENA_MIN_BLOCK);
+	atomic_store(&arena->used, 0);
+	for(size_t i = 0; i < HT_ARENA_CLASSES; i++) {
+		atomic_store(&arena->free_lists[i], 0);
+	}
+}
+
+// Returns the offset of a block of at least len bytes, 0 if the arena is full.
+// A free block keeps the index of the next one in its first word.
+static size_t ht_arena_alloc(ht_arena_t *arena, size_t len) {
+	size_t cls = ht_arena_class(len);
+	size_t block = (size_t)HT_ARENA_MIN_BLOCK << cls;
+	_Atomic uint64_t *list = &arena->free_lists[cls];
+
+	uint64_t head = atomic_load_explicit(list, memory_order_acquire);
+	while((uint32_t)head) {
+		size_t offset = (size_t)(uint32_t)head * HT_ARENA_MIN_BLOCK;
+		uint64_t next = __atomic_load_n((uint64_t *)(arena->base + offset),
+			__ATOMIC_RELAXED);
+		uint64_t new_head = ((head >> 32) + 1) << 32 | (uint32_t)next;
+		if(atomic_compare_exchange_weak_explicit(list, &head, new_head,
+			memory_order_acquire, memory_order_acquire))
+		{
+			atomic_fetch_add_explicit(&arena->used, block, memory_order_relaxed);
+			return offset;
 		}
 	}
 
-	// Now insert in the freed slot.
-	uint64_t desired = (
-		(uint64_t)h << HASH_HOP_INFO_OFFSET) |
-		(1ULL << (free_slot - home) % HOP_RANGE);
-	atomic_store_explicit(&ht->nodes[free_slot].hop_info, desired, memory_order_release);
-	memcpy(ht->nodes[free_slot].key, key, KEY_SIZE);
-	memcpy(ht->nodes[free_slot].value, value, VALUE_SIZE);
-	atomic_fetch_add_explicit(&ht->size, 1, memory_order_relaxed);
+	// Nothing to reuse, carve a new block. An overshoot leaves top past the
+	// end, the tail is lost but every later bump fails the same way.
+	size_t offset = atomic_fetch_add_explicit(&arena->top, block, memory_order_relaxed);
+	if(offset + block > arena->size) return 0;
+	atomic_fetch_add_explicit(&arena->used, block, memory_order_relaxed);
+	return offset;
+}
+
+static void ht_arena_free(ht_arena_t *arena, size_t offset, size_t len) {
+	size_t cls = ht_arena_class(len);
+	_Atomic uint64_t *list = &arena->free_lists[cls];
+
+	uint64_t head = atomic_load_explicit(list, memory_order_relaxed);
+	uint64_t new_head;
+	do {
+		__atomic_store_n((uint64_t *)(arena->base + offset), (uint32_t)head,
+			__ATOMIC_RELAXED);
+		new_head = ((head >> 32) + 1) << 32 | (uint32_t)(offset / HT_ARENA_MIN_BLOCK);
+	} while(!atomic_compare_exchange_weak_explicit(list, &head, new_head,
+		memory_order_release, memory_order_relaxed));
+	atomic_fetch_sub_explicit(&arena->used, (size_t)HT_ARENA_MIN_BLOCK << cls,
+		memory_order_relaxed);
+}
+
+static inline uint32_t ht_var_len(const uint8_t *ref) {
+	uint32_t len;
+	memcpy(&len, ref, sizeof(len));
+	return len;
+}
+
+// Data of a reference copied out of a slot, NULL if a torn read produced
+// anything but a block inside the arena (the seqlock will reject the read
+// anyway). A slot never holds a probe, so no pointer out of it is followed.
+static const uint8_t *ht_var_slot_data(const ht_arena_t *arena, const uint8_t *ref) {
+	uint32_t len = ht_var_len(ref);
+	if(len <= HT_VAR_INLINE) return ref + sizeof(uint32_t);
+
+	uint32_t kind;
+	uint64_t where;
+	memcpy(&kind, ref + 4, sizeof(kind));
+	memcpy(&where, ref + 8, sizeof(where));
+	if(kind != HT_VAR_ARENA) return NULL;
+	if(where < HT_ARENA_MIN_BLOCK || where > arena->size || len > arena->size - where) {
+		return NULL;
+	}
+	return arena->base + where;
+}
+
+// Data of the caller's key reference, a probe or a reference being stored.
+// Nothing else writes it, its pointer can be trusted.
+static const uint8_t *ht_var_probe_data(const ht_arena_t *arena, const uint8_t *ref) {
+	uint32_t len = ht_var_len(ref);
+	if(len <= HT_VAR_INLINE) return ref + sizeof(uint32_t);
+
+	uint32_t kind;
+	uint64_t where;
+	memcpy(&kind, ref + 4, sizeof(kind));
+	memcpy(&where, ref + 8, sizeof(where));
+	if(kind == HT_VAR_PROBE) return (const uint8_t *)(uintptr_t)where;
+	return arena->base + where;
+}
+
+// Builds the reference of data, a stored one copies long data into the arena,
+// a probe only points at it.
+static bool ht_var_make(
+	ht_arena_t *arena,
+	uint8_t *ref,
+	const uint8_t *data,
+	size_t len,
+	bool probe
+) {
+	if(len > HT_ARENA_MAX_BLOCK) return false;
+
+	uint32_t len32 = (uint32_t)len;
+	memset(ref, 0, HT_VAR_REF_SIZE);
+	memcpy(ref, &len32, sizeof(len32));
+	if(len <= HT_VAR_INLINE) {
+		memcpy(ref + 4, data, len);
+		return true;
+	}
+
+	uint32_t kind = probe ? HT_VAR_PROBE : HT_VAR_ARENA;
+	uint64_t where = (uint64_t)(uintptr_t)data;
+	if(!probe) {
+		where = ht_arena_alloc(arena, len);
+		if(!where) return false;
+		memcpy(arena->base + where, data, len);
+	}
+	memcpy(ref + 4, &kind, sizeof(kind));
+	memcpy(ref + 8, &where, sizeof(where));
 	return true;
 }
 
-bool ht_remove_key(
+static void ht_arena_reclaim(void *ctx, void *ptr, size_t len) {
+	ht_arena_t *arena = ctx;
+	ht_arena_free(arena, (size_t)((uint8_t *)ptr - arena->base), len);
+}
+
+// Gives the arena block of a stored reference back. A block which has been
+// reachable from a slot is retired, readers may still copy it. One that never
+// got into a slot goes back at once.
+static void ht_var_release(
 	hopscotch_hash_table_t *ht,
-	hash_function_f hash_function,
-	const uint8_t *key
+	const uint8_t *ref,
+	bool published
 ) {
-	uint32_t h = hash_function(key);
-	size_t home = INDEX(h, ht->mask);
+	uint32_t len = ht_var_len(ref);
+	if(len <= HT_VAR_INLINE) return;
 
-	// Search in the neighborhood for the key.
-	for(size_t i = 0; i < HOP_RANGE * MAX_RELOCATION_FACTOR; i++) {
-		size_t idx = (home + i) & ht->mask;
-		uint64_t node_info = atomic_load_explicit(
-			&ht->nodes[idx].hop_info,
-			memory_order_acquire
-		);
-		
-		if((node_info >> HASH_HOP_INFO_OFFSET) == h) {
-			if(memcmp(ht->nodes[idx].key, key, KEY_SIZE) == 0) {
-				// Found the key, now remove it.
-				// Clear the hop bit in the home bucket.
-				size_t home_idx = home;
-				uint64_t old_val, new_val;
-				do {
-					old_val = atomic_load_explicit(
-						&ht->nodes[home_idx].hop_info,
-						memory_order_acquire
-					);
-					uint32_t new_hop = old_val & HOP_INFO_MASK;
-					new_hop &= ~(1UL << i % HOP_RANGE);  // Clear the bit for this index
-					new_val = (old_val & HASH_MASK) | new_hop;
-				} while (!atomic_compare_exchange_weak_explicit(
-					&ht->nodes[home_idx].hop_info,
-					&old_val,
-					new_val,
-					memory_order_release,
-					memory_order_acquire
-				));
+	uint64_t where;
+	memcpy(&where, ref + 8, sizeof(where));
+	if(!published) {
+		ht_arena_free(ht->arena, (size_t)where, len);
+		return;
+	}
+	atomic_fetch_add_explicit(&ht->retired, 1, memory_order_relaxed);
+	ht_epoch_retire(ht_arena_reclaim, ht->arena, ht->arena->base + where, len);
+}
 
-				// Clear the node's data
-				atomic_store_explicit(&ht->nodes[idx].hop_info, 0, memory_order_release);
-				memset(ht->nodes[idx].key, 0, KEY_SIZE);
-				memset(ht->nodes[idx].value, 0, VALUE_SIZE);
+// The slot reference is copied once, its length, kind and offset come from
+// the same read even if a writer rewrites the slot meanwhile.
+static bool ht_var_equal(const ht_arena_t *arena, const uint8_t *slot_ref, const uint8_t *probe) {
+	uint8_t ref[HT_VAR_REF_SIZE];
+	memcpy(ref, slot_ref, HT_VAR_REF_SIZE);
 
-				// Decrement size
-				atomic_fetch_sub_explicit(&ht->size, 1, memory_order_relaxed);
-				return true;
+	uint32_t len = ht_var_len(ref);
+	if(len != ht_var_len(probe)) return false;
+	if(len <= HT_VAR_INLINE) return memcmp(ref, probe, HT_VAR_REF_SIZE) == 0;
+
+	const uint8_t *data = ht_var_slot_data(arena, ref);
+	const uint8_t *probe_data = ht_var_probe_data(arena, probe);
+	return data && memcmp(data, probe_data, len) == 0;
+}
+
+static void ht_var_copy_out(const ht_arena_t *arena, const uint8_t *slot_ref, ht_var_out_t *out) {
+	uint8_t ref[HT_VAR_REF_SIZE];
+	memcpy(ref, slot_ref, HT_VAR_REF_SIZE);
+
+	uint32_t len = ht_var_len(ref);
+	const uint8_t *data = ht_var_slot_data(arena, ref);
+	out->len = len;
+	if(data && out->buf) {
+		memcpy(out->buf, data, len < out->capacity ? len : out->capacity);
+	}
+}
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Memory placement related functions.
+//------------------------------------------------------------------------------
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT (26)
+#endif
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#endif
+#ifndef MAP_HUGE_1GB
+#define MAP_HUGE_1GB (30 << MAP_HUGE_SHIFT)
+#endif
+// mbind modes, numaif.h (libnuma) is not required.
+#define HT_MPOL_BIND (2)
+#define HT_MPOL_INTERLEAVE (3)
+#define HT_PAGE_2MB ((size_t)1 << 21)
+#define HT_PAGE_1GB ((size_t)1 << 30)
+
+static inline bool ht_alloc_mapped(const ht_alloc_options_t *options) {
+	return options && (options->pages != HT_PAGES_DEFAULT ||
+		options->numa != HT_NUMA_DEFAULT || options->init_threads > 1);
+}
+
+// Online nodes as listed in sysfs ("0-1,3"), node 0 if unknown.
+static unsigned long ht_numa_online_mask(void) {
+	unsigned long mask = 0;
+	FILE *f = fopen("/sys/devices/system/node/online", "r");
+	if(f) {
+		unsigned first, last;
+		int n;
+		while((n = fscanf(f, "%u-%u", &first, &last)) >= 1) {
+			if(n == 1) last = first;
+			for(unsigned node = first; node <= last && node < 64; node++) {
+				mask |= 1UL << node;
 			}
+			if(fgetc(f) != ',') break;
 		}
+		fclose(f);
 	}
-	return false; // Key not found
+	return mask ? mask : 1;
+}
+
+unsigned ht_numa_nodes(unsigned *nodes, unsigned max) {
+	unsigned long mask = ht_numa_online_mask();
+	unsigned count = 0;
+	for(unsigned node = 0; node < 64 && count < max; node++) {
+		if(mask & (1UL << node)) nodes[count++] = node;
 	}
+	return count;
+}
 
-bool ht_contains_key(
-	const hopscotch_hash_table_t *ht,
-	hash_function_f hash_function,
-	const uint8_t *key,
-	uint8_t *out_value
-) {
-	uint32_t h = hash_function(key);
-	size_t home = h & ht->mask;
+int ht_numa_current_node(void) {
+#if defined(SYS_getcpu)
+	unsigned cpu, node;
+	if(syscall(SYS_getcpu, &cpu, &node, NULL) == 0) return (int)node;
+#endif
+	return -1;
+}
 
-	for(size_t i = 0; i < HOP_RANGE * MAX_RELOCATION_FACTOR; i++) {
-		size_t idx = (home + i) & ht->mask;
+static bool ht_numa_apply(void *addr, size_t len, ht_numa_policy_t numa, unsigned node) {
+#if defined(SYS_mbind)
+	unsigned long mask;
+	int mode;
+	if(numa == HT_NUMA_INTERLEAVE) {
+		mask = ht_numa_online_mask();
+		mode = HT_MPOL_INTERLEAVE;
+	} else {
+		if(node >= 64) return false;
+		mask = 1UL << node;
+		mode = HT_MPOL_BIND;
+	}
+	return syscall(SYS_mbind, addr, len, mode, &mask, 8 * sizeof(mask) + 1, 0) == 0;
+#else
+	(void)addr; (void)len; (void)numa; (void)node;
+	return false;
+#endif
+}
 
-		// Atomic load matches ht_remove_key's function.
-		uint64_t node_info = atomic_load_explicit(
-			&ht->nodes[idx].hop_info,
-			memory_order_acquire);
+typedef struct {
+	uint8_t *begin;
+	uint8_t *end;
+} ht_touch_range_t;
 
-			uint32_t node_hash = (uint32_t)(node_info >> HASH_HOP_INFO_OFFSET);
+static int ht_touch_thread(void *arg) {
+	ht_touch_range_t *range = arg;
+	for(volatile uint8_t *p = range->begin; p < range->end; p += HT_TOUCH_STEP) {
+		*p = 0;
+	}
+	return 0;
+}
 
-		if(node_hash == h) {
-			bool match = true;
-			for(int j = 0; j < KEY_SIZE; j++) {
-				uint8_t key_byte = atomic_load_explicit(
-					&ht->nodes[idx].key[j],
-					memory_order_relaxed);
-				if(key_byte != key[j]) {
-					match = false;
-					break;
-				}
-			}
+// Faults the pages of a fresh mapping in from several threads. The caller
+// touches the first range itself.
+static void ht_buffer_touch(uint8_t *buffer, size_t size, unsigned threads) {
+	thrd_t tids[HT_INIT_MAX_THREADS];
+	ht_touch_range_t ranges[HT_INIT_MAX_THREADS];
+	bool started[HT_INIT_MAX_THREADS] = { false };
+	if(threads > HT_INIT_MAX_THREADS) threads = HT_INIT_MAX_THREADS;
 
-			if(match) {
-				// Only difference is optional value retrieval.
-				if(out_value) {
-					for(int j = 0; j < VALUE_SIZE; j++) {
-						out_value[j] = atomic_load_explicit(
-							&ht->nodes[idx].value[j],
-							memory_order_relaxed);
-					}
-				}
-				return true;
-			}
+	size_t steps = (size + HT_TOUCH_STEP - 1) / HT_TOUCH_STEP;
+	size_t per_thread = (steps + threads - 1) / threads * HT_TOUCH_STEP;
+	for(unsigned t = 0; t < threads; t++) {
+		size_t begin = t * per_thread < size ? t * per_thread : size;
+		size_t end = begin + per_thread < size ? begin + per_thread : size;
+		ranges[t] = (ht_touch_range_t){ buffer + begin, buffer + end };
+		if(t > 0) {
+			started[t] = thrd_create(&tids[t], ht_touch_thread, &ranges[t]) == thrd_success;
 		}
 	}
-	return false;
+	for(unsigned t = 0; t < threads; t++) {
+		if(started[t]) {
+			thrd_join(tids[t], NULL);
+		} else {
+			ht_touch_thread(&ranges[t]);
+		}
+	}
+}
+
+// Maps at least size zeroed bytes as options ask. map_size gets the length
+// of the mapping, pages and numa what it actually got.
+static uint8_t *ht_buffer_map(
+	size_t size,
+	const ht_alloc_options_t *options,
+	size_t *map_size,
+	ht_page_mode_t *pages,
+	ht_numa_policy_t *numa
+) {
+	ht_page_mode_t mode = options->pages;
+	uint8_t *buffer = MAP_FAILED;
+	size_t length = 0;
+
+	if(mode == HT_PAGES_HUGE_2MB || mode == HT_PAGES_HUGE_1GB) {
+		size_t huge = mode == HT_PAGES_HUGE_2MB ? HT_PAGE_2MB : HT_PAGE_1GB;
+		length = (size + huge - 1) & ~(huge - 1);
+		buffer = mmap(NULL, length, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB |
+			(mode == HT_PAGES_HUGE_2MB ? MAP_HUGE_2MB : MAP_HUGE_1GB), -1, 0);
+		// No reserved pool, transparent huge pages are the next best.
+		if(buffer == MAP_FAILED) mode = HT_PAGES_THP;
+	}
+	if(buffer == MAP_FAILED) {
+		// THP only backs 2MB aligned ranges: map a huge page more than needed
+		// and trim both ends to the boundary.
+		size_t align = mode == HT_PAGES_THP ? HT_PAGE_2MB : (size_t)sysconf(_SC_PAGESIZE);
+		length = (size + align - 1) & ~(align - 1);
+		size_t extra = mode == HT_PAGES_THP ? align : 0;
+		uint8_t *raw = mmap(NULL, length + extra, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if(raw == MAP_FAILED) return NULL;
+		buffer = (uint8_t *)(((uintptr_t)raw + align - 1) & ~(uintptr_t)(align - 1));
+		if(extra) {
+			if(buffer > raw) munmap(raw, (size_t)(buffer - raw));
+			if(raw + extra > buffer) munmap(buffer + length, (size_t)(raw + extra - buffer));
+		}
+		if(mode == HT_PAGES_THP && madvise(buffer, length, MADV_HUGEPAGE) != 0) {
+			mode = HT_PAGES_DEFAULT;
+		}
+	}
+
+	*numa = HT_NUMA_DEFAULT;
+	if(options->numa != HT_NUMA_DEFAULT &&
+		ht_numa_apply(buffer, length, options->numa, options->numa_node))
+	{
+		*numa = options->numa;
+	}
+	// The policy is set, the first touch may place the pages now.
+	if(options->init_threads > 1) {
+		ht_buffer_touch(buffer, length, options->init_threads);
+	}
+	*map_size = length;
+	*pages = mode;
+	return buffer;
+}
+
+const char *ht_page_mode_name(ht_page_mode_t pages) {
+	switch(pages) {
+	case HT_PAGES_THP: return "thp";
+	case HT_PAGES_HUGE_2MB: return "huge-2mb";
+	case HT_PAGES_HUGE_1GB: return "huge-1gb";
+	default: return "default";
+	}
+}
+
+const char *ht_numa_policy_name(ht_numa_policy_t numa) {
+	switch(numa) {
+	case HT_NUMA_INTERLEAVE: return "interleave";
+	case HT_NUMA_BIND: return "bind";
+	default: return "default";
+	}
+}
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Bucket array related functions.
+//------------------------------------------------------------------------------
+#define HT_ALIGN64(_s) (((_s) + 63) & ~(size_t)63)
+
+// HT_INSERT_FAILED - no room, HT_INSERT_KEPT - the key is there and the
+// write did not apply, HT_INSERT_ABSENT - no such key and the write does not
+// add one.
+typedef enum {
+	HT_INSERT_FAILED = 0,
+	HT_INSERT_ADDED,
+	HT_INSERT_UPDATED,
+	HT_INSERT_KEPT,
+	HT_INSERT_ABSENT
+} ht_insert_result_t;
+
+// What a write does to a key already in the table and whether it may add it.
+typedef enum {
+	HT_WRITE_SET = 0,
+	HT_WRITE_IF_ABSENT,
+	HT_WRITE_REPLACE,
+	HT_WRITE_CAS,
+	HT_WRITE_UPSERT
+} ht_write_mode_t;
+
+typedef struct {
+	ht_write_mode_t mode;
+	const uint8_t *value;
+	// HT_WRITE_CAS: the value the slot must hold.
+	const uint8_t *expected;
+	// HT_WRITE_UPSERT: computes the value in place.
+	ht_upsert_f upsert;
+	void *ctx;
+	// Gets the replaced value (optional).
+	uint8_t *old_value;
+	// Cache mode: the current time (0 - expiry is not checked) and the expiry
+	// word the write stores, the table default unless own_expiry is set.
+	// expired (optional) counts the expired entries the write reclaimed.
+	uint64_t now;
+	uint64_t expiry;
+	bool own_expiry;
+	size_t *expired;
+} ht_write_t;
+
+static inline bool ht_write_adds(const ht_write_t *w) {
+	return w->mode != HT_WRITE_REPLACE && w->mode != HT_WRITE_CAS;
+}
+
+static inline size_t ht_array_chunk_size(size_t capacity) {
+	return capacity < HT_RESIZE_CHUNK ? capacity : HT_RESIZE_CHUNK;
+}
+
+static inline size_t ht_array_chunks(size_t capacity) {
+	size_t chunk_size = ht_array_chunk_size(capacity);
+	return (capacity + chunk_size - 1) / chunk_size;
+}
+
+static inline size_t ht_array_chunk(const ht_array_t *a, uint64_t h) {
+	return INDEX(h, a->mask) / a->chunk_size;
+}
+
+// Structural counters go to the caller's stripe of the table owning the
+// array. Slot lock and claim retries pile up per thread until the insert or
+// remove call which caused them takes them. Without HT_STATS the macros are
+// empty and their arguments are never evaluated.
+static inline size_t ht_stats_bin(size_t v) {
+	size_t bin = v ? 64 - (size_t)__builtin_clzll(v) : 0;
+	return bin < HT_STATS_BINS ? bin : HT_STATS_BINS - 1;
+}
+
+#if HT_STATS
+static inline unsigned ht_counter_stripe_index(void);
+static _Thread_local uint64_t ht_stats_retries = 0;
+
+static inline ht_probe_counters_t *ht_array_probe(const ht_array_t *a) {
+	return &a->stripes[ht_counter_stripe_index()].probe;
+}
+
+#define HT_STAT_ADD(_a, _field, _n) \
+	atomic_fetch_add_explicit(&ht_array_probe(_a)->_field, (_n), memory_order_relaxed)
+#define HT_STAT_BIN(_a, _hist, _v) HT_STAT_ADD(_a, _hist[ht_stats_bin(_v)], 1)
+#define HT_STAT_RETRY() (ht_stats_retries++)
+#define HT_STAT_TAKE_RETRIES(_a, _field) \
+	do { \
+		HT_STAT_ADD(_a, _field, ht_stats_retries); \
+		ht_stats_retries = 0; \
+	} while(0)
+#else
+#define HT_STAT_ADD(_a, _field, _n) ((void)0)
+#define HT_STAT_BIN(_a, _hist, _v) ((void)0)
+#define HT_STAT_RETRY() ((void)0)
+#define HT_STAT_TAKE_RETRIES(_a, _field) ((void)0)
+#endif
+
+// Slot layout and the bytes a slot keeps for its key and value. AoS slots
+// are hash_node_t records, variable-length entries only keep references.
+// Tables made by ht_create_cache have expiry words as well.
+typedef struct {
+	ht_layout_t layout;
+	size_t key_size;
+	size_t value_size;
+	bool expiry;
+} ht_shape_t;
+
+// Per slot metadata: the tag array (one byte per slot) followed by the
+// seqlock versions and the relocation timestamps (one word per slot each)
+// and the expiry words of a cache.
+static inline size_t ht_array_meta_size(size_t capacity, ht_shape_t shape) {
+	return HT_ALIGN64(capacity) + 2 * HT_ALIGN64(capacity * sizeof(uint32_t)) +
+		(shape.expiry ? HT_ALIGN64(capacity * sizeof(uint64_t)) : 0);
+}
+
+static inline ht_shape_t ht_layout_shape(ht_layout_t layout) {
+	size_t key_size = layout == HT_LAYOUT_VARLEN ? HT_VAR_REF_SIZE : KEY_SIZE;
+	size_t value_size = layout == HT_LAYOUT_VARLEN ? HT_VAR_REF_SIZE : VALUE_SIZE;
+	return (ht_shape_t){ layout, key_size, value_size, false };
+}
+
+static inline ht_shape_t ht_array_shape(const ht_array_t *a) {
+	return (ht_shape_t){ a->layout, a->key_size, a->value_size, a->expiry != NULL };
+}
+
+// Slots of the array, either hash_node_t records (AoS) or three parallel
+// arrays: hop_info words, keys and values (SoA, VARLEN).
+// The per slot metadata always comes first.
+static size_t ht_array_slots_size(size_t capacity, ht_shape_t shape) {
+	size_t meta = ht_array_meta_size(capacity, shape);
+	if(shape.layout != HT_LAYOUT_AOS) {
+		return meta + HT_ALIGN64(capacity * sizeof(atomic_uint_fast64_t)) +
+			HT_ALIGN64(capacity * shape.key_size) +
+			HT_ALIGN64(capacity * shape.value_size);
+	}
+	return meta + HT_ALIGN64(capacity * sizeof(hash_node_t));
+}
+
+// Chunk states first, then 64-byte aligned slots.
+static size_t ht_array_payload_size(size_t capacity, ht_shape_t shape) {
+	return HT_ALIGN64(ht_array_chunks(capacity) * sizeof(uint32_t)) +
+		ht_array_slots_size(capacity, shape);
+}
+
+// Points a fresh descriptor at its payload, the payload itself is untouched
+// (a file-backed array keeps its slots).
+static void ht_array_attach(
+	ht_array_t *a,
+	uint8_t *payload,
+	size_t capacity,
+	ht_shape_t shape,
+	bool embedded
+) {
+	ht_layout_t layout = shape.layout;
+	memset(a, 0, sizeof(ht_array_t));
+	a->chunk_state = (_Atomic uint32_t *)payload;
+	a->slots = payload + HT_ALIGN64(ht_array_chunks(capacity) * sizeof(uint32_t));
+	a->layout = layout;
+	a->tags = (_Atomic uint8_t *)a->slots;
+	a->versions = (_Atomic uint32_t *)(a->slots + HT_ALIGN64(capacity));
+	a->timestamps = (_Atomic uint32_t *)((uint8_t *)a->versions +
+		HT_ALIGN64(capacity * sizeof(uint32_t)));
+	a->expiry = !shape.expiry ? NULL : (_Atomic uint64_t *)((uint8_t *)a->timestamps +
+		HT_ALIGN64(capacity * sizeof(uint32_t)));
+	a->key_size = shape.key_size;
+	a->value_size = shape.value_size;
+	if(layout != HT_LAYOUT_AOS) {
+		a->hop_info_base = a->slots + ht_array_meta_size(capacity, shape);
+		a->hop_info_stride = sizeof(atomic_uint_fast64_t);
+		a->key_base = a->hop_info_base +
+			HT_ALIGN64(capacity * sizeof(atomic_uint_fast64_t));
+		a->key_stride = a->key_size;
+		a->value_base = a->key_base + HT_ALIGN64(capacity * a->key_size);
+		a->value_stride = a->value_size;
+	} else {
+		hash_node_t *nodes = (hash_node_t *)(a->slots + ht_array_meta_size(capacity, shape));
+		a->hop_info_base = (uint8_t *)&nodes[0].hop_info;
+		a->key_base = nodes[0].key;
+		a->value_base = nodes[0].value;
+		a->hop_info_stride = a->key_stride = a->value_stride = sizeof(hash_node_t);
+	}
+	a->capacity = capacity;
+	a->mask = capacity - 1;
+	a->chunk_size = ht_array_chunk_size(capacity);
+	a->chunks = ht_array_chunks(capacity);
+	a->embedded = embedded;
+	atomic_init(&a->resizing, false);
+}
+
+static void ht_array_init(
+	ht_array_t *a,
+	uint8_t *payload,
+	size_t capacity,
+	ht_shape_t shape,
+	bool embedded
+) {
+	ht_array_attach(a, payload, capacity, shape, embedded);
+	memset(payload, 0, ht_array_payload_size(capacity, shape));
+}
+
+static inline atomic_uint_fast64_t *ht_slot_hop_info(const ht_array_t *a, size_t idx) {
+	return (atomic_uint_fast64_t *)(a->hop_info_base + idx * a->hop_info_stride);
+}
+
+static inline uint8_t *ht_slot_key(const ht_array_t *a, size_t idx) {
+	return a->key_base + idx * a->key_stride;
+}
+
+static inline uint8_t *ht_slot_value(const ht_array_t *a, size_t idx) {
+	return a->value_base + idx * a->value_stride;
+}
+
+// Keys of a variable-length array are references, compared by their data.
+// Common key sizes get a compare the compiler can inline.
+static inline bool ht_slot_key_equal(const ht_array_t *a, size_t idx, const uint8_t *key) {
+	const uint8_t *slot_key = ht_slot_key(a, idx);
+	if(a->arena) return ht_var_equal(a->arena, slot_key, key);
+	switch(a->key_size) {
+	case 8: return memcmp(slot_key, key, 8) == 0;
+	case 16: return memcmp(slot_key, key, 16) == 0;
+	case 32: return memcmp(slot_key, key, 32) == 0;
+	case 64: return memcmp(slot_key, key, 64) == 0;
+	default: return memcmp(slot_key, key, a->key_size) == 0;
+	}
+}
+
+// Tag 0 marks a free slot, the tag is taken from the upper hash bits which
+// are not used by the home index of reasonably sized tables. Bit 63 is not
+// part of it: the slot word only keeps 63 hash bits. HT_TAG_PENDING is kept
+// for adds in progress.
+static inline uint8_t ht_tag(uint64_t h) {
+	uint8_t tag = (uint8_t)(h >> 55);
+	if(tag == 0 || tag == HT_TAG_PENDING) tag ^= 1;
+	return tag;
+}
+
+// A published entry, neither free, claimed nor pending.
+static inline bool ht_tag_live(uint8_t tag) {
+	return tag != 0 && tag != HT_TAG_PENDING;
+}
+
+// A tag is published after the key and value, and cleared before them.
+static inline void ht_slot_set_tag(ht_array_t *a, size_t idx, uint8_t tag) {
+	atomic_store_explicit(&a->tags[idx], tag, memory_order_release);
+}
+
+// Writers make the slot version odd for the time they modify the key, the
+// value or the hop_info word of the slot. Readers copy the slot without
+// atomics and retry if the version was odd or has changed meanwhile.
+static inline void ht_slot_lock(ht_array_t *a, size_t idx) {
+	_Atomic uint32_t *version = &a->versions[idx];
+	uint32_t current = atomic_load_explicit(version, memory_order_relaxed);
+	for(;;) {
+		if(current & 1) {
+			HT_STAT_RETRY();
+			thrd_yield();
+			current = atomic_load_explicit(version, memory_order_relaxed);
+			continue;
+		}
+		if(atomic_compare_exchange_weak_explicit(version, &current, current + 1,
+			memory_order_acquire, memory_order_relaxed))
+		{
+			break;
+		}
+		HT_STAT_RETRY();
+	}
+	// Slot stores must not become visible before the odd version.
+	atomic_thread_fence(memory_order_release);
+}
+
+static inline void ht_slot_unlock(ht_array_t *a, size_t idx) {
+	atomic_fetch_add_explicit(&a->versions[idx], 1, memory_order_release);
+}
+
+_Static_assert(sizeof(_Atomic uint8_t) == 1, "tags are read as a byte array");
+
+// Bit i is set if the tag of slot (idx + i) & mask matches.
+static inline uint32_t ht_array_tag_match(const ht_array_t *a, size_t idx, uint8_t tag) {
+	uint32_t matches = 0;
+	idx &= a->mask;
+	if(idx + HOP_RANGE <= a->capacity) {
+		// The kernels load the tags as plain bytes (vector loads have no
+		// atomic form). A byte is read whole, a stale one only costs a key
+		// compare or a miss the slot version or the timestamp retries.
+		matches = atomic_load_explicit(&ht_tag_match, memory_order_relaxed)(
+			(const uint8_t *)(a->tags + idx), tag);
+	} else {
+		// The window wraps around the end of the array.
+		for(size_t i = 0; i < HOP_RANGE; i++) {
+			uint8_t t = atomic_load_explicit(&a->tags[(idx + i) & a->mask],
+				memory_order_relaxed);
+			matches |= (uint32_t)(t == tag) << i;
+		}
+	}
+	atomic_thread_fence(memory_order_acquire);
+	return matches;
+}
+
+// Arrays created by a resize: descriptor and payload in one block, placed
+// like the table buffer.
+static ht_array_t *ht_array_alloc(
+	size_t capacity,
+	ht_shape_t shape,
+	const ht_alloc_options_t *alloc
+) {
+	size_t header_size = HT_ALIGN64(sizeof(ht_array_t));
+	size_t size = header_size + ht_array_payload_size(capacity, shape);
+	if(ht_alloc_mapped(alloc)) {
+		size_t map_size;
+		ht_page_mode_t pages;
+		ht_numa_policy_t numa;
+		uint8_t *buffer = ht_buffer_map(size, alloc, &map_size, &pages, &numa);
+		if(!buffer) return NULL;
+
+		// A fresh mapping is zeroed already.
+		ht_array_t *a = (ht_array_t *)buffer;
+		ht_array_attach(a, buffer + header_size, capacity, shape, false);
+		a->map_size = map_size;
+		a->pages = pages;
+		a->numa = numa;
+		return a;
+	}
+
+	uint8_t *buffer = aligned_alloc(64, size);
+	if(!buffer) return NULL;
+
+	ht_array_t *a = (ht_array_t *)buffer;
+	ht_array_init(a, buffer + header_size, capacity, shape, false);
+	return a;
+}
+
+static void ht_array_free(ht_array_t *a) {
+	if(!a || a->embedded) return;
+	if(a->map_size) {
+		munmap(a, a->map_size);
+	} else {
+		free(a);
+	}
+}
+
+static void ht_array_reclaim(void *ctx, void *ptr, size_t len) {
+	(void)ctx; (void)len;
+	ht_array_free(ptr);
+}
+
+// A writer announces itself in the chunk of its home bucket. It fails once a
+// migration has closed the chunk, the caller must then look for the new array.
+static inline bool ht_chunk_enter(ht_array_t *a, size_t chunk) {
+	uint32_t old = atomic_fetch_add(&a->chunk_state[chunk], 1);
+	if(old & (HT_CHUNK_CLOSED | HT_CHUNK_DONE)) {
+		atomic_fetch_sub_explicit(&a->chunk_state[chunk], 1, memory_order_release);
+		return false;
+	}
+	return true;
+}
+
+static inline void ht_chunk_exit(ht_array_t *a, size_t chunk) {
+	atomic_fetch_sub_explicit(&a->chunk_state[chunk], 1, memory_order_release);
+}
+
+// Every home bucket has a relocation timestamp, bumped whenever one of its
+// residents is moved. A lookup which found nothing retries if the timestamp
+// has changed meanwhile, the key may have been moved past the scan.
+static inline uint32_t ht_bucket_timestamp(const ht_array_t *a, size_t home) {
+	return atomic_load_explicit(&a->timestamps[home], memory_order_acquire);
+}
+
+static inline bool ht_bucket_moved(const ht_array_t *a, size_t home, uint32_t timestamp) {
+	atomic_thread_fence(memory_order_acquire);
+	return atomic_load_explicit(&a->timestamps[home], memory_order_relaxed) != timestamp;
+}
+
+// The word of an occupied (or claimed) slot, any hash including 0 is valid.
+static inline uint64_t ht_hash_word(uint64_t h) {
+	return h | HT_SLOT_USED;
+}
+
+// An entry expires once now reaches its expiry, now 0 never expires one.
+static inline bool ht_expired(uint64_t expiry, uint64_t now) {
+	expiry &= ~HT_EXPIRY_REF;
+	return expiry != 0 && expiry <= now && now != 0;
+}
+
+// Expiry word of a slot, 0 in a table without them.
+static inline uint64_t ht_slot_expiry(const ht_array_t *a, size_t idx) {
+	return a->expiry ? atomic_load_explicit(&a->expiry[idx], memory_order_relaxed) : 0;
+}
+
+static inline bool ht_slot_expired(const ht_array_t *a, size_t idx, uint64_t now) {
+	return now && ht_expired(atomic_load_explicit(&a->expiry[idx], memory_order_relaxed), now);
+}
+
+// Sets the CLOCK reference bit of a slot a lookup hit, a set bit is only
+// read: hot entries do not bounce their cache line between readers.
+static inline void ht_slot_touch(ht_array_t *a, size_t idx) {
+	if(!(atomic_load_explicit(&a->expiry[idx], memory_order_relaxed) & HT_EXPIRY_REF)) {
+		atomic_fetch_or_explicit(&a->expiry[idx], HT_EXPIRY_REF, memory_order_relaxed);
+	}
+}
+
+// The caller holds the slot version, the slot keeps the key of w.
+static ht_insert_result_t ht_slot_write(ht_array_t *a, size_t idx, const ht_write_t *w) {
+	uint8_t *value = ht_slot_value(a, idx);
+	switch(w->mode) {
+	case HT_WRITE_IF_ABSENT:
+		return HT_INSERT_KEPT;
+	case HT_WRITE_UPSERT:
+		if(w->old_value) memcpy(w->old_value, value, a->value_size);
+		w->upsert(value, a->value_size, true, w->ctx);
+		break;
+	case HT_WRITE_CAS:
+		if(memcmp(value, w->expected, a->value_size) != 0) return HT_INSERT_KEPT;
+		// Fall through.
+	default:
+		if(w->old_value) memcpy(w->old_value, value, a->value_size);
+		memcpy(value, w->value, a->value_size);
+		break;
+	}
+	// An updated entry counts as referenced.
+	if(w->now) {
+		atomic_store_explicit(&a->expiry[idx], w->expiry | HT_EXPIRY_REF, memory_order_relaxed);
+	}
+	return HT_INSERT_UPDATED;
+}
+
+static void ht_array_clear_slot(ht_array_t *a, size_t idx);
+
+// Applies w to an existing key under its slot version, HT_INSERT_ABSENT if
+// there is no such key. An expired entry of the key is cleared on the way.
+static ht_insert_result_t ht_array_update(
+	ht_array_t *a,
+	uint64_t h,
+	const uint8_t *key,
+	const ht_write_t *w
+) {
+	size_t home = INDEX(h, a->mask);
+	uint8_t tag = ht_tag(h);
+	uint64_t word = ht_hash_word(h);
+	uint32_t timestamp;
+
+	do {
+		timestamp = ht_bucket_timestamp(a, home);
+		for(size_t base = 0; base < HOP_RANGE * MAX_RELOCATION_FACTOR; base += HOP_RANGE) {
+			uint32_t matches = ht_array_tag_match(a, home + base, tag);
+			while(matches) {
+				size_t idx = (home + base + __builtin_ctz(matches)) & a->mask;
+				matches &= matches - 1;
+				uint64_t node_info = atomic_load_explicit(
+					ht_slot_hop_info(a, idx), memory_order_acquire);
+				if(node_info != word) continue;
+
+				ht_slot_lock(a, idx);
+				node_info = atomic_load_explicit(
+					ht_slot_hop_info(a, idx), memory_order_relaxed);
+				if(node_info == word &&
+					ht_slot_key_equal(a, idx, key))
+				{
+					if(ht_slot_expired(a, idx, w->now)) {
+						ht_array_clear_slot(a, idx);
+						ht_slot_unlock(a, idx);
+						if(w->expired) (*w->expired)++;
+						return HT_INSERT_ABSENT;
+					}
+					ht_insert_result_t res = ht_slot_write(a, idx, w);
+					ht_slot_unlock(a, idx);
+					HT_STAT_BIN(a, probe_distance, (idx - home) & a->mask);
+					return res;
+				}
+				ht_slot_unlock(a, idx);
+			}
+		}
+	} while(ht_bucket_moved(a, home, timestamp));
+	return HT_INSERT_ABSENT;
+}
+
+// Histogram bin of the occupied slots among the first HOP_RANGE of home.
+static inline size_t ht_array_occupancy_bin(const ht_array_t *a, size_t home) {
+	return (HOP_RANGE - __builtin_popcount(ht_array_tag_match(a, home, 0))) / (HOP_RANGE / 8);
+}
+
+// Claims the closest free slot within range of the home bucket. A claimed
+// slot carries the hash word but no tag: other writers skip it and lookups
+// never match it.
+static bool ht_array_claim_free(
+	ht_array_t *a,
+	uint64_t h,
+	size_t home,
+	size_t range,
+	size_t *distance
+) {
+	if(range > a->capacity) range = a->capacity;
+
+	// Free slots carry tag 0.
+	for(size_t base = 0; base < range; base += HOP_RANGE) {
+		uint32_t candidates = ht_array_tag_match(a, home + base, 0);
+		while(candidates) {
+			size_t d = base + __builtin_ctz(candidates);
+			if(d >= range) break;
+			size_t idx = (home + d) & a->mask;
+			uint64_t current = atomic_load(ht_slot_hop_info(a, idx));
+			if(current == 0) { // Empty slot
+				if(atomic_compare_exchange_weak_explicit(
+					ht_slot_hop_info(a, idx),
+					&current,
+					ht_hash_word(h),
+					memory_order_acquire,
+					memory_order_acquire))
+				{
+					*distance = d;
+					return true;
+				}
+				// Spurious failure, the slot is still free.
+				HT_STAT_RETRY();
+				if(current == 0) continue;
+			}
+			candidates &= candidates - 1;
+		}
+	}
+	return false;
+}
+
+// Moves the resident of slot src into the claimed slot dst, src becomes the
+// claimed slot. The copy is published before the timestamp of the resident's
+// home bucket is bumped and the source is cleared only after that: a reader
+// which missed both copies is bound to see the new timestamp.
+static bool ht_array_move(ht_array_t *a, size_t src, size_t dst) {
+	size_t neighborhood = HOP_RANGE * MAX_RELOCATION_FACTOR;
+
+	ht_slot_lock(a, src);
+	uint8_t tag = atomic_load_explicit(&a->tags[src], memory_order_relaxed);
+	uint64_t info = atomic_load_explicit(ht_slot_hop_info(a, src), memory_order_relaxed);
+	size_t home = INDEX(info, a->mask);
+	if(!ht_tag_live(tag) || !(info & HT_SLOT_USED) ||
+		((dst - home) & a->mask) >= neighborhood)
+	{
+		// Removed or replaced meanwhile, or an add has not published it.
+		ht_slot_unlock(a, src);
+		return false;
+	}
+
+	ht_slot_lock(a, dst);
+	uint64_t claim = atomic_load_explicit(ht_slot_hop_info(a, dst), memory_order_relaxed);
+	memcpy(ht_slot_key(a, dst), ht_slot_key(a, src), a->key_size);
+	memcpy(ht_slot_value(a, dst), ht_slot_value(a, src), a->value_size);
+	if(a->expiry) {
+		atomic_store_explicit(&a->expiry[dst],
+			atomic_load_explicit(&a->expiry[src], memory_order_relaxed), memory_order_relaxed);
+	}
+	atomic_store_explicit(ht_slot_hop_info(a, dst), info, memory_order_release);
+	ht_slot_unlock(a, dst);
+	ht_slot_set_tag(a, dst, tag);
+
+	atomic_fetch_add_explicit(&a->timestamps[home], 1, memory_order_release);
+
+	ht_slot_set_tag(a, src, 0);
+	atomic_store_explicit(ht_slot_hop_info(a, src), claim, memory_order_release);
+	ht_slot_unlock(a, src);
+	return true;
+}
+
+// One step of the displacement chain: a resident between the home bucket and
+// the claimed slot which can still reach its own home bucket from there is
+// moved into it. The farthest resident is tried first, it brings the claimed
+// slot closest to the home bucket.
+static bool ht_array_displace(ht_array_t *a, size_t home, size_t *distance) {
+	size_t neighborhood = HOP_RANGE * MAX_RELOCATION_FACTOR;
+	size_t free_slot = (home + *distance) & a->mask;
+	size_t farthest = *distance < neighborhood ? *distance : neighborhood;
+
+	for(size_t back = farthest - 1; back > 0; back--) {
+		size_t idx = (free_slot - back) & a->mask;
+		if(!ht_tag_live(atomic_load_explicit(&a->tags[idx], memory_order_relaxed))) continue;
+
+		uint64_t info = atomic_load_explicit(ht_slot_hop_info(a, idx), memory_order_acquire);
+		if(!(info & HT_SLOT_USED) ||
+			((free_slot - INDEX(info, a->mask)) & a->mask) >= neighborhood)
+		{
+			continue;
+		}
+
+		// The resident may belong to a chunk being migrated, the move is
+		// done as a writer of that chunk.
+		size_t chunk = ht_array_chunk(a, info);
+		if(!ht_chunk_enter(a, chunk)) continue;
+		HT_STAT_ADD(a, relocation_attempts, 1);
+		bool moved = ht_array_move(a, idx, free_slot);
+		ht_chunk_exit(a, chunk);
+		if(moved) {
+			HT_STAT_ADD(a, relocations, 1);
+			*distance -= back;
+			return true;
+		}
+	}
+	return false;
+}
+
+// Whether slot idx holds key under the hash word, read under its version.
+static bool ht_slot_holds(const ht_array_t *a, size_t idx, uint64_t word, const uint8_t *key) {
+	_Atomic uint32_t *version = &a->versions[idx];
+	for(;;) {
+		uint32_t before = atomic_load_explicit(version, memory_order_acquire);
+		if(before & 1) {
+			thrd_yield();
+			continue;
+		}
+		bool match = atomic_load_explicit(ht_slot_hop_info(a, idx), memory_order_relaxed) ==
+			word && ht_slot_key_equal(a, idx, key);
+		atomic_thread_fence(memory_order_acquire);
+		if(atomic_load_explicit(version, memory_order_relaxed) == before) return match;
+	}
+}
+
+// Publishes the entry an add wrote into slot idx under HT_TAG_PENDING, false
+// if another copy of the key wins. Every add makes its entry pending before
+// it looks for other copies, so of two adds racing on a key at least one
+// sees the other. A published copy wins, so does a pending one closer to the
+// home bucket. One further away is killed: its tag goes back to 0, the CAS
+// publishing it fails and its add starts over. Pending entries never move,
+// two adds never kill each other.
+static bool ht_array_publish(ht_array_t *a, uint64_t h, const uint8_t *key, size_t idx) {
+	size_t home = INDEX(h, a->mask);
+	size_t distance = (idx - home) & a->mask;
+	uint8_t tag = ht_tag(h);
+	uint64_t word = ht_hash_word(h);
+	uint32_t timestamp;
+
+	atomic_thread_fence(memory_order_seq_cst);
+	do {
+		timestamp = ht_bucket_timestamp(a, home);
+		for(size_t base = 0; base < HOP_RANGE * MAX_RELOCATION_FACTOR; base += HOP_RANGE) {
+			uint32_t matches = ht_array_tag_match(a, home + base, tag) |
+				ht_array_tag_match(a, home + base, HT_TAG_PENDING);
+			while(matches) {
+				// A table smaller than the neighborhood is seen more than once.
+				size_t other = (home + base + __builtin_ctz(matches)) & a->mask;
+				matches &= matches - 1;
+				if(other == idx || !ht_slot_holds(a, other, word, key)) continue;
+
+				// A slot reused meanwhile only costs its add a retry.
+				uint8_t found = atomic_load_explicit(&a->tags[other], memory_order_acquire);
+				if(found == HT_TAG_PENDING && ((other - home) & a->mask) > distance &&
+					atomic_compare_exchange_strong_explicit(&a->tags[other], &found, 0,
+						memory_order_acq_rel, memory_order_acquire))
+				{
+					continue;
+				}
+				if(found == tag || found == HT_TAG_PENDING) return false;
+			}
+		}
+	} while(ht_bucket_moved(a, home, timestamp));
+
+	uint8_t pending = HT_TAG_PENDING;
+	return atomic_compare_exchange_strong_explicit(&a->tags[idx], &pending, tag,
+		memory_order_acq_rel, memory_order_relaxed);
+}
+
+// Residents live within HOP_RANGE * MAX_RELOCATION_FACTOR slots of their home
+// bucket. A free slot found further away is bubbled back towards the home
+// bucket, hop by hop, until it is close enough. No lock is held: an add which
+// loses a race on its key to another add gives its slot back and applies the
+// write to the winner's entry once it is published (see ht_array_publish).
+static ht_insert_result_t ht_array_insert(
+	ht_array_t *a,
+	uint64_t h,
+	const uint8_t *key,
+	const ht_write_t *w
+) {
+	size_t home = INDEX(h, a->mask); // number of buckets (mask = capacity - 1)
+
+	for(;;) {
+		// Check for existing key first (the whole probing window).
+		ht_insert_result_t res = ht_array_update(a, h, key, w);
+		if(res != HT_INSERT_ABSENT || !ht_write_adds(w)) return res;
+
+		// An upsert of a new key starts from a zeroed value.
+		const uint8_t *value = w->value;
+		uint8_t computed[HT_MAX_VALUE_SIZE];
+		if(w->mode == HT_WRITE_UPSERT) {
+			memset(computed, 0, a->value_size);
+			w->upsert(computed, a->value_size, false, w->ctx);
+			value = computed;
+		}
+
+		// A cache evicts rather than displaces: the slot must be in the
+		// neighborhood right away.
+		size_t range = w->now ? HOP_RANGE * MAX_RELOCATION_FACTOR : HT_ADD_RANGE;
+		size_t distance;
+		HT_STAT_ADD(a, occupancy[ht_array_occupancy_bin(a, home)], 1);
+		if(!ht_array_claim_free(a, h, home, range, &distance)) {
+			HT_STAT_ADD(a, range_full, 1);
+			return HT_INSERT_FAILED; // Table may not be fully full but range is full.
+		}
+
+#if HT_STATS
+		size_t chain = 0;
+#endif
+		while(distance >= HOP_RANGE * MAX_RELOCATION_FACTOR) {
+			if(!ht_array_displace(a, home, &distance)) {
+				// No resident can be moved, give the claimed slot back.
+				size_t idx = (home + distance) & a->mask;
+				ht_slot_lock(a, idx);
+				atomic_store_explicit(ht_slot_hop_info(a, idx), 0, memory_order_release);
+				ht_slot_unlock(a, idx);
+				HT_STAT_ADD(a, no_candidate, 1);
+				return HT_INSERT_FAILED;
+			}
+#if HT_STATS
+			chain++;
+#endif
+		}
+		HT_STAT_BIN(a, relocation_chain, chain);
+		HT_STAT_BIN(a, probe_distance, distance);
+
+		// The claimed slot already carries the hash word.
+		size_t idx = (home + distance) & a->mask;
+		ht_slot_lock(a, idx);
+		memcpy(ht_slot_key(a, idx), key, a->key_size);
+		memcpy(ht_slot_value(a, idx), value, a->value_size);
+		if(a->expiry) atomic_store_explicit(&a->expiry[idx], w->expiry, memory_order_relaxed);
+		ht_slot_unlock(a, idx);
+		ht_slot_set_tag(a, idx, HT_TAG_PENDING);
+		if(ht_array_publish(a, h, key, idx)) return HT_INSERT_ADDED;
+
+		// Lost the key to another add, pending or killed the slot goes back.
+		// The winner is let to publish before the key is looked up again.
+		ht_slot_lock(a, idx);
+		ht_array_clear_slot(a, idx);
+		ht_slot_unlock(a, idx);
+		HT_STAT_RETRY();
+		thrd_yield();
+	}
+}
+
+// The caller holds the slot version.
+static void ht_array_clear_slot(ht_array_t *a, size_t idx) {
+	ht_slot_set_tag(a, idx, 0);
+	atomic_store_explicit(ht_slot_hop_info(a, idx), 0, memory_order_release);
+	memset(ht_slot_key(a, idx), 0, a->key_size);
+	memset(ht_slot_value(a, idx), 0, a->value_size);
+	if(a->expiry) atomic_store_explicit(&a->expiry[idx], 0, memory_order_relaxed);
+}
+
+// removed_key and removed_value (optional) get the cleared slot contents.
+// An entry expired at now is cleared as well, it counts in expired and the
+// key is reported missing.
+static bool ht_array_remove(
+	ht_array_t *a,
+	uint64_t h,
+	const uint8_t *key,
+	uint8_t *removed_key,
+	uint8_t *removed_value,
+	uint64_t now,
+	size_t *expired
+) {
+	size_t home = INDEX(h, a->mask);
+	uint8_t tag = ht_tag(h);
+	uint64_t word = ht_hash_word(h);
+	uint32_t timestamp;
+
+	// Search in the neighborhood for the key, only tag matches are compared.
+	do {
+		timestamp = ht_bucket_timestamp(a, home);
+		for(size_t base = 0; base < HOP_RANGE * MAX_RELOCATION_FACTOR; base += HOP_RANGE) {
+			uint32_t matches = ht_array_tag_match(a, home + base, tag);
+			while(matches) {
+				size_t idx = (home + base + __builtin_ctz(matches)) & a->mask;
+				matches &= matches - 1;
+				uint64_t node_info = atomic_load_explicit(
+					ht_slot_hop_info(a, idx),
+					memory_order_acquire
+				);
+
+				if(node_info != word) continue;
+
+				// Re-check under the slot version, a concurrent remove may have
+				// freed the slot and an insert may have reused it.
+				ht_slot_lock(a, idx);
+				node_info = atomic_load_explicit(
+					ht_slot_hop_info(a, idx), memory_order_relaxed);
+				if(node_info != word || !ht_slot_key_equal(a, idx, key))
+				{
+					ht_slot_unlock(a, idx);
+					continue;
+				}
+
+				if(ht_slot_expired(a, idx, now)) {
+					ht_array_clear_slot(a, idx);
+					ht_slot_unlock(a, idx);
+					if(expired) (*expired)++;
+					return false;
+				}
+
+				// Found the key, clear the node's data with its hash word.
+				if(removed_key) memcpy(removed_key, ht_slot_key(a, idx), a->key_size);
+				if(removed_value) memcpy(removed_value, ht_slot_value(a, idx), a->value_size);
+				ht_array_clear_slot(a, idx);
+				ht_slot_unlock(a, idx);
+				HT_STAT_BIN(a, probe_distance, (idx - home) & a->mask);
+				return true;
+			}
+		}
+	} while(ht_bucket_moved(a, home, timestamp));
+	return false; // Key not found
+}
+
+// A variable-length value is copied into var_out while the slot version
+// still protects its arena block. An entry expired at now is a miss.
+static bool ht_array_find(
+	ht_array_t *a,
+	uint64_t h,
+	const uint8_t *key,
+	uint8_t *out_value,
+	ht_var_out_t *var_out,
+	uint64_t now
+) {
+	size_t home = INDEX(h, a->mask);
+	uint8_t tag = ht_tag(h);
+	uint64_t word = ht_hash_word(h);
+	uint32_t timestamp;
+
+	do {
+		timestamp = ht_bucket_timestamp(a, home);
+		for(size_t base = 0; base < HOP_RANGE * MAX_RELOCATION_FACTOR; base += HOP_RANGE) {
+			uint32_t matches = ht_array_tag_match(a, home + base, tag);
+			while(matches) {
+				size_t idx = (home + base + __builtin_ctz(matches)) & a->mask;
+				matches &= matches - 1;
+
+				// Optimistic read: plain copies validated by the slot version.
+				_Atomic uint32_t *version = &a->versions[idx];
+				uint8_t value[HT_MAX_VALUE_SIZE];
+				bool match;
+				for(;;) {
+					uint32_t before = atomic_load_explicit(version, memory_order_acquire);
+					if(before & 1) {
+						thrd_yield();
+						continue;
+					}
+
+					uint64_t node_info = atomic_load_explicit(
+						ht_slot_hop_info(a, idx),
+						memory_order_relaxed);
+					match = node_info == word && ht_slot_key_equal(a, idx, key) &&
+						!ht_slot_expired(a, idx, now);
+					if(match && out_value) {
+						memcpy(value, ht_slot_value(a, idx), a->value_size);
+					}
+					if(match && var_out) {
+						ht_var_copy_out(a->arena, ht_slot_value(a, idx), var_out);
+					}
+
+					atomic_thread_fence(memory_order_acquire);
+					if(atomic_load_explicit(version, memory_order_relaxed) == before) break;
+				}
+
+				if(match) {
+					// Only difference is optional value retrieval.
+					if(out_value) memcpy(out_value, value, a->value_size);
+					if(now) ht_slot_touch(a, idx);
+					HT_STAT_BIN(a, probe_distance, (idx - home) & a->mask);
+					return true;
+				}
+			}
+		}
+	} while(ht_bucket_moved(a, home, timestamp));
+	return false;
+}
+
+// Slot holding key and the even version it matched at, nothing is copied
+// (see ht_get_ref).
+static bool ht_array_locate(
+	ht_array_t *a,
+	uint64_t h,
+	const uint8_t *key,
+	size_t *slot,
+	uint32_t *slot_version,
+	uint64_t now
+) {
+	size_t home = INDEX(h, a->mask);
+	uint8_t tag = ht_tag(h);
+	uint64_t word = ht_hash_word(h);
+	uint32_t timestamp;
+
+	do {
+		timestamp = ht_bucket_timestamp(a, home);
+		for(size_t base = 0; base < HOP_RANGE * MAX_RELOCATION_FACTOR; base += HOP_RANGE) {
+			uint32_t matches = ht_array_tag_match(a, home + base, tag);
+			while(matches) {
+				size_t idx = (home + base + __builtin_ctz(matches)) & a->mask;
+				matches &= matches - 1;
+
+				_Atomic uint32_t *version = &a->versions[idx];
+				uint32_t before;
+				bool match;
+				for(;;) {
+					before = atomic_load_explicit(version, memory_order_acquire);
+					if(before & 1) {
+						thrd_yield();
+						continue;
+					}
+					uint64_t node_info = atomic_load_explicit(
+						ht_slot_hop_info(a, idx),
+						memory_order_relaxed);
+					match = node_info == word && ht_slot_key_equal(a, idx, key) &&
+						!ht_slot_expired(a, idx, now);
+
+					atomic_thread_fence(memory_order_acquire);
+					if(atomic_load_explicit(version, memory_order_relaxed) == before) break;
+				}
+
+				if(match) {
+					if(now) ht_slot_touch(a, idx);
+					HT_STAT_BIN(a, probe_distance, (idx - home) & a->mask);
+					*slot = idx;
+					*slot_version = before;
+					return true;
+				}
+			}
+		}
+	} while(ht_bucket_moved(a, home, timestamp));
+	return false;
+}
+
+// Clears the resident of slot idx as a writer of its home chunk, only if it
+// has expired at now when expired_only is set.
+static bool ht_array_drop(ht_array_t *a, size_t idx, uint64_t now, bool expired_only) {
+	uint64_t info = atomic_load_explicit(ht_slot_hop_info(a, idx), memory_order_acquire);
+	if(!(info & HT_SLOT_USED)) return false;
+	size_t chunk = ht_array_chunk(a, info);
+	if(!ht_chunk_enter(a, chunk)) return false;
+
+	ht_slot_lock(a, idx);
+	bool drop = ht_tag_live(atomic_load_explicit(&a->tags[idx], memory_order_relaxed)) &&
+		atomic_load_explicit(ht_slot_hop_info(a, idx), memory_order_relaxed) == info &&
+		(!expired_only || ht_slot_expired(a, idx, now));
+	if(drop) ht_array_clear_slot(a, idx);
+	ht_slot_unlock(a, idx);
+	ht_chunk_exit(a, chunk);
+	return drop;
+}
+
+// Makes room in the full neighborhood of the home bucket of h. The CLOCK
+// hand sweeps the neighborhood from a point picked by the hash: it takes the
+// first resident which has expired or has no reference bit, and clears the
+// bits it passes. expired tells which kind of entry went.
+static bool ht_array_evict(ht_array_t *a, uint64_t h, uint64_t now, bool *expired) {
+	size_t home = INDEX(h, a->mask);
+	size_t n = HOP_RANGE * MAX_RELOCATION_FACTOR;
+	if(n > a->capacity) n = a->capacity;
+	size_t hand = (h >> 32) % n;
+
+	// Two rounds: every reference bit is cleared by the end of the first one.
+	for(size_t i = 0; i < 2 * n; i++) {
+		size_t idx = (home + (hand + i) % n) & a->mask;
+		if(!ht_tag_live(atomic_load_explicit(&a->tags[idx], memory_order_relaxed))) continue;
+		uint64_t expiry = atomic_load_explicit(&a->expiry[idx], memory_order_relaxed);
+		*expired = ht_expired(expiry, now);
+		if(!*expired && (expiry & HT_EXPIRY_REF)) {
+			atomic_fetch_and_explicit(&a->expiry[idx], ~HT_EXPIRY_REF, memory_order_relaxed);
+			continue;
+		}
+		if(ht_array_drop(a, idx, now, *expired)) return true;
+	}
+	return false;
+}
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Element counter related functions.
+//------------------------------------------------------------------------------
+// Threads get a stripe round robin on their first update (0 - not yet).
+static _Atomic unsigned ht_counter_next_stripe = 0;
+static _Thread_local unsigned ht_counter_stripe = 0;
+
+static int64_t ht_counter_flush_threshold(size_t capacity) {
+	size_t threshold = capacity / (HT_COUNTER_STRIPES * 64);
+	if(threshold < 1) return 1;
+	return threshold > HT_COUNTER_FLUSH ? HT_COUNTER_FLUSH : (int64_t)threshold;
+}
+
+static inline unsigned ht_counter_stripe_index(void) {
+	if(ht_counter_stripe == 0) {
+		ht_counter_stripe = atomic_fetch_add_explicit(&ht_counter_next_stripe, 1,
+			memory_order_relaxed) % HT_COUNTER_STRIPES + 1;
+	}
+	return ht_counter_stripe - 1;
+}
+
+static inline ht_counter_stripe_t *ht_counter_stripe_of(hopscotch_hash_table_t *ht) {
+	return &ht->stripes[ht_counter_stripe_index()];
+}
+
+// Returns true and the approximate size if the stripe has been folded into
+// the shared size, the resize policy only looks at the size then.
+static bool ht_counter_add(hopscotch_hash_table_t *ht, int64_t delta, size_t *size) {
+	_Atomic int64_t *count = &ht_counter_stripe_of(ht)->count;
+
+	int64_t drift = atomic_fetch_add_explicit(count, delta, memory_order_relaxed) + delta;
+	int64_t threshold = atomic_load_explicit(&ht->counter_flush, memory_order_relaxed);
+	if(drift < threshold && drift > -threshold) return false;
+
+	// Other threads may share the stripe, take whatever it holds right now.
+	drift = atomic_exchange_explicit(count, 0, memory_order_relaxed);
+	int64_t total = atomic_fetch_add_explicit(&ht->size, drift,
+		memory_order_relaxed) + drift;
+	*size = total > 0 ? (size_t)total : 0;
+	return true;
+}
+
+// The cache statistics start over as well.
+static void ht_counter_reset(hopscotch_hash_table_t *ht) {
+	atomic_store(&ht->size, 0);
+	for(size_t i = 0; i < HT_COUNTER_STRIPES; i++) {
+		atomic_store(&ht->stripes[i].count, 0);
+		atomic_store(&ht->stripes[i].hits, 0);
+		atomic_store(&ht->stripes[i].misses, 0);
+		atomic_store(&ht->stripes[i].evictions, 0);
+		atomic_store(&ht->stripes[i].expirations, 0);
+		atomic_store(&ht->stripes[i].sweep_cursor, 0);
+#if HT_STATS
+		memset((void *)&ht->stripes[i].probe, 0, sizeof(ht_probe_counters_t));
+#endif
+	}
+}
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Online resize related functions.
+//------------------------------------------------------------------------------
+// Buckets of the source array are moved chunk by chunk. A chunk is closed for
+// new writers, drained, copied into the target array and only then cleared in
+// the source, so a reader checking the source first and the target second
+// never misses a key. Entries which do not fit into the target are rolled back
+// and the chunk is marked stuck: it keeps serving from the source array and
+// is retried later. A stuck chunk which fails again, or a grow asked for
+// meanwhile, moves the whole migration into a bigger target.
+static void ht_migration_finish(hopscotch_hash_table_t *ht, ht_migration_t *m) {
+	// Array first: whoever sees no migration must also see the target, a
+	// reader would otherwise search the cleared source and miss the key.
+	// A resize racing with us fails until the migration is gone.
+	atomic_store(&ht->array, m->to);
+	atomic_store(&ht->migration, NULL);
+
+	// Readers may still look at the source, it goes once they are gone.
+	atomic_fetch_add_explicit(&ht->retired, 1, memory_order_relaxed);
+	ht_epoch_retire(ht_array_reclaim, NULL, m->from, 0);
+
+	atomic_store_explicit(&ht->counter_flush,
+		ht_counter_flush_threshold(m->to->capacity), memory_order_relaxed);
+	if(m->to->capacity > m->from->capacity) {
+		atomic_fetch_add_explicit(&ht->grows, 1, memory_order_relaxed);
+	} else {
+		atomic_fetch_add_explicit(&ht->shrinks, 1, memory_order_relaxed);
+	}
+}
+
+// Closes a chunk for new writers and waits for the ones inside, false if it
+// has migrated. A chunk being migrated is waited for first.
+static bool ht_chunk_close(ht_array_t *a, size_t chunk) {
+	_Atomic uint32_t *state = &a->chunk_state[chunk];
+	uint32_t st = atomic_load(state);
+	for(;;) {
+		if(st & HT_CHUNK_DONE) return false;
+		if(st & HT_CHUNK_CLOSED) {
+			thrd_yield();
+			st = atomic_load(state);
+			continue;
+		}
+		if(atomic_compare_exchange_weak(state, &st, st | HT_CHUNK_CLOSED)) break;
+	}
+	while(atomic_load_explicit(state, memory_order_acquire) & HT_CHUNK_WRITERS_MASK) {
+		thrd_yield();
+	}
+	return true;
+}
+
+// Marks a closed chunk migrated. Writers bouncing off it keep their count.
+static void ht_chunk_done(ht_array_t *a, size_t chunk) {
+	_Atomic uint32_t *state = &a->chunk_state[chunk];
+	uint32_t st = atomic_load(state);
+	while(!atomic_compare_exchange_weak(state, &st,
+		(st & HT_CHUNK_WRITERS_MASK) | HT_CHUNK_DONE));
+}
+
+// Adds the published entries of from to to, false if one does not fit.
+static bool ht_array_copy(ht_array_t *to, ht_array_t *from) {
+	for(size_t idx = 0; idx < from->capacity; idx++) {
+		if(!ht_tag_live(atomic_load_explicit(&from->tags[idx], memory_order_relaxed))) {
+			continue;
+		}
+		ht_write_t w = {
+			.mode = HT_WRITE_SET,
+			.value = ht_slot_value(from, idx),
+			.expiry = ht_slot_expiry(from, idx)
+		};
+		uint64_t hh = atomic_load_explicit(ht_slot_hop_info(from, idx), memory_order_relaxed);
+		if(ht_array_insert(to, hh, ht_slot_key(from, idx), &w) == HT_INSERT_FAILED) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Moves a migration which can not place its chunks into a target of at least
+// capacity slots, doubled until every entry fits. Both arrays are closed for
+// writers and copied, readers keep reading them meanwhile. The new target is
+// published as the array, the old chunks are marked migrated (the old target
+// forwards to the new one, for scans) and cleared like a migrated chunk.
+// False if the migration finished meanwhile or there is no memory, the
+// arrays are reopened then.
+static bool ht_migration_retarget(
+	hopscotch_hash_table_t *ht,
+	ht_migration_t *m,
+	size_t capacity
+) {
+	bool expected = false;
+	if(!atomic_compare_exchange_strong(&m->retargeting, &expected, true)) return false;
+
+	ht_array_t *from = m->from;
+	ht_array_t *to = m->to;
+	size_t closed = 0;
+	for(size_t c = 0; c < from->chunks; c++) closed += ht_chunk_close(from, c);
+	// Every chunk has moved, the migration finishes on its own.
+	if(closed == 0) {
+		atomic_store(&m->retargeting, false);
+		return false;
+	}
+	for(size_t c = 0; c < to->chunks; c++) ht_chunk_close(to, c);
+
+	ht_array_t *target = NULL;
+	for(; capacity && !target; capacity *= 2) {
+		target = ht_array_alloc(capacity, ht_array_shape(from), &ht->alloc);
+		if(!target) break;
+		target->arena = from->arena;
+		target->stripes = from->stripes;
+		if(!ht_array_copy(target, from) || !ht_array_copy(target, to)) {
+			ht_array_free(target);
+			target = NULL;
+		}
+	}
+	if(!target) {
+		for(size_t c = 0; c < from->chunks; c++) {
+			uint32_t st = atomic_load(&from->chunk_state[c]);
+			if(!(st & HT_CHUNK_DONE)) atomic_fetch_and(&from->chunk_state[c], ~HT_CHUNK_CLOSED);
+		}
+		for(size_t c = 0; c < to->chunks; c++) {
+			atomic_fetch_and(&to->chunk_state[c], ~HT_CHUNK_CLOSED);
+		}
+		atomic_store(&m->retargeting, false);
+		return false;
+	}
+
+	atomic_store(&to->resizing, true);
+	to->migration.from = to;
+	to->migration.to = target;
+	// Array first, as a migration finishing.
+	atomic_store(&ht->array, target);
+	atomic_store(&ht->migration, NULL);
+	for(size_t c = 0; c < from->chunks; c++) ht_chunk_done(from, c);
+	for(size_t c = 0; c < to->chunks; c++) ht_chunk_done(to, c);
+
+	// A reader still on the old arrays finds nothing and looks again.
+	ht_array_t *old[2] = { from, to };
+	for(size_t i = 0; i < 2; i++) {
+		for(size_t idx = 0; idx < old[i]->capacity; idx++) {
+			if(!ht_tag_live(atomic_load_explicit(&old[i]->tags[idx], memory_order_relaxed))) {
+				continue;
+			}
+			ht_slot_lock(old[i], idx);
+			ht_array_clear_slot(old[i], idx);
+			ht_slot_unlock(old[i], idx);
+		}
+		atomic_fetch_add_explicit(&ht->retired, 1, memory_order_relaxed);
+		ht_epoch_retire(ht_array_reclaim, NULL, old[i], 0);
+	}
+
+	atomic_store_explicit(&ht->counter_flush,
+		ht_counter_flush_threshold(target->capacity), memory_order_relaxed);
+	if(target->capacity > from->capacity) {
+		atomic_fetch_add_explicit(&ht->grows, 1, memory_order_relaxed);
+	} else if(target->capacity < from->capacity) {
+		atomic_fetch_add_explicit(&ht->shrinks, 1, memory_order_relaxed);
+	}
+	return true;
+}
+
+static bool ht_migrate_chunk(
+	hopscotch_hash_table_t *ht,
+	ht_migration_t *m,
+	size_t chunk,
+	bool retry_stuck
+) {
+	ht_array_t *from = m->from;
+	_Atomic uint32_t *state = &from->chunk_state[chunk];
+
+	// Claim the chunk.
+	uint32_t st = atomic_load(state);
+	do {
+		if(st & (HT_CHUNK_CLOSED | HT_CHUNK_DONE)) return false;
+		if((st & HT_CHUNK_STUCK) && !retry_stuck) return false;
+	} while(!atomic_compare_exchange_weak(state, &st,
+		(st & ~HT_CHUNK_STUCK) | HT_CHUNK_CLOSED));
+	bool retried = st & HT_CHUNK_STUCK;
+	if(retried) atomic_fetch_sub(&m->chunks_stuck, 1);
+
+	// Wait for writers which entered before the chunk was closed.
+	while(atomic_load_explicit(state, memory_order_acquire) & HT_CHUNK_WRITERS_MASK) {
+		thrd_yield();
+	}
+
+	size_t first = chunk * from->chunk_size;
+	size_t last = first + from->chunk_size;
+	size_t span = from->chunk_size + HOP_RANGE * MAX_RELOCATION_FACTOR;
+	if(span > from->capacity) span = from->capacity;
+
+	size_t moved[HT_RESIZE_CHUNK + HOP_RANGE * MAX_RELOCATION_FACTOR];
+	size_t moved_count = 0;
+	bool placed = true;
+	for(size_t i = 0; i < span; i++) {
+		size_t idx = (first + i) & from->mask;
+		uint64_t hh = atomic_load_explicit(ht_slot_hop_info(from, idx),
+			memory_order_acquire);
+		if(!(hh & HT_SLOT_USED)) continue;
+
+		size_t home = INDEX(hh, from->mask);
+		if(home < first || home >= last) continue;
+
+		// Variable-length references move as they are, the arena is shared.
+		// So do expiry words, expired entries included.
+		ht_write_t w = {
+			.mode = HT_WRITE_SET,
+			.value = ht_slot_value(from, idx),
+			.expiry = ht_slot_expiry(from, idx)
+		};
+		if(ht_array_insert(m->to, hh, ht_slot_key(from, idx), &w) == HT_INSERT_FAILED) {
+			placed = false;
+			break;
+		}
+		moved[moved_count++] = idx;
+	}
+
+	if(!placed) {
+		// Roll back, the source copy is still intact.
+		for(size_t i = 0; i < moved_count; i++) {
+			uint64_t info = atomic_load(ht_slot_hop_info(from, moved[i]));
+			ht_array_remove(m->to, info, ht_slot_key(from, moved[i]), NULL, NULL, 0, NULL);
+		}
+		atomic_fetch_add(&m->chunks_stuck, 1);
+		atomic_fetch_xor(state, HT_CHUNK_CLOSED | HT_CHUNK_STUCK);
+		// The target only fills up, the chunk would stay stuck for good.
+		if(retried) ht_migration_retarget(ht, m, m->to->capacity * 2);
+		return false;
+	}
+
+	for(size_t i = 0; i < moved_count; i++) {
+		ht_slot_lock(from, moved[i]);
+		ht_array_clear_slot(from, moved[i]);
+		ht_slot_unlock(from, moved[i]);
+	}
+	atomic_fetch_xor(state, HT_CHUNK_CLOSED | HT_CHUNK_DONE);
+
+	if(atomic_fetch_add(&m->chunks_done, 1) + 1 == from->chunks) {
+		ht_migration_finish(ht, m);
+	}
+	return true;
+}
+
+// Every API call moves a few chunks while a resize is running.
+static void ht_migration_help(hopscotch_hash_table_t *ht, ht_migration_t *m) {
+	size_t chunks = m->from->chunks;
+	for(size_t i = 0; i < HT_RESIZE_HELP_CHUNKS; i++) {
+		bool stuck = atomic_load_explicit(&m->chunks_stuck, memory_order_relaxed) != 0;
+		if(atomic_load_explicit(&m->chunk_cursor, memory_order_relaxed) >= chunks &&
+			!stuck)
+		{
+			return;
+		}
+		size_t chunk = atomic_fetch_add_explicit(&m->chunk_cursor, 1,
+			memory_order_relaxed);
+		ht_migrate_chunk(ht, m, chunk % chunks, chunk >= chunks);
+	}
+}
+
+// Returns true once the chunk lives in the target array, false if it is stuck
+// in the source array.
+static bool ht_migration_ensure_chunk(
+	hopscotch_hash_table_t *ht,
+	ht_migration_t *m,
+	size_t chunk
+) {
+	for(;;) {
+		uint32_t st = atomic_load(&m->from->chunk_state[chunk]);
+		if(st & HT_CHUNK_DONE) return true;
+		// Closed by a migration retried or moved to a bigger target.
+		if(st & HT_CHUNK_CLOSED) {
+			thrd_yield();
+			continue;
+		}
+		if(st & HT_CHUNK_STUCK) return false;
+		ht_migrate_chunk(ht, m, chunk, false);
+	}
+}
+
+// Picks the array a writer works on for hash h and enters the home chunk.
+static ht_array_t *ht_writer_enter(
+	hopscotch_hash_table_t *ht,
+	uint64_t h,
+	size_t *chunk
+) {
+	for(;;) {
+		ht_migration_t *m = atomic_load(&ht->migration);
+		ht_array_t *a = atomic_load(&ht->array);
+		if(m) {
+			ht_migration_help(ht, m);
+			a = ht_migration_ensure_chunk(ht, m, ht_array_chunk(m->from, h)) ?
+				m->to : m->from;
+		}
+		*chunk = ht_array_chunk(a, h);
+		if(ht_chunk_enter(a, *chunk)) return a;
+	}
+}
+
+// Caller is inside an epoch section, the current array may be retired by a
+// resize finishing meanwhile.
+static bool ht_resize_start(hopscotch_hash_table_t *ht, size_t new_capacity) {
+	ht_migration_t *m = atomic_load(&ht->migration);
+	if(m) {
+		// A grow takes over a shrink or a migration which is stuck.
+		return new_capacity > m->to->capacity &&
+			(m->to->capacity < m->from->capacity || atomic_load(&m->chunks_stuck)) &&
+			ht_migration_retarget(ht, m, new_capacity);
+	}
+
+	ht_array_t *from = atomic_load(&ht->array);
+	if(new_capacity == from->capacity) return false;
+
+	// Every array migrates out only once.
+	bool expected = false;
+	if(!atomic_compare_exchange_strong(&from->resizing, &expected, true)) {
+		return false;
+	}
+
+	ht_array_t *to = ht_array_alloc(new_capacity, ht_array_shape(from), &ht->alloc);
+	if(!to) {
+		atomic_store(&from->resizing, false);
+		return false;
+	}
+	to->arena = from->arena;
+	to->stripes = from->stripes;
+
+	m = &from->migration;
+	m->from = from;
+	m->to = to;
+	atomic_init(&m->chunk_cursor, 0);
+	atomic_init(&m->chunks_done, 0);
+	atomic_init(&m->chunks_stuck, 0);
+	atomic_init(&m->retargeting, false);
+	atomic_store(&ht->migration, m);
+	return true;
+}
+
+bool ht_resize(hopscotch_hash_table_t *ht, size_t new_capacity) {
+	if(!ht) return false;
+	// The array of a file-backed table stays in its file.
+	if(ht->map_size) return false;
+	if(new_capacity == 0 || (new_capacity & (new_capacity - 1))) return false;
+
+	ht_epoch_enter();
+	bool started = ht_resize_start(ht, new_capacity);
+	ht_epoch_exit();
+	return started;
+}
+
+void ht_resize_wait(hopscotch_hash_table_t *ht) {
+	if(!ht) return;
+
+	ht_migration_t *m;
+	ht_epoch_enter();
+	while((m = atomic_load(&ht->migration)) != NULL) {
+		size_t done = atomic_load(&m->chunks_done);
+		for(size_t c = 0; c < m->from->chunks; c++) {
+			while(atomic_load(&m->from->chunk_state[c]) & HT_CHUNK_CLOSED) {
+				thrd_yield();
+			}
+			ht_migrate_chunk(ht, m, c, true);
+		}
+		// Stuck chunks retried in vain move the migration into a bigger
+		// target, unless another thread does already. Give up if even that
+		// failed (no memory).
+		if(atomic_load(&ht->migration) == m && atomic_load(&m->chunks_done) == done &&
+			!atomic_load(&m->retargeting) && !ht_migration_retarget(ht, m, m->to->capacity * 2))
+		{
+			break;
+		}
+	}
+	ht_epoch_exit();
+}
+
+void ht_set_resize_policy(
+	hopscotch_hash_table_t *ht,
+	unsigned grow_load_percent,
+	unsigned shrink_load_percent
+) {
+	if(!ht) return;
+	atomic_store(&ht->grow_load_percent, grow_load_percent);
+	atomic_store(&ht->shrink_load_percent, shrink_load_percent);
+}
+
+static void ht_maybe_grow(hopscotch_hash_table_t *ht, size_t size) {
+	unsigned percent = atomic_load_explicit(&ht->grow_load_percent, memory_order_relaxed);
+	if(percent == 0 || atomic_load_explicit(&ht->cache, memory_order_relaxed) ||
+		atomic_load_explicit(&ht->migration, memory_order_relaxed))
+	{
+		return;
+	}
+
+	size_t capacity = atomic_load(&ht->array)->capacity;
+	if(size * 100 > capacity * percent) {
+		ht_resize(ht, capacity * 2);
+	}
+}
+
+static void ht_maybe_shrink(hopscotch_hash_table_t *ht, size_t size) {
+	unsigned percent = atomic_load_explicit(&ht->shrink_load_percent, memory_order_relaxed);
+	if(percent == 0 || atomic_load_explicit(&ht->cache, memory_order_relaxed) ||
+		atomic_load_explicit(&ht->migration, memory_order_relaxed))
+	{
+		return;
+	}
+
+	// Nor into an array the size would grow again, a shrink into a target
+	// too small to take the entries ends up growing back.
+	size_t capacity = atomic_load(&ht->array)->capacity;
+	unsigned grow = atomic_load_explicit(&ht->grow_load_percent, memory_order_relaxed);
+	if(capacity > ht->min_capacity && size * 100 < capacity * percent &&
+		(grow == 0 || size * 100 < capacity / 2 * grow))
+	{
+		ht_resize(ht, capacity / 2);
+	}
+}
+
+// A full neighborhood in a well loaded table asks for a bigger array. Returns
+// true if the insert is worth another try.
+static bool ht_grow_on_failure(hopscotch_hash_table_t *ht, ht_array_t *a) {
+	if(atomic_load_explicit(&ht->cache, memory_order_relaxed)) return false;
+
+	// A full target, or a full source whose stuck chunks never move, fails
+	// adds until the migration is moved into a bigger target. Whatever the
+	// policy, the resize was asked for.
+	ht_migration_t *m = atomic_load(&ht->migration);
+	if(m && (a == m->to || (a == m->from && atomic_load(&m->chunks_stuck)))) {
+		if(ht_migration_retarget(ht, m, m->to->capacity * 2)) return true;
+		// Or another thread moves it already.
+		while(atomic_load(&m->retargeting) && atomic_load(&ht->migration) == m) {
+			thrd_yield();
+		}
+		return atomic_load(&ht->migration) != m;
+	}
+
+	if(atomic_load_explicit(&ht->grow_load_percent, memory_order_relaxed) == 0) return false;
+	if(!m) {
+		if(ht_size(ht) * 100 < a->capacity * HT_GROW_ON_FAIL_LOAD_PERCENT) return false;
+		ht_resize(ht, a->capacity * 2);
+
+		// Another thread may still be setting the resize up.
+		while(!(m = atomic_load(&ht->migration)) &&
+			atomic_load(&a->resizing) && atomic_load(&ht->array) == a) {
+			thrd_yield();
+		}
+	}
+	return m && m->from == a;
+}
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Hash table related functions / API.
+//------------------------------------------------------------------------------
+void ht_print_debug(const hopscotch_hash_table_t * const ht) {
+	if(!ht) return;
+
+	static _Atomic int print_lock = 0;
+
+	// Spinlock for thread-safe printing.
+	while (atomic_exchange_explicit(&print_lock, 1, memory_order_acquire)) {
+		thrd_yield();
+	}
+
+	ht_epoch_enter();
+	const ht_array_t *a = atomic_load(&ht->array);
+	printf("\nHopscotch Hash Table (Capacity: %zu, Size: %zu)\n",
+		   a->capacity, ht_size_exact(ht));
+	printf("-----------------------------------------------------------------------------------------\n");
+	printf("IDX   Hom->Cur Hash              Dist Key....  Val....  Neighborhood(32)\n");
+	printf("-----------------------------------------------------------------------------------------\n");
+
+	for(size_t i = 0; i < a->capacity; i++) {
+		uint64_t node_info = atomic_load_explicit(ht_slot_hop_info(a, i), memory_order_acquire);
+
+		// Maintaining only occupied buckets.
+		if(node_info & HT_SLOT_USED) {  // Only show occupied (or claimed) buckets
+			uint64_t node_hash = node_info & ~HT_SLOT_USED;
+			size_t home = INDEX(node_hash, a->mask);
+			size_t distance = (i - home) & a->mask;
+
+			// IDX - Home->Curr - Hash - Distance.
+			printf("[%03zu] %03zu->%03zu %016llX %4zu ", i, home, i,
+				(unsigned long long)node_hash, distance);
+
+			// Key - Value.
+			printf("%02X%02X...  %02X%02X...  ", 
+				   ht_slot_key(a, i)[0], ht_slot_key(a, i)[1],
+				   ht_slot_value(a, i)[0], ht_slot_value(a, i)[1]);
+			
+			// Neighborhood (32). Position of the slot in its home window.
+			printf("[");
+			for(size_t j = 0; j < HOP_RANGE; j++) {
+				printf(j == distance ? "x" : ".");
+			}
+			printf("]\n");
+		}
+	}
+	ht_epoch_exit();
+	atomic_store_explicit(&print_lock, 0, memory_order_release);
+}
+
+void ht_get_stats(const hopscotch_hash_table_t * const ht, ht_stats_t *stats) {
+	if(!ht || !stats) return;
+
+	memset(stats, 0, sizeof(ht_stats_t));
+	ht_epoch_enter();
+	const ht_array_t *a = atomic_load(&ht->array);
+	stats->size = ht_size_exact(ht);
+	stats->capacity = a->capacity;
+	stats->load_factor = (double)stats->size / a->capacity;
+	stats->grow_load_percent = atomic_load(&ht->grow_load_percent);
+	stats->shrink_load_percent = atomic_load(&ht->shrink_load_percent);
+	stats->grows = atomic_load(&ht->grows);
+	stats->shrinks = atomic_load(&ht->shrinks);
+	stats->tag_kernel = ht_get_tag_kernel();
+	stats->hash_kernel = ht_get_hash_kernel();
+	if(ht->arena) {
+		stats->arena_size = ht->arena->size;
+		stats->arena_used = atomic_load(&ht->arena->used);
+	}
+	stats->pages = a->pages;
+	stats->numa = a->numa;
+	stats->cache = atomic_load(&ht->cache);
+	for(size_t i = 0; i < HT_COUNTER_STRIPES; i++) {
+		const ht_counter_stripe_t *stripe = &ht->stripes[i];
+		stats->cache_hits += atomic_load_explicit(&stripe->hits, memory_order_relaxed);
+		stats->cache_misses += atomic_load_explicit(&stripe->misses, memory_order_relaxed);
+		stats->cache_evictions += atomic_load_explicit(&stripe->evictions, memory_order_relaxed);
+		stats->cache_expirations += atomic_load_explicit(&stripe->expirations,
+			memory_order_relaxed);
+	}
+	if(stats->cache_hits + stats->cache_misses) {
+		stats->cache_hit_rate = (double)stats->cache_hits /
+			(stats->cache_hits + stats->cache_misses);
+	}
+
+#if HT_STATS
+	stats->probe_stats = true;
+	for(size_t i = 0; i < HT_COUNTER_STRIPES; i++) {
+		const ht_probe_counters_t *probe = &ht->stripes[i].probe;
+		for(size_t bin = 0; bin < HT_STATS_BINS; bin++) {
+			stats->probe_distance[bin] += atomic_load_explicit(&probe->probe_distance[bin],
+				memory_order_relaxed);
+			stats->occupancy[bin] += atomic_load_explicit(&probe->occupancy[bin],
+				memory_order_relaxed);
+			stats->relocation_chain[bin] += atomic_load_explicit(&probe->relocation_chain[bin],
+				memory_order_relaxed);
+		}
+		stats->relocation_attempts += atomic_load_explicit(&probe->relocation_attempts,
+			memory_order_relaxed);
+		stats->relocations += atomic_load_explicit(&probe->relocations, memory_order_relaxed);
+		stats->range_full += atomic_load_explicit(&probe->range_full, memory_order_relaxed);
+		stats->no_candidate += atomic_load_explicit(&probe->no_candidate, memory_order_relaxed);
+		stats->insert_cas_retries += atomic_load_explicit(&probe->insert_cas_retries,
+			memory_order_relaxed);
+		stats->remove_cas_retries += atomic_load_explicit(&probe->remove_cas_retries,
+			memory_order_relaxed);
+	}
+#endif
+
+	ht_migration_t *m = atomic_load(&ht->migration);
+	if(m) {
+		stats->resize_in_progress = true;
+		stats->resize_from_capacity = m->from->capacity;
+		stats->resize_to_capacity = m->to->capacity;
+		stats->resize_chunks_total = m->from->chunks;
+		stats->resize_chunks_done = atomic_load(&m->chunks_done);
+		stats->resize_chunks_stuck = atomic_load(&m->chunks_stuck);
+	}
+	ht_epoch_exit();
+}
+
+void ht_print_stats(const hopscotch_hash_table_t * const ht) {
+	if(!ht) return;
+	ht_stats_t stats;
+	ht_get_stats(ht, &stats);
+	printf("Hash table stats: size=%zu (%.1f%% full) tags=%s hash=%s\n", 
+			stats.size, stats.load_factor * 100.0,
+			ht_tag_kernel_name(stats.tag_kernel),
+			ht_hash_kernel_name(stats.hash_kernel));
+	printf("Hash table resize: capacity=%zu grow>%u%% shrink<%u%% grows=%zu shrinks=%zu\n",
+			stats.capacity, stats.grow_load_percent, stats.shrink_load_percent,
+			stats.grows, stats.shrinks);
+	if(stats.arena_size) {
+		printf("Hash table arena: used=%zu of %zu bytes\n",
+			stats.arena_used, stats.arena_size);
+	}
+	if(stats.pages != HT_PAGES_DEFAULT || stats.numa != HT_NUMA_DEFAULT) {
+		printf("Hash table memory: pages=%s numa=%s\n",
+			ht_page_mode_name(stats.pages), ht_numa_policy_name(stats.numa));
+	}
+	if(stats.cache) {
+		printf("Hash table cache: hits=%zu misses=%zu (%.1f%% hit rate) evictions=%zu expirations=%zu\n",
+			stats.cache_hits, stats.cache_misses, stats.cache_hit_rate * 100.0,
+			stats.cache_evictions, stats.cache_expirations);
+	}
+	if(stats.resize_in_progress) {
+		printf("Hash table resize: %zu->%zu in progress, chunks %zu/%zu (%zu stuck)\n",
+			stats.resize_from_capacity, stats.resize_to_capacity,
+			stats.resize_chunks_done, stats.resize_chunks_total,
+			stats.resize_chunks_stuck);
+	}
+	if(stats.probe_stats) {
+		printf("Hash table probes: relocations=%zu of %zu range_full=%zu no_candidate=%zu "
+			"cas_retries=%zu/%zu (insert/remove), see ht_stats_json\n",
+			stats.relocations, stats.relocation_attempts, stats.range_full,
+			stats.no_candidate, stats.insert_cas_retries, stats.remove_cas_retries);
+	}
+}
+
+// Output of ht_stats_json, len keeps counting past a full buffer.
+typedef struct {
+	char *buf;
+	size_t size;
+	size_t len;
+} ht_json_t;
+
+static void ht_json_printf(ht_json_t *j, const char *fmt, ...) {
+	va_list args;
+	va_start(args, fmt);
+	int n = vsnprintf(j->len < j->size ? j->buf + j->len : NULL,
+		j->len < j->size ? j->size - j->len : 0, fmt, args);
+	va_end(args);
+	if(n > 0) j->len += (size_t)n;
+}
+
+static void ht_json_histogram(ht_json_t *j, const char *name, const size_t *bins) {
+	ht_json_printf(j, ",\"%s\":[", name);
+	for(size_t bin = 0; bin < HT_STATS_BINS; bin++) {
+		ht_json_printf(j, bin ? ",%zu" : "%zu", bins[bin]);
+	}
+	ht_json_printf(j, "]");
+}
+
+size_t ht_stats_json(const ht_stats_t *stats, char *buf, size_t size) {
+	if(!stats) return 0;
+	ht_json_t j = { buf, buf ? size : 0, 0 };
+	ht_json_printf(&j, "{\"size\":%zu,\"capacity\":%zu,\"load_factor\":%.4f",
+		stats->size, stats->capacity, stats->load_factor);
+	ht_json_printf(&j, ",\"resize\":{\"grow_percent\":%u,\"shrink_percent\":%u,"
+		"\"grows\":%zu,\"shrinks\":%zu,\"in_progress\":%s,\"from\":%zu,\"to\":%zu,"
+		"\"chunks\":%zu,\"chunks_done\":%zu,\"chunks_stuck\":%zu}",
+		stats->grow_load_percent, stats->shrink_load_percent, stats->grows, stats->shrinks,
+		stats->resize_in_progress ? "true" : "false", stats->resize_from_capacity,
+		stats->resize_to_capacity, stats->resize_chunks_total, stats->resize_chunks_done,
+		stats->resize_chunks_stuck);
+	ht_json_printf(&j, ",\"tag_kernel\":\"%s\",\"hash_kernel\":\"%s\"",
+		ht_tag_kernel_name(stats->tag_kernel), ht_hash_kernel_name(stats->hash_kernel));
+	ht_json_printf(&j, ",\"arena\":{\"size\":%zu,\"used\":%zu}",
+		stats->arena_size, stats->arena_used);
+	ht_json_printf(&j, ",\"memory\":{\"pages\":\"%s\",\"numa\":\"%s\"}",
+		ht_page_mode_name(stats->pages), ht_numa_policy_name(stats->numa));
+	ht_json_printf(&j, ",\"cache\":{\"enabled\":%s,\"hits\":%zu,\"misses\":%zu,"
+		"\"hit_rate\":%.4f,\"evictions\":%zu,\"expirations\":%zu}",
+		stats->cache ? "true" : "false", stats->cache_hits, stats->cache_misses,
+		stats->cache_hit_rate, stats->cache_evictions, stats->cache_expirations);
+
+	ht_json_printf(&j, ",\"probes\":{\"enabled\":%s", stats->probe_stats ? "true" : "false");
+	ht_json_histogram(&j, "probe_distance", stats->probe_distance);
+	ht_json_histogram(&j, "occupancy", stats->occupancy);
+	ht_json_histogram(&j, "relocation_chain", stats->relocation_chain);
+	ht_json_printf(&j, ",\"relocation_attempts\":%zu,\"relocations\":%zu,"
+		"\"range_full\":%zu,\"no_candidate\":%zu,"
+		"\"insert_cas_retries\":%zu,\"remove_cas_retries\":%zu}}",
+		stats->relocation_attempts, stats->relocations, stats->range_full,
+		stats->no_candidate, stats->insert_cas_retries, stats->remove_cas_retries);
+	return j.len;
+}
+
+size_t ht_capacity(const hopscotch_hash_table_t * const ht) {
+	if(!ht) return 0;
+	ht_epoch_enter();
+	size_t capacity = atomic_load(&ht->array)->capacity;
+	ht_epoch_exit();
+	return capacity;
+}
+
+size_t ht_size(const hopscotch_hash_table_t * const ht) {
+	if(!ht) return 0;
+	int64_t size = atomic_load_explicit(&ht->size, memory_order_relaxed);
+	return size > 0 ? (size_t)size : 0;
+}
+
+size_t ht_size_exact(const hopscotch_hash_table_t * const ht) {
+	if(!ht) return 0;
+	int64_t size = atomic_load(&ht->size);
+	for(size_t i = 0; i < HT_COUNTER_STRIPES; i++) {
+		size += atomic_load_explicit(&ht->stripes[i].count, memory_order_relaxed);
+	}
+	return size > 0 ? (size_t)size : 0;
+}
+
+// Not thread-safe. A running resize is completed first.
+void ht_zero(hopscotch_hash_table_t *ht) {
+	if(!ht) return;
+
+	ht_migration_t *m = atomic_load(&ht->migration);
+	if(m) {
+		// Stuck chunks move once their entries are gone.
+		memset(m->from->slots, 0,
+			ht_array_slots_size(m->from->capacity, ht_array_shape(m->from)));
+		ht_resize_wait(ht);
+	}
+
+	ht_array_t *a = atomic_load(&ht->array);
+	memset(a->slots, 0, ht_array_slots_size(a->capacity, ht_array_shape(a)));
+	ht_counter_reset(ht);
+	if(ht->arena) {
+		// A block reclaimed after the reset would be handed out twice.
+		if(atomic_load(&ht->retired)) ht_epoch_barrier();
+		ht_arena_reset(ht->arena);
+	}
+}
+
+hopscotch_hash_table_t *ht_create(
+	size_t capacity,
+	hash_function_f hash_function,
+	uint64_t seed
+) {
+	return ht_create_ex(capacity, HT_LAYOUT_AOS, hash_function, seed);
+}
+
+// Header, initial array descriptor and arena descriptor, then the array
+// payload and the arena data (variable-length tables only).
+static inline size_t ht_buffer_header_size(void) {
+	return HT_ALIGN64(sizeof(hopscotch_hash_table_t) +
+		sizeof(ht_array_t) + sizeof(ht_arena_t));
+}
+
+static inline size_t ht_buffer_size(size_t capacity, ht_shape_t shape, size_t arena_size) {
+	return ht_buffer_header_size() + ht_array_payload_size(capacity, shape) +
+		HT_ALIGN64(arena_size);
+}
+
+// Rebuilds the pointers of the descriptors in a buffer. Slots, arena state
+// and counters are left as they are.
+static hopscotch_hash_table_t *ht_buffer_attach(
+	uint8_t *buffer,
+	size_t capacity,
+	ht_shape_t shape,
+	size_t arena_size
+) {
+	size_t header_size = ht_buffer_header_size();
+	size_t payload_size = ht_array_payload_size(capacity, shape);
+	hopscotch_hash_table_t *ht = (hopscotch_hash_table_t *)buffer;
+	ht_array_t *a = (ht_array_t *)(buffer + sizeof(hopscotch_hash_table_t));
+	ht_array_attach(a, buffer + header_size, capacity, shape, true);
+
+	ht->arena = NULL;
+	if(shape.layout == HT_LAYOUT_VARLEN) {
+		ht_arena_t *arena = (ht_arena_t *)((uint8_t *)a + sizeof(ht_array_t));
+		arena->base = buffer + header_size + payload_size;
+		arena->size = arena_size;
+		ht->arena = a->arena = arena;
+	}
+	a->stripes = ht->stripes;
+	ht->key_size = shape.key_size;
+	ht->map_size = 0;
+	ht->alloc = (ht_alloc_options_t){ 0 };
+	ht->alloc_size = 0;
+
+	atomic_init(&ht->array, a);
+	atomic_init(&ht->migration, NULL);
+	atomic_init(&ht->retired, 0);
+	return ht;
+}
+
+// Sets a new table up in a buffer of ht_buffer_size bytes. A zeroed buffer
+// (a fresh file) is not written to, its pages stay untouched.
+static hopscotch_hash_table_t *ht_buffer_init(
+	uint8_t *buffer,
+	size_t capacity,
+	ht_shape_t shape,
+	size_t arena_size,
+	hash_function_f hash_function,
+	uint64_t seed,
+	bool zeroed
+) {
+	hopscotch_hash_table_t *ht = ht_buffer_attach(buffer, capacity, shape, arena_size);
+
+	// Every key of the table is hashed by the same function and seed.
+	ht->hash_function = hash_function ? hash_function : murmur_custom_hash;
+	ht->seed = seed;
+
+	ht->min_capacity = capacity;
+	atomic_init(&ht->grow_load_percent, HT_GROW_LOAD_PERCENT);
+	atomic_init(&ht->shrink_load_percent, HT_SHRINK_LOAD_PERCENT);
+	atomic_init(&ht->grows, 0);
+	atomic_init(&ht->shrinks, 0);
+	atomic_init(&ht->counter_flush, ht_counter_flush_threshold(capacity));
+	atomic_init(&ht->cache, false);
+	atomic_init(&ht->cache_ttl, 0);
+
+	// Initialize nodes
+	if(zeroed) {
+		ht_counter_reset(ht);
+		if(ht->arena) ht_arena_reset(ht->arena);
+	} else {
+		memset(buffer + ht_buffer_header_size(), 0,
+			ht_array_payload_size(capacity, shape));
+		ht_zero(ht);
+	}
+	return ht;
+}
+
+static hopscotch_hash_table_t *ht_create_buffer(
+	size_t capacity,
+	ht_shape_t shape,
+	size_t arena_size,
+	hash_function_f hash_function,
+	uint64_t seed
+) {
+	if(capacity == 0) return NULL;
+
+	// Allocate single contiguous block.
+	uint8_t* buffer = aligned_alloc(64, ht_buffer_size(capacity, shape, arena_size));
+	if(!buffer) return NULL;
+
+	return ht_buffer_init(buffer, capacity, shape, arena_size, hash_function, seed, false);
+}
+
+hopscotch_hash_table_t *ht_create_ex(
+	size_t capacity,
+	ht_layout_t layout,
+	hash_function_f hash_function,
+	uint64_t seed
+) {
+	// Variable-length tables need an arena, see ht_create_var.
+	if(layout == HT_LAYOUT_VARLEN) return NULL;
+	return ht_create_buffer(capacity, ht_layout_shape(layout), 0, hash_function, seed);
+}
+
+hopscotch_hash_table_t *ht_create_opts(
+	size_t capacity,
+	ht_layout_t layout,
+	hash_function_f hash_function,
+	uint64_t seed,
+	const ht_alloc_options_t *options
+) {
+	if(!ht_alloc_mapped(options)) {
+		return ht_create_ex(capacity, layout, hash_function, seed);
+	}
+	if(capacity == 0 || layout == HT_LAYOUT_VARLEN) return NULL;
+
+	ht_shape_t shape = ht_layout_shape(layout);
+	size_t map_size;
+	ht_page_mode_t pages;
+	ht_numa_policy_t numa;
+	uint8_t *buffer = ht_buffer_map(ht_buffer_size(capacity, shape, 0), options,
+		&map_size, &pages, &numa);
+	if(!buffer) return NULL;
+
+	// Nothing is memset, the pages stay where the policy or the first-touch
+	// threads put them.
+	hopscotch_hash_table_t *ht = ht_buffer_init(buffer, capacity, shape, 0,
+		hash_function, seed, true);
+	ht->alloc = *options;
+	ht->alloc_size = map_size;
+	ht_array_t *a = atomic_load(&ht->array);
+	a->pages = pages;
+	a->numa = numa;
+	return ht;
+}
+
+hopscotch_hash_table_t *ht_create_sized(
+	size_t capacity,
+	size_t key_size,
+	size_t value_size,
+	hash_function_f hash_function,
+	uint64_t seed
+) {
+	if(key_size == 0 || key_size > HT_MAX_KEY_SIZE) return NULL;
+	if(value_size == 0 || value_size > HT_MAX_VALUE_SIZE) return NULL;
+	ht_shape_t shape = { HT_LAYOUT_SOA, key_size, value_size, false };
+	return ht_create_buffer(capacity, shape, 0, hash_function, seed);
+}
+
+hopscotch_hash_table_t *ht_create_var(
+	size_t capacity,
+	size_t arena_size,
+	hash_function_f hash_function,
+	uint64_t seed
+) {
+	// Free list entries keep 32-bit block indexes.
+	if(arena_size / HT_ARENA_MIN_BLOCK > UINT32_MAX) return NULL;
+	return ht_create_buffer(capacity, ht_layout_shape(HT_LAYOUT_VARLEN), arena_size,
+		hash_function, seed);
+}
+
+uint64_t ht_hash(const hopscotch_hash_table_t *ht, const uint8_t *key, size_t len) {
+	return ht->hash_function(key, len, ht->seed);
+}
+
+static void ht_mmap_close(hopscotch_hash_table_t *ht);
+
+void ht_free(hopscotch_hash_table_t *ht) {
+	if(!ht) return;
+	// A file-backed table never resizes, the mapping is all it has.
+	if(ht->map_size) {
+		ht_mmap_close(ht);
+		return;
+	}
+
+	// Retired arrays and arena blocks of the table go first, an arena block
+	// is given back into the buffer freed below.
+	if(atomic_load(&ht->retired)) ht_epoch_barrier();
+
+	ht_migration_t *m = atomic_load(&ht->migration);
+	if(m) ht_array_free(m->to);
+	ht_array_free(atomic_load(&ht->array));
+
+	if(ht->alloc_size) {
+		munmap(ht, ht->alloc_size);
+	} else {
+		free(ht);
+	}
+	ht = NULL;
+}
+
+// Wall clock in ms for the expiry checks of cache mode, 0 outside of it.
+static inline uint64_t ht_cache_now(const hopscotch_hash_table_t *ht) {
+	if(!atomic_load_explicit(&ht->cache, memory_order_relaxed)) return 0;
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static inline uint64_t ht_cache_expiry(uint64_t now, uint64_t ttl_ms) {
+	return ttl_ms ? (now + ttl_ms) & ~HT_EXPIRY_REF : 0;
+}
+
+// Counts a lookup of cache mode as a hit or a miss, returns found.
+static inline bool ht_cache_count_lookup(hopscotch_hash_table_t *ht, uint64_t now, bool found) {
+	if(now) {
+		ht_counter_stripe_t *stripe = ht_counter_stripe_of(ht);
+		atomic_fetch_add_explicit(found ? &stripe->hits : &stripe->misses, 1,
+			memory_order_relaxed);
+	}
+	return found;
+}
+
+// Reclaims the expired entries among the next slots slots of the sweep. The
+// caller is inside an epoch section, a running resize is left alone. The
+// cursor lives in the counter stripe of the thread, stripes start a
+// HT_COUNTER_STRIPES-th of the table apart.
+static size_t ht_cache_reclaim(hopscotch_hash_table_t *ht, size_t slots, uint64_t now) {
+	if(atomic_load_explicit(&ht->migration, memory_order_relaxed)) return 0;
+	ht_array_t *a = atomic_load(&ht->array);
+	if(slots > a->capacity) slots = a->capacity;
+	ht_counter_stripe_t *stripe = ht_counter_stripe_of(ht);
+	size_t first = atomic_fetch_add_explicit(&stripe->sweep_cursor, slots,
+		memory_order_relaxed) + (size_t)(stripe - ht->stripes) * (a->capacity / HT_COUNTER_STRIPES);
+
+	size_t reclaimed = 0;
+	for(size_t i = 0; i < slots; i++) {
+		size_t idx = (first + i) & a->mask;
+		if(!ht_tag_live(atomic_load_explicit(&a->tags[idx], memory_order_relaxed)) ||
+			!ht_slot_expired(a, idx, now))
+		{
+			continue;
+		}
+		if(ht_array_drop(a, idx, now, true)) reclaimed++;
+	}
+
+	if(reclaimed) {
+		size_t size;
+		ht_counter_add(ht, -(int64_t)reclaimed, &size);
+		atomic_fetch_add_explicit(&stripe->expirations, reclaimed, memory_order_relaxed);
+	}
+	return reclaimed;
+}
+
+static ht_insert_result_t ht_insert_hashed(
+	hopscotch_hash_table_t *ht,
+	uint64_t h,
+	const uint8_t *key,
+	const ht_write_t *w
+) {
+	ht_insert_result_t res;
+
+	// Cache mode: the write carries the time and the expiry it stores.
+	ht_write_t timed;
+	size_t expired = 0;
+	size_t evicted = 0;
+	uint64_t now = ht_cache_now(ht);
+	if(now) {
+		timed = *w;
+		timed.now = now;
+		if(!timed.own_expiry) {
+			timed.expiry = ht_cache_expiry(now, atomic_load_explicit(&ht->cache_ttl,
+				memory_order_relaxed));
+		}
+		timed.expired = &expired;
+		w = &timed;
+	}
+
+	ht_epoch_enter();
+	for(int attempt = 0; ; attempt++) {
+		size_t chunk;
+		ht_array_t *a = ht_writer_enter(ht, h, &chunk);
+		res = ht_array_insert(a, h, key, w);
+		// A full neighborhood of a cache gives an entry up instead.
+		for(int tries = 0; res == HT_INSERT_FAILED && now && tries < HT_CACHE_EVICT_TRIES;
+			tries++)
+		{
+			bool was_expired;
+			if(!ht_array_evict(a, h, now, &was_expired)) break;
+			if(was_expired) {
+				expired++;
+			} else {
+				evicted++;
+			}
+			res = ht_array_insert(a, h, key, w);
+		}
+		ht_chunk_exit(a, chunk);
+		HT_STAT_TAKE_RETRIES(a, insert_cas_retries);
+
+		if(res == HT_INSERT_ADDED) {
+			size_t size;
+			if(ht_counter_add(ht, 1, &size)) ht_maybe_grow(ht, size);
+			break;
+		}
+		if(res != HT_INSERT_FAILED) break;
+		if(attempt > 0 || !ht_grow_on_failure(ht, a)) {
+			res = HT_INSERT_FAILED;
+			break;
+		}
+	}
+
+	if(now) {
+		if(expired + evicted) {
+			size_t size;
+			ht_counter_stripe_t *stripe = ht_counter_stripe_of(ht);
+			ht_counter_add(ht, -(int64_t)(expired + evicted), &size);
+			atomic_fetch_add_explicit(&stripe->expirations, expired, memory_order_relaxed);
+			atomic_fetch_add_explicit(&stripe->evictions, evicted, memory_order_relaxed);
+		}
+		ht_cache_reclaim(ht, HT_CACHE_SWEEP_SLOTS, now);
+	}
+	ht_epoch_exit();
+	return res;
+}
+
+static bool ht_remove_hashed(
+	hopscotch_hash_table_t *ht,
+	uint64_t h,
+	const uint8_t *key,
+	uint8_t *removed_key,
+	uint8_t *removed_value
+) {
+	size_t chunk;
+	size_t expired = 0;
+	uint64_t now = ht_cache_now(ht);
+	ht_epoch_enter();
+	ht_array_t *a = ht_writer_enter(ht, h, &chunk);
+	bool removed = ht_array_remove(a, h, key, removed_key, removed_value, now, &expired);
+	ht_chunk_exit(a, chunk);
+	HT_STAT_TAKE_RETRIES(a, remove_cas_retries);
+
+	size_t size;
+	if(removed && ht_counter_add(ht, -1, &size)) {
+		ht_maybe_shrink(ht, size);
+	}
+	if(expired) {
+		ht_counter_add(ht, -1, &size);
+		atomic_fetch_add_explicit(&ht_counter_stripe_of(ht)->expirations, 1,
+			memory_order_relaxed);
+	}
+	ht_epoch_exit();
+	return removed;
+}
+
+static bool ht_contains_hashed(
+	hopscotch_hash_table_t *ht,
+	uint64_t h,
+	const uint8_t *key,
+	uint8_t *out_value,
+	ht_var_out_t *var_out
+) {
+	bool found = false;
+	uint64_t now = ht_cache_now(ht);
+	ht_epoch_enter();
+	for(;;) {
+		ht_migration_t *m = atomic_load(&ht->migration);
+		ht_array_t *a = atomic_load(&ht->array);
+		if(m) {
+			ht_migration_help(ht, m);
+			// Source first: a migrated key is copied before it is cleared.
+			uint32_t st = atomic_load(&m->from->chunk_state[ht_array_chunk(m->from, h)]);
+			found = (!(st & HT_CHUNK_DONE) &&
+				ht_array_find(m->from, h, key, out_value, var_out, now)) ||
+				ht_array_find(m->to, h, key, out_value, var_out, now);
+		} else {
+			found = ht_array_find(a, h, key, out_value, var_out, now);
+		}
+
+		// Retry if a resize might have moved the key under our feet.
+		if(found || (atomic_load(&ht->migration) == m && atomic_load(&ht->array) == a)) {
+			break;
+		}
+	}
+	ht_cache_count_lookup(ht, now, found);
+	ht_epoch_exit();
+	return found;
+}
+
+// Same search as ht_contains_hashed without the copy. The caller is inside
+// an epoch section, the array found stays mapped while it is.
+static bool ht_locate_hashed(
+	hopscotch_hash_table_t *ht,
+	uint64_t h,
+	const uint8_t *key,
+	ht_array_t **array,
+	size_t *slot,
+	uint32_t *version
+) {
+	uint64_t now = ht_cache_now(ht);
+	for(;;) {
+		ht_migration_t *m = atomic_load(&ht->migration);
+		ht_array_t *a = atomic_load(&ht->array);
+		if(m) {
+			ht_migration_help(ht, m);
+			// A key moved meanwhile changes the version of its source slot.
+			uint32_t st = atomic_load(&m->from->chunk_state[ht_array_chunk(m->from, h)]);
+			if(!(st & HT_CHUNK_DONE) && ht_array_locate(m->from, h, key, slot, version, now)) {
+				*array = m->from;
+				return ht_cache_count_lookup(ht, now, true);
+			}
+			if(ht_array_locate(m->to, h, key, slot, version, now)) {
+				*array = m->to;
+				return ht_cache_count_lookup(ht, now, true);
+			}
+		} else if(ht_array_locate(a, h, key, slot, version, now)) {
+			*array = a;
+			return ht_cache_count_lookup(ht, now, true);
+		}
+
+		if(atomic_load(&ht->migration) == m && atomic_load(&ht->array) == a) {
+			return ht_cache_count_lookup(ht, now, false);
+		}
+	}
+}
+
+bool ht_insert(
+	hopscotch_hash_table_t* ht,
+	const uint8_t *key,
+	const uint8_t *value
+) {
+	if(ht->arena) return false;
+	ht_write_t w = { .mode = HT_WRITE_SET, .value = value };
+	return ht_insert_hashed(ht, ht_hash(ht, key, ht->key_size), key, &w) != HT_INSERT_FAILED;
+}
+
+bool ht_remove_key(
+	hopscotch_hash_table_t *ht,
+	const uint8_t *key
+) {
+	if(ht->arena) return false;
+	return ht_remove_hashed(ht, ht_hash(ht, key, ht->key_size), key, NULL, NULL);
+}
+
+bool ht_contains_key(
+	hopscotch_hash_table_t *ht,
+	const uint8_t *key,
+	uint8_t *out_value
+) {
+	if(ht->arena) return false;
+	return ht_contains_hashed(ht, ht_hash(ht, key, ht->key_size), key, out_value, NULL);
+}
+
+bool ht_insert_with_hash(
+	hopscotch_hash_table_t *ht,
+	uint64_t hash,
+	const uint8_t *key,
+	const uint8_t *value
+) {
+	if(ht->arena) return false;
+	ht_write_t w = { .mode = HT_WRITE_SET, .value = value };
+	return ht_insert_hashed(ht, hash, key, &w) != HT_INSERT_FAILED;
+}
+
+bool ht_remove_with_hash(
+	hopscotch_hash_table_t *ht,
+	uint64_t hash,
+	const uint8_t *key
+) {
+	if(ht->arena) return false;
+	return ht_remove_hashed(ht, hash, key, NULL, NULL);
+}
+
+bool ht_contains_with_hash(
+	hopscotch_hash_table_t *ht,
+	uint64_t hash,
+	const uint8_t *key,
+	uint8_t *out_value
+) {
+	if(ht->arena) return false;
+	return ht_contains_hashed(ht, hash, key, out_value, NULL);
+}
+
+//------------------------------------------------------------------------------
+// Conditional writes.
+//------------------------------------------------------------------------------
+// Each call takes effect at one point: under the version of the slot holding
+// the key, or at the CAS publishing its entry when the key is missing.
+bool ht_insert_if_absent(
+	hopscotch_hash_table_t *ht,
+	const uint8_t *key,
+	const uint8_t *value
+) {
+	if(!ht || !key || !value || ht->arena) return false;
+	ht_write_t w = { .mode = HT_WRITE_IF_ABSENT, .value = value };
+	return ht_insert_hashed(ht, ht_hash(ht, key, ht->key_size), key, &w) == HT_INSERT_ADDED;
+}
+
+bool ht_replace(
+	hopscotch_hash_table_t *ht,
+	const uint8_t *key,
+	const uint8_t *value
+) {
+	if(!ht || !key || !value || ht->arena) return false;
+	ht_write_t w = { .mode = HT_WRITE_REPLACE, .value = value };
+	return ht_insert_hashed(ht, ht_hash(ht, key, ht->key_size), key, &w) == HT_INSERT_UPDATED;
+}
+
+bool ht_compare_and_swap_value(
+	hopscotch_hash_table_t *ht,
+	const uint8_t *key,
+	const uint8_t *expected,
+	const uint8_t *desired
+) {
+	if(!ht || !key || !expected || !desired || ht->arena) return false;
+	ht_write_t w = { .mode = HT_WRITE_CAS, .value = desired, .expected = expected };
+	return ht_insert_hashed(ht, ht_hash(ht, key, ht->key_size), key, &w) == HT_INSERT_UPDATED;
+}
+
+bool ht_upsert(
+	hopscotch_hash_table_t *ht,
+	const uint8_t *key,
+	ht_upsert_f fn,
+	void *ctx
+) {
+	if(!ht || !key || !fn || ht->arena) return false;
+	ht_write_t w = { .mode = HT_WRITE_UPSERT, .upsert = fn, .ctx = ctx };
+	ht_insert_result_t res = ht_insert_hashed(ht, ht_hash(ht, key, ht->key_size), key, &w);
+	return res == HT_INSERT_ADDED || res == HT_INSERT_UPDATED;
+}
+
+//------------------------------------------------------------------------------
+// Cache mode.
+//------------------------------------------------------------------------------
+// Variable-length entries are left out: an eviction would have to give
+// their arena blocks back from under the slot version.
+hopscotch_hash_table_t *ht_create_cache(
+	size_t capacity,
+	ht_layout_t layout,
+	hash_function_f hash_function,
+	uint64_t seed,
+	uint64_t default_ttl_ms
+) {
+	if(layout == HT_LAYOUT_VARLEN) return NULL;
+	ht_shape_t shape = ht_layout_shape(layout);
+	shape.expiry = true;
+	hopscotch_hash_table_t *ht = ht_create_buffer(capacity, shape, 0, hash_function, seed);
+	if(ht) ht_set_cache_mode(ht, true, default_ttl_ms);
+	return ht;
+}
+
+// Only tables with expiry words, the other ones do not pay for them.
+bool ht_set_cache_mode(hopscotch_hash_table_t *ht, bool enabled, uint64_t default_ttl_ms) {
+	if(!ht || ht->arena || !atomic_load(&ht->array)->expiry) return false;
+	atomic_store(&ht->cache_ttl, default_ttl_ms);
+	atomic_store(&ht->cache, enabled);
+	return true;
+}
+
+bool ht_insert_ttl(
+	hopscotch_hash_table_t *ht,
+	const uint8_t *key,
+	const uint8_t *value,
+	uint64_t ttl_ms
+) {
+	if(!ht || !key || !value || ht->arena) return false;
+	uint64_t now = ht_cache_now(ht);
+	ht_write_t w = {
+		.mode = HT_WRITE_SET,
+		.value = value,
+		.expiry = ht_cache_expiry(now, now ? ttl_ms : 0),
+		.own_expiry = true
+	};
+	return ht_insert_hashed(ht, ht_hash(ht, key, ht->key_size), key, &w) != HT_INSERT_FAILED;
+}
+
+size_t ht_cache_sweep(hopscotch_hash_table_t *ht, size_t slots) {
+	if(!ht) return 0;
+	uint64_t now = ht_cache_now(ht);
+	if(!now) return 0;
+	ht_epoch_enter();
+	size_t reclaimed = ht_cache_reclaim(ht, slots, now);
+	ht_epoch_exit();
+	return reclaimed;
+}
+
+//------------------------------------------------------------------------------
+// Zero-copy access.
+//------------------------------------------------------------------------------
+bool ht_get_ref(hopscotch_hash_table_t *ht, const uint8_t *key, ht_ref_t *ref) {
+	if(!ht || !key || !ref || ht->arena) return false;
+	uint64_t h = ht_hash(ht, key, ht->key_size);
+
+	// The section is left by ht_ref_release.
+	ht_array_t *a;
+	size_t idx;
+	uint32_t version;
+	ht_epoch_enter();
+	if(!ht_locate_hashed(ht, h, key, &a, &idx, &version)) {
+		ht_epoch_exit();
+		return false;
+	}
+	*ref = (ht_ref_t){
+		.value = ht_slot_value(a, idx),
+		.value_size = a->value_size,
+		.version = &a->versions[idx],
+		.snapshot = version
+	};
+	return true;
+}
+
+bool ht_ref_valid(const ht_ref_t *ref) {
+	if(!ref || !ref->value) return false;
+	// Reads of the value must not move past the version check.
+	atomic_thread_fence(memory_order_acquire);
+	return atomic_load_explicit(ref->version, memory_order_relaxed) == ref->snapshot;
+}
+
+void ht_ref_release(ht_ref_t *ref) {
+	if(!ref || !ref->value) return;
+	ref->value = NULL;
+	ht_epoch_exit();
+}
+
+bool ht_visit(
+	hopscotch_hash_table_t *ht,
+	const uint8_t *key,
+	ht_visit_f callback,
+	void *ctx
+) {
+	if(!ht || !key || !callback || ht->arena) return false;
+	uint64_t h = ht_hash(ht, key, ht->key_size);
+
+	bool found;
+	ht_epoch_enter();
+	for(;;) {
+		ht_array_t *a;
+		size_t idx;
+		uint32_t version;
+		found = ht_locate_hashed(ht, h, key, &a, &idx, &version);
+		if(!found) break;
+
+		callback(ht_slot_value(a, idx), a->value_size, ctx);
+		atomic_thread_fence(memory_order_acquire);
+		if(atomic_load_explicit(&a->versions[idx], memory_order_relaxed) == version) break;
+	}
+	ht_epoch_exit();
+	return found;
+}
+
+//------------------------------------------------------------------------------
+// Scans.
+//------------------------------------------------------------------------------
+// Entries of a scan are copied into a growing buffer, key then value. A
+// block of home buckets is scanned in one go and its copies are kept only
+// if neither a resident of the block moved (the timestamps of its home
+// buckets) nor its chunks migrated (the chunk states) meanwhile.
+typedef struct {
+	uint8_t *entries;
+	size_t count;
+	size_t capacity;
+	size_t key_size;
+	size_t value_size;
+	// Cache mode: entries expired at now are skipped.
+	uint64_t now;
+	// Out of memory, the scan is cut short.
+	bool failed;
+} ht_scan_t;
+
+struct ht_iter {
+	hopscotch_hash_table_t *ht;
+	ht_array_t *array;
+	size_t next_home;
+	size_t pos;
+	ht_scan_t scan;
+};
+
+static inline uint8_t *ht_scan_entry(const ht_scan_t *s, size_t i) {
+	return s->entries + i * (s->key_size + s->value_size);
+}
+
+static bool ht_scan_reserve(ht_scan_t *s, size_t count) {
+	if(count <= s->capacity) return true;
+	size_t capacity = s->capacity ? s->capacity * 2 : HT_ITER_BLOCK;
+	while(capacity < count) capacity *= 2;
+	uint8_t *entries = realloc(s->entries, capacity * (s->key_size + s->value_size));
+	if(!entries) {
+		s->failed = true;
+		return false;
+	}
+	s->entries = entries;
+	s->capacity = capacity;
+	return true;
+}
+
+// Sum of the timestamps of home buckets [first, first + n), they only grow.
+static inline uint64_t ht_scan_timestamps(const ht_array_t *a, size_t first, size_t n) {
+	uint64_t sum = 0;
+	for(size_t i = 0; i < n; i++) {
+		sum += atomic_load_explicit(&a->timestamps[first + i], memory_order_acquire);
+	}
+	return sum;
+}
+
+// Union of the states of the chunks holding home buckets [first, first + n).
+static inline uint32_t ht_scan_chunk_states(const ht_array_t *a, size_t first, size_t n) {
+	uint32_t states = 0;
+	size_t last = (first + n - 1) / a->chunk_size;
+	for(size_t c = first / a->chunk_size; c <= last; c++) {
+		states |= atomic_load_explicit(&a->chunk_state[c], memory_order_acquire);
+	}
+	return states;
+}
+
+// Copies the residents of home buckets [first, first + n) whose hash also
+// falls into [lo, lo + n) under mask. False if the copies cannot be kept.
+static bool ht_scan_copy(
+	ht_scan_t *s,
+	ht_array_t *a,
+	size_t first,
+	size_t n,
+	size_t mask,
+	size_t lo
+) {
+	size_t span = n + HOP_RANGE * MAX_RELOCATION_FACTOR;
+	if(span > a->capacity) span = a->capacity;
+	if(!ht_scan_reserve(s, s->count + span)) return false;
+
+	for(size_t base = 0; base < span; base += HOP_RANGE) {
+		// Free slots carry tag 0.
+		uint32_t occupied = ~ht_array_tag_match(a, first + base, 0);
+		if(span - base < HOP_RANGE) occupied &= (1u << (span - base)) - 1;
+		while(occupied) {
+			size_t idx = (first + base + __builtin_ctz(occupied)) & a->mask;
+			occupied &= occupied - 1;
+
+			_Atomic uint32_t *version = &a->versions[idx];
+			uint8_t *entry = ht_scan_entry(s, s->count);
+			bool match;
+			for(;;) {
+				uint32_t before = atomic_load_explicit(version, memory_order_acquire);
+				if(before & 1) {
+					thrd_yield();
+					continue;
+				}
+				uint8_t tag = atomic_load_explicit(&a->tags[idx], memory_order_acquire);
+				uint64_t info = atomic_load_explicit(ht_slot_hop_info(a, idx),
+					memory_order_relaxed);
+				match = ht_tag_live(tag) && (info & HT_SLOT_USED) &&
+					INDEX(info, a->mask) - first < n && INDEX(info, mask) - lo < n &&
+					!ht_slot_expired(a, idx, s->now);
+				if(match) {
+					memcpy(entry, ht_slot_key(a, idx), a->key_size);
+					memcpy(entry + a->key_size, ht_slot_value(a, idx), a->value_size);
+				}
+				atomic_thread_fence(memory_order_acquire);
+				if(atomic_load_explicit(version, memory_order_relaxed) == before) break;
+			}
+			if(match) s->count++;
+		}
+	}
+	return true;
+}
+
+static void ht_scan_range(ht_scan_t *s, ht_array_t *a, size_t mask, size_t lo, size_t n);
+
+// Home buckets [first, first + n) of a, n is a power of two within a chunk
+// or a run of whole chunks. Chunks migrated meanwhile are scanned in the
+// array they moved to.
+static void ht_scan_block(
+	ht_scan_t *s,
+	ht_array_t *a,
+	size_t first,
+	size_t n,
+	size_t mask,
+	size_t lo
+) {
+	for(int attempt = 0; ; attempt++) {
+		uint32_t states = ht_scan_chunk_states(a, first, n);
+		if(states & HT_CHUNK_CLOSED) {
+			thrd_yield();
+			continue;
+		}
+		if((states & HT_CHUNK_DONE) || (attempt > 1 && n > a->chunk_size)) {
+			break;
+		}
+
+		size_t mark = s->count;
+		uint64_t timestamps = ht_scan_timestamps(a, first, n);
+		bool copied = ht_scan_copy(s, a, first, n, mask, lo);
+		atomic_thread_fence(memory_order_acquire);
+		states = ht_scan_chunk_states(a, first, n);
+		if(copied && !(states & (HT_CHUNK_CLOSED | HT_CHUNK_DONE)) &&
+			ht_scan_timestamps(a, first, n) == timestamps)
+		{
+			return;
+		}
+		s->count = mark;
+		if(!copied) return;
+	}
+
+	if(n > a->chunk_size) {
+		// Chunk by chunk, only the migrated ones move on.
+		ht_scan_block(s, a, first, n / 2, mask, lo);
+		ht_scan_block(s, a, first + n / 2, n / 2, mask, lo + n / 2);
+		return;
+	}
+	ht_scan_range(s, a->migration.to, mask, lo, n);
+}
+
+// Entries of a whose hash falls into [lo, lo + n) under mask, lo is a
+// multiple of n (a power of two).
+static void ht_scan_range(ht_scan_t *s, ht_array_t *a, size_t mask, size_t lo, size_t n) {
+	if(n > a->capacity || n > HT_ITER_BLOCK) {
+		ht_scan_range(s, a, mask, lo, n / 2);
+		ht_scan_range(s, a, mask, lo + n / 2, n / 2);
+		return;
+	}
+	if(a->mask <= mask) {
+		// Same or fewer buckets: one run of home buckets, hashes of other
+		// runs share it.
+		ht_scan_block(s, a, lo & a->mask, n, mask, lo);
+		return;
+	}
+	// More buckets: every run of home buckets is a finer range of its own.
+	for(size_t first = lo; first < a->capacity; first += mask + 1) {
+		ht_scan_block(s, a, first, n, a->mask, first);
+	}
+}
+
+ht_iter_t *ht_iter_begin(hopscotch_hash_table_t *ht) {
+	if(!ht || ht->arena) return NULL;
+
+	ht_iter_t *it = calloc(1, sizeof(ht_iter_t));
+	if(!it) return NULL;
+	ht_epoch_enter();
+	it->ht = ht;
+	it->array = atomic_load(&ht->array);
+	it->scan.key_size = it->array->key_size;
+	it->scan.value_size = it->array->value_size;
+	it->scan.now = ht_cache_now(ht);
+	return it;
+}
+
+bool ht_iter_next(ht_iter_t *it, const uint8_t **key, const uint8_t **value) {
+	if(!it) return false;
+
+	ht_array_t *a = it->array;
+	size_t n = a->capacity < HT_ITER_BLOCK ? a->capacity : HT_ITER_BLOCK;
+	while(it->pos == it->scan.count) {
+		if(it->next_home >= a->capacity || it->scan.failed) return false;
+		it->scan.count = it->pos = 0;
+		ht_scan_range(&it->scan, a, a->mask, it->next_home, n);
+		it->next_home += n;
+	}
+
+	uint8_t *entry = ht_scan_entry(&it->scan, it->pos++);
+	if(key) *key = entry;
+	if(value) *value = entry + it->scan.key_size;
+	return true;
+}
+
+bool ht_iter_failed(const ht_iter_t *it) {
+	return it && it->scan.failed;
+}
+
+void ht_iter_end(ht_iter_t *it) {
+	if(!it) return;
+	ht_epoch_exit();
+	free(it->scan.entries);
+	free(it);
+}
+
+typedef struct {
+	ht_array_t *array;
+	_Atomic size_t *cursor;
+	ht_for_each_f fn;
+	void *ctx;
+	uint64_t now;
+	size_t visited;
+	bool failed;
+} ht_for_each_worker_t;
+
+static int ht_for_each_worker(void *arg) {
+	ht_for_each_worker_t *w = (ht_for_each_worker_t *)arg;
+	ht_array_t *a = w->array;
+	size_t n = a->capacity < HT_ITER_BLOCK ? a->capacity : HT_ITER_BLOCK;
+	ht_scan_t scan = {
+		.key_size = a->key_size,
+		.value_size = a->value_size,
+		.now = w->now
+	};
+
+	ht_epoch_enter();
+	for(;;) {
+		size_t first = atomic_fetch_add_explicit(w->cursor, n, memory_order_relaxed);
+		if(first >= a->capacity || scan.failed) break;
+		scan.count = 0;
+		ht_scan_range(&scan, a, a->mask, first, n);
+		for(size_t i = 0; i < scan.count; i++) {
+			uint8_t *entry = ht_scan_entry(&scan, i);
+			w->fn(entry, entry + scan.key_size, w->ctx);
+		}
+		w->visited += scan.count;
+	}
+	ht_epoch_exit();
+	free(scan.entries);
+	w->failed = scan.failed;
+	return 0;
+}
+
+size_t ht_parallel_for_each(
+	hopscotch_hash_table_t *ht,
+	size_t threads,
+	ht_for_each_f fn,
+	void *ctx,
+	bool *failed
+) {
+	if(failed) *failed = false;
+	if(!ht || !fn || ht->arena) return 0;
+	if(threads == 0) threads = 1;
+	if(threads > HT_INIT_MAX_THREADS) threads = HT_INIT_MAX_THREADS;
+
+	// The section keeps the array and whatever it migrates to mapped until
+	// every worker is done.
+	ht_epoch_enter();
+	ht_array_t *a = atomic_load(&ht->array);
+	_Atomic size_t cursor = 0;
+	ht_for_each_worker_t workers[HT_INIT_MAX_THREADS];
+	thrd_t tids[HT_INIT_MAX_THREADS];
+	for(size_t i = 0; i < threads; i++) {
+		workers[i] = (ht_for_each_worker_t){
+			.array = a,
+			.cursor = &cursor,
+			.fn = fn,
+			.ctx = ctx,
+			.now = ht_cache_now(ht)
+		};
+	}
+	// Ranges are handed out by the cursor, workers which fail to start leave
+	// theirs to the others.
+	size_t started = 1;
+	for(; started < threads; started++) {
+		if(thrd_create(&tids[started], ht_for_each_worker, &workers[started]) !=
+			thrd_success)
+		{
+			break;
+		}
+	}
+	ht_for_each_worker(&workers[0]);
+
+	size_t visited = workers[0].visited;
+	bool cut_short = workers[0].failed;
+	for(size_t i = 1; i < started; i++) {
+		thrd_join(tids[i], NULL);
+		visited += workers[i].visited;
+		cut_short |= workers[i].failed;
+	}
+	ht_epoch_exit();
+	if(failed) *failed = cut_short;
+	return visited;
+}
+
+//------------------------------------------------------------------------------
+// Structural validation.
+//------------------------------------------------------------------------------
+// Every worker checks its own run of slots in order, so its first violations
+// are the first ones of the run and the merged list keeps the first ones of
+// the table.
+typedef struct {
+	hopscotch_hash_table_t *ht;
+	ht_array_t *array;
+	size_t first;
+	size_t last;
+	size_t entries;
+	size_t violations;
+	size_t reported;
+	ht_violation_t violation[HT_VALIDATE_MAX_VIOLATIONS];
+} ht_validate_worker_t;
+
+static void ht_validate_add(
+	ht_validate_worker_t *w,
+	ht_violation_kind_t kind,
+	size_t slot,
+	size_t home,
+	uint64_t word
+) {
+	w->violations++;
+	if(w->reported < HT_VALIDATE_MAX_VIOLATIONS) {
+		w->violation[w->reported++] = (ht_violation_t){ kind, slot, home, word };
+	}
+}
+
+// Hash of the key in slot idx, false if a variable-length key does not name
+// an arena block.
+static bool ht_validate_hash(const ht_validate_worker_t *w, size_t idx, uint64_t *h) {
+	const ht_array_t *a = w->array;
+	const uint8_t *key = ht_slot_key(a, idx);
+	if(!a->arena) {
+		*h = ht_hash(w->ht, key, a->key_size);
+		return true;
+	}
+
+	uint32_t len = ht_var_len(key);
+	const uint8_t *data = ht_var_slot_data(a->arena, key);
+	if(!data) return false;
+	*h = ht_hash(w->ht, data, len);
+	return true;
+}
+
+static void ht_validate_slot(ht_validate_worker_t *w, size_t idx) {
+	ht_array_t *a = w->array;
+	uint64_t word = atomic_load_explicit(ht_slot_hop_info(a, idx), memory_order_relaxed);
+	uint8_t tag = atomic_load_explicit(&a->tags[idx], memory_order_relaxed);
+	size_t neighborhood = HOP_RANGE * MAX_RELOCATION_FACTOR;
+
+	if(atomic_load_explicit(&a->versions[idx], memory_order_relaxed) & 1) {
+		ht_validate_add(w, HT_VIOLATION_LOCKED, idx, word ? INDEX(word, a->mask) : SIZE_MAX,
+			word);
+	}
+	if(word == 0) {
+		if(tag != 0) ht_validate_add(w, HT_VIOLATION_TAG, idx, SIZE_MAX, word);
+		return;
+	}
+
+	size_t home = INDEX(word, a->mask);
+	w->entries++;
+	if(!ht_tag_live(tag)) {
+		ht_validate_add(w, HT_VIOLATION_CLAIMED, idx, home, word);
+		return;
+	}
+	if(tag != ht_tag(word) || !(word & HT_SLOT_USED)) {
+		ht_validate_add(w, HT_VIOLATION_TAG, idx, home, word);
+	}
+	if(((idx - home) & a->mask) >= neighborhood) {
+		ht_validate_add(w, HT_VIOLATION_RANGE, idx, home, word);
+	}
+
+	uint64_t h;
+	if(!ht_validate_hash(w, idx, &h)) {
+		ht_validate_add(w, HT_VIOLATION_REFERENCE, idx, home, word);
+		return;
+	}
+	if(ht_hash_word(h) != word) {
+		ht_validate_add(w, HT_VIOLATION_HASH, idx, home, word);
+	}
+
+	// Another copy of the key between this slot and the end of the
+	// neighborhood, found by its tag like a lookup does.
+	size_t distance = (idx - home) & a->mask;
+	const uint8_t *key = ht_slot_key(a, idx);
+	for(size_t base = distance + 1; base < neighborhood; base += HOP_RANGE) {
+		uint32_t matches = ht_array_tag_match(a, home + base, tag);
+		while(matches) {
+			size_t d = base + __builtin_ctz(matches);
+			matches &= matches - 1;
+			if(d >= neighborhood) break;
+			size_t other = (home + d) & a->mask;
+			if(atomic_load_explicit(ht_slot_hop_info(a, other), memory_order_relaxed) != word) {
+				continue;
+			}
+			if(ht_slot_key_equal(a, other, key)) {
+				ht_validate_add(w, HT_VIOLATION_DUPLICATE, idx, home, word);
+				return;
+			}
+		}
+	}
+}
+
+static int ht_validate_worker(void *arg) {
+	ht_validate_worker_t *w = (ht_validate_worker_t *)arg;
+	for(size_t idx = w->first; idx < w->last; idx++) {
+		ht_validate_slot(w, idx);
+	}
+	return 0;
+}
+
+bool ht_validate(hopscotch_hash_table_t *ht, size_t threads, ht_validate_report_t *report) {
+	if(!ht) return false;
+	if(threads == 0) threads = 1;
+	if(threads > HT_INIT_MAX_THREADS) threads = HT_INIT_MAX_THREADS;
+
+	ht_resize_wait(ht);
+	ht_epoch_enter();
+	ht_array_t *a = atomic_load(&ht->array);
+	bool migrating = atomic_load(&ht->migration) != NULL;
+	if(threads > a->capacity) threads = a->capacity;
+
+	ht_validate_worker_t *workers = calloc(threads, sizeof(*workers));
+	if(!workers) {
+		ht_epoch_exit();
+		return false;
+	}
+	for(size_t t = 0; t < threads; t++) {
+		workers[t].ht = ht;
+		workers[t].array = a;
+		workers[t].first = a->capacity * t / threads;
+		workers[t].last = a->capacity * (t + 1) / threads;
+	}
+	// Runs of workers which fail to start are checked by the caller.
+	thrd_t tids[HT_INIT_MAX_THREADS];
+	size_t started = 1;
+	for(; started < threads; started++) {
+		if(thrd_create(&tids[started], ht_validate_worker, &workers[started]) != thrd_success) {
+			break;
+		}
+	}
+	ht_validate_worker(&workers[0]);
+	for(size_t t = started; t < threads; t++) ht_validate_worker(&workers[t]);
+	for(size_t t = 1; t < started; t++) thrd_join(tids[t], NULL);
+
+	ht_validate_report_t r = { .capacity = a->capacity, .size = ht_size_exact(ht) };
+	for(size_t t = 0; t < threads; t++) {
+		ht_validate_worker_t *w = &workers[t];
+		r.entries += w->entries;
+		r.violations += w->violations;
+		for(size_t i = 0; i < w->reported && r.reported < HT_VALIDATE_MAX_VIOLATIONS; i++) {
+			r.violation[r.reported++] = w->violation[i];
+		}
+	}
+	// A stuck migration leaves entries in the source array.
+	if(!migrating && r.entries != r.size) {
+		r.violations++;
+		if(r.reported < HT_VALIDATE_MAX_VIOLATIONS) {
+			r.violation[r.reported++] = (ht_violation_t){
+				HT_VIOLATION_SIZE, SIZE_MAX, SIZE_MAX, r.size
+			};
+		}
+	}
+	free(workers);
+	ht_epoch_exit();
+
+	if(report) *report = r;
+	return r.violations == 0;
+}
+
+const char *ht_violation_name(ht_violation_kind_t kind) {
+	switch(kind) {
+	case HT_VIOLATION_TAG: return "tag";
+	case HT_VIOLATION_CLAIMED: return "claimed";
+	case HT_VIOLATION_RANGE: return "range";
+	case HT_VIOLATION_HASH: return "hash";
+	case HT_VIOLATION_REFERENCE: return "reference";
+	case HT_VIOLATION_DUPLICATE: return "duplicate";
+	case HT_VIOLATION_LOCKED: return "locked";
+	case HT_VIOLATION_SIZE: return "size";
+	}
+	return "unknown";
+}
+
+void ht_print_validate(const ht_validate_report_t *report) {
+	if(!report) return;
+	printf("Hash table validation: capacity %zu, entries %zu, size %zu, violations %zu\n",
+		report->capacity, report->entries, report->size, report->violations);
+	for(size_t i = 0; i < report->reported; i++) {
+		const ht_violation_t *v = &report->violation[i];
+		if(v->kind == HT_VIOLATION_SIZE) {
+			printf("  %-9s size %zu, entries %zu\n", ht_violation_name(v->kind),
+				report->size, report->entries);
+		} else if(v->home == SIZE_MAX) {
+			printf("  %-9s slot %zu (free)\n", ht_violation_name(v->kind), v->slot);
+		} else {
+			printf("  %-9s slot %zu, home %zu, word 0x%016lx\n", ht_violation_name(v->kind),
+				v->slot, v->home, v->word);
+		}
+	}
+}
+
+//------------------------------------------------------------------------------
+// Batched operations.
+//------------------------------------------------------------------------------
+// Keys are processed in groups of HT_BATCH_GROUP. The whole group is hashed
+// and the tags of every home neighborhood are prefetched, then the first tag
+// match of every key gets its slot prefetched, and only then the keys are
+// resolved one by one. The DRAM misses of a group overlap instead of being
+// paid key after key.
+typedef enum {
+	HT_BATCH_CONTAINS = 0,
+	HT_BATCH_INSERT,
+	HT_BATCH_REMOVE
+} ht_batch_op_t;
+
+// The array is only used for the prefetch addresses, a resize running
+// meanwhile costs a few useless prefetches but never a wrong result. The
+// batch section keeps a replaced array mapped until the group is done.
+static void ht_batch_prefetch(
+	ht_array_t *a,
+	const uint64_t *hashes,
+	size_t count,
+	ht_batch_op_t op
+) {
+	// Stage 1: tags and timestamp of the home bucket.
+	for(size_t i = 0; i < count; i++) {
+		size_t home = INDEX(hashes[i], a->mask);
+		__builtin_prefetch(&a->tags[home], 0, 3);
+		__builtin_prefetch(&a->tags[(home + HOP_RANGE - 1) & a->mask], 0, 3);
+		__builtin_prefetch(&a->timestamps[home], 0, 3);
+	}
+
+	// Stage 2: the slot of the first tag match, or the first free slot for
+	// an insert of a new key.
+	for(size_t i = 0; i < count; i++) {
+		size_t home = INDEX(hashes[i], a->mask);
+		uint32_t matches = ht_array_tag_match(a, home, ht_tag(hashes[i]));
+		if(!matches && op == HT_BATCH_INSERT) {
+			matches = ht_array_tag_match(a, home, 0);
+		}
+		if(!matches) continue;
+
+		size_t idx = (home + __builtin_ctz(matches)) & a->mask;
+		if(op == HT_BATCH_CONTAINS) {
+			__builtin_prefetch(ht_slot_hop_info(a, idx), 0, 3);
+		} else {
+			__builtin_prefetch(ht_slot_hop_info(a, idx), 1, 3);
+		}
+		__builtin_prefetch(ht_slot_key(a, idx), 0, 3);
+		if(op != HT_BATCH_REMOVE) {
+			__builtin_prefetch(ht_slot_value(a, idx), 0, 3);
+			__builtin_prefetch(ht_slot_value(a, idx) + a->value_size - 1, 0, 3);
+		}
+	}
+}
+
+static void ht_hash_keys(
+	const hopscotch_hash_table_t *ht,
+	const uint8_t *const *keys,
+	size_t count,
+	uint64_t *hashes
+) {
+	// The bundled murmur hashes a whole group of 64-byte keys with the
+	// vector kernel.
+	if(ht->hash_function == murmur_custom_hash && ht->key_size == 64) {
+		murmur_custom_hash_batch(keys, count, ht->seed, hashes);
+		return;
+	}
+	for(size_t i = 0; i < count; i++) {
+		hashes[i] = ht_hash(ht, keys[i], ht->key_size);
+	}
+}
+
+static size_t ht_batch(
+	hopscotch_hash_table_t *ht,
+	ht_batch_op_t op,
+	const uint8_t *const *keys,
+	const uint8_t *const *values,
+	uint8_t *const *out_values,
+	bool *results,
+	size_t count
+) {
+	uint64_t hashes[HT_BATCH_GROUP];
+	size_t done = 0;
+
+	// One section for the batch, the calls below only nest into it.
+	ht_epoch_enter();
+	for(size_t first = 0; first < count; first += HT_BATCH_GROUP) {
+		size_t n = count - first < HT_BATCH_GROUP ? count - first : HT_BATCH_GROUP;
+		ht_hash_keys(ht, keys + first, n, hashes);
+
+		ht_batch_prefetch(atomic_load(&ht->array), hashes, n, op);
+
+		// Stage 3: resolve.
+		for(size_t i = 0; i < n; i++) {
+			size_t k = first + i;
+			bool res;
+			switch(op) {
+			case HT_BATCH_INSERT: {
+				ht_write_t w = { .mode = HT_WRITE_SET, .value = values[k] };
+				res = ht_insert_hashed(ht, hashes[i], keys[k], &w) != HT_INSERT_FAILED;
+				break;
+			}
+			case HT_BATCH_REMOVE:
+				res = ht_remove_hashed(ht, hashes[i], keys[k], NULL, NULL);
+				break;
+			default:
+				res = ht_contains_hashed(ht, hashes[i], keys[k],
+					out_values ? out_values[k] : NULL, NULL);
+				break;
+			}
+			if(results) results[k] = res;
+			done += res;
+		}
+	}
+	ht_epoch_exit();
+	return done;
+}
+
+size_t ht_contains_batch(
+	hopscotch_hash_table_t *ht,
+	const uint8_t *const *keys,
+	uint8_t *const *out_values,
+	bool *results,
+	size_t count
+) {
+	if(!ht || !keys || ht->arena) return 0;
+	return ht_batch(ht, HT_BATCH_CONTAINS, keys, NULL,
+		out_values, results, count);
+}
+
+size_t ht_insert_batch(
+	hopscotch_hash_table_t *ht,
+	const uint8_t *const *keys,
+	const uint8_t *const *values,
+	bool *results,
+	size_t count
+) {
+	if(!ht || !keys || !values || ht->arena) return 0;
+	return ht_batch(ht, HT_BATCH_INSERT, keys, values,
+		NULL, results, count);
+}
+
+size_t ht_remove_batch(
+	hopscotch_hash_table_t *ht,
+	const uint8_t *const *keys,
+	bool *results,
+	size_t count
+) {
+	if(!ht || !keys || ht->arena) return 0;
+	return ht_batch(ht, HT_BATCH_REMOVE, keys, NULL,
+		NULL, results, count);
+}
+
+//------------------------------------------------------------------------------
+// Bulk build.
+//------------------------------------------------------------------------------
+// Entries are hashed and radix-partitioned into buckets of 2^HT_BULK_RADIX_BITS
+// home buckets in parallel. Every thread owns a run of those buckets: it
+// sorts one bucket at a time by home (in cache) and fills its run front to
+// back with plain stores, the table is private and nobody reads the versions
+// meanwhile. An entry which would land past the run or the neighborhood is
+// left over and added by the regular insert afterwards.
+typedef struct {
+	uint64_t hash;
+	size_t idx;
+} ht_bulk_entry_t;
+
+typedef struct {
+	hopscotch_hash_table_t *ht;
+	ht_array_t *array;
+	const uint8_t *const *keys;
+	const uint8_t *const *values;
+	size_t count;
+	size_t threads;
+	unsigned bits;
+	size_t buckets;
+	// Expiry word of every entry (cache mode).
+	uint64_t expiry;
+	uint64_t *hashes;
+	// hist[t * buckets + q] - entries of slice t in bucket q, then the
+	// position slice t scatters them to.
+	size_t *hist;
+	// Bucket q holds entries [start[q], start[q + 1]).
+	size_t *start;
+	ht_bulk_entry_t *entries;
+	size_t *placed;
+	size_t *left;
+	_Atomic bool failed;
+} ht_bulk_t;
+
+typedef struct {
+	ht_bulk_t *bulk;
+	size_t id;
+	void (*phase)(ht_bulk_t *, size_t);
+} ht_bulk_worker_t;
+
+static inline size_t ht_bulk_bucket(const ht_bulk_t *b, uint64_t h) {
+	return INDEX(h, b->array->mask) >> b->bits;
+}
+
+// Slice t of the input and run t of the buckets.
+static inline void ht_bulk_share(size_t total, size_t threads, size_t t, size_t *first, size_t *last) {
+	*first = total * t / threads;
+	*last = total * (t + 1) / threads;
+}
+
+static void ht_bulk_hash(ht_bulk_t *b, size_t t) {
+	size_t first, last;
+	ht_bulk_share(b->count, b->threads, t, &first, &last);
+	size_t *hist = b->hist + t * b->buckets;
+	for(size_t i = first; i < last; i += HT_BATCH_GROUP) {
+		size_t n = last - i < HT_BATCH_GROUP ? last - i : HT_BATCH_GROUP;
+		ht_hash_keys(b->ht, b->keys + i, n, b->hashes + i);
+		for(size_t k = 0; k < n; k++) {
+			hist[ht_bulk_bucket(b, b->hashes[i + k])]++;
+		}
+	}
+}
+
+static void ht_bulk_scatter(ht_bulk_t *b, size_t t) {
+	size_t first, last;
+	ht_bulk_share(b->count, b->threads, t, &first, &last);
+	size_t *pos = b->hist + t * b->buckets;
+	for(size_t i = first; i < last; i++) {
+		uint64_t h = b->hashes[i];
+		b->entries[pos[ht_bulk_bucket(b, h)]++] = (ht_bulk_entry_t){ h, i };
+	}
+}
+
+// Places the run of buckets of thread t. Every bucket is sorted by home
+// (stable, the last duplicate stays last), left over entries go to the front
+// of the run in entries.
+static void ht_bulk_place(ht_bulk_t *b, size_t t) {
+	ht_array_t *a = b->array;
+	size_t bucket_size = (size_t)1 << b->bits;
+	size_t first_bucket, last_bucket;
+	ht_bulk_share(b->buckets, b->threads, t, &first_bucket, &last_bucket);
+	size_t hi = last_bucket * bucket_size;
+	size_t run = b->start[first_bucket];
+
+	uint32_t *offsets = malloc((bucket_size + 1) * sizeof(uint32_t));
+	ht_bulk_entry_t *sorted = NULL;
+	size_t sorted_size = 0;
+	size_t neighborhood = HOP_RANGE * MAX_RELOCATION_FACTOR;
+	size_t next = first_bucket * bucket_size, placed = 0, left = 0;
+	for(size_t q = first_bucket; q < last_bucket && offsets; q++) {
+		size_t first = b->start[q], last = b->start[q + 1];
+		if(last - first > sorted_size) {
+			free(sorted);
+			sorted_size = (last - first) * 2;
+			sorted = malloc(sorted_size * sizeof(ht_bulk_entry_t));
+			if(!sorted) break;
+		}
+
+		size_t lo = q * bucket_size;
+		memset(offsets, 0, (bucket_size + 1) * sizeof(uint32_t));
+		for(size_t i = first; i < last; i++) {
+			offsets[INDEX(b->entries[i].hash, a->mask) - lo + 1]++;
+		}
+		for(size_t i = 1; i <= bucket_size; i++) offsets[i] += offsets[i - 1];
+		for(size_t i = first; i < last; i++) {
+			size_t home = INDEX(b->entries[i].hash, a->mask);
+			sorted[offsets[home - lo]++] = b->entries[i];
+		}
+
+		size_t group_home = SIZE_MAX, group_first = lo;
+		for(size_t i = 0; i < last - first; i++) {
+			// The pairs are read in bucket order, that is at random.
+			if(i + HT_BATCH_GROUP < last - first) {
+				size_t ahead = sorted[i + HT_BATCH_GROUP].idx;
+				__builtin_prefetch(b->keys[ahead], 0, 0);
+				__builtin_prefetch(b->values[ahead], 0, 0);
+				__builtin_prefetch(b->values[ahead] + a->value_size - 1, 0, 0);
+			}
+
+			ht_bulk_entry_t e = sorted[i];
+			size_t home = INDEX(e.hash, a->mask);
+			const uint8_t *key = b->keys[e.idx];
+			if(home != group_home) {
+				group_home = home;
+				group_first = next > home ? next : home;
+			}
+
+			// Duplicates share the hash word and sit in the same group.
+			uint64_t word = ht_hash_word(e.hash);
+			bool updated = false;
+			for(size_t idx = group_first; idx < next; idx++) {
+				if(atomic_load_explicit(ht_slot_hop_info(a, idx), memory_order_relaxed) == word &&
+					ht_slot_key_equal(a, idx, key))
+				{
+					memcpy(ht_slot_value(a, idx), b->values[e.idx], a->value_size);
+					updated = true;
+					break;
+				}
+			}
+			if(updated) continue;
+
+			size_t idx = next > home ? next : home;
+			if(idx >= hi || idx - home >= neighborhood) {
+				b->entries[run + left++] = e;
+				continue;
+			}
+			memcpy(ht_slot_key(a, idx), key, a->key_size);
+			memcpy(ht_slot_value(a, idx), b->values[e.idx], a->value_size);
+			if(a->expiry) atomic_store_explicit(&a->expiry[idx], b->expiry, memory_order_relaxed);
+			atomic_store_explicit(ht_slot_hop_info(a, idx), word, memory_order_relaxed);
+			atomic_store_explicit(&a->tags[idx], ht_tag(e.hash), memory_order_relaxed);
+			next = idx + 1;
+			placed++;
+		}
+	}
+	if(!offsets || (b->start[last_bucket] > b->start[first_bucket] && !sorted)) {
+		atomic_store(&b->failed, true);
+	}
+	free(offsets);
+	free(sorted);
+	b->placed[t] = placed;
+	b->left[t] = left;
+}
+
+static int ht_bulk_worker(void *arg) {
+	ht_bulk_worker_t *w = (ht_bulk_worker_t *)arg;
+	w->phase(w->bulk, w->id);
+	return 0;
+}
+
+// Runs phase for every id, on the calling thread if no more can be started.
+static void ht_bulk_run(ht_bulk_t *b, void (*phase)(ht_bulk_t *, size_t)) {
+	thrd_t tids[b->threads];
+	ht_bulk_worker_t workers[b->threads];
+	size_t started = 1;
+	for(size_t t = 0; t < b->threads; t++) {
+		workers[t] = (ht_bulk_worker_t){ b, t, phase };
+	}
+	for(; started < b->threads; started++) {
+		if(thrd_create(&tids[started], ht_bulk_worker, &workers[started]) != thrd_success) {
+			break;
+		}
+	}
+	phase(b, 0);
+	for(size_t t = started; t < b->threads; t++) phase(b, t);
+	for(size_t t = 1; t < started; t++) thrd_join(tids[t], NULL);
+}
+
+bool ht_bulk_build(
+	hopscotch_hash_table_t *ht,
+	const uint8_t *const *keys,
+	const uint8_t *const *values,
+	size_t count,
+	size_t threads
+) {
+	if(!ht || !keys || !values || ht->arena) return false;
+	ht_resize_wait(ht);
+	if(atomic_load(&ht->migration) || ht_size_exact(ht) != 0) return false;
+	if(count == 0) return true;
+
+	// Grow the empty table up front, it would grow during the build anyway.
+	// A cache keeps its capacity.
+	unsigned percent = atomic_load(&ht->grow_load_percent);
+	size_t capacity = ht_capacity(ht);
+	uint64_t now = ht_cache_now(ht);
+	if(percent && !now && count * 100 > capacity * percent) {
+		size_t target = capacity;
+		while(count * 100 > target * percent) target *= 2;
+		ht_resize(ht, target);
+		ht_resize_wait(ht);
+	}
+
+	ht_bulk_t b = {
+		.ht = ht,
+		.array = atomic_load(&ht->array),
+		.keys = keys,
+		.values = values,
+		.count = count,
+		.expiry = ht_cache_expiry(now, atomic_load(&ht->cache_ttl))
+	};
+	unsigned capacity_bits = (unsigned)__builtin_ctzll(b.array->capacity);
+	b.bits = capacity_bits < HT_BULK_RADIX_BITS ? capacity_bits : HT_BULK_RADIX_BITS;
+	b.buckets = b.array->capacity >> b.bits;
+	b.threads = threads ? threads : 1;
+	if(b.threads > HT_BULK_MAX_THREADS) b.threads = HT_BULK_MAX_THREADS;
+	if(b.threads > b.buckets) b.threads = b.buckets;
+
+	b.hashes = malloc(count * sizeof(uint64_t));
+	b.hist = calloc(b.threads * b.buckets, sizeof(size_t));
+	b.start = calloc(b.buckets + 1, sizeof(size_t));
+	b.entries = malloc(count * sizeof(ht_bulk_entry_t));
+	b.placed = calloc(b.threads, sizeof(size_t));
+	b.left = calloc(b.threads, sizeof(size_t));
+	bool ret_val = b.hashes && b.hist && b.start && b.entries && b.placed && b.left;
+	if(ret_val) {
+		ht_bulk_run(&b, ht_bulk_hash);
+
+		// Bucket q starts after all earlier buckets, slice t after the
+		// earlier slices of the same bucket.
+		size_t pos = 0;
+		for(size_t q = 0; q < b.buckets; q++) {
+			b.start[q] = pos;
+			for(size_t t = 0; t < b.threads; t++) {
+				size_t n = b.hist[t * b.buckets + q];
+				b.hist[t * b.buckets + q] = pos;
+				pos += n;
+			}
+		}
+		b.start[b.buckets] = pos;
+		ht_bulk_run(&b, ht_bulk_scatter);
+		ht_bulk_run(&b, ht_bulk_place);
+		ret_val = !atomic_load(&b.failed);
+	}
+
+	if(ret_val) {
+		size_t placed = 0;
+		for(size_t t = 0; t < b.threads; t++) placed += b.placed[t];
+		atomic_fetch_add(&ht->size, (int64_t)placed);
+
+		// Published by the thread joins, the rest goes through the usual path.
+		for(size_t t = 0; t < b.threads; t++) {
+			size_t first_bucket, last_bucket;
+			ht_bulk_share(b.buckets, b.threads, t, &first_bucket, &last_bucket);
+			for(size_t i = 0; i < b.left[t]; i++) {
+				ht_bulk_entry_t e = b.entries[b.start[first_bucket] + i];
+				ht_write_t w = { .mode = HT_WRITE_SET, .value = values[e.idx] };
+				ret_val &= ht_insert_hashed(ht, e.hash, keys[e.idx], &w) != HT_INSERT_FAILED;
+			}
+		}
+	}
+
+	free(b.hashes);
+	free(b.hist);
+	free(b.start);
+	free(b.entries);
+	free(b.placed);
+	free(b.left);
+	return ret_val;
+}
+
+//------------------------------------------------------------------------------
+// Variable-length API.
+//------------------------------------------------------------------------------
+// The table takes its own copies: short data inline in the slot, long data in
+// an arena block. A block is retired only after its reference has left the
+// slot under the slot version and is reused once no reader can copy it.
+bool ht_insert_var(
+	hopscotch_hash_table_t *ht,
+	const uint8_t *key,
+	size_t key_len,
+	const uint8_t *value,
+	size_t value_len
+) {
+	if(!ht || !ht->arena || !key) return false;
+	if(!value && value_len) return false;
+
+	uint8_t key_ref[HT_VAR_REF_SIZE];
+	uint8_t value_ref[HT_VAR_REF_SIZE];
+	if(!ht_var_make(ht->arena, key_ref, key, key_len, false)) return false;
+	if(!ht_var_make(ht->arena, value_ref, value, value_len, false)) {
+		ht_var_release(ht, key_ref, false);
+		return false;
+	}
+
+	uint8_t old_value[HT_VAR_REF_SIZE];
+	ht_write_t w = { .mode = HT_WRITE_SET, .value = value_ref, .old_value = old_value };
+	switch(ht_insert_hashed(ht, ht_hash(ht, key, key_len), key_ref, &w)) {
+	case HT_INSERT_ADDED:
+		return true;
+	case HT_INSERT_UPDATED:
+		// The slot keeps its own key.
+		ht_var_release(ht, key_ref, false);
+		ht_var_release(ht, old_value, true);
+		return true;
+	default:
+		ht_var_release(ht, key_ref, false);
+		ht_var_release(ht, value_ref, false);
+		return false;
+	}
+}
+
+bool ht_remove_var(
+	hopscotch_hash_table_t *ht,
+	const uint8_t *key,
+	size_t key_len
+) {
+	if(!ht || !ht->arena || !key) return false;
+
+	uint8_t probe[HT_VAR_REF_SIZE];
+	if(!ht_var_make(ht->arena, probe, key, key_len, true)) return false;
+
+	uint8_t key_ref[HT_VAR_REF_SIZE];
+	uint8_t value_ref[HT_VAR_REF_SIZE];
+	if(!ht_remove_hashed(ht, ht_hash(ht, key, key_len), probe, key_ref, value_ref)) {
+		return false;
+	}
+	ht_var_release(ht, key_ref, true);
+	ht_var_release(ht, value_ref, true);
+	return true;
+}
+
+bool ht_contains_var(
+	hopscotch_hash_table_t *ht,
+	const uint8_t *key,
+	size_t key_len,
+	uint8_t *value,
+	size_t value_capacity,
+	size_t *value_len
+) {
+	if(!ht || !ht->arena || !key) return false;
+
+	uint8_t probe[HT_VAR_REF_SIZE];
+	if(!ht_var_make(ht->arena, probe, key, key_len, true)) return false;
+
+	ht_var_out_t out = { .buf = value, .capacity = value ? value_capacity : 0 };
+	if(!ht_contains_hashed(ht, ht_hash(ht, key, key_len), probe, NULL,
+		(value || value_len) ? &out : NULL))
+	{
+		return false;
+	}
+	if(value_len) *value_len = out.len;
+	return true;
+}
+
+//------------------------------------------------------------------------------
+// File-backed tables.
+//------------------------------------------------------------------------------
+// The file names the hash function by ID, a function pointer would not
+// survive the restart.
+static const hash_function_f ht_hash_ids[] = {
+	[HT_HASH_ID_NONE] = NULL,
+	[HT_HASH_ID_MURMUR] = murmur_custom_hash,
+	[HT_HASH_ID_JENKINS] = jenkins_one_at_a_time_hash,
+	[HT_HASH_ID_CRC32C] = crc32c_hash,
+	[HT_HASH_ID_XXH3] = xxh3_custom_hash,
+	[HT_HASH_ID_DUMMY] = dummy_set_1_hash
+};
+
+static ht_hash_id_t ht_hash_id(hash_function_f hash_function) {
+	for(size_t id = HT_HASH_ID_MURMUR; id <= HT_HASH_ID_DUMMY; id++) {
+		if(ht_hash_ids[id] == hash_function) return (ht_hash_id_t)id;
+	}
+	return HT_HASH_ID_NONE;
+}
+
+static inline ht_mmap_header_t *ht_mmap_header(const hopscotch_hash_table_t *ht) {
+	return (ht_mmap_header_t *)((uint8_t *)ht - HT_MMAP_HEADER_SIZE);
+}
+
+static bool ht_mmap_header_valid(const ht_mmap_header_t *header, size_t file_size) {
+	if(header->magic != HT_MMAP_MAGIC || header->version != HT_MMAP_VERSION) return false;
+	// The descriptors are stored as they are laid out in memory.
+	if(header->buffer_header_size != ht_buffer_header_size() ||
+		header->node_size != sizeof(hash_node_t))
+	{
+		return false;
+	}
+	if(header->layout != HT_LAYOUT_AOS && header->layout != HT_LAYOUT_SOA) return false;
+	if(header->hash_id <= HT_HASH_ID_NONE || header->hash_id > HT_HASH_ID_DUMMY) return false;
+	if(header->key_size == 0 || header->key_size > HT_MAX_KEY_SIZE) return false;
+	if(header->value_size == 0 || header->value_size > HT_MAX_VALUE_SIZE) return false;
+	if(header->layout == HT_LAYOUT_AOS &&
+		(header->key_size != KEY_SIZE || header->value_size != VALUE_SIZE))
+	{
+		return false;
+	}
+	// Every slot takes more than a byte, a bigger capacity is garbage.
+	size_t capacity = header->capacity;
+	if(capacity == 0 || (capacity & (capacity - 1)) || capacity > file_size) return false;
+
+	ht_shape_t shape = {
+		(ht_layout_t)header->layout, header->key_size, header->value_size, false
+	};
+	return header->arena_size == 0 && header->file_size == file_size &&
+		file_size == HT_MMAP_HEADER_SIZE + ht_buffer_size(capacity, shape, 0);
+}
+
+// True if another published slot of the neighborhood of idx holds its key.
+static bool ht_mmap_recover_copied(ht_array_t *a, size_t idx, uint64_t word) {
+	size_t home = INDEX(word, a->mask);
+	for(size_t d = 0; d < HOP_RANGE * MAX_RELOCATION_FACTOR && d < a->capacity; d++) {
+		size_t other = (home + d) & a->mask;
+		if(other != idx &&
+			ht_tag_live(atomic_load_explicit(&a->tags[other], memory_order_relaxed)) &&
+			atomic_load_explicit(ht_slot_hop_info(a, other), memory_order_relaxed) == word &&
+			ht_slot_key_equal(a, other, ht_slot_key(a, idx)))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+// The last process died with the table open. Claimed slots and adds never
+// published (a slot word without a live tag) are dropped, so is any other slot
+// a writer held locked, unless it still has a live tag: that is the source of
+// a move, never modified, or an entry updated in place (its value may be torn).
+// The source is dropped only if the destination was published already. Lock
+// and chunk words are cleared and the size is counted again.
+static void ht_mmap_recover(hopscotch_hash_table_t *ht) {
+	ht_array_t *a = atomic_load(&ht->array);
+	int64_t size = 0;
+	for(size_t i = 0; i < a->capacity; i++) {
+		uint8_t tag = atomic_load_explicit(&a->tags[i], memory_order_relaxed);
+		uint64_t word = atomic_load_explicit(ht_slot_hop_info(a, i), memory_order_relaxed);
+		bool locked = atomic_load_explicit(&a->versions[i], memory_order_relaxed) & 1;
+		bool live = ht_tag_live(tag) && (word & HT_SLOT_USED);
+		if((word || tag) && (!live || (locked && ht_mmap_recover_copied(a, i, word)))) {
+			ht_array_clear_slot(a, i);
+			continue;
+		}
+		size += live;
+	}
+	memset((void *)a->versions, 0, a->capacity * sizeof(uint32_t));
+	memset((void *)a->timestamps, 0, a->capacity * sizeof(uint32_t));
+	memset((void *)a->chunk_state, 0, a->chunks * sizeof(uint32_t));
+	ht_counter_reset(ht);
+	atomic_store(&ht->size, size);
+}
+
+hopscotch_hash_table_t *ht_create_mmap(
+	const char *path,
+	size_t capacity,
+	ht_layout_t layout,
+	hash_function_f hash_function,
+	uint64_t seed
+) {
+	if(!path || capacity == 0 || (capacity & (capacity - 1))) return NULL;
+	if(layout != HT_LAYOUT_AOS && layout != HT_LAYOUT_SOA) return NULL;
+	ht_hash_id_t hash_id = ht_hash_id(hash_function ? hash_function : murmur_custom_hash);
+	if(hash_id == HT_HASH_ID_NONE) return NULL;
+
+	ht_shape_t shape = ht_layout_shape(layout);
+	size_t file_size = HT_MMAP_HEADER_SIZE + ht_buffer_size(capacity, shape, 0);
+	int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if(fd < 0) return NULL;
+	// The file reads as zeros, its blocks are only allocated once written.
+	if(ftruncate(fd, (off_t)file_size) != 0) {
+		close(fd);
+		return NULL;
+	}
+	uint8_t *map = mmap(NULL, file_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED) return NULL;
+
+	hopscotch_hash_table_t *ht = ht_buffer_init(map + HT_MMAP_HEADER_SIZE, capacity,
+		shape, 0, ht_hash_ids[hash_id], seed, true);
+	ht->map_size = file_size;
+	// Resized arrays would live on the heap, outside the file.
+	atomic_store(&ht->grow_load_percent, 0);
+	atomic_store(&ht->shrink_load_percent, 0);
+
+	ht_mmap_header_t *header = (ht_mmap_header_t *)map;
+	header->version = HT_MMAP_VERSION;
+	header->layout = layout;
+	header->capacity = capacity;
+	header->key_size = shape.key_size;
+	header->value_size = shape.value_size;
+	header->arena_size = 0;
+	header->hash_id = hash_id;
+	header->seed = seed;
+	header->file_size = file_size;
+	header->buffer_header_size = ht_buffer_header_size();
+	header->node_size = sizeof(hash_node_t);
+	atomic_store(&header->clean, 0);
+	header->magic = HT_MMAP_MAGIC;
+	return ht;
+}
+
+hopscotch_hash_table_t *ht_open_mmap(const char *path) {
+	if(!path) return NULL;
+	int fd = open(path, O_RDWR);
+	if(fd < 0) return NULL;
+
+	ht_mmap_header_t header;
+	struct stat st;
+	bool valid = fstat(fd, &st) == 0 && st.st_size >= HT_MMAP_HEADER_SIZE &&
+		pread(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header) &&
+		ht_mmap_header_valid(&header, (size_t)st.st_size);
+	// No MAP_POPULATE: only the pages a call touches are read in.
+	uint8_t *map = valid ? mmap(NULL, header.file_size, PROT_READ | PROT_WRITE,
+		MAP_SHARED, fd, 0) : MAP_FAILED;
+	close(fd);
+	if(map == MAP_FAILED) return NULL;
+
+	ht_shape_t shape = {
+		(ht_layout_t)header.layout, header.key_size, header.value_size, false
+	};
+	hopscotch_hash_table_t *ht = ht_buffer_attach(map + HT_MMAP_HEADER_SIZE,
+		header.capacity, shape, 0);
+	ht->hash_function = ht_hash_ids[header.hash_id];
+	ht->seed = header.seed;
+	ht->map_size = header.file_size;
+
+	ht_mmap_header_t *mapped = (ht_mmap_header_t *)map;
+	if(!atomic_load(&mapped->clean)) ht_mmap_recover(ht);
+	atomic_store(&mapped->clean, 0);
+	return ht;
+}
+
+bool ht_checkpoint(hopscotch_hash_table_t *ht) {
+	if(!ht || !ht->map_size) return false;
+	return msync(ht_mmap_header(ht), ht->map_size, MS_SYNC) == 0;
+}
+
+// Marks the file clean once everything else is on disk.
+static void ht_mmap_close(hopscotch_hash_table_t *ht) {
+	ht_mmap_header_t *header = ht_mmap_header(ht);
+	size_t map_size = ht->map_size;
+	if(ht_checkpoint(ht)) {
+		atomic_store(&header->clean, 1);
+		msync(header, HT_MMAP_HEADER_SIZE, MS_SYNC);
+	}
+	munmap(header, map_size);
 }
 
 // !DO NOT USE!
 // This is non-atomic !non-thread-safe! Exposed to compare with atomic variants
 // to estimate complexity of the code.
 bool __ht_contains(hopscotch_hash_table_t* ht, const uint8_t* key) {
-	uint32_t h = murmur_custom_hash(key);
-	size_t home = h % ht->capacity;
+	ht_array_t *a = atomic_load(&ht->array);
+	uint64_t h = ht_hash(ht, key, KEY_SIZE);
+	size_t home = h % a->capacity;
 
 	for(int i = 0; i < HOP_RANGE * MAX_RELOCATION_FACTOR; i++) {
-		size_t idx = (home + i) % ht->capacity;
-		uint64_t node_info = atomic_load(&ht->nodes[idx].hop_info);
+		size_t idx = (home + i) % a->capacity;
+		uint64_t node_info = atomic_load(ht_slot_hop_info(a, idx));
 		
-		// Skip empty slots (full hash == 0)
-		if((node_info >> 32) == 0) continue;
+		// Skip empty slots
+		if(!(node_info & HT_SLOT_USED)) continue;
 		
 		// Full key comparison (critical!)
-		if(memcmp(ht->nodes[idx].key, key, KEY_SIZE) == 0) {
+		if(memcmp(ht_slot_key(a, idx), key, KEY_SIZE) == 0) {
 			return true;
 		}
 	}
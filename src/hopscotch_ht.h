@@ -13,6 +13,10 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "hopscotch_ht_epoch.h"
 
 //------------------------------------------------------------------------------
 // Hash table related functions and defines.
@@ -20,10 +24,68 @@
 #define KEY_SIZE (64)
 #define VALUE_SIZE (128)
 #define HOP_RANGE (32)
+// Bounds of the key and value sizes of ht_create_sized tables.
+#define HT_MAX_KEY_SIZE (256)
+#define HT_MAX_VALUE_SIZE (1024)
 #define MAX_RELOCATION_FACTOR (5)
-#define HASH_HOP_INFO_OFFSET (32)
-#define HOP_INFO_MASK (0xFFFFFFFF)
-#define HASH_MASK (0xFFFFFFFF00000000)
+// How far ht_insert looks for a free slot, a slot beyond the neighborhood of
+// HOP_RANGE * MAX_RELOCATION_FACTOR is bubbled back by displacing residents.
+#define HT_ADD_RANGE (4096)
+// Keys prefetched together by the batched calls.
+#define HT_BATCH_GROUP (16)
+// Home buckets a scan copies and validates at once (see ht_iter_begin).
+#define HT_ITER_BLOCK (1024)
+// Most threads ht_bulk_build runs on and the home buckets it sorts at once
+// (log2).
+#define HT_BULK_MAX_THREADS (256)
+#define HT_BULK_RADIX_BITS (12)
+
+//------------------------------------------------------------------------------
+// Cache mode related defines.
+//------------------------------------------------------------------------------
+/*
+Every slot of a table created by ht_create_cache has an expiry word next to its
+version, other tables have none. It is only looked at in cache mode (see
+ht_set_cache_mode).
++------------+----------------------------------------+
+|     63     |  62 ... 0                              |
+|------------|----------------------------------------|
+| Referenced |  Expiry, ms since the epoch, 0 - never |
++------------+----------------------------------------+
+*/
+#define HT_EXPIRY_REF (1ULL << 63)
+// Evictions an insert into a full neighborhood tries before it fails.
+#define HT_CACHE_EVICT_TRIES (4)
+// Slots every insert in cache mode sweeps for expired entries.
+#define HT_CACHE_SWEEP_SLOTS (16)
+
+//------------------------------------------------------------------------------
+// Structural statistics related defines.
+//------------------------------------------------------------------------------
+// Built with HT_STATS=1 the table counts where its keys are found and placed,
+// how its relocations go and how often slot locks are retried (see
+// ht_stats_t). Otherwise the counters are compiled out.
+#ifndef HT_STATS
+#define HT_STATS (0)
+#endif
+// Histogram bins. Distances and chain lengths go by powers of two (0, 1, 2-3,
+// ..., 128 and more), neighborhood occupancy by HOP_RANGE / 8 slots.
+#define HT_STATS_BINS (9)
+
+//------------------------------------------------------------------------------
+// Element counter related defines.
+//------------------------------------------------------------------------------
+// The element count is striped over HT_COUNTER_STRIPES cache lines. A stripe
+// is folded into the shared size once it drifts by the flush threshold:
+// capacity / (HT_COUNTER_STRIPES * 64), at least 1 and at most
+// HT_COUNTER_FLUSH. ht_size() is thus off by less than 1/64 of the capacity.
+#define HT_COUNTER_STRIPES (64)
+#define HT_COUNTER_FLUSH (64)
+// Occupancy bit of the hop_info word, the other 63 bits keep the hash.
+#define HT_SLOT_USED (1ULL << 63)
+// Tag of an entry written by an add which is not published yet, no hash maps
+// to it (see ht_array_insert).
+#define HT_TAG_PENDING (0xFF)
 
 #define INDEX(hash, mask) ((hash) & (mask))
 #define PRINT_KEY_VALUE(_k, _v) \
@@ -48,65 +110,784 @@
 
 /*
 hop_info type diagram.
-Lower bits for hop, upper for hash
-+-----------+------------+
-| 63 ... 32 | 31 3 2 1 0 |
-|-----------|------------|
-|   Hash    |  Hop bits  |
-+-----------+------------+
+The occupancy bit and the lower 63 bits of the 64-bit hash, 0 if the slot is
+free. The home bucket is the hash masked by capacity - 1, the tag (bits
+55..62) and the full word filter key compares.
++------+-----------+
+|  63  | 62 ... 0  |
+|------|-----------|
+| Used |   Hash    |
++------+-----------+
 */
 typedef struct {
 	uint8_t value[VALUE_SIZE];
 	uint8_t key[KEY_SIZE];
-	atomic_uint_fast64_t hop_info; // Lower bits for hop, upper for hash
+	atomic_uint_fast64_t hop_info; // Occupancy bit and hash
 } hash_node_t;
 
-// %32 size
+//------------------------------------------------------------------------------
+// Fingerprint tags related defines.
+//------------------------------------------------------------------------------
+// Every slot has an 8-bit tag (upper hash bits, 0 for a free slot) in a
+// contiguous array. HOP_RANGE tags are compared at once by the kernel
+// selected at runtime from the CPU features.
+typedef enum {
+	HT_TAG_KERNEL_AUTO = 0,
+	HT_TAG_KERNEL_SCALAR,
+	HT_TAG_KERNEL_SSE2,
+	HT_TAG_KERNEL_AVX2
+} ht_tag_kernel_t;
+
+//------------------------------------------------------------------------------
+// Memory placement related defines.
+//------------------------------------------------------------------------------
+// Pages backing a table buffer. Explicit huge pages need a reserved pool
+// (vm.nr_hugepages), a table falls back to THP without one.
+typedef enum {
+	HT_PAGES_DEFAULT = 0,
+	HT_PAGES_THP,
+	HT_PAGES_HUGE_2MB,
+	HT_PAGES_HUGE_1GB
+} ht_page_mode_t;
+
+// NUMA placement of a table buffer, set with mbind before the first touch.
+typedef enum {
+	HT_NUMA_DEFAULT = 0,
+	HT_NUMA_INTERLEAVE,
+	HT_NUMA_BIND
+} ht_numa_policy_t;
+
+// Allocation options of ht_create_opts, zero-initialized is the heap default.
+// Any other choice maps the buffer. init_threads > 1 first-touches the pages
+// in parallel, with HT_NUMA_DEFAULT every page lands on the node of the
+// thread touching it.
 typedef struct {
-	hash_node_t* nodes;
-	_Atomic size_t size;
+	ht_page_mode_t pages;
+	ht_numa_policy_t numa;
+	unsigned numa_node;
+	unsigned init_threads;
+} ht_alloc_options_t;
+#define HT_INIT_MAX_THREADS (64)
+// A first-touch thread writes one byte every HT_TOUCH_STEP bytes.
+#define HT_TOUCH_STEP (4096)
+
+//------------------------------------------------------------------------------
+// Online resize related defines.
+//------------------------------------------------------------------------------
+// Buckets are migrated in chunks. Every chunk has a state word in the array
+// which also counts writers currently working inside the chunk.
+#define HT_RESIZE_CHUNK (64)
+// Number of chunks every API call helps to migrate while a resize is running.
+#define HT_RESIZE_HELP_CHUNKS (1)
+// Default load factor triggers (percent of the capacity, 0 disables).
+#define HT_GROW_LOAD_PERCENT (90)
+#define HT_SHRINK_LOAD_PERCENT (10)
+// A failed insert only grows the table if it is loaded at least that much.
+#define HT_GROW_ON_FAIL_LOAD_PERCENT (75)
+
+/*
+Chunk state word diagram.
++--------+--------+-------+---------------+
+|   30   |   29   |  28   | 27 ... 0      |
+|--------|--------|-------|---------------|
+|  Done  | Closed | Stuck | Writers count |
++--------+--------+-------+---------------+
+*/
+#define HT_CHUNK_WRITERS_MASK (0x0FFFFFFFu)
+#define HT_CHUNK_STUCK (1u << 28)
+#define HT_CHUNK_CLOSED (1u << 29)
+#define HT_CHUNK_DONE (1u << 30)
+
+struct ht_array;
+
+// Migration out of an array, embedded into the source array.
+typedef struct {
+	struct ht_array *from;
+	struct ht_array *to;
+	_Atomic size_t chunk_cursor;
+	_Atomic size_t chunks_done;
+	_Atomic size_t chunks_stuck;
+	// Set while the migration is moved into a bigger target.
+	_Atomic bool retargeting;
+} ht_migration_t;
+
+// Slot layout of a table.
+// HT_LAYOUT_AOS - array of hash_node_t (hop_info next to key and value).
+// HT_LAYOUT_SOA - hop_info words, keys and values in parallel arrays, a full
+//                 neighborhood's metadata takes 4 cache lines.
+// HT_LAYOUT_VARLEN - SoA with HT_VAR_REF_SIZE references instead of keys and
+//                 values, see ht_create_var.
+typedef enum {
+	HT_LAYOUT_AOS = 0,
+	HT_LAYOUT_SOA,
+	HT_LAYOUT_VARLEN
+} ht_layout_t;
+
+//------------------------------------------------------------------------------
+// Variable-length keys and values related defines.
+//------------------------------------------------------------------------------
+/*
+A HT_LAYOUT_VARLEN slot holds a 16-byte reference for the key and another one
+for the value. Data up to HT_VAR_INLINE bytes is kept in the reference itself,
+longer data lives in a slab arena at the end of the ht_create_var buffer.
++-----------+----------------------------------+
+|  0 ... 3  |  4 ... 15                        |
+|-----------|----------------------------------|
+|  Length   |  Data (length <= HT_VAR_INLINE)  |
+|           |  0, arena offset (bytes 8..15)   |
++-----------+----------------------------------+
+*/
+#define HT_VAR_REF_SIZE (16)
+#define HT_VAR_INLINE (12)
+// Arena blocks are powers of two between these sizes, the largest block
+// bounds the length of a key or value.
+#define HT_ARENA_MIN_BLOCK (16)
+#define HT_ARENA_MAX_BLOCK (65536)
+#define HT_ARENA_CLASSES (13)
+
+// Freed blocks go to a lock-free list of their size class, a list head is
+// (ABA tag << 32) | (offset / HT_ARENA_MIN_BLOCK), offset 0 is never handed out.
+typedef struct {
+	uint8_t *base;
+	size_t size;
+	_Atomic size_t top;
+	_Atomic size_t used;
+	_Atomic uint64_t free_lists[HT_ARENA_CLASSES];
+} ht_arena_t;
+
+// Bucket array. The initial array lives in the ht_create buffer, arrays
+// created by a resize are allocated as a single block each. Slot fields are
+// addressed as base + index * stride, whatever the layout is.
+typedef struct ht_array {
+	uint8_t *hop_info_base;
+	uint8_t *key_base;
+	uint8_t *value_base;
+	size_t hop_info_stride;
+	size_t key_stride;
+	size_t value_stride;
+	uint8_t *slots;
+	_Atomic uint8_t *tags;
+	size_t key_size;
+	size_t value_size;
+	ht_arena_t *arena;
+	_Atomic uint32_t *versions;
+	_Atomic uint32_t *timestamps;
+	_Atomic uint64_t *expiry;
+	// Counter stripes of the table (HT_STATS).
+	struct ht_counter_stripe *stripes;
+	ht_layout_t layout;
+	_Atomic uint32_t *chunk_state;
 	size_t capacity;
 	size_t mask;
+	size_t chunks;
+	size_t chunk_size;
+	bool embedded;
+	// Mapped arrays: the mapping length and the pages and policy they got.
+	size_t map_size;
+	ht_page_mode_t pages;
+	ht_numa_policy_t numa;
+	// Written during a resize, away from the fields every call reads.
+	_Alignas(64) _Atomic bool resizing;
+	ht_migration_t migration;
+} ht_array_t;
+
+// Hash of a key of len bytes. Bound to a table at creation, see ht_create.
+typedef uint64_t (*hash_function_f)(const uint8_t *key, size_t len, uint64_t seed);
+
+// Hash kernels selected at runtime from the CPU features: the multi-key
+// murmur kernel of the batched calls and the CRC32C instruction of
+// crc32c_hash (SSE4.2 unless HT_HASH_KERNEL_SCALAR is set, then software).
+// AUTO times the murmur kernels the CPU supports and keeps the fastest.
+typedef enum {
+	HT_HASH_KERNEL_AUTO = 0,
+	HT_HASH_KERNEL_SCALAR,
+	HT_HASH_KERNEL_AVX2,
+	HT_HASH_KERNEL_AVX512
+} ht_hash_kernel_t;
+
+// Structural counters of a stripe (HT_STATS builds).
+typedef struct {
+	_Atomic uint64_t probe_distance[HT_STATS_BINS];
+	_Atomic uint64_t occupancy[HT_STATS_BINS];
+	_Atomic uint64_t relocation_chain[HT_STATS_BINS];
+	_Atomic uint64_t relocation_attempts;
+	_Atomic uint64_t relocations;
+	_Atomic uint64_t range_full;
+	_Atomic uint64_t no_candidate;
+	_Atomic uint64_t insert_cas_retries;
+	_Atomic uint64_t remove_cas_retries;
+} ht_probe_counters_t;
+
+// Element counter stripe, one cache line each. Threads update the stripe
+// they were given on first use and fold it into the shared size from time to
+// time (see HT_COUNTER_FLUSH).
+typedef struct ht_counter_stripe {
+	_Alignas(64) _Atomic int64_t count;
+	// Cache mode only.
+	_Atomic uint64_t hits;
+	_Atomic uint64_t misses;
+	_Atomic uint64_t evictions;
+	_Atomic uint64_t expirations;
+	// Slots the cache sweep of the stripe has looked at, every stripe sweeps
+	// from its own place.
+	_Atomic size_t sweep_cursor;
+#if HT_STATS
+	ht_probe_counters_t probe;
+#endif
+} ht_counter_stripe_t;
+
+// %32 size
+typedef struct {
+	// Read by every call, written by resizes only.
+	_Atomic(ht_array_t *) array;
+	_Atomic(ht_migration_t *) migration;
+	size_t min_capacity;
+	_Atomic unsigned grow_load_percent;
+	_Atomic unsigned shrink_load_percent;
+	_Atomic int64_t counter_flush;
+	// Cache mode and the TTL of entries written without one (0 - none).
+	_Atomic bool cache;
+	_Atomic uint64_t cache_ttl;
+	ht_arena_t *arena;
+	hash_function_f hash_function;
+	uint64_t seed;
+	size_t key_size;
+	// Size of the file mapping, 0 for a heap table (see ht_create_mmap).
+	size_t map_size;
+	// Placement of the buffer and of arrays created by a resize, the length
+	// of the buffer mapping (0 - heap, see ht_create_opts).
+	ht_alloc_options_t alloc;
+	size_t alloc_size;
+
+	// Written by counter flushes and resizes.
+	_Alignas(64) _Atomic int64_t size;
+	// Objects this table handed to the epoch reclamation (see
+	// hopscotch_ht_epoch.h), ht_free waits for them if any.
+	_Atomic size_t retired;
+	_Atomic size_t grows;
+	_Atomic size_t shrinks;
+
+	ht_counter_stripe_t stripes[HT_COUNTER_STRIPES];
 } hopscotch_hash_table_t;
 
+// Table statistics snapshot (see ht_get_stats).
+typedef struct {
+	size_t size;
+	size_t capacity;
+	double load_factor;
+	unsigned grow_load_percent;
+	unsigned shrink_load_percent;
+	size_t grows;
+	size_t shrinks;
+	bool resize_in_progress;
+	size_t resize_from_capacity;
+	size_t resize_to_capacity;
+	size_t resize_chunks_total;
+	size_t resize_chunks_done;
+	size_t resize_chunks_stuck;
+	ht_tag_kernel_t tag_kernel;
+	ht_hash_kernel_t hash_kernel;
+	size_t arena_size;
+	size_t arena_used;
+	ht_page_mode_t pages;
+	ht_numa_policy_t numa;
+	bool cache;
+	size_t cache_hits;
+	size_t cache_misses;
+	double cache_hit_rate;
+	// Entries dropped for room while still valid, and expired ones.
+	size_t cache_evictions;
+	size_t cache_expirations;
+	// Structural statistics, all zero unless built with HT_STATS:
+	// - probe_distance - distance from the home bucket of the slots keys are
+	//   found in, added to and removed from.
+	// - occupancy - occupied slots of the first HOP_RANGE of the home bucket
+	//   when a new key is added.
+	// - relocation_chain - residents displaced to add a key.
+	// - relocation_attempts, relocations - displacement steps tried and done.
+	// - range_full - adds which found no free slot within HT_ADD_RANGE.
+	// - no_candidate - adds which found one but no resident to displace.
+	// - insert_cas_retries, remove_cas_retries - failed CAS of the free slot
+	//   claims and slot version locks of the writes.
+	bool probe_stats;
+	size_t probe_distance[HT_STATS_BINS];
+	size_t occupancy[HT_STATS_BINS];
+	size_t relocation_chain[HT_STATS_BINS];
+	size_t relocation_attempts;
+	size_t relocations;
+	size_t range_full;
+	size_t no_candidate;
+	size_t insert_cas_retries;
+	size_t remove_cas_retries;
+} ht_stats_t;
+
+// Structural violations found by ht_validate.
+// - HT_VIOLATION_TAG - the tag of a slot is not the one of its slot word.
+// - HT_VIOLATION_CLAIMED - a slot word without a tag or with the pending
+//   one, a claim or an add left behind.
+// - HT_VIOLATION_RANGE - an entry outside the neighborhood of its home bucket,
+//   lookups never reach it.
+// - HT_VIOLATION_HASH - the slot word is not the hash of the stored key.
+// - HT_VIOLATION_REFERENCE - a variable-length key points outside the arena.
+// - HT_VIOLATION_DUPLICATE - the key is stored again further in the
+//   neighborhood (reported at the first copy).
+// - HT_VIOLATION_LOCKED - the slot version is odd, a write left it locked.
+// - HT_VIOLATION_SIZE - the element count is not the number of entries
+//   (slot SIZE_MAX).
+typedef enum {
+	HT_VIOLATION_TAG = 0,
+	HT_VIOLATION_CLAIMED,
+	HT_VIOLATION_RANGE,
+	HT_VIOLATION_HASH,
+	HT_VIOLATION_REFERENCE,
+	HT_VIOLATION_DUPLICATE,
+	HT_VIOLATION_LOCKED,
+	HT_VIOLATION_SIZE
+} ht_violation_kind_t;
+
+typedef struct {
+	ht_violation_kind_t kind;
+	size_t slot;
+	// Home bucket taken from the slot word, SIZE_MAX for a free slot.
+	size_t home;
+	uint64_t word;
+} ht_violation_t;
+
+// Report of ht_validate, violation[] keeps the first ones by slot.
+#define HT_VALIDATE_MAX_VIOLATIONS (16)
+typedef struct {
+	size_t capacity;
+	size_t entries;
+	size_t size;
+	size_t violations;
+	size_t reported;
+	ht_violation_t violation[HT_VALIDATE_MAX_VIOLATIONS];
+} ht_validate_report_t;
+
+// Read guard of ht_get_ref: the value inside the table and the slot version
+// it was found at.
+typedef struct {
+	const uint8_t *value;
+	size_t value_size;
+	_Atomic uint32_t *version;
+	uint32_t snapshot;
+} ht_ref_t;
+
+// Callback of ht_visit, value points into the table.
+typedef void (*ht_visit_f)(const uint8_t *value, size_t value_size, void *ctx);
+
+// Callback of ht_parallel_for_each, key and value point to copies.
+typedef void (*ht_for_each_f)(const uint8_t *key, const uint8_t *value, void *ctx);
+
+// Iterator of ht_iter_begin.
+typedef struct ht_iter ht_iter_t;
+
+// Callback of ht_upsert. value holds the stored value (exists) or zeros
+// (a new key) and is changed in place, under the slot version.
+typedef void (*ht_upsert_f)(uint8_t *value, size_t value_size, bool exists, void *ctx);
+
 //------------------------------------------------------------------------------
-// Hash functions related block.
+// File-backed tables related defines.
 //------------------------------------------------------------------------------
-typedef uint32_t (*hash_function_f)(const uint8_t *);
+/*
+A file-backed table is a MAP_SHARED mapping of the whole file: a header page,
+then the ht_create buffer (table header, array and arena descriptors, slots,
+arena data). The slots and the arena only keep offsets, the pointers of the
+descriptors are rebuilt from the header page by ht_open_mmap.
++-------------------------+--------------------------------------------+
+|  0 ... 4095             |  4096 ...                                  |
+|-------------------------|--------------------------------------------|
+|  ht_mmap_header_t       |  ht_create buffer                          |
++-------------------------+--------------------------------------------+
+*/
+#define HT_MMAP_MAGIC (0x3154484353504F48ULL) // "HOPSCHT1"
+#define HT_MMAP_VERSION (4)
+#define HT_MMAP_HEADER_SIZE (4096)
+
+// Hash functions a file can name, a table bound to any other function can
+// not be file-backed.
+typedef enum {
+	HT_HASH_ID_NONE = 0,
+	HT_HASH_ID_MURMUR,
+	HT_HASH_ID_JENKINS,
+	HT_HASH_ID_CRC32C,
+	HT_HASH_ID_XXH3,
+	HT_HASH_ID_DUMMY
+} ht_hash_id_t;
 
-// MurmurHash3 custom.
-uint32_t murmur_custom_hash(const uint8_t* );
+typedef struct {
+	uint64_t magic;
+	uint32_t version;
+	uint32_t layout;
+	uint64_t capacity;
+	uint64_t key_size;
+	uint64_t value_size;
+	uint64_t arena_size;
+	uint64_t hash_id;
+	uint64_t seed;
+	uint64_t file_size;
+	// Descriptor sizes of the build which wrote the file.
+	uint64_t buffer_header_size;
+	uint64_t node_size;
+	// Set while no process has the table open, cleared by ht_open_mmap.
+	_Atomic uint32_t clean;
+} ht_mmap_header_t;
+
+//------------------------------------------------------------------------------
+// Hash functions related block.
+//------------------------------------------------------------------------------
+// MurmurHash3 custom, keys of any length (the default of every table).
+uint64_t murmur_custom_hash(const uint8_t *, size_t, uint64_t);
 
 // Jenkins hash function.
-uint32_t jenkins_one_at_a_time_hash(const uint8_t *);
+uint64_t jenkins_one_at_a_time_hash(const uint8_t *, size_t, uint64_t);
 
 // Dummy hash function to test collisions.
-uint32_t dummy_set_1_hash(const uint8_t *);
+uint64_t dummy_set_1_hash(const uint8_t *, size_t, uint64_t);
+
+// CRC32C, two 32-bit chains widened to 64 bits. Uses the SSE4.2 instruction
+// when the CPU has it, the same result in software otherwise.
+uint64_t crc32c_hash(const uint8_t *, size_t, uint64_t);
+
+// XXH3-style wide hash, 16-byte stripes folded by 64x64->128 multiplies.
+uint64_t xxh3_custom_hash(const uint8_t *, size_t, uint64_t);
+
+// murmur_custom_hash of count 64-byte keys, 4 (AVX2) or 8 (AVX-512) keys in
+// parallel. hashes[i] equals murmur_custom_hash(keys[i], 64, seed).
+void murmur_custom_hash_batch(
+	const uint8_t *const *keys,
+	size_t count,
+	uint64_t seed,
+	uint64_t *hashes
+);
+
+// Process-wide hash kernel. HT_HASH_KERNEL_AUTO picks the best one the CPU
+// supports (also done on first use unless a kernel was set before), false if
+// the CPU lacks the kernel. The kernels are timed once per process.
+bool ht_set_hash_kernel(ht_hash_kernel_t kernel);
+ht_hash_kernel_t ht_get_hash_kernel(void);
+const char *ht_hash_kernel_name(ht_hash_kernel_t kernel);
 
 //------------------------------------------------------------------------------
 // Hash table related functions / API.
 //------------------------------------------------------------------------------
 void ht_print_debug(const hopscotch_hash_table_t * const ht);
 void ht_print_stats(const hopscotch_hash_table_t * const ht);
+void ht_get_stats(const hopscotch_hash_table_t * const ht, ht_stats_t *stats);
+// Writes the stats as one JSON object into buf like snprintf: at most size
+// bytes, returns the length the whole object needs.
+size_t ht_stats_json(const ht_stats_t *stats, char *buf, size_t size);
+size_t ht_capacity(const hopscotch_hash_table_t * const ht);
+// Approximate element count, a single load.
+size_t ht_size(const hopscotch_hash_table_t * const ht);
+// Exact element count once concurrent writers are done, sums all stripes.
+size_t ht_size_exact(const hopscotch_hash_table_t * const ht);
 void ht_zero(hopscotch_hash_table_t *ht);
-hopscotch_hash_table_t *ht_create(size_t capacity);
+// The hash function (NULL - murmur_custom_hash) and its seed are bound to the
+// table, every call hashes the keys with them.
+hopscotch_hash_table_t *ht_create(
+	size_t capacity,
+	hash_function_f hash_function,
+	uint64_t seed
+);
+hopscotch_hash_table_t *ht_create_ex(
+	size_t capacity,
+	ht_layout_t layout,
+	hash_function_f hash_function,
+	uint64_t seed
+);
+// SoA table with key_size / value_size bytes per slot instead of KEY_SIZE /
+// VALUE_SIZE, see HOPSCOTCH_DEFINE_TYPED in hopscotch_ht_define.h.
+hopscotch_hash_table_t *ht_create_sized(
+	size_t capacity,
+	size_t key_size,
+	size_t value_size,
+	hash_function_f hash_function,
+	uint64_t seed
+);
+// ht_create_ex with the buffer placed as options ask (NULL - heap). Huge
+// pages fall back to THP and a failed mbind to the default policy, ht_get_stats
+// reports what the current array got.
+hopscotch_hash_table_t *ht_create_opts(
+	size_t capacity,
+	ht_layout_t layout,
+	hash_function_f hash_function,
+	uint64_t seed,
+	const ht_alloc_options_t *options
+);
+const char *ht_page_mode_name(ht_page_mode_t pages);
+const char *ht_numa_policy_name(ht_numa_policy_t numa);
+// Online NUMA nodes (at most max of them) written to nodes, their count is
+// returned (1 - node 0 on a machine without NUMA). The node the calling
+// thread runs on right now, -1 if unknown.
+unsigned ht_numa_nodes(unsigned *nodes, unsigned max);
+int ht_numa_current_node(void);
+// Table in a MAP_SHARED mapping of path (created or truncated), AoS or SoA.
+// The hash function must be a bundled one (see ht_hash_id_t), the file keeps
+// its ID and the seed. A file-backed table does not resize.
+hopscotch_hash_table_t *ht_create_mmap(
+	const char *path,
+	size_t capacity,
+	ht_layout_t layout,
+	hash_function_f hash_function,
+	uint64_t seed
+);
+// Maps a table written by ht_create_mmap, pages are read in on first touch.
+// NULL if the file is not a table of this build.
+hopscotch_hash_table_t *ht_open_mmap(const char *path);
+// Writes the mapping back to its file (msync). The image is consistent if
+// no writer runs meanwhile. ht_free of a file-backed table checkpoints it.
+bool ht_checkpoint(hopscotch_hash_table_t *ht);
+// Hash of a key as the table computes it (for the ht_*_with_hash calls).
+uint64_t ht_hash(const hopscotch_hash_table_t *ht, const uint8_t *key, size_t len);
 void ht_free(hopscotch_hash_table_t *ht);
+
+// Process-wide tag match kernel. HT_TAG_KERNEL_AUTO picks the best one the
+// CPU supports (also done on first use), false if the CPU lacks the kernel.
+bool ht_set_tag_kernel(ht_tag_kernel_t kernel);
+ht_tag_kernel_t ht_get_tag_kernel(void);
+const char *ht_tag_kernel_name(ht_tag_kernel_t kernel);
+
+// Load factor triggers in percent of capacity, 0 disables the trigger.
+// The table never shrinks below the capacity given to ht_create.
+void ht_set_resize_policy(
+	hopscotch_hash_table_t *ht,
+	unsigned grow_load_percent,
+	unsigned shrink_load_percent
+);
+
+// Starts an online resize to new_capacity (power of two). Buckets are moved
+// by the following API calls, ht_resize_wait finishes the job in place.
+bool ht_resize(hopscotch_hash_table_t *ht, size_t new_capacity);
+void ht_resize_wait(hopscotch_hash_table_t *ht);
+
 bool ht_insert(
 	hopscotch_hash_table_t* ht,
-	hash_function_f hash_key,
 	const uint8_t *key,
 	const uint8_t *value
 );
 bool ht_remove_key(
 	hopscotch_hash_table_t *ht,
-	hash_function_f hash_function,
 	const uint8_t *key
 );
 
+// Not const: a lookup helps to migrate buckets when a resize is running.
 bool ht_contains_key(
-	const hopscotch_hash_table_t *ht,
-	hash_function_f hash_function,
+	hopscotch_hash_table_t *ht,
+	const uint8_t *key,
+	uint8_t *out_value
+);
+
+// Same as above with the hash of the key computed by the caller, it must be
+// the hash of the bound function (see ht_hash).
+bool ht_insert_with_hash(
+	hopscotch_hash_table_t *ht,
+	uint64_t hash,
+	const uint8_t *key,
+	const uint8_t *value
+);
+bool ht_remove_with_hash(
+	hopscotch_hash_table_t *ht,
+	uint64_t hash,
+	const uint8_t *key
+);
+bool ht_contains_with_hash(
+	hopscotch_hash_table_t *ht,
+	uint64_t hash,
 	const uint8_t *key,
 	uint8_t *out_value
 );
+
+// Conditional writes, fixed-size tables only. Each takes effect atomically
+// against every other call on the key and retries internally when a resize
+// or a displacement moves the key meanwhile.
+// - ht_insert_if_absent - adds key, false if it is already there.
+// - ht_replace - overwrites the value, false if key is missing.
+// - ht_compare_and_swap_value - overwrites the value with desired if it
+//   equals expected (value_size bytes).
+// - ht_upsert - fn updates the value of key in place or sets the value of a
+//   new key. fn must not call into the table. It runs once, or again if the
+//   key was missing and the table had to grow first or another thread added
+//   the key meanwhile, only the last run counts. False if the key was
+//   missing and there was no room.
+bool ht_insert_if_absent(
+	hopscotch_hash_table_t *ht,
+	const uint8_t *key,
+	const uint8_t *value
+);
+bool ht_replace(
+	hopscotch_hash_table_t *ht,
+	const uint8_t *key,
+	const uint8_t *value
+);
+bool ht_compare_and_swap_value(
+	hopscotch_hash_table_t *ht,
+	const uint8_t *key,
+	const uint8_t *expected,
+	const uint8_t *desired
+);
+bool ht_upsert(
+	hopscotch_hash_table_t *ht,
+	const uint8_t *key,
+	ht_upsert_f fn,
+	void *ctx
+);
+
+// Zero-copy access, fixed-size tables only. ht_get_ref enters an epoch
+// section and points the guard at the stored value, it stays mapped until
+// ht_ref_release. Writers may change it meanwhile: what was read from it is
+// consistent only if ht_ref_valid holds afterwards, look the key up again
+// otherwise. ht_visit runs callback on the value in place and runs it again
+// if the value changed during the call, the last run saw a consistent value.
+bool ht_get_ref(hopscotch_hash_table_t *ht, const uint8_t *key, ht_ref_t *ref);
+bool ht_ref_valid(const ht_ref_t *ref);
+void ht_ref_release(ht_ref_t *ref);
+bool ht_visit(
+	hopscotch_hash_table_t *ht,
+	const uint8_t *key,
+	ht_visit_f callback,
+	void *ctx
+);
+
+// Loads count pairs into an empty table nobody else uses meanwhile, on
+// threads threads. The table grows up front to fit them under its resize
+// policy. Keys are hashed and partitioned by home bucket in parallel, every
+// thread then fills its own run of buckets in order with plain stores. Of
+// duplicate keys the last value is kept. False if the table was not empty or
+// not every pair found room.
+bool ht_bulk_build(
+	hopscotch_hash_table_t *ht,
+	const uint8_t *const *keys,
+	const uint8_t *const *values,
+	size_t count,
+	size_t threads
+);
+
+// Cache mode: the table keeps its capacity (the resize triggers are ignored)
+// and an insert into a full neighborhood evicts an entry of it instead of
+// failing: the first one a CLOCK hand finds expired or not referenced since
+// the hand last passed (lookups set the reference bit). Expired entries are
+// invisible to every call and reclaimed lazily: by the writes which meet
+// them, by every insert sweeping HT_CACHE_SWEEP_SLOTS slots and by
+// ht_cache_sweep, which a background thread may call in a loop.
+// - ht_create_cache - a fixed-size table with the expiry words of cache mode,
+//   in cache mode from the start.
+// - ht_set_cache_mode - turns cache mode of a table made by ht_create_cache
+//   on or off, false for any other table. default_ttl_ms applies to entries
+//   written by the other calls (0 - no expiry).
+// - ht_insert_ttl - ht_insert with its own TTL (0 - no expiry).
+// - ht_cache_sweep - looks at the next slots slots, returns the number of
+//   entries reclaimed.
+// Hits, misses, evictions and expirations are in ht_stats_t.
+hopscotch_hash_table_t *ht_create_cache(
+	size_t capacity,
+	ht_layout_t layout,
+	hash_function_f hash_function,
+	uint64_t seed,
+	uint64_t default_ttl_ms
+);
+bool ht_set_cache_mode(hopscotch_hash_table_t *ht, bool enabled, uint64_t default_ttl_ms);
+bool ht_insert_ttl(
+	hopscotch_hash_table_t *ht,
+	const uint8_t *key,
+	const uint8_t *value,
+	uint64_t ttl_ms
+);
+size_t ht_cache_sweep(hopscotch_hash_table_t *ht, size_t slots);
+
+// Weakly consistent scans, fixed-size tables only. Writers and resizes go on
+// meanwhile. Every key present for the whole scan is visited exactly once,
+// with a value it held during the scan. Keys added or removed meanwhile may
+// be visited or not, never twice.
+// - ht_iter_begin - starts a scan, NULL if it cannot. The iterator holds an
+//   epoch section until ht_iter_end, use it on the thread which began it.
+// - ht_iter_next - points key and value (either may be NULL) at copies which
+//   stay valid until the next call, false once the scan is over.
+// - ht_iter_failed - true if the scan was cut short by a failed allocation,
+//   ht_iter_next returned false before the end of the table then.
+// - ht_parallel_for_each - splits the buckets into ranges of HT_ITER_BLOCK
+//   handed out to threads workers (the caller is one of them, at most
+//   HT_INIT_MAX_THREADS) and calls fn on every entry. fn runs concurrently and
+//   may call into the table. Returns the number of entries visited, failed
+//   (optional) is set if a worker was cut short by a failed allocation.
+ht_iter_t *ht_iter_begin(hopscotch_hash_table_t *ht);
+bool ht_iter_next(ht_iter_t *it, const uint8_t **key, const uint8_t **value);
+bool ht_iter_failed(const ht_iter_t *it);
+void ht_iter_end(ht_iter_t *it);
+size_t ht_parallel_for_each(
+	hopscotch_hash_table_t *ht,
+	size_t threads,
+	ht_for_each_f fn,
+	void *ctx,
+	bool *failed
+);
+
+// Checks the structure of a table nobody writes meanwhile, a running resize
+// is completed first. Every occupied slot must carry the tag and the hash
+// word of its key, sit within HOP_RANGE * MAX_RELOCATION_FACTOR of its home
+// bucket and be the only slot of the key there; free slots carry no tag and
+// no version is left odd. The slots are split between threads threads (the
+// caller is one of them). report (may be NULL) gets the counts and the first
+// HT_VALIDATE_MAX_VIOLATIONS violations. True if there is none.
+bool ht_validate(hopscotch_hash_table_t *ht, size_t threads, ht_validate_report_t *report);
+const char *ht_violation_name(ht_violation_kind_t kind);
+void ht_print_validate(const ht_validate_report_t *report);
+
+// Batched variants of the calls above. A group of keys is hashed and its
+// neighborhoods are prefetched before any key is resolved, so the cache
+// misses of the group overlap. results[i] (results may be NULL) is the
+// outcome for keys[i], the number of successful keys is returned.
+// out_values (or any of its entries) may be NULL.
+size_t ht_contains_batch(
+	hopscotch_hash_table_t *ht,
+	const uint8_t *const *keys,
+	uint8_t *const *out_values,
+	bool *results,
+	size_t count
+);
+size_t ht_insert_batch(
+	hopscotch_hash_table_t *ht,
+	const uint8_t *const *keys,
+	const uint8_t *const *values,
+	bool *results,
+	size_t count
+);
+size_t ht_remove_batch(
+	hopscotch_hash_table_t *ht,
+	const uint8_t *const *keys,
+	bool *results,
+	size_t count
+);
+
+// Variable-length entries, HT_LAYOUT_VARLEN tables only (the fixed-size calls
+// above fail on them). arena_size bytes of the ht_create_var buffer hold
+// keys and values longer than HT_VAR_INLINE, up to HT_ARENA_MAX_BLOCK each.
+hopscotch_hash_table_t *ht_create_var(
+	size_t capacity,
+	size_t arena_size,
+	hash_function_f hash_function,
+	uint64_t seed
+);
+bool ht_insert_var(
+	hopscotch_hash_table_t *ht,
+	const uint8_t *key,
+	size_t key_len,
+	const uint8_t *value,
+	size_t value_len
+);
+bool ht_remove_var(
+	hopscotch_hash_table_t *ht,
+	const uint8_t *key,
+	size_t key_len
+);
+// Up to value_capacity bytes of the value are copied to value (may be NULL),
+// value_len (may be NULL) gets its full length.
+bool ht_contains_var(
+	hopscotch_hash_table_t *ht,
+	const uint8_t *key,
+	size_t key_len,
+	uint8_t *value,
+	size_t value_capacity,
+	size_t *value_len
+);
 #endif /* HOPSCOTCH_HT_H */
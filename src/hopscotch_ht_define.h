@@ -0,0 +1,82 @@
+#ifndef HOPSCOTCH_HT_DEFINE_H
+#define HOPSCOTCH_HT_DEFINE_H
+
+#include "hopscotch_ht.h"
+
+//------------------------------------------------------------------------------
+// Typed tables of other key and value sizes.
+//------------------------------------------------------------------------------
+/*
+HOPSCOTCH_DEFINE_TYPED(name, key_size, value_size, hash_fn) emits typed
+wrappers over an ht_create_sized table with its own key and value sizes, any
+number of shapes can live in one process:
+
+	static inline uint64_t u64_hash(const uint8_t *key);
+	HOPSCOTCH_DEFINE_TYPED(u64_map, 8, 8, u64_hash)
+
+	u64_map_t *map = u64_map_create(1024);
+	u64_map_insert(map, key, value);
+	u64_map_contains(map, key, out_value);
+	u64_map_remove(map, key);
+	u64_map_free(map);
+
+hash_fn (uint64_t hash_fn(const uint8_t *key)) takes key_size bytes and is
+called directly, a static inline one is inlined into the wrappers, which pass
+the hash to the shared ht_*_with_hash calls. Any other signature fails to
+compile, a 32-bit hash would leave the upper bits (tags and slot words) zero.
+Nothing else is specialized: the shared calls copy keys and values by the
+sizes of the table and compare keys of 8, 16, 32 and 64 bytes with fixed-size
+memcmp calls picked at runtime. The table is bound to hash_fn as well,
+u64_map_table() gives the handle for the generic calls (stats, resize
+policy, ...).
+*/
+#define HOPSCOTCH_DEFINE_TYPED(name, key_size, value_size, hash_fn) \
+	_Static_assert((key_size) > 0 && (key_size) <= HT_MAX_KEY_SIZE, \
+		#name ": key_size out of range"); \
+	_Static_assert((value_size) > 0 && (value_size) <= HT_MAX_VALUE_SIZE, \
+		#name ": value_size out of range"); \
+	_Static_assert(_Generic((hash_fn), uint64_t (*)(const uint8_t *): 1, default: 0), \
+		#name ": hash_fn must be uint64_t hash_fn(const uint8_t *key)"); \
+	\
+	typedef struct name name##_t; \
+	enum { name##_key_size = (key_size), name##_value_size = (value_size) }; \
+	\
+	static inline hopscotch_hash_table_t *name##_table(name##_t *t) { \
+		return (hopscotch_hash_table_t *)t; \
+	} \
+	static inline uint64_t name##_bound_hash( \
+		const uint8_t *key, \
+		size_t len __attribute__((unused)), \
+		uint64_t seed __attribute__((unused)) \
+	) { \
+		return hash_fn(key); \
+	} \
+	static inline name##_t *name##_create(size_t capacity) { \
+		return (name##_t *)ht_create_sized(capacity, (key_size), (value_size), \
+			name##_bound_hash, 0); \
+	} \
+	static inline void name##_free(name##_t *t) { \
+		ht_free(name##_table(t)); \
+	} \
+	static inline bool name##_insert( \
+		name##_t *t, \
+		const uint8_t *key, \
+		const uint8_t *value \
+	) { \
+		return ht_insert_with_hash(name##_table(t), hash_fn(key), key, value); \
+	} \
+	static inline bool name##_remove(name##_t *t, const uint8_t *key) { \
+		return ht_remove_with_hash(name##_table(t), hash_fn(key), key); \
+	} \
+	static inline bool name##_contains( \
+		name##_t *t, \
+		const uint8_t *key, \
+		uint8_t *out_value \
+	) { \
+		return ht_contains_with_hash(name##_table(t), hash_fn(key), key, out_value); \
+	} \
+	static inline size_t name##_size(name##_t *t) { \
+		return ht_size(name##_table(t)); \
+	}
+
+#endif /* HOPSCOTCH_HT_DEFINE_H */
@@ -0,0 +1,164 @@
+#include <threads.h>
+#include <assert.h>
+
+#include "hopscotch_ht_epoch.h"
+
+//------------------------------------------------------------------------------
+// Epoch-based reclamation related functions / API.
+//------------------------------------------------------------------------------
+typedef struct ht_epoch_node {
+	struct ht_epoch_node *next;
+	ht_reclaim_f reclaim;
+	void *ctx;
+	void *ptr;
+	size_t len;
+} ht_epoch_node_t;
+
+// Epoch 0 stands for "outside of a section", the counter starts at 1.
+_Atomic uint64_t ht_epoch_global = 1;
+_Thread_local ht_epoch_record_t *ht_epoch_self = NULL;
+
+static _Atomic(ht_epoch_record_t *) ht_epoch_records = NULL;
+static _Atomic(ht_epoch_node_t *) ht_epoch_limbo[HT_EPOCH_LIMBO_LISTS];
+static _Atomic size_t ht_epoch_retired = 0;
+static _Atomic size_t ht_epoch_reclaimed = 0;
+// Taken by the thread advancing the epoch: a list is reclaimed completely
+// before the next advance, so the barrier never races a late reclaim.
+static atomic_flag ht_epoch_advancing = ATOMIC_FLAG_INIT;
+static _Thread_local unsigned ht_epoch_retires = 0;
+
+static once_flag ht_epoch_once = ONCE_FLAG_INIT;
+static tss_t ht_epoch_key;
+
+static void ht_epoch_thread_exit(void *arg) {
+	ht_epoch_record_t *r = arg;
+	atomic_store_explicit(&r->local, 0, memory_order_release);
+	r->nest = 0;
+	atomic_store_explicit(&r->used, false, memory_order_release);
+}
+
+static void ht_epoch_key_create(void) {
+	tss_create(&ht_epoch_key, ht_epoch_thread_exit);
+}
+
+ht_epoch_record_t *ht_epoch_register(void) {
+	if(ht_epoch_self) return ht_epoch_self;
+	call_once(&ht_epoch_once, ht_epoch_key_create);
+
+	// Reuse the record of a finished thread, records are never freed.
+	ht_epoch_record_t *r = atomic_load(&ht_epoch_records);
+	for(; r; r = r->next) {
+		bool expected = false;
+		if(!atomic_load_explicit(&r->used, memory_order_relaxed) &&
+			atomic_compare_exchange_strong(&r->used, &expected, true))
+		{
+			break;
+		}
+	}
+	if(!r) {
+		r = aligned_alloc(64, sizeof(ht_epoch_record_t));
+		if(!r) abort();
+		atomic_init(&r->local, 0);
+		atomic_init(&r->used, true);
+		r->next = atomic_load(&ht_epoch_records);
+		while(!atomic_compare_exchange_weak(&ht_epoch_records, &r->next, r));
+	}
+	r->nest = 0;
+	ht_epoch_self = r;
+	tss_set(ht_epoch_key, r);
+	return r;
+}
+
+void ht_epoch_unregister(void) {
+	ht_epoch_record_t *r = ht_epoch_self;
+	if(!r) return;
+	assert(r->nest == 0);
+	ht_epoch_self = NULL;
+	tss_set(ht_epoch_key, NULL);
+	ht_epoch_thread_exit(r);
+}
+
+static void ht_epoch_reclaim(ht_epoch_node_t *node) {
+	size_t count = 0;
+	while(node) {
+		ht_epoch_node_t *next = node->next;
+		node->reclaim(node->ctx, node->ptr, node->len);
+		free(node);
+		node = next;
+		count++;
+	}
+	atomic_fetch_add_explicit(&ht_epoch_reclaimed, count, memory_order_relaxed);
+}
+
+// Caller holds ht_epoch_advancing.
+static bool ht_epoch_advance_locked(void) {
+	uint64_t epoch = atomic_load_explicit(&ht_epoch_global, memory_order_relaxed);
+	atomic_thread_fence(memory_order_seq_cst);
+	for(ht_epoch_record_t *r = atomic_load(&ht_epoch_records); r; r = r->next) {
+		uint64_t local = atomic_load_explicit(&r->local, memory_order_relaxed);
+		if(local && local != epoch) return false;
+	}
+	atomic_thread_fence(memory_order_acquire);
+	atomic_store_explicit(&ht_epoch_global, epoch + 1, memory_order_release);
+
+	// Objects retired at epoch - 1 (or three epochs before that).
+	ht_epoch_reclaim(atomic_exchange(&ht_epoch_limbo[(epoch + 2) % HT_EPOCH_LIMBO_LISTS],
+		NULL));
+	return true;
+}
+
+void ht_epoch_retire(ht_reclaim_f reclaim, void *ctx, void *ptr, size_t len) {
+	ht_epoch_node_t *node = malloc(sizeof(ht_epoch_node_t));
+	if(!node) abort();
+	node->reclaim = reclaim;
+	node->ctx = ctx;
+	node->ptr = ptr;
+	node->len = len;
+
+	// Inside a section the epoch cannot move by two before the push lands.
+	ht_epoch_enter();
+	uint64_t epoch = atomic_load(&ht_epoch_global);
+	_Atomic(ht_epoch_node_t *) *list = &ht_epoch_limbo[epoch % HT_EPOCH_LIMBO_LISTS];
+	node->next = atomic_load_explicit(list, memory_order_relaxed);
+	while(!atomic_compare_exchange_weak_explicit(list, &node->next, node,
+		memory_order_release, memory_order_relaxed));
+	atomic_fetch_add_explicit(&ht_epoch_retired, 1, memory_order_relaxed);
+	ht_epoch_exit();
+
+	if(++ht_epoch_retires % HT_EPOCH_ADVANCE_EVERY == 0) ht_epoch_collect();
+}
+
+bool ht_epoch_collect(void) {
+	if(atomic_flag_test_and_set_explicit(&ht_epoch_advancing, memory_order_acquire)) {
+		return false;
+	}
+	bool advanced = ht_epoch_advance_locked();
+	atomic_flag_clear_explicit(&ht_epoch_advancing, memory_order_release);
+	return advanced;
+}
+
+void ht_epoch_barrier(void) {
+	assert(!ht_epoch_self || ht_epoch_self->nest == 0);
+	uint64_t target = atomic_load(&ht_epoch_global) + 2;
+	for(;;) {
+		while(atomic_flag_test_and_set_explicit(&ht_epoch_advancing,
+			memory_order_acquire))
+		{
+			thrd_yield();
+		}
+		bool done = atomic_load(&ht_epoch_global) >= target;
+		bool advanced = !done && ht_epoch_advance_locked();
+		atomic_flag_clear_explicit(&ht_epoch_advancing, memory_order_release);
+		if(done) return;
+		if(!advanced) thrd_yield();
+	}
+}
+
+size_t ht_epoch_pending(void) {
+	size_t reclaimed = atomic_load_explicit(&ht_epoch_reclaimed, memory_order_relaxed);
+	return atomic_load_explicit(&ht_epoch_retired, memory_order_relaxed) - reclaimed;
+}
+
+uint64_t ht_epoch_current(void) {
+	return atomic_load(&ht_epoch_global);
+}
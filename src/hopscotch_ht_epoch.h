@@ -0,0 +1,89 @@
+#ifndef HOPSCOTCH_HT_EPOCH_H
+#define HOPSCOTCH_HT_EPOCH_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+
+//------------------------------------------------------------------------------
+// Epoch-based reclamation related defines.
+//------------------------------------------------------------------------------
+/*
+Memory unlinked from a table (a bucket array after a resize, an arena block
+after an update or a remove) is retired instead of freed. A process-wide
+epoch counter moves on only when every thread inside a critical section has
+seen its current value, an object retired at epoch e is reclaimed once the
+epoch reaches e + 2: no reader that could still hold it is left by then.
+
+Every ht_* call runs as a critical section (ht_epoch_enter / ht_epoch_exit,
+nested calls only count the depth). A caller holding a section across calls
+keeps whatever they returned alive, see ht_epoch_enter.
+
+Threads register on their first section and are forgotten at thread exit,
+ht_epoch_unregister does it earlier. Retired objects wait in three global
+lists, one per epoch modulo 3, and are reclaimed by the thread advancing the
+epoch. Advancing is tried every HT_EPOCH_ADVANCE_EVERY retires per thread.
+*/
+#define HT_EPOCH_LIMBO_LISTS (3)
+#define HT_EPOCH_ADVANCE_EVERY (64)
+
+// Frees a retired object, ctx / ptr / len as given to ht_epoch_retire.
+typedef void (*ht_reclaim_f)(void *ctx, void *ptr, size_t len);
+
+// Thread record, one cache line each. local is the epoch the thread entered
+// its section at, 0 outside of any section.
+typedef struct ht_epoch_record {
+	_Alignas(64) _Atomic uint64_t local;
+	unsigned nest;
+	_Atomic bool used;
+	struct ht_epoch_record *next;
+} ht_epoch_record_t;
+
+extern _Atomic uint64_t ht_epoch_global;
+extern _Thread_local ht_epoch_record_t *ht_epoch_self;
+
+//------------------------------------------------------------------------------
+// Epoch-based reclamation related functions / API.
+//------------------------------------------------------------------------------
+// Record of the calling thread, registered on first use.
+ht_epoch_record_t *ht_epoch_register(void);
+void ht_epoch_unregister(void);
+
+// Critical section. Pointers read from a table (ht_get_ref, iterators) stay
+// valid until the outermost ht_epoch_exit. A section must not block on
+// another thread's ht_epoch_barrier.
+static inline void ht_epoch_enter(void) {
+	ht_epoch_record_t *r = ht_epoch_self;
+	if(!r) r = ht_epoch_register();
+	if(r->nest++) return;
+	atomic_store_explicit(&r->local,
+		atomic_load_explicit(&ht_epoch_global, memory_order_relaxed),
+		memory_order_relaxed);
+	// The announcement must be visible before any table pointer is read.
+	atomic_thread_fence(memory_order_seq_cst);
+}
+
+static inline void ht_epoch_exit(void) {
+	ht_epoch_record_t *r = ht_epoch_self;
+	if(--r->nest) return;
+	atomic_store_explicit(&r->local, 0, memory_order_release);
+}
+
+// Hands an unlinked object over, reclaim(ctx, ptr, len) runs two epochs
+// later on whichever thread advances the epoch.
+void ht_epoch_retire(ht_reclaim_f reclaim, void *ctx, void *ptr, size_t len);
+
+// Tries to advance the epoch and reclaim what became safe, false if a thread
+// still lags behind or another thread is advancing.
+bool ht_epoch_collect(void);
+
+// Waits until everything retired before the call is reclaimed. Must not be
+// called inside a critical section.
+void ht_epoch_barrier(void);
+
+// Objects retired and not yet reclaimed, process-wide.
+size_t ht_epoch_pending(void);
+uint64_t ht_epoch_current(void);
+
+#endif // HOPSCOTCH_HT_EPOCH_H
@@ -0,0 +1,107 @@
+#include "hopscotch_ht_sharded.h"
+
+//------------------------------------------------------------------------------
+// Sharded table related functions / API.
+//------------------------------------------------------------------------------
+static size_t ht_sharded_round_capacity(size_t capacity) {
+	size_t rounded = 1;
+	while(rounded < capacity) rounded <<= 1;
+	return rounded;
+}
+
+// Multiply-shift of the routing bits, any shard count gets an even share.
+static inline size_t ht_sharded_route(const ht_sharded_t *s, uint64_t h) {
+	uint64_t bits = (h >> HT_SHARD_SHIFT) & ((1ULL << HT_SHARD_BITS) - 1);
+	return (size_t)((bits * s->shards) >> HT_SHARD_BITS);
+}
+
+ht_sharded_t *ht_sharded_create(
+	size_t capacity,
+	size_t shards,
+	hash_function_f hash_function,
+	uint64_t seed
+) {
+	unsigned nodes[HT_SHARDS_MAX];
+	unsigned node_count = ht_numa_nodes(nodes, HT_SHARDS_MAX);
+	if(shards == 0) shards = node_count;
+	if(shards == 0 || shards > HT_SHARDS_MAX || capacity < shards) return NULL;
+
+	ht_sharded_t *s = calloc(1, sizeof(ht_sharded_t));
+	if(!s) return NULL;
+	s->shards = shards;
+	s->hash_function = hash_function ? hash_function : murmur_custom_hash;
+	s->seed = seed;
+
+	// Sub-tables are bound to their node and first-touched there.
+	size_t shard_capacity = ht_sharded_round_capacity(capacity / shards);
+	for(size_t i = 0; i < shards; i++) {
+		s->nodes[i] = nodes[i % node_count];
+		ht_alloc_options_t options = {
+			.pages = HT_PAGES_DEFAULT,
+			.numa = node_count > 1 ? HT_NUMA_BIND : HT_NUMA_DEFAULT,
+			.numa_node = s->nodes[i],
+			.init_threads = 1
+		};
+		s->tables[i] = ht_create_opts(shard_capacity, HT_LAYOUT_AOS,
+			s->hash_function, seed, &options);
+		if(!s->tables[i]) {
+			ht_sharded_free(s);
+			return NULL;
+		}
+	}
+	return s;
+}
+
+void ht_sharded_free(ht_sharded_t *s) {
+	if(!s) return;
+	for(size_t i = 0; i < s->shards; i++) {
+		ht_free(s->tables[i]);
+	}
+	free(s);
+}
+
+bool ht_sharded_insert(ht_sharded_t *s, const uint8_t *key, const uint8_t *value) {
+	if(!s || !key || !value) return false;
+	uint64_t h = s->hash_function(key, KEY_SIZE, s->seed);
+	return ht_insert_with_hash(s->tables[ht_sharded_route(s, h)], h, key, value);
+}
+
+bool ht_sharded_remove_key(ht_sharded_t *s, const uint8_t *key) {
+	if(!s || !key) return false;
+	uint64_t h = s->hash_function(key, KEY_SIZE, s->seed);
+	return ht_remove_with_hash(s->tables[ht_sharded_route(s, h)], h, key);
+}
+
+bool ht_sharded_contains_key(ht_sharded_t *s, const uint8_t *key, uint8_t *out_value) {
+	if(!s || !key) return false;
+	uint64_t h = s->hash_function(key, KEY_SIZE, s->seed);
+	return ht_contains_with_hash(s->tables[ht_sharded_route(s, h)], h, key, out_value);
+}
+
+size_t ht_sharded_size(const ht_sharded_t *s) {
+	if(!s) return 0;
+	size_t size = 0;
+	for(size_t i = 0; i < s->shards; i++) {
+		size += ht_size_exact(s->tables[i]);
+	}
+	return size;
+}
+
+size_t ht_sharded_shard_of(const ht_sharded_t *s, const uint8_t *key) {
+	if(!s || !key) return 0;
+	return ht_sharded_route(s, s->hash_function(key, KEY_SIZE, s->seed));
+}
+
+size_t ht_sharded_local_shard(const ht_sharded_t *s) {
+	if(!s) return 0;
+	int node = ht_numa_current_node();
+	for(size_t i = 0; node >= 0 && i < s->shards; i++) {
+		if(s->nodes[i] == (unsigned)node) return i;
+	}
+	return 0;
+}
+
+unsigned ht_sharded_node(const ht_sharded_t *s, size_t shard) {
+	if(!s || shard >= s->shards) return 0;
+	return s->nodes[shard];
+}
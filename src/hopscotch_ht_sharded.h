@@ -0,0 +1,60 @@
+#ifndef HOPSCOTCH_HT_SHARDED_H
+#define HOPSCOTCH_HT_SHARDED_H
+
+#include "hopscotch_ht.h"
+
+//------------------------------------------------------------------------------
+// NUMA-partitioned sharded table related defines.
+//------------------------------------------------------------------------------
+/*
+The key space is split across sub-tables, each one bound to a NUMA node
+(HT_NUMA_BIND, first-touched on its node). A key is routed by hash bits
+32..54: above the bucket index of any practical capacity and below the
+fingerprint tag, so neither the placement inside a shard nor the tag
+filter loses entropy to the routing.
++--------+-----------------+---------------------+
+| 63..55 | 54 ... 32       | 31 ... 0            |
+|--------|-----------------|---------------------|
+|  Tag   | Shard (x count) | Bucket index        |
++--------+-----------------+---------------------+
+Every sub-table is bound to the same hash function and seed, the hash of a
+key is computed once and passed to ht_*_with_hash.
+*/
+#define HT_SHARDS_MAX (64)
+#define HT_SHARD_SHIFT (32)
+#define HT_SHARD_BITS (23)
+
+typedef struct {
+	size_t shards;
+	hash_function_f hash_function;
+	uint64_t seed;
+	unsigned nodes[HT_SHARDS_MAX];
+	hopscotch_hash_table_t *tables[HT_SHARDS_MAX];
+} ht_sharded_t;
+
+//------------------------------------------------------------------------------
+// Sharded table related functions / API.
+//------------------------------------------------------------------------------
+// shards sub-tables (0 - one per online NUMA node) sharing capacity between
+// them, shard i lives on the i-th online node (round-robin).
+ht_sharded_t *ht_sharded_create(
+	size_t capacity,
+	size_t shards,
+	hash_function_f hash_function,
+	uint64_t seed
+);
+void ht_sharded_free(ht_sharded_t *s);
+
+bool ht_sharded_insert(ht_sharded_t *s, const uint8_t *key, const uint8_t *value);
+bool ht_sharded_remove_key(ht_sharded_t *s, const uint8_t *key);
+bool ht_sharded_contains_key(ht_sharded_t *s, const uint8_t *key, uint8_t *out_value);
+size_t ht_sharded_size(const ht_sharded_t *s);
+
+// Affinity hints: the shard owning a key and the first shard on the node
+// the calling thread runs on (shard 0 if none is). A thread can prefer the
+// keys of its local shard, or pin itself to the CPUs of ht_sharded_node.
+size_t ht_sharded_shard_of(const ht_sharded_t *s, const uint8_t *key);
+size_t ht_sharded_local_shard(const ht_sharded_t *s);
+unsigned ht_sharded_node(const ht_sharded_t *s, size_t shard);
+
+#endif // HOPSCOTCH_HT_SHARDED_H
@@ -1,4 +1,5 @@
 #include "hopscotch_ht_test_misc.h"
+#include "hopscotch_ht_define.h"
 
 bool test_lookup_for_specific_key_value(
 	hopscotch_hash_table_t *h,
@@ -15,9 +16,9 @@ bool test_lookup_for_specific_key_value(
 	printf("[TEST %s] Started\n", __func__);
 	if(h) {
 		ht = h;
-		number_of_elements = ANY_PERCENT(ht->capacity, 80);
+		number_of_elements = ANY_PERCENT(ht_capacity(ht), 80);
 	} else {
-		ht = ht_create(ht_size);
+		ht = ht_create(ht_size, hash_function, 0);
 		if(!ht) {
 			printf("[TEST %s] Error: Unable to create hash table\n", __func__);
 			return false;
@@ -25,7 +26,7 @@ bool test_lookup_for_specific_key_value(
 		is_local_ht = true;
 		number_of_elements = ANY_PERCENT(ht_size, 80);
 	}
-	if(ht->size > 0) {
+	if(ht_size_exact(ht) > 0) {
 		printf("[TEST %s] Error: Hash table is not empty\n", __func__);
 		return false;
 	}
@@ -43,7 +44,7 @@ bool test_lookup_for_specific_key_value(
 
 	BENCHMARK_START
 	for(size_t i = 0; i < number_of_elements; i++) {
-		if(ht_insert(ht, hash_function, pdata[i].key, pdata[i].value)) {
+		if(ht_insert(ht, pdata[i].key, pdata[i].value)) {
 			pdata[i].inserted = true;
 			inserted_els++;
 		}
@@ -63,7 +64,7 @@ bool test_lookup_for_specific_key_value(
 	uint8_t got_value[VALUE_SIZE];
 	memcpy(key, pdata[idx_el_to_lookup].key, KEY_SIZE);
 	memcpy(expected_value, pdata[idx_el_to_lookup].value, VALUE_SIZE);
-	if(ht_contains_key(ht, hash_function, key, got_value)) {
+	if(ht_contains_key(ht, key, got_value)) {
 		printf("[TEST %s] Contains value obtained\n", __func__);
 	}
 	BENCHMARK_END
@@ -92,6 +93,19 @@ bool test_lookup_for_specific_key_value(
 	return ret_val;
 }
 
+// Structural check after a phase of a test, prints the report if it fails.
+#define VALIDATE_TEST_THREADS (4)
+
+static bool validate_test_phase(hopscotch_hash_table_t *ht, const char *test, const char *phase) {
+	ht_validate_report_t report;
+	double start_time = get_current_time();
+	bool valid = ht_validate(ht, VALIDATE_TEST_THREADS, &report);
+	printf("[TEST %s] Validation after %s: %zu entries, %zu violations, %.4f sec\n",
+		test, phase, report.entries, report.violations, get_current_time() - start_time);
+	if(!valid) ht_print_validate(&report);
+	return valid;
+}
+
 bool test_insert_remove_elements(
 	size_t number_of_elements,
 	hash_function_f hash_function,
@@ -115,7 +129,8 @@ bool test_insert_remove_elements(
 	printf("[TEST %s] Stared\n", __func__);
 	printf("[TEST %s] Table capacity : %ld\n", __func__, capacity);
 
-	hopscotch_hash_table_t* ht = ht_create(capacity);
+	bool ret_val = true;
+	hopscotch_hash_table_t* ht = ht_create(capacity, hash_function, 0);
 	if(ht == NULL) {
 		printf("[TEST %s] Error: Unable to create hash table\n", __func__);
 		return false;
@@ -138,7 +153,7 @@ bool test_insert_remove_elements(
 	int inserted_els = 0;
 	printf("[TEST %s] INSERT flow started... \n", __func__);
 	for(size_t i = 0; i < number_of_elements; i++) {
-		if(!ht_insert(ht, hash_function, pdata[i].key, pdata[i].value)) {
+		if(!ht_insert(ht, pdata[i].key, pdata[i].value)) {
 			missing_inserted_els++;
 		} else {
 			pdata[i].inserted = true;
@@ -149,6 +164,7 @@ bool test_insert_remove_elements(
 	printf("[TEST %s] Missing  elements : %d\n", __func__, missing_inserted_els);
 	printf("[TEST %s] Inserted elements : %d\n", __func__, inserted_els);
 	ht_print_stats(ht);
+	ret_val &= validate_test_phase(ht, __func__, "insert");
 	// More detailed data (in case if there are not so many elements)
 	if(inserted_els <= 0xFF)
 		ht_print_debug(ht);
@@ -163,7 +179,7 @@ bool test_insert_remove_elements(
 			if(!pdata[i].inserted) {
 				continue;
 			}
-			if(!ht_contains_key(ht, hash_function, pdata[i].key, NULL)) {
+			if(!ht_contains_key(ht, pdata[i].key, NULL)) {
 				missing++;
 			}
 		}
@@ -181,7 +197,7 @@ bool test_insert_remove_elements(
 			if(!pdata[i].inserted) {
 				continue;
 			}
-			if(!ht_remove_key(ht, hash_function, pdata[i].key)) {
+			if(!ht_remove_key(ht, pdata[i].key)) {
 				missing_removes++;
 			}
 		}
@@ -190,12 +206,17 @@ bool test_insert_remove_elements(
 		printf("[TEST %s] Printint hash table info\n", __func__);
 		ht_print_stats(ht);
 		ht_print_debug(ht);
+		ret_val &= validate_test_phase(ht, __func__, "remove");
 	}
 	free_test_data(pdata, number_of_elements);
 	ht_free(ht);
 	pdata = NULL;
-	printf("[TEST %s] PASSED successfully\n", __func__);
-	return true;
+	if(ret_val) {
+		printf("[TEST %s] PASSED successfully\n", __func__);
+	} else {
+		printf("[TEST %s] FAILED\n", __func__);
+	}
+	return ret_val;
 }
 
 bool test_relocation_and_max_relocation_value() {
@@ -209,7 +230,7 @@ bool test_relocation_and_max_relocation_value() {
 
 	printf("[TEST %s] Started\n", __func__);
 	printf("[TEST %s] Table size %ld\n", __func__, table_size);
-	hopscotch_hash_table_t* ht = ht_create(table_size);
+	hopscotch_hash_table_t* ht = ht_create(table_size, dummy_set_1_hash, 0);
 	if(ht == NULL) {
 		printf("[TEST %s] FAILED: Unable to create hash table\n", __func__);
 		return false;
@@ -227,7 +248,7 @@ bool test_relocation_and_max_relocation_value() {
 			printf("[TEST %s] ... \n", __func__);
 	}
 	for(size_t i = 0; i < number_of_elements; i ++) {
-		if(!ht_insert(ht, dummy_set_1_hash, pdata[i].key, pdata[i].value)) {
+		if(!ht_insert(ht, pdata[i].key, pdata[i].value)) {
 			els_in_exceeded_relocation++;
 			printf("[TEST %s] INFO MSG: Unable to relocate ", __func__);
 			PRINT_KEY_VALUE(pdata[i].key, pdata[i].value);
@@ -241,7 +262,7 @@ bool test_relocation_and_max_relocation_value() {
 	uint8_t idx_to_fetch = number_of_elements - 0x10;
 	uint8_t got_value[VALUE_SIZE];
 	printf("[TEST %s] Index to fetch %d\n", __func__, idx_to_fetch);
-	if(!ht_contains_key(ht, dummy_set_1_hash, pdata[idx_to_fetch].key, got_value)) {
+	if(!ht_contains_key(ht, pdata[idx_to_fetch].key, got_value)) {
 		printf("[TEST %s] Failed to fetch element ", __func__);
 		PRINT_KEY_VALUE(pdata[idx_to_fetch].key, pdata[idx_to_fetch].value);
 		return false;
@@ -259,3 +280,1568 @@ bool test_relocation_and_max_relocation_value() {
 	ht_free(ht);
 	return true;
 }
+
+bool test_layout_benchmark(
+	size_t number_of_elements,
+	hash_function_f hash_function
+) {
+	static const char *layout_names[] = { "AoS", "SoA" };
+	const ht_tag_kernel_t kernels[] = {
+		HT_TAG_KERNEL_SCALAR, HT_TAG_KERNEL_SSE2, HT_TAG_KERNEL_AVX2
+	};
+	ht_tag_kernel_t default_kernel = ht_get_tag_kernel();
+	static const char *phase_names[] = { "insert", "hit", "miss", "remove" };
+	const ht_layout_t layouts[] = { HT_LAYOUT_AOS, HT_LAYOUT_SOA };
+	bool ret_val = true;
+
+	size_t capacity = round_to_power_of_two(number_of_elements);
+	number_of_elements = ANY_PERCENT(capacity, 80);
+	printf("[TEST %s] Started\n", __func__);
+	printf("[TEST %s] Table capacity     : %ld\n", __func__, capacity);
+	printf("[TEST %s] Number of elements : %ld\n", __func__, number_of_elements);
+
+	test_data_t *pdata = allocate_test_data(number_of_elements);
+	if(pdata == NULL) {
+		printf("[TEST %s] Error: Unable to allocate test elements\n", __func__);
+		return false;
+	}
+
+	for(size_t run = 0; run < 2 * sizeof(kernels) / sizeof(kernels[0]); run++) {
+		size_t l = run % 2;
+		ht_tag_kernel_t kernel = kernels[run / 2];
+		if(!ht_set_tag_kernel(kernel)) {
+			printf("[TEST %s] %s/%s: not supported by the CPU\n", __func__,
+				layout_names[l], ht_tag_kernel_name(kernel));
+			continue;
+		}
+		hopscotch_hash_table_t *ht = ht_create_ex(capacity, layouts[l], hash_function, 0);
+		if(!ht) {
+			printf("[TEST %s] Error: Unable to create hash table\n", __func__);
+			ret_val = false;
+			break;
+		}
+		// Keep the capacity fixed, the layouts must be compared on equal terms.
+		ht_set_resize_policy(ht, 0, 0);
+
+		size_t found[4] = {0};
+		double throughput[4] = {0};
+		uint8_t miss_key[KEY_SIZE];
+		for(int phase = 0; phase < 4; phase++) {
+			BENCHMARK_INIT;
+			BENCHMARK_START;
+			for(size_t i = 0; i < number_of_elements; i++) {
+				switch(phase) {
+				case 0:
+					pdata[i].inserted = ht_insert(ht, pdata[i].key, pdata[i].value);
+					found[phase] += pdata[i].inserted;
+					break;
+				case 1:
+					found[phase] += ht_contains_key(ht, pdata[i].key, NULL);
+					break;
+				case 2:
+					memcpy(miss_key, pdata[i].key, KEY_SIZE);
+					miss_key[0] ^= 0xFF;
+					found[phase] += ht_contains_key(ht, miss_key, NULL);
+					break;
+				default:
+					found[phase] += ht_remove_key(ht, pdata[i].key);
+					break;
+				}
+			}
+			BENCHMARK_END;
+			BENCHMARK_MEASURE_THROUGHPUT(number_of_elements);
+			throughput[phase] = BENCHMARK_GET_THROUGHPUT;
+		}
+
+		printf("[TEST %s] %s/%-6s:", __func__, layout_names[l], ht_tag_kernel_name(kernel));
+		for(int phase = 0; phase < 4; phase++) {
+			printf(" %s %.2f Mops/sec", phase_names[phase], throughput[phase] / 1e6);
+		}
+		printf("\n");
+		if(found[1] != found[0] || found[2] != 0 || found[3] != found[0]) {
+			printf("[TEST %s] Error: %s/%s lost keys\n", __func__,
+				layout_names[l], ht_tag_kernel_name(kernel));
+			ret_val = false;
+		}
+		ht_free(ht);
+	}
+
+	ht_set_tag_kernel(default_kernel);
+	free_test_data(pdata, number_of_elements);
+	if(ret_val) {
+		printf("[TEST %s] PASSED successfully\n", __func__);
+	}
+	return ret_val;
+}
+
+bool test_batch_operations(
+	size_t number_of_elements,
+	hash_function_f hash_function
+) {
+	static const char *phase_names[] = { "insert", "hit", "remove" };
+	bool ret_val = true;
+
+	size_t capacity = round_to_power_of_two(number_of_elements);
+	number_of_elements = ANY_PERCENT(capacity, 80);
+	printf("[TEST %s] Started\n", __func__);
+	printf("[TEST %s] Table capacity     : %ld\n", __func__, capacity);
+	printf("[TEST %s] Number of elements : %ld\n", __func__, number_of_elements);
+	printf("[TEST %s] Batch group        : %d\n", __func__, HT_BATCH_GROUP);
+
+	test_data_t *pdata = allocate_test_data(number_of_elements);
+	const uint8_t **keys = malloc(sizeof(uint8_t *) * number_of_elements);
+	const uint8_t **values = malloc(sizeof(uint8_t *) * number_of_elements);
+	uint8_t **out_values = malloc(sizeof(uint8_t *) * number_of_elements);
+	uint8_t *out_buffer = malloc((size_t)VALUE_SIZE * number_of_elements);
+	bool *results = malloc(sizeof(bool) * number_of_elements);
+	if(!pdata || !keys || !values || !out_values || !out_buffer || !results) {
+		printf("[TEST %s] Error: Unable to allocate test elements\n", __func__);
+		if(pdata) free_test_data(pdata, number_of_elements);
+		free(keys); free(values); free(out_values); free(out_buffer); free(results);
+		return false;
+	}
+	for(size_t i = 0; i < number_of_elements; i++) {
+		keys[i] = pdata[i].key;
+		values[i] = pdata[i].value;
+		out_values[i] = out_buffer + (size_t)VALUE_SIZE * i;
+	}
+
+	// Run 0 is key by key, run 1 goes through the batched calls.
+	for(int run = 0; run < 2 && ret_val; run++) {
+		hopscotch_hash_table_t *ht = ht_create(capacity, hash_function, 0);
+		if(!ht) {
+			printf("[TEST %s] Error: Unable to create hash table\n", __func__);
+			ret_val = false;
+			break;
+		}
+		ht_set_resize_policy(ht, 0, 0);
+		memset(out_buffer, 0, (size_t)VALUE_SIZE * number_of_elements);
+
+		size_t done[3] = {0};
+		double throughput[3] = {0};
+		for(int phase = 0; phase < 3; phase++) {
+			BENCHMARK_INIT;
+			BENCHMARK_START;
+			if(run == 1) {
+				switch(phase) {
+				case 0:
+					done[phase] = ht_insert_batch(ht, keys, values,
+						results, number_of_elements);
+					break;
+				case 1:
+					done[phase] = ht_contains_batch(ht, keys,
+						out_values, NULL, number_of_elements);
+					break;
+				default:
+					done[phase] = ht_remove_batch(ht, keys,
+						NULL, number_of_elements);
+					break;
+				}
+			} else {
+				for(size_t i = 0; i < number_of_elements; i++) {
+					switch(phase) {
+					case 0:
+						results[i] = ht_insert(ht, keys[i], values[i]);
+						done[phase] += results[i];
+						break;
+					case 1:
+						done[phase] += ht_contains_key(ht, keys[i], out_values[i]);
+						break;
+					default:
+						done[phase] += ht_remove_key(ht, keys[i]);
+						break;
+					}
+				}
+			}
+			BENCHMARK_END;
+			BENCHMARK_MEASURE_THROUGHPUT(number_of_elements);
+			throughput[phase] = BENCHMARK_GET_THROUGHPUT;
+
+			if(phase == 1) {
+				for(size_t i = 0; i < number_of_elements; i++) {
+					if(results[i] && memcmp(out_values[i], values[i], VALUE_SIZE) != 0) {
+						printf("[TEST %s] Error: value mismatch at %zu\n", __func__, i);
+						ret_val = false;
+						break;
+					}
+				}
+			}
+		}
+
+		printf("[TEST %s] %-7s:", __func__, run ? "batched" : "single");
+		for(int phase = 0; phase < 3; phase++) {
+			printf(" %s %.2f Mops/sec", phase_names[phase], throughput[phase] / 1e6);
+		}
+		printf("\n");
+		if(done[1] != done[0] || done[2] != done[0]) {
+			printf("[TEST %s] Error: keys lost (%zu inserted, %zu found, %zu removed)\n",
+				__func__, done[0], done[1], done[2]);
+			ret_val = false;
+		}
+		ht_free(ht);
+	}
+
+	free_test_data(pdata, number_of_elements);
+	free(keys);
+	free(values);
+	free(out_values);
+	free(out_buffer);
+	free(results);
+	if(ret_val) {
+		printf("[TEST %s] PASSED successfully\n", __func__);
+	} else {
+		printf("[TEST %s] FAILED\n", __func__);
+	}
+	return ret_val;
+}
+
+// Key i: every fourth key fits into the slot reference, the others go to the
+// arena with lengths varying around 30 bytes.
+static size_t var_test_key(uint8_t *buf, size_t i) {
+	if(i % 4 == 0) return (size_t)sprintf((char *)buf, "k%zx", i);
+	return (size_t)sprintf((char *)buf, "variable-length-key-%0*zu", (int)(4 + i % 16), i);
+}
+
+// Value i of a round: 1 to 300 bytes.
+static size_t var_test_value(uint8_t *buf, size_t i, size_t round) {
+	size_t len = 1 + (i * 37 + round * 101) % 300;
+	for(size_t j = 0; j < len; j++) {
+		buf[j] = (uint8_t)(i + j * 13 + round);
+	}
+	return len;
+}
+
+bool test_variable_length(
+	size_t number_of_elements,
+	hash_function_f hash_function
+) {
+	bool ret_val = true;
+	uint8_t key[64];
+	uint8_t value[512];
+	uint8_t expected[512];
+	size_t peak_used = 0;
+
+	// Key refs and values up to 300 bytes take at most a 64 and a 512 byte block.
+	size_t arena_size = number_of_elements * (64 + 512);
+	printf("[TEST %s] Started\n", __func__);
+	printf("[TEST %s] Number of elements : %ld\n", __func__, number_of_elements);
+	printf("[TEST %s] Arena size         : %ld\n", __func__, arena_size);
+
+	// Start small, the table grows while the references are migrated.
+	hopscotch_hash_table_t *ht = ht_create_var(0x100, arena_size, hash_function, 0);
+	if(!ht) {
+		printf("[TEST %s] Error: Unable to create hash table\n", __func__);
+		return false;
+	}
+
+	// Round 0 inserts, round 1 updates every other key with a new length.
+	for(size_t round = 0; round < 2 && ret_val; round++) {
+		BENCHMARK_INIT;
+		BENCHMARK_START;
+		for(size_t i = round; i < number_of_elements; i += round + 1) {
+			size_t key_len = var_test_key(key, i);
+			size_t value_len = var_test_value(value, i, round);
+			if(!ht_insert_var(ht, key, key_len, value, value_len)) {
+				printf("[TEST %s] Error: Unable to insert key %zu\n", __func__, i);
+				ret_val = false;
+				break;
+			}
+		}
+		BENCHMARK_END;
+		BENCHMARK_MEASURE_THROUGHPUT(number_of_elements / (round + 1));
+		printf("[TEST %s] %s: %.2f Mops/sec\n", __func__,
+			round ? "update" : "insert", BENCHMARK_GET_THROUGHPUT / 1e6);
+	}
+	ht_resize_wait(ht);
+
+	for(size_t i = 0; i < number_of_elements && ret_val; i++) {
+		size_t key_len = var_test_key(key, i);
+		size_t expected_len = var_test_value(expected, i, i % 2);
+		size_t value_len = 0;
+		if(!ht_contains_var(ht, key, key_len, value, sizeof(value),
+			&value_len) || value_len != expected_len ||
+			memcmp(value, expected, value_len) != 0)
+		{
+			printf("[TEST %s] Error: key %zu not found or wrong value\n", __func__, i);
+			ret_val = false;
+		}
+	}
+
+	// A truncated copy still reports the full length.
+	size_t key_len = var_test_key(key, 1);
+	size_t value_len = 0;
+	if(ret_val && (!ht_contains_var(ht, key, key_len, value, 1,
+		&value_len) || value_len != var_test_value(expected, 1, 1)))
+	{
+		printf("[TEST %s] Error: truncated lookup failed\n", __func__);
+		ret_val = false;
+	}
+	if(ret_val && ht_size_exact(ht) != number_of_elements) {
+		printf("[TEST %s] Error: size %zu, expected %zu\n", __func__,
+			ht_size_exact(ht), number_of_elements);
+		ret_val = false;
+	}
+
+	ht_stats_t stats;
+	ht_get_stats(ht, &stats);
+	peak_used = stats.arena_used;
+	size_t capacity = ht_capacity(ht);
+
+	for(size_t i = 0; i < number_of_elements && ret_val; i++) {
+		key_len = var_test_key(key, i);
+		if(!ht_remove_var(ht, key, key_len) ||
+			ht_contains_var(ht, key, key_len, NULL, 0, NULL))
+		{
+			printf("[TEST %s] Error: Unable to remove key %zu\n", __func__, i);
+			ret_val = false;
+		}
+	}
+	// Removed blocks are retired, they are back once no reader can see them.
+	ht_epoch_barrier();
+	ht_get_stats(ht, &stats);
+	if(ret_val && (stats.arena_used != 0 || ht_size_exact(ht) != 0)) {
+		printf("[TEST %s] Error: %zu arena bytes / %zu entries left\n", __func__,
+			stats.arena_used, ht_size_exact(ht));
+		ret_val = false;
+	}
+
+	// Slot bytes: tag, version and timestamp plus hop_info, key and value.
+	size_t meta = 1 + 2 * sizeof(uint32_t);
+	double fixed = (double)capacity * (meta + sizeof(hash_node_t)) / number_of_elements;
+	double var = ((double)capacity * (meta + sizeof(uint64_t) + 2 * HT_VAR_REF_SIZE) +
+		peak_used) / number_of_elements;
+	printf("[TEST %s] Bytes per entry    : %.1f varlen, %.1f fixed %d/%d\n", __func__,
+		var, fixed, KEY_SIZE, VALUE_SIZE);
+
+	ht_free(ht);
+	if(ret_val) {
+		printf("[TEST %s] PASSED successfully\n", __func__);
+	} else {
+		printf("[TEST %s] FAILED\n", __func__);
+	}
+	return ret_val;
+}
+
+// Hashes of the typed shapes below, inlined into the generated calls.
+static inline uint64_t typed_hash_8(const uint8_t *key) {
+	uint64_t k;
+	memcpy(&k, key, sizeof(k));
+	k ^= 0x9E3779B97F4A7C15;
+	k ^= k >> 33;
+	k *= 0xFF51AFD7ED558CCD;
+	k ^= k >> 33;
+	k *= 0xC4CEB9FE1A85EC53;
+	k ^= k >> 33;
+	return k;
+}
+
+static inline uint64_t typed_hash_16(const uint8_t *key) {
+	uint64_t k[2];
+	memcpy(k, key, sizeof(k));
+	return typed_hash_8((const uint8_t *)&k[0]) ^ (typed_hash_8((const uint8_t *)&k[1]) * 31);
+}
+
+static inline uint64_t typed_hash_64(const uint8_t *key) {
+	return murmur_custom_hash(key, KEY_SIZE, 0);
+}
+
+HOPSCOTCH_DEFINE_TYPED(typed_u64, 8, 8, typed_hash_8)
+HOPSCOTCH_DEFINE_TYPED(typed_k16v32, 16, 32, typed_hash_16)
+HOPSCOTCH_DEFINE_TYPED(typed_default, KEY_SIZE, VALUE_SIZE, typed_hash_64)
+
+// Key i of any size: the index followed by a filler pattern, value i likewise.
+static void typed_test_fill(uint8_t *buf, size_t size, size_t i, uint8_t salt) {
+	uint64_t id = i;
+	for(size_t j = 0; j < size; j++) {
+		buf[j] = (uint8_t)(j * 7 + salt);
+	}
+	memcpy(buf, &id, size < sizeof(id) ? size : sizeof(id));
+}
+
+// Inserts, looks up (with value check) and removes number_of_elements keys
+// of one generated shape, prints the throughput of each phase.
+#define TYPED_TEST_RUN(name, ret_val, number_of_elements) \
+	do { \
+		uint8_t _key[name##_key_size]; \
+		uint8_t _value[name##_value_size]; \
+		uint8_t _out[name##_value_size]; \
+		double _rates[3] = {0}; \
+		name##_t *_t = name##_create(round_to_power_of_two(number_of_elements * 5 / 4)); \
+		if(!_t) { \
+			printf("[TEST %s] Error: Unable to create %s\n", __func__, #name); \
+			ret_val = false; \
+			break; \
+		} \
+		for(int _phase = 0; _phase < 3 && ret_val; _phase++) { \
+			BENCHMARK_INIT; \
+			BENCHMARK_START; \
+			for(size_t _i = 0; _i < number_of_elements; _i++) { \
+				typed_test_fill(_key, sizeof(_key), _i, 0x5A); \
+				bool _ok; \
+				if(_phase == 0) { \
+					typed_test_fill(_value, sizeof(_value), _i, 0xA5); \
+					_ok = name##_insert(_t, _key, _value); \
+				} else if(_phase == 1) { \
+					typed_test_fill(_value, sizeof(_value), _i, 0xA5); \
+					_ok = name##_contains(_t, _key, _out) && \
+						memcmp(_out, _value, sizeof(_out)) == 0; \
+				} else { \
+					_ok = name##_remove(_t, _key); \
+				} \
+				if(!_ok) { \
+					printf("[TEST %s] Error: %s phase %d failed at %zu\n", \
+						__func__, #name, _phase, _i); \
+					ret_val = false; \
+					break; \
+				} \
+			} \
+			BENCHMARK_END; \
+			BENCHMARK_MEASURE_THROUGHPUT(number_of_elements); \
+			_rates[_phase] = BENCHMARK_GET_THROUGHPUT; \
+		} \
+		if(ret_val && ht_size_exact(name##_table(_t)) != 0) { \
+			printf("[TEST %s] Error: %s is not empty\n", __func__, #name); \
+			ret_val = false; \
+		} \
+		printf("[TEST %s] %-13s %3d/%-3d: insert %.2f hit %.2f remove %.2f Mops/sec\n", \
+			__func__, #name, name##_key_size, name##_value_size, \
+			_rates[0] / 1e6, _rates[1] / 1e6, _rates[2] / 1e6); \
+		name##_free(_t); \
+	} while(0)
+
+bool test_typed_tables(size_t number_of_elements) {
+	bool ret_val = true;
+
+	printf("[TEST %s] Started\n", __func__);
+	printf("[TEST %s] Number of elements : %ld\n", __func__, number_of_elements);
+
+	TYPED_TEST_RUN(typed_u64, ret_val, number_of_elements);
+	TYPED_TEST_RUN(typed_k16v32, ret_val, number_of_elements);
+	TYPED_TEST_RUN(typed_default, ret_val, number_of_elements);
+
+	// A key of one shape must not be visible in another table.
+	typed_u64_t *a = typed_u64_create(64);
+	typed_k16v32_t *b = typed_k16v32_create(64);
+	uint8_t key[16];
+	uint8_t value[32];
+	typed_test_fill(key, sizeof(key), 1, 0);
+	typed_test_fill(value, sizeof(value), 1, 0);
+	if(!a || !b || !typed_k16v32_insert(b, key, value) || typed_u64_contains(a, key, NULL) ||
+		typed_u64_size(a) != 0)
+	{
+		printf("[TEST %s] Error: shapes are not independent\n", __func__);
+		ret_val = false;
+	}
+	typed_u64_free(a);
+	typed_k16v32_free(b);
+
+	if(ret_val) {
+		printf("[TEST %s] PASSED successfully\n", __func__);
+	} else {
+		printf("[TEST %s] FAILED\n", __func__);
+	}
+	return ret_val;
+}
+
+// Every key hashes to 0, the hash an empty slot used to be marked with.
+static uint64_t zero_hash(
+	const uint8_t *key __attribute__((unused)),
+	size_t len __attribute__((unused)),
+	uint64_t seed __attribute__((unused))
+) {
+	return 0;
+}
+
+bool test_hash_binding(size_t number_of_elements) {
+	bool ret_val = true;
+	size_t zero_keys = HOP_RANGE * MAX_RELOCATION_FACTOR;
+	uint8_t got_value[VALUE_SIZE];
+
+	printf("[TEST %s] Started\n", __func__);
+	printf("[TEST %s] Number of elements : %ld\n", __func__, number_of_elements);
+	test_data_t *pdata = allocate_test_data(number_of_elements);
+	if(!pdata) {
+		printf("[TEST %s] Error: Unable to allocate test elements\n", __func__);
+		return false;
+	}
+
+	// A full neighborhood of keys with hash 0.
+	hopscotch_hash_table_t *ht = ht_create(round_to_power_of_two(zero_keys * 2), zero_hash, 0);
+	for(size_t i = 0; ht && i < zero_keys && ret_val; i++) {
+		if(!ht_insert(ht, pdata[i].key, pdata[i].value)) {
+			printf("[TEST %s] Error: Unable to insert key %zu with hash 0\n", __func__, i);
+			ret_val = false;
+		}
+	}
+	for(size_t i = 0; ht && i < zero_keys && ret_val; i++) {
+		if(!ht_contains_key(ht, pdata[i].key, got_value) ||
+			memcmp(got_value, pdata[i].value, VALUE_SIZE) != 0 ||
+			!ht_remove_key(ht, pdata[i].key))
+		{
+			printf("[TEST %s] Error: key %zu with hash 0 lost\n", __func__, i);
+			ret_val = false;
+		}
+	}
+	if(!ht || (ret_val && ht_size_exact(ht) != 0)) {
+		printf("[TEST %s] Error: hash 0 table failed\n", __func__);
+		ret_val = false;
+	}
+	ht_free(ht);
+
+	// The same keys under two seeds: different hashes, same contents.
+	size_t capacity = round_to_power_of_two(number_of_elements * 2);
+	hopscotch_hash_table_t *seeded[2] = {
+		ht_create(capacity, NULL, 1),
+		ht_create(capacity, NULL, 2)
+	};
+	size_t same_hash = 0;
+	for(size_t i = 0; i < number_of_elements && ret_val; i++) {
+		same_hash += ht_hash(seeded[0], pdata[i].key, KEY_SIZE) ==
+			ht_hash(seeded[1], pdata[i].key, KEY_SIZE);
+		for(int t = 0; t < 2; t++) {
+			if(!seeded[t] || !ht_insert(seeded[t], pdata[i].key, pdata[i].value)) {
+				printf("[TEST %s] Error: Unable to insert key %zu (seed %d)\n",
+					__func__, i, t + 1);
+				ret_val = false;
+				break;
+			}
+		}
+	}
+	for(size_t i = 0; i < number_of_elements && ret_val; i++) {
+		for(int t = 0; t < 2; t++) {
+			if(!ht_contains_key(seeded[t], pdata[i].key, got_value) ||
+				memcmp(got_value, pdata[i].value, VALUE_SIZE) != 0)
+			{
+				printf("[TEST %s] Error: key %zu lost (seed %d)\n", __func__, i, t + 1);
+				ret_val = false;
+				break;
+			}
+		}
+	}
+	printf("[TEST %s] Equal hashes under seeds 1 and 2: %zu\n", __func__, same_hash);
+	if(same_hash > 0) ret_val = false;
+	ht_free(seeded[0]);
+	ht_free(seeded[1]);
+
+	free_test_data(pdata, number_of_elements);
+	if(ret_val) {
+		printf("[TEST %s] PASSED successfully\n", __func__);
+	} else {
+		printf("[TEST %s] FAILED\n", __func__);
+	}
+	return ret_val;
+}
+
+//------------------------------------------------------------------------------
+// Hash kernels.
+//------------------------------------------------------------------------------
+static const struct {
+	const char *name;
+	hash_function_f hash_function;
+} hash_test_functions[] = {
+	{"murmur", murmur_custom_hash},
+	{"jenkins", jenkins_one_at_a_time_hash},
+	{"crc32c", crc32c_hash},
+	{"xxh3", xxh3_custom_hash}
+};
+
+bool test_hash_kernels(size_t number_of_elements) {
+	bool ret_val = true;
+	uint8_t got_value[VALUE_SIZE];
+	uint64_t crc_ref[KEY_SIZE + 1];
+	// Throughput is measured over a set of keys that stays in the cache.
+	size_t hot = number_of_elements < 0x400 ? number_of_elements : 0x400;
+
+	printf("[TEST %s] Started\n", __func__);
+	printf("[TEST %s] Number of elements : %ld\n", __func__, number_of_elements);
+	test_data_t *pdata = allocate_test_data(number_of_elements);
+	const uint8_t **keys = calloc(number_of_elements, sizeof(*keys));
+	uint64_t *hashes = calloc(number_of_elements, sizeof(*hashes));
+	if(!pdata || !keys || !hashes) {
+		printf("[TEST %s] Error: Unable to allocate test elements\n", __func__);
+		free(keys);
+		free(hashes);
+		if(pdata) free_test_data(pdata, number_of_elements);
+		return false;
+	}
+	for(size_t i = 0; i < number_of_elements; i++) {
+		keys[i] = pdata[i].key;
+	}
+
+	// The software CRC32C is the reference of the hardware one.
+	ht_set_hash_kernel(HT_HASH_KERNEL_SCALAR);
+	for(size_t len = 0; len <= KEY_SIZE; len++) {
+		crc_ref[len] = crc32c_hash(keys[0], len, 7);
+	}
+
+	// Every kernel against the scalar murmur, with a tail shorter than a
+	// vector step.
+	size_t count = number_of_elements - 3;
+	for(ht_hash_kernel_t k = HT_HASH_KERNEL_SCALAR; k <= HT_HASH_KERNEL_AVX512; k++) {
+		if(!ht_set_hash_kernel(k)) {
+			printf("[TEST %s] Kernel %s is not supported\n", __func__, ht_hash_kernel_name(k));
+			continue;
+		}
+		murmur_custom_hash_batch(keys, count, 7, hashes);
+		size_t mismatches = 0;
+		for(size_t i = 0; i < count; i++) {
+			mismatches += hashes[i] != murmur_custom_hash(keys[i], KEY_SIZE, 7);
+		}
+		for(size_t len = 0; len <= KEY_SIZE; len++) {
+			mismatches += crc_ref[len] != crc32c_hash(keys[0], len, 7);
+		}
+		if(mismatches) {
+			printf("[TEST %s] Error: kernel %s has %zu mismatching hashes\n",
+				__func__, ht_hash_kernel_name(k), mismatches);
+			ret_val = false;
+		}
+
+		BENCHMARK_INIT;
+		BENCHMARK_START;
+		for(size_t i = 0; i < number_of_elements; i += hot) {
+			size_t n = number_of_elements - i < hot ? number_of_elements - i : hot;
+			murmur_custom_hash_batch(keys, n, 7, hashes + i);
+		}
+		BENCHMARK_END;
+		BENCHMARK_MEASURE_THROUGHPUT(number_of_elements);
+		printf("[TEST %s] Batch murmur %-6s: %.2f Mhash/s\n", __func__,
+			ht_hash_kernel_name(k), BENCHMARK_GET_THROUGHPUT / 1e6);
+	}
+	ht_set_hash_kernel(HT_HASH_KERNEL_AUTO);
+	printf("[TEST %s] Selected kernel: %s\n", __func__,
+		ht_hash_kernel_name(ht_get_hash_kernel()));
+
+	// Single-key throughput of every bundled function on cache-hot KEY_SIZE
+	// keys.
+	for(size_t f = 0; f < sizeof(hash_test_functions) / sizeof(hash_test_functions[0]); f++) {
+		hash_function_f hash_function = hash_test_functions[f].hash_function;
+		uint64_t sum = 0;
+		BENCHMARK_INIT;
+		BENCHMARK_START;
+		for(size_t i = 0; i < number_of_elements; i += hot) {
+			for(size_t j = 0; j < hot && i + j < number_of_elements; j++) {
+				sum ^= hash_function(keys[j], KEY_SIZE, i);
+			}
+		}
+		BENCHMARK_END;
+		BENCHMARK_MEASURE_THROUGHPUT(number_of_elements);
+		hashes[0] = sum;
+		printf("[TEST %s] %-7s: %.2f Mhash/s\n", __func__,
+			hash_test_functions[f].name, BENCHMARK_GET_THROUGHPUT / 1e6);
+	}
+
+	// The new functions bound to tables.
+	size_t capacity = round_to_power_of_two(number_of_elements * 2);
+	hash_function_f bound[2] = {crc32c_hash, xxh3_custom_hash};
+	for(int t = 0; t < 2 && ret_val; t++) {
+		hopscotch_hash_table_t *ht = ht_create(capacity, bound[t], 7);
+		for(size_t i = 0; ht && i < number_of_elements && ret_val; i++) {
+			if(!ht_insert(ht, pdata[i].key, pdata[i].value)) {
+				printf("[TEST %s] Error: Unable to insert key %zu\n", __func__, i);
+				ret_val = false;
+			}
+		}
+		for(size_t i = 0; ht && i < number_of_elements && ret_val; i++) {
+			if(!ht_contains_key(ht, pdata[i].key, got_value) ||
+				memcmp(got_value, pdata[i].value, VALUE_SIZE) != 0)
+			{
+				printf("[TEST %s] Error: key %zu lost\n", __func__, i);
+				ret_val = false;
+			}
+		}
+		if(!ht || (ret_val && ht_size_exact(ht) != number_of_elements)) {
+			printf("[TEST %s] Error: table bound to %s failed\n", __func__,
+				bound[t] == crc32c_hash ? "crc32c" : "xxh3");
+			ret_val = false;
+		}
+		ht_free(ht);
+	}
+
+	free(keys);
+	free(hashes);
+	free_test_data(pdata, number_of_elements);
+	if(ret_val) {
+		printf("[TEST %s] PASSED successfully\n", __func__);
+	} else {
+		printf("[TEST %s] FAILED\n", __func__);
+	}
+	return ret_val;
+}
+
+//------------------------------------------------------------------------------
+// File-backed tables.
+//------------------------------------------------------------------------------
+static bool mmap_test_check(
+	hopscotch_hash_table_t *ht,
+	test_data_t *pdata,
+	size_t first,
+	size_t count,
+	bool present
+) {
+	uint8_t got_value[VALUE_SIZE];
+	for(size_t i = first; i < first + count; i++) {
+		bool found = ht_contains_key(ht, pdata[i].key, got_value);
+		if(found != present ||
+			(found && memcmp(got_value, pdata[i].value, VALUE_SIZE) != 0))
+		{
+			printf("[TEST %s] Error: key %zu %s after reopen\n", __func__, i,
+				present ? "lost" : "came back");
+			return false;
+		}
+	}
+	return true;
+}
+
+// Leaves what a writer killed mid-add leaves behind in free slots of the home
+// neighborhood of key: a claimed slot (a slot word without a tag) and an add
+// never published (the pending tag).
+static bool mmap_test_plant_adds(hopscotch_hash_table_t *ht, const uint8_t *key) {
+	ht_array_t *a = atomic_load(&ht->array);
+	uint64_t h = ht_hash(ht, key, KEY_SIZE);
+	size_t planted = 0;
+	for(size_t d = 0; planted < 2 && d < HOP_RANGE * MAX_RELOCATION_FACTOR; d++) {
+		size_t idx = (INDEX(h, a->mask) + d) & a->mask;
+		atomic_uint_fast64_t *word =
+			(atomic_uint_fast64_t *)(a->hop_info_base + idx * a->hop_info_stride);
+		if(atomic_load(word) != 0) continue;
+		memcpy(a->key_base + idx * a->key_stride, key, KEY_SIZE);
+		atomic_store(word, h | HT_SLOT_USED);
+		a->tags[idx] = planted++ ? HT_TAG_PENDING : 0;
+	}
+	return planted == 2;
+}
+
+// Leaves a move of the slot of key to a free slot of its neighborhood cut
+// short: the source stays locked, the destination is filled while locked
+// (stage 0), filled and unlocked without a tag (stage 1) or published with the
+// tag (stage 2). The key has to survive once.
+static bool mmap_test_plant_move(hopscotch_hash_table_t *ht, const uint8_t *key, int stage) {
+	ht_array_t *a = atomic_load(&ht->array);
+	uint64_t word = ht_hash(ht, key, KEY_SIZE) | HT_SLOT_USED;
+	size_t src = SIZE_MAX, dst = SIZE_MAX;
+	for(size_t d = 0; d < HOP_RANGE * MAX_RELOCATION_FACTOR; d++) {
+		size_t idx = (INDEX(word, a->mask) + d) & a->mask;
+		uint64_t info = atomic_load(
+			(atomic_uint_fast64_t *)(a->hop_info_base + idx * a->hop_info_stride));
+		if(info == word && memcmp(a->key_base + idx * a->key_stride, key, KEY_SIZE) == 0) {
+			src = idx;
+		} else if(info == 0 && src != SIZE_MAX) {
+			dst = idx;
+			break;
+		}
+	}
+	if(dst == SIZE_MAX) return false;
+
+	a->versions[src] += 1;
+	memcpy(a->key_base + dst * a->key_stride, a->key_base + src * a->key_stride, KEY_SIZE);
+	memcpy(a->value_base + dst * a->value_stride, a->value_base + src * a->value_stride,
+		VALUE_SIZE);
+	atomic_store((atomic_uint_fast64_t *)(a->hop_info_base + dst * a->hop_info_stride), word);
+	if(stage == 0) a->versions[dst] += 1;
+	if(stage == 2) a->tags[dst] = a->tags[src];
+	return true;
+}
+
+bool test_mmap_table(size_t number_of_elements, hash_function_f hash_function) {
+	bool ret_val = true;
+	char path[] = "/tmp/hopscotch_ht_mmap_XXXXXX";
+	size_t capacity = round_to_power_of_two(number_of_elements * 5 / 4);
+
+	printf("[TEST %s] Started\n", __func__);
+	printf("[TEST %s] Number of elements : %ld\n", __func__, number_of_elements);
+	test_data_t *pdata = allocate_test_data(number_of_elements);
+	int fd = mkstemp(path);
+	if(!pdata || fd < 0) {
+		printf("[TEST %s] Error: Unable to allocate test elements\n", __func__);
+		if(pdata) free_test_data(pdata, number_of_elements);
+		return false;
+	}
+	close(fd);
+
+	// Restart by re-inserting everything, the baseline.
+	BENCHMARK_INIT;
+	BENCHMARK_START;
+	hopscotch_hash_table_t *ht = ht_create(capacity, hash_function, 0);
+	for(size_t i = 0; ht && i < number_of_elements; i++) {
+		ht_insert(ht, pdata[i].key, pdata[i].value);
+	}
+	BENCHMARK_END;
+	double rebuild = BENCHMARK_GET_ELAPSED;
+	ht_free(ht);
+
+	ht = ht_create_mmap(path, capacity, HT_LAYOUT_AOS, hash_function, 0);
+	for(size_t i = 0; ht && i < number_of_elements && ret_val; i++) {
+		if(!ht_insert(ht, pdata[i].key, pdata[i].value)) {
+			printf("[TEST %s] Error: Unable to insert key %zu\n", __func__, i);
+			ret_val = false;
+		}
+	}
+	if(!ht || ht_resize(ht, capacity * 2) || !ht_checkpoint(ht)) {
+		printf("[TEST %s] Error: file-backed table failed\n", __func__);
+		ret_val = false;
+	}
+	ht_free(ht);
+
+	// Reopen: only the header page is read, the slots page in on access.
+	BENCHMARK_START;
+	ht = ht_open_mmap(path);
+	BENCHMARK_END;
+	double reopen = BENCHMARK_GET_ELAPSED;
+	printf("[TEST %s] Rebuild: %.4f sec, reopen: %.6f sec\n", __func__, rebuild, reopen);
+	if(!ht || ht_size_exact(ht) != number_of_elements ||
+		ht_hash(ht, pdata[0].key, KEY_SIZE) != hash_function(pdata[0].key, KEY_SIZE, 0))
+	{
+		printf("[TEST %s] Error: reopened table differs\n", __func__);
+		ret_val = false;
+	}
+	BENCHMARK_START;
+	ret_val = ret_val && mmap_test_check(ht, pdata, 0, number_of_elements, true);
+	BENCHMARK_END;
+	BENCHMARK_MEASURE_THROUGHPUT(number_of_elements);
+	printf("[TEST %s] First lookups after reopen: ", __func__);
+	BENCHMARK_DATA_PRINT;
+
+	// Changes of the second run survive the next restart as well.
+	size_t half = number_of_elements / 2;
+	for(size_t i = 0; ret_val && i < half; i++) {
+		ht_remove_key(ht, pdata[i].key);
+	}
+	ht_free(ht);
+	ht = ht_open_mmap(path);
+	if(!ht || ht_size_exact(ht) != number_of_elements - half) {
+		printf("[TEST %s] Error: size after the second reopen\n", __func__);
+		ret_val = false;
+	}
+	ret_val = ret_val && mmap_test_check(ht, pdata, 0, half, false) &&
+		mmap_test_check(ht, pdata, half, number_of_elements - half, true);
+
+	// An open table is not clean: a second mapping recovers and counts again.
+	// Adds cut short are dropped, a removed key does not come back, keys of
+	// moves cut short are kept once.
+	if(ht && !mmap_test_plant_adds(ht, pdata[0].key)) {
+		printf("[TEST %s] Error: no free slot to plant an add\n", __func__);
+		ret_val = false;
+	}
+	for(int stage = 0; ht && stage < 3; stage++) {
+		if(!mmap_test_plant_move(ht, pdata[half + stage].key, stage)) {
+			printf("[TEST %s] Error: no free slot to plant a move\n", __func__);
+			ret_val = false;
+		}
+	}
+	hopscotch_hash_table_t *second = ht_open_mmap(path);
+	ht_validate_report_t report;
+	bool valid = second && ht_validate(second, 1, &report);
+	if(second && !valid) ht_print_validate(&report);
+	if(!valid || ht_size(second) != number_of_elements - half ||
+		!mmap_test_check(second, pdata, 0, 1, false) ||
+		!mmap_test_check(second, pdata, half, 3, true))
+	{
+		printf("[TEST %s] Error: recovery of an unclean file\n", __func__);
+		ret_val = false;
+	}
+	ht_free(second);
+	ht_free(ht);
+
+	// Only bundled hash functions can be named by the file.
+	if(ht_create_mmap(path, capacity, HT_LAYOUT_AOS, zero_hash, 0) ||
+		ht_open_mmap("/nonexistent/hopscotch_ht_mmap"))
+	{
+		printf("[TEST %s] Error: invalid file-backed table accepted\n", __func__);
+		ret_val = false;
+	}
+
+	unlink(path);
+	free_test_data(pdata, number_of_elements);
+	if(ret_val) {
+		printf("[TEST %s] PASSED successfully\n", __func__);
+	} else {
+		printf("[TEST %s] FAILED\n", __func__);
+	}
+	return ret_val;
+}
+
+//------------------------------------------------------------------------------
+// Memory placement.
+//------------------------------------------------------------------------------
+// Anonymous memory of the process backed by transparent huge pages, in kB.
+static size_t alloc_test_thp_kb(void) {
+	size_t kb = 0;
+	char line[256];
+	FILE *f = fopen("/proc/self/smaps_rollup", "r");
+	if(!f) return 0;
+	while(fgets(line, sizeof(line), f)) {
+		if(sscanf(line, "AnonHugePages: %zu kB", &kb) == 1) break;
+	}
+	fclose(f);
+	return kb;
+}
+
+bool test_alloc_options(size_t number_of_elements, hash_function_f hash_function) {
+	static const struct {
+		const char *name;
+		ht_alloc_options_t options;
+	} configs[] = {
+		{"heap", { HT_PAGES_DEFAULT, HT_NUMA_DEFAULT, 0, 0 }},
+		{"thp", { HT_PAGES_THP, HT_NUMA_DEFAULT, 0, 0 }},
+		{"huge-2mb", { HT_PAGES_HUGE_2MB, HT_NUMA_DEFAULT, 0, 0 }},
+		{"huge-1gb", { HT_PAGES_HUGE_1GB, HT_NUMA_DEFAULT, 0, 0 }},
+		{"interleave", { HT_PAGES_DEFAULT, HT_NUMA_INTERLEAVE, 0, 0 }},
+		{"bind-0", { HT_PAGES_DEFAULT, HT_NUMA_BIND, 0, 0 }},
+		{"first-touch-4", { HT_PAGES_DEFAULT, HT_NUMA_DEFAULT, 0, 4 }},
+		{"thp-interleave-4", { HT_PAGES_THP, HT_NUMA_INTERLEAVE, 0, 4 }}
+	};
+	bool ret_val = true;
+	uint8_t got_value[VALUE_SIZE];
+	size_t capacity = round_to_power_of_two(number_of_elements * 5 / 4);
+
+	printf("[TEST %s] Started\n", __func__);
+	printf("[TEST %s] Table capacity     : %zu\n", __func__, capacity);
+	printf("[TEST %s] Number of elements : %zu\n", __func__, number_of_elements);
+	test_data_t *pdata = allocate_test_data(number_of_elements);
+	if(!pdata) {
+		printf("[TEST %s] Error: Unable to allocate test elements\n", __func__);
+		return false;
+	}
+
+	for(size_t c = 0; c < sizeof(configs) / sizeof(configs[0]) && ret_val; c++) {
+		BENCHMARK_INIT;
+		size_t thp_before = alloc_test_thp_kb();
+		BENCHMARK_START;
+		hopscotch_hash_table_t *ht = ht_create_opts(capacity, HT_LAYOUT_AOS,
+			hash_function, 0, &configs[c].options);
+		BENCHMARK_END;
+		double create = BENCHMARK_GET_ELAPSED;
+		if(!ht) {
+			printf("[TEST %s] Error: Unable to create the %s table\n", __func__, configs[c].name);
+			ret_val = false;
+			break;
+		}
+		ht_set_resize_policy(ht, 0, 0);
+
+		BENCHMARK_START;
+		for(size_t i = 0; i < number_of_elements && ret_val; i++) {
+			if(!ht_insert(ht, pdata[i].key, pdata[i].value)) {
+				printf("[TEST %s] Error: Unable to insert key %zu\n", __func__, i);
+				ret_val = false;
+			}
+		}
+		BENCHMARK_END;
+		BENCHMARK_MEASURE_THROUGHPUT(number_of_elements);
+		double insert = BENCHMARK_GET_THROUGHPUT;
+
+		// Lookups in a scattered order, every one lands on a cold page.
+		int tlb = tlb_counter_open();
+		uint64_t tlb_start = tlb_counter_read(tlb);
+		BENCHMARK_START;
+		for(size_t n = 0, i = 0; n < number_of_elements && ret_val; n++) {
+			i = (i + 0x9E3779B1) % number_of_elements;
+			if(!ht_contains_key(ht, pdata[i].key, got_value) ||
+				memcmp(got_value, pdata[i].value, VALUE_SIZE) != 0)
+			{
+				printf("[TEST %s] Error: key %zu lost\n", __func__, i);
+				ret_val = false;
+			}
+		}
+		BENCHMARK_END;
+		BENCHMARK_MEASURE_THROUGHPUT(number_of_elements);
+		uint64_t tlb_misses = tlb_counter_read(tlb) - tlb_start;
+		tlb_counter_close(tlb);
+
+		ht_stats_t stats;
+		ht_get_stats(ht, &stats);
+		char tlb_text[32] = "n/a";
+		if(tlb >= 0) {
+			snprintf(tlb_text, sizeof(tlb_text), "%.2f",
+				(double)tlb_misses / number_of_elements);
+		}
+		printf("[TEST %s] %-16s: pages %-8s numa %-10s thp %5zu MB create %.3f sec "
+			"insert %.2f Mops/sec hit %.2f Mops/sec dTLB misses/hit %s\n", __func__,
+			configs[c].name, ht_page_mode_name(stats.pages), ht_numa_policy_name(stats.numa),
+			(alloc_test_thp_kb() - thp_before) / 1024, create, insert / 1e6,
+			BENCHMARK_GET_THROUGHPUT / 1e6, tlb_text);
+
+		// A resized array is placed like the first one.
+		if(ret_val && configs[c].options.pages == HT_PAGES_THP) {
+			ht_resize(ht, capacity * 2);
+			ht_resize_wait(ht);
+			ht_get_stats(ht, &stats);
+			if(stats.capacity != capacity * 2 || stats.size != number_of_elements ||
+				stats.pages == HT_PAGES_DEFAULT ||
+				!ht_contains_key(ht, pdata[0].key, NULL))
+			{
+				printf("[TEST %s] Error: resize of the %s table\n", __func__, configs[c].name);
+				ret_val = false;
+			}
+		}
+		ht_free(ht);
+	}
+
+	free_test_data(pdata, number_of_elements);
+	if(ret_val) {
+		printf("[TEST %s] PASSED successfully\n", __func__);
+	} else {
+		printf("[TEST %s] FAILED\n", __func__);
+	}
+	return ret_val;
+}
+
+// Reads the first 8 bytes of a value in place.
+static void value_test_visit(const uint8_t *value, size_t value_size, void *ctx) {
+	(void)value_size;
+	memcpy(ctx, value, sizeof(uint64_t));
+}
+
+bool test_value_access(size_t number_of_elements, hash_function_f hash_function) {
+	static const char *way_names[] = { "copy", "no value", "visit", "get_ref" };
+	const size_t rounds = 8;
+	bool ret_val = true;
+
+	printf("[TEST %s] Started\n", __func__);
+	printf("[TEST %s] Number of elements : %ld\n", __func__, number_of_elements);
+
+	hopscotch_hash_table_t *ht = ht_create(
+		round_to_power_of_two(number_of_elements * 2), hash_function, 0);
+	test_data_t *pdata = allocate_test_data(number_of_elements);
+	if(!ht || !pdata) {
+		printf("[TEST %s] Error: Unable to allocate test data\n", __func__);
+		if(pdata) free_test_data(pdata, number_of_elements);
+		if(ht) ht_free(ht);
+		return false;
+	}
+	for(size_t i = 0; i < number_of_elements; i++) {
+		ret_val &= ht_insert(ht, pdata[i].key, pdata[i].value);
+	}
+
+	uint8_t value[VALUE_SIZE];
+	for(int way = 0; way < 4 && ret_val; way++) {
+		size_t found = 0, wrong = 0;
+		BENCHMARK_INIT;
+		BENCHMARK_START;
+		for(size_t r = 0; r < rounds; r++) {
+			for(size_t i = 0; i < number_of_elements; i++) {
+				const uint8_t *key = pdata[i].key;
+				uint64_t head = 0;
+				bool hit;
+				switch(way) {
+				case 0:
+					hit = ht_contains_key(ht, key, value);
+					memcpy(&head, value, sizeof(head));
+					break;
+				case 1:
+					hit = ht_contains_key(ht, key, NULL);
+					memcpy(&head, pdata[i].value, sizeof(head));
+					break;
+				case 2:
+					hit = ht_visit(ht, key, value_test_visit, &head);
+					break;
+				default: {
+					ht_ref_t ref;
+					hit = ht_get_ref(ht, key, &ref);
+					if(hit) {
+						memcpy(&head, ref.value, sizeof(head));
+						hit = ht_ref_valid(&ref);
+						ht_ref_release(&ref);
+					}
+					break;
+				}
+				}
+				found += hit;
+				wrong += hit && memcmp(&head, pdata[i].value, sizeof(head)) != 0;
+			}
+		}
+		BENCHMARK_END;
+		BENCHMARK_MEASURE_THROUGHPUT((double)number_of_elements * rounds);
+		printf("[TEST %s] %-8s: %.2f Mops/sec\n", __func__, way_names[way],
+			BENCHMARK_GET_THROUGHPUT / 1e6);
+		if(found != number_of_elements * rounds || wrong) {
+			printf("[TEST %s] Error: %zu found, %zu wrong values\n", __func__, found, wrong);
+			ret_val = false;
+		}
+	}
+
+	// The guard also covers the whole value.
+	ht_ref_t ref;
+	if(ret_val && (!ht_get_ref(ht, pdata[0].key, &ref) || ref.value_size != VALUE_SIZE ||
+		memcmp(ref.value, pdata[0].value, VALUE_SIZE) != 0))
+	{
+		printf("[TEST %s] Error: Wrong value behind the guard\n", __func__);
+		ret_val = false;
+	} else if(ret_val) {
+		ht_ref_release(&ref);
+	}
+
+	// Missing keys.
+	ht_remove_key(ht, pdata[0].key);
+	uint64_t head = 0;
+	if(ht_visit(ht, pdata[0].key, value_test_visit, &head) ||
+		ht_get_ref(ht, pdata[0].key, &ref))
+	{
+		printf("[TEST %s] Error: Removed key still visible\n", __func__);
+		ret_val = false;
+	}
+
+	free_test_data(pdata, number_of_elements);
+	ht_free(ht);
+	if(ret_val) {
+		printf("[TEST %s] PASSED successfully\n", __func__);
+	} else {
+		printf("[TEST %s] FAILED\n", __func__);
+	}
+	return ret_val;
+}
+
+bool test_cache_mode(size_t number_of_elements, hash_function_f hash_function) {
+	const uint64_t ttl_ms = 50;
+	bool ret_val = true;
+
+	printf("[TEST %s] Started\n", __func__);
+	printf("[TEST %s] Number of elements : %ld\n", __func__, number_of_elements);
+
+	// Room for a quarter of the keys, a sixteenth of the room is hot.
+	size_t capacity = round_to_power_of_two(number_of_elements / 4);
+	size_t hot = capacity / 16;
+	hopscotch_hash_table_t *ht = ht_create_cache(capacity, HT_LAYOUT_AOS, hash_function, 0, 0);
+	test_data_t *pdata = allocate_test_data(number_of_elements);
+	if(!ht || !pdata) {
+		printf("[TEST %s] Error: Unable to allocate test data\n", __func__);
+		if(pdata) free_test_data(pdata, number_of_elements);
+		if(ht) ht_free(ht);
+		return false;
+	}
+
+	// Every insert finds room, the hot keys are read in between.
+	size_t failed = 0;
+	BENCHMARK_INIT;
+	BENCHMARK_START;
+	for(size_t i = 0; i < number_of_elements; i++) {
+		failed += !ht_insert(ht, pdata[i].key, pdata[i].value);
+		ht_contains_key(ht, pdata[i % hot].key, NULL);
+	}
+	BENCHMARK_END;
+	BENCHMARK_MEASURE_THROUGHPUT((double)number_of_elements);
+	printf("[TEST %s] Insert past capacity: %.2f Mops/sec\n", __func__,
+		BENCHMARK_GET_THROUGHPUT / 1e6);
+
+	size_t hot_kept = 0, cold_kept = 0;
+	uint8_t value[VALUE_SIZE];
+	for(size_t i = 0; i < number_of_elements; i++) {
+		bool hit = ht_contains_key(ht, pdata[i].key, value);
+		if(hit && memcmp(value, pdata[i].value, VALUE_SIZE) != 0) {
+			printf("[TEST %s] Error: Wrong value of key %zu\n", __func__, i);
+			ret_val = false;
+			break;
+		}
+		if(i < hot) {
+			hot_kept += hit;
+		} else {
+			cold_kept += hit;
+		}
+	}
+	printf("[TEST %s] Kept: %zu of %zu hot keys, %zu of %zu cold ones\n", __func__,
+		hot_kept, hot, cold_kept, number_of_elements - hot);
+	if(failed || ht_capacity(ht) != capacity || ht_size_exact(ht) > capacity) {
+		printf("[TEST %s] Error: %zu inserts failed, capacity %zu, size %zu\n", __func__,
+			failed, ht_capacity(ht), ht_size_exact(ht));
+		ret_val = false;
+	}
+	// The reference bits keep the hot keys, the cold ones are mostly gone.
+	if(hot_kept * 5 < hot * 4 ||
+		(double)cold_kept / (number_of_elements - hot) > 0.5)
+	{
+		printf("[TEST %s] Error: The eviction ignores the hot keys\n", __func__);
+		ret_val = false;
+	}
+
+	// Entries with a TTL expire, the others do not.
+	size_t half = hot / 2;
+	ht_zero(ht);
+	for(size_t i = 0; i < hot; i++) {
+		ret_val &= ht_insert_ttl(ht, pdata[i].key, pdata[i].value, i < half ? ttl_ms : 0);
+	}
+	usleep((ttl_ms * 2) * 1000);
+	size_t expired_hits = 0, lasting_misses = 0;
+	for(size_t i = 0; i < hot; i++) {
+		bool hit = ht_contains_key(ht, pdata[i].key, NULL);
+		expired_hits += i < half && hit;
+		lasting_misses += i >= half && !hit;
+	}
+	// Writes which meet an expired key see it missing. Inserts reclaim some
+	// expired entries on their own, the sweep takes the rest.
+	bool replaced = ht_replace(ht, pdata[0].key, pdata[1].value);
+	bool added = ht_insert_if_absent(ht, pdata[1].key, pdata[1].value);
+	size_t swept = ht_cache_sweep(ht, capacity);
+	ht_stats_t stats;
+	ht_get_stats(ht, &stats);
+	printf("[TEST %s] Expired: %zu hits after the TTL, %zu swept\n", __func__,
+		expired_hits, swept);
+	if(expired_hits || lasting_misses || replaced || !added ||
+		stats.cache_expirations != half || ht_size_exact(ht) != hot - half + 1)
+	{
+		printf("[TEST %s] Error: Expiry, %zu hits, %zu misses, %zu of %zu left\n", __func__,
+			expired_hits, lasting_misses, ht_size_exact(ht), hot - half + 1);
+		ret_val = false;
+	}
+	ht_print_stats(ht);
+
+	// The default TTL applies to plain inserts.
+	ht_zero(ht);
+	ht_set_cache_mode(ht, true, ttl_ms);
+	for(size_t i = 0; i < hot; i++) ret_val &= ht_insert(ht, pdata[i].key, pdata[i].value);
+	usleep((ttl_ms * 2) * 1000);
+	ht_cache_sweep(ht, capacity);
+	ht_get_stats(ht, &stats);
+	if(ht_size_exact(ht) != 0 || stats.cache_expirations != hot || stats.cache_hits != 0) {
+		printf("[TEST %s] Error: Default TTL, %zu of %zu expired\n", __func__,
+			stats.cache_expirations, hot);
+		ret_val = false;
+	}
+
+	// Variable-length tables and tables without expiry words have no cache mode.
+	hopscotch_hash_table_t *var = ht_create_var(0x100, 0x1000, hash_function, 0);
+	if(var && ht_set_cache_mode(var, true, 0)) {
+		printf("[TEST %s] Error: Cache mode on a variable-length table\n", __func__);
+		ret_val = false;
+	}
+	if(var) ht_free(var);
+	hopscotch_hash_table_t *plain = ht_create(0x100, hash_function, 0);
+	if(plain && ht_set_cache_mode(plain, true, 0)) {
+		printf("[TEST %s] Error: Cache mode on a table without expiry words\n", __func__);
+		ret_val = false;
+	}
+	if(plain) ht_free(plain);
+
+	free_test_data(pdata, number_of_elements);
+	ht_free(ht);
+	if(ret_val) {
+		printf("[TEST %s] PASSED successfully\n", __func__);
+	} else {
+		printf("[TEST %s] FAILED\n", __func__);
+	}
+	return ret_val;
+}
+
+// Brackets and braces of the JSON text pair up, strings aside.
+static bool stats_test_json_balanced(const char *json) {
+	char open[16];
+	size_t depth = 0;
+	bool in_string = false;
+	for(const char *c = json; *c; c++) {
+		if(in_string) {
+			in_string = *c != '"';
+		} else if(*c == '"') {
+			in_string = true;
+		} else if(*c == '{' || *c == '[') {
+			if(depth == sizeof(open)) return false;
+			open[depth++] = *c;
+		} else if(*c == '}' || *c == ']') {
+			if(depth == 0 || open[--depth] != (*c == '}' ? '{' : '[')) return false;
+		}
+	}
+	return depth == 0 && !in_string;
+}
+
+static size_t stats_test_sum(const size_t *bins) {
+	size_t sum = 0;
+	for(size_t bin = 0; bin < HT_STATS_BINS; bin++) sum += bins[bin];
+	return sum;
+}
+
+bool test_probe_stats(size_t capacity, hash_function_f hash_function) {
+	size_t number_of_elements = capacity / 100 * 95;
+	bool ret_val = true;
+
+	printf("[TEST %s] Started\n", __func__);
+	printf("[TEST %s] Capacity : %ld, elements : %ld\n", __func__, capacity, number_of_elements);
+
+	hopscotch_hash_table_t *ht = ht_create(capacity, hash_function, 0);
+	test_data_t *pdata = allocate_test_data(number_of_elements);
+	if(!ht || !pdata) {
+		printf("[TEST %s] Error: Unable to allocate test data\n", __func__);
+		if(pdata) free_test_data(pdata, number_of_elements);
+		if(ht) ht_free(ht);
+		return false;
+	}
+
+	// A fixed table loaded to 95% relocates.
+	ht_set_resize_policy(ht, 0, 0);
+	size_t added = 0, found = 0, removed = 0;
+	for(size_t i = 0; i < number_of_elements; i++) {
+		added += ht_insert(ht, pdata[i].key, pdata[i].value);
+	}
+	for(size_t i = 0; i < number_of_elements; i++) {
+		found += ht_contains_key(ht, pdata[i].key, NULL);
+	}
+	for(size_t i = 0; i < number_of_elements; i += 2) {
+		removed += ht_remove_key(ht, pdata[i].key);
+	}
+
+	ht_stats_t stats;
+	ht_get_stats(ht, &stats);
+	size_t len = ht_stats_json(&stats, NULL, 0);
+	char *json = malloc(len + 1);
+	char small[16];
+	if(!json || ht_stats_json(&stats, json, len + 1) != len || strlen(json) != len ||
+		ht_stats_json(&stats, small, sizeof(small)) != len ||
+		strlen(small) != sizeof(small) - 1)
+	{
+		printf("[TEST %s] Error: JSON length %zu\n", __func__, len);
+		ret_val = false;
+	} else if(json[0] != '{' || json[len - 1] != '}' || !stats_test_json_balanced(json) ||
+		!strstr(json, "\"probes\":{") || !strstr(json, "\"probe_distance\":["))
+	{
+		printf("[TEST %s] Error: Malformed JSON\n", __func__);
+		ret_val = false;
+	}
+	if(ret_val) printf("[TEST %s] %s\n", __func__, json);
+
+	// Every key found, added or removed is one probe distance sample and
+	// every add one occupancy and one chain length sample.
+	if(stats.probe_stats) {
+		size_t probes = stats_test_sum(stats.probe_distance);
+		if(probes != added + found + removed ||
+			stats_test_sum(stats.occupancy) != added + stats.range_full + stats.no_candidate ||
+			stats_test_sum(stats.relocation_chain) != added ||
+			stats.relocations == 0 || stats.relocations > stats.relocation_attempts)
+		{
+			printf("[TEST %s] Error: %zu probes for %zu calls, %zu relocations\n", __func__,
+				probes, added + found + removed, stats.relocations);
+			ret_val = false;
+		}
+	} else if(stats_test_sum(stats.probe_distance) || stats.relocation_attempts) {
+		printf("[TEST %s] Error: Counters without HT_STATS\n", __func__);
+		ret_val = false;
+	}
+	ht_print_stats(ht);
+
+	free(json);
+	free_test_data(pdata, number_of_elements);
+	ht_free(ht);
+	if(ret_val) {
+		printf("[TEST %s] PASSED successfully\n", __func__);
+	} else {
+		printf("[TEST %s] FAILED\n", __func__);
+	}
+	return ret_val;
+}
+
+//------------------------------------------------------------------------------
+// Test data generation.
+//------------------------------------------------------------------------------
+bool test_data_generation(size_t number_of_elements) {
+	printf("[TEST %s] Started...\n", __func__);
+	printf("[TEST %s] Elements : %ld\n", __func__, number_of_elements);
+	printf("[TEST %s] Run seed : %#lx\n", __func__, get_test_data_seed());
+
+	const size_t bytes = number_of_elements * (KEY_SIZE + VALUE_SIZE);
+	uint64_t seed = 0x1234;
+	double start_time = get_current_time();
+	test_data_t *first = allocate_test_data_seeded(number_of_elements, seed);
+	double elapsed = get_current_time() - start_time;
+	test_data_t *again = allocate_test_data_seeded(number_of_elements, seed);
+	test_data_t *other = allocate_test_data_seeded(number_of_elements, seed + 1);
+	if(!first || !again || !other) {
+		printf("[TEST %s] Error: Unable to allocate test data\n", __func__);
+		free_test_data(first, number_of_elements);
+		free_test_data(again, number_of_elements);
+		free_test_data(other, number_of_elements);
+		return false;
+	}
+	printf("[TEST %s] Generated in %.4f sec, %.0f elements/sec\n", __func__, elapsed,
+		number_of_elements / elapsed);
+
+	bool ret_val = true;
+	// The same seed gives the same bytes, another seed other keys.
+	if(memcmp(first[0].key, again[0].key, bytes) != 0) {
+		printf("[TEST %s] Error: Same seed, different data\n", __func__);
+		ret_val = false;
+	}
+	size_t same_keys = 0, flagged = 0;
+	for(size_t i = 0; i < number_of_elements; i++) {
+		if(memcmp(first[i].key, other[i].key, KEY_SIZE) == 0) same_keys++;
+		if(first[i].inserted) flagged++;
+		if(first[i].value != first[i].key + KEY_SIZE) flagged++;
+	}
+	if(same_keys || flagged) {
+		printf("[TEST %s] Error: %zu equal keys under another seed, %zu bad elements\n",
+			__func__, same_keys, flagged);
+		ret_val = false;
+	}
+
+	// Sets of one run differ from each other.
+	test_data_t *set_a = allocate_test_data(number_of_elements);
+	test_data_t *set_b = allocate_test_data(number_of_elements);
+	if(!set_a || !set_b || memcmp(set_a[0].key, set_b[0].key, KEY_SIZE) == 0) {
+		printf("[TEST %s] Error: Two sets of the run are equal\n", __func__);
+		ret_val = false;
+	}
+
+	free_test_data(set_a, number_of_elements);
+	free_test_data(set_b, number_of_elements);
+	free_test_data(first, number_of_elements);
+	free_test_data(again, number_of_elements);
+	free_test_data(other, number_of_elements);
+	if(ret_val) {
+		printf("[TEST %s] PASSED successfully\n", __func__);
+	} else {
+		printf("[TEST %s] FAILED\n", __func__);
+	}
+	return ret_val;
+}
+
+//------------------------------------------------------------------------------
+// Structural validation.
+//------------------------------------------------------------------------------
+static inline atomic_uint_fast64_t *validate_test_word(ht_array_t *a, size_t idx) {
+	return (atomic_uint_fast64_t *)(a->hop_info_base + idx * a->hop_info_stride);
+}
+
+// Copies slot src (word, key, value, tag) into slot dst.
+static void validate_test_copy(ht_array_t *a, size_t src, size_t dst) {
+	atomic_store(validate_test_word(a, dst), atomic_load(validate_test_word(a, src)));
+	memcpy(a->key_base + dst * a->key_stride, a->key_base + src * a->key_stride, a->key_size);
+	memcpy(a->value_base + dst * a->value_stride, a->value_base + src * a->value_stride,
+		a->value_size);
+	a->tags[dst] = a->tags[src];
+}
+
+// Next occupied slot from idx on.
+static size_t validate_test_next_used(ht_array_t *a, size_t idx) {
+	while(atomic_load(validate_test_word(a, idx & a->mask)) == 0) idx++;
+	return idx & a->mask;
+}
+
+// Free slot at least min and less than max slots after home, SIZE_MAX if none.
+static size_t validate_test_free(ht_array_t *a, size_t home, size_t min, size_t max) {
+	for(size_t d = min; d < max; d++) {
+		size_t idx = (home + d) & a->mask;
+		if(atomic_load(validate_test_word(a, idx)) == 0) return idx;
+	}
+	return SIZE_MAX;
+}
+
+bool test_validate(size_t capacity, hash_function_f hash_function, size_t max_threads) {
+	printf("[TEST %s] Started...\n", __func__);
+	printf("[TEST %s] Table capacity    : %ld\n", __func__, capacity);
+	printf("[TEST %s] Max threads       : %ld\n", __func__, max_threads);
+
+	size_t number_of_elements = ANY_PERCENT(capacity, 95);
+	hopscotch_hash_table_t *ht = ht_create(capacity, hash_function, 0);
+	test_data_t *pdata = allocate_test_data(number_of_elements);
+	if(!ht || !pdata) {
+		printf("[TEST %s] Error: Unable to allocate test data\n", __func__);
+		if(pdata) free_test_data(pdata, number_of_elements);
+		if(ht) ht_free(ht);
+		return false;
+	}
+
+	//--------------------------------------------------------------------------
+	// Sound tables: 95% load with displacement, removes, a resize, varlen.
+	//--------------------------------------------------------------------------
+	bool ret_val = true;
+	ht_set_resize_policy(ht, 0, 0);
+	for(size_t i = 0; i < number_of_elements; i++) {
+		ret_val &= ht_insert(ht, pdata[i].key, pdata[i].value);
+	}
+	for(size_t i = 0; i < number_of_elements; i += 3) {
+		ret_val &= ht_remove_key(ht, pdata[i].key);
+	}
+	if(!ret_val) printf("[TEST %s] Error: Unable to fill the table\n", __func__);
+
+	ht_validate_report_t report;
+	for(size_t threads = 1; threads <= max_threads; threads *= 2) {
+		double start_time = get_current_time();
+		bool valid = ht_validate(ht, threads, &report);
+		double elapsed = get_current_time() - start_time;
+		printf("[TEST %s] %2zu thread(s): %.0f slots/sec, %zu entries, %zu violations\n",
+			__func__, threads, capacity / elapsed, report.entries, report.violations);
+		if(!valid) ht_print_validate(&report);
+		ret_val &= valid && report.entries == ht_size_exact(ht);
+	}
+
+	ret_val &= ht_resize(ht, capacity * 2);
+	bool valid = ht_validate(ht, max_threads, &report);
+	printf("[TEST %s] After a resize to %zu: %zu violations\n", __func__,
+		report.capacity, report.violations);
+	ret_val &= valid && report.capacity == capacity * 2;
+	ret_val &= ht_resize(ht, capacity);
+	ht_resize_wait(ht);
+
+	hopscotch_hash_table_t *var = ht_create_var(0x1000, 0x100000, hash_function, 0);
+	if(var) {
+		size_t var_keys = ANY_PERCENT(0x1000, 80);
+		for(size_t i = 0; i < var_keys; i++) {
+			// Inline and arena keys.
+			size_t len = 8 + i % (KEY_SIZE - 7);
+			ret_val &= ht_insert_var(var, pdata[i].key, len, pdata[i].value, 16);
+		}
+		valid = ht_validate(var, max_threads, &report);
+		printf("[TEST %s] Variable-length table: %zu entries, %zu violations\n", __func__,
+			report.entries, report.violations);
+		ret_val &= valid && report.entries == var_keys;
+		ht_free(var);
+	} else {
+		ret_val = false;
+	}
+
+	//--------------------------------------------------------------------------
+	// Every kind of damage is found.
+	//--------------------------------------------------------------------------
+	ht_array_t *a = atomic_load(&ht->array);
+	size_t neighborhood = HOP_RANGE * MAX_RELOCATION_FACTOR;
+	size_t slot = validate_test_next_used(a, 0);
+	uint8_t tag = a->tags[slot] + 1;
+	a->tags[slot] = tag ? tag : 1;
+
+	slot = validate_test_next_used(a, capacity / 8);
+	a->tags[slot] = 0;
+
+	slot = validate_test_next_used(a, capacity / 4);
+	a->key_base[slot * a->key_stride] ^= 0xFF;
+
+	// An entry moved out of its neighborhood, and one copied within it.
+	size_t moved = SIZE_MAX, copied = SIZE_MAX;
+	for(slot = capacity / 2; moved == SIZE_MAX && slot < capacity; slot++) {
+		uint64_t word = atomic_load(validate_test_word(a, slot));
+		if(!word) continue;
+		moved = validate_test_free(a, INDEX(word, a->mask), neighborhood, 2 * neighborhood);
+		if(moved != SIZE_MAX) {
+			validate_test_copy(a, slot, moved);
+			atomic_store(validate_test_word(a, slot), 0);
+			a->tags[slot] = 0;
+		}
+	}
+	for(slot = 3 * capacity / 4; copied == SIZE_MAX && slot < capacity; slot++) {
+		uint64_t word = atomic_load(validate_test_word(a, slot));
+		if(!word) continue;
+		size_t home = INDEX(word, a->mask);
+		copied = validate_test_free(a, home, ((slot - home) & a->mask) + 1, neighborhood);
+		if(copied != SIZE_MAX) validate_test_copy(a, slot, copied);
+	}
+
+	slot = validate_test_next_used(a, 7 * capacity / 8);
+	a->versions[slot] += 1;
+
+	valid = ht_validate(ht, max_threads, &report);
+	ht_print_validate(&report);
+	bool found[HT_VIOLATION_SIZE + 1] = { false };
+	for(size_t i = 0; i < report.reported; i++) found[report.violation[i].kind] = true;
+	for(int kind = 0; kind <= HT_VIOLATION_SIZE; kind++) {
+		// Fixed-size keys have no references.
+		if(kind == HT_VIOLATION_REFERENCE) continue;
+		if(!found[kind]) {
+			printf("[TEST %s] Error: %s violation not found\n", __func__,
+				ht_violation_name(kind));
+			ret_val = false;
+		}
+	}
+	ret_val &= !valid && moved != SIZE_MAX && copied != SIZE_MAX && report.violations == 7;
+
+	free_test_data(pdata, number_of_elements);
+	ht_free(ht);
+	if(ret_val) {
+		printf("[TEST %s] PASSED successfully\n", __func__);
+	} else {
+		printf("[TEST %s] FAILED\n", __func__);
+	}
+	return ret_val;
+}
@@ -16,6 +16,9 @@ Parameters:
 					  the capacity of the requested number of elements.
 	- number_of_threads – The total number of threads executing hash table
 						  operations.
+	- shards – 0 runs against a single table, otherwise against a sharded
+			   front-end (hopscotch_ht_sharded.h) of that many NUMA-bound
+			   sub-tables sharing the capacity.
 Return value:
 	- Returns `true` if the test succeeds, `false` otherwise.
 Notes:
@@ -44,12 +47,15 @@ Thread  3: [I C R]  0.4661 sec 224953.64 ops/sec
 Thread  4: [I C R]  4.1129 sec 25494.36 ops/sec
 Thread  5: [I C R]  1.9036 sec 55083.67 ops/sec
 Thread  6: [I C R]  3.8072 sec 27541.71 ops/sec
+The sum of the thread rates is printed per mode, so a single-table run and a
+sharded run of the same size compare directly.
 */
 bool test_run_concurrent(
 	size_t number_of_elements,
 	hash_function_f hash_function,
 	bool ht_twice_size,
-	size_t number_of_threads
+	size_t number_of_threads,
+	size_t shards
 );
 
 /*
@@ -76,7 +82,9 @@ bool test_lookup_for_specific_key_value(
 /*
 Test Description:
 Executes fundamental hash table operations including insertion, optional
-containment checks and optional removal.
+containment checks and optional removal. ht_validate checks the structure of
+the table after the insertion and after the removal, any violation fails the
+test.
 
 Parameters:
 	- number_of_elements - Total elements to insert (must be > 0).
@@ -164,4 +172,424 @@ Return value:
 */
 bool test_relocation_and_max_relocation_value();
 
+/*
+Test Description:
+The test compares the slot layouts (HT_LAYOUT_AOS and HT_LAYOUT_SOA) and the
+tag match kernels (scalar, SSE2, AVX2) on the same data set: insert, lookup of
+present keys (hit), lookup of absent keys (miss) and remove. Throughput of
+every phase is printed per layout and kernel, kernels the CPU lacks are skipped.
+
+Parameters:
+	- number_of_elements - Table capacity (rounded to power of two), the table
+						   is filled to 80%.
+	- hash_function – The hash function to be used for key hashing.
+					  (available functions are defined in hopscotch_ht.h).
+Return value:
+	- Returns `true` if the test succeeds, `false` otherwise.
+*/
+bool test_layout_benchmark(
+	size_t number_of_elements,
+	hash_function_f hash_function
+);
+
+/*
+Test Description:
+The test starts from a small table and lets the threads insert far more
+elements than it can hold. The table grows online while the threads keep
+working, every inserted key must be found with its value, then all keys are
+removed and the table shrinks again. Last, a table holding more keys than half
+its capacity is shrunk to half: the stuck migration has to move into a bigger
+array, inserts meanwhile and a grow afterwards must work and keep every key.
+
+Parameters:
+	- initial_capacity - Capacity passed to ht_create (rounded to power of two).
+	- number_of_elements - Total elements to insert.
+	- hash_function – The hash function to be used for key hashing.
+					  (available functions are defined in hopscotch_ht.h).
+	- number_of_threads – The total number of threads.
+Return value:
+	- Returns `true` if the test succeeds, `false` otherwise.
+*/
+bool test_online_resize(
+	size_t initial_capacity,
+	size_t number_of_elements,
+	hash_function_f hash_function,
+	size_t number_of_threads
+);
+
+/*
+Test Description:
+Half of the threads keep overwriting, removing and re-inserting a small set of
+keys, every value is filled with a single byte. The other half keep reading
+the keys and check that no value mixes bytes of two writes (a torn read).
+Readers take turns with ht_contains_key, ht_visit and ht_get_ref (the guard
+read is retried until ht_ref_valid holds).
+
+Parameters:
+	- number_of_keys - Number of keys shared by all threads.
+	- hash_function – The hash function to be used for key hashing.
+					  (available functions are defined in hopscotch_ht.h).
+	- number_of_threads – The total number of threads (at least 2).
+	- rounds - Number of passes every writer makes over the keys.
+Return value:
+	- Returns `true` if the test succeeds, `false` otherwise.
+*/
+bool test_consistent_reads(
+	size_t number_of_keys,
+	hash_function_f hash_function,
+	size_t number_of_threads,
+	size_t rounds
+);
+
+/*
+Test Description:
+The table is filled to 80% with resize disabled, then half of the threads
+insert more keys up to load_percent while the other half keep looking up the
+prefilled keys. The extra keys only fit by bubbling free slots back into their
+neighborhoods, which moves the prefilled keys around under the readers.
+No insert may fail and no prefilled key may be missed.
+
+Parameters:
+	- capacity - Table capacity (rounded to power of two).
+	- hash_function – The hash function to be used for key hashing.
+					  (available functions are defined in hopscotch_ht.h).
+	- load_percent - Final load factor of the table.
+	- number_of_threads – The total number of threads (at least 2).
+Return value:
+	- Returns `true` if the test succeeds, `false` otherwise.
+*/
+bool test_high_load_displacement(
+	size_t capacity,
+	hash_function_f hash_function,
+	size_t load_percent,
+	size_t number_of_threads
+);
+
+/*
+Test Description:
+The test runs the same insert, lookup (hit) and remove phases key by key and
+through ht_insert_batch / ht_contains_batch / ht_remove_batch, checks that
+both find every inserted key with its value and prints the throughput of
+every phase for both.
+
+Parameters:
+	- number_of_elements - Table capacity (rounded to power of two), the table
+						   is filled to 80%.
+	- hash_function – The hash function to be used for key hashing.
+					  (available functions are defined in hopscotch_ht.h).
+Return value:
+	- Returns `true` if the test succeeds, `false` otherwise.
+*/
+bool test_batch_operations(
+	size_t number_of_elements,
+	hash_function_f hash_function
+);
+
+/*
+Test Description:
+The test fills a variable-length table (ht_create_var) starting from a small
+capacity, so the references are migrated by several resizes. Keys are short
+(kept inline) or longer ones in the arena, values are 1 to 300 bytes long.
+Every other key is then updated with a value of another length. The test
+checks every value, a truncated lookup, removes all keys, checks that the
+arena is empty again and prints the memory per entry next to the fixed-size
+layout.
+
+Parameters:
+	- number_of_elements - Number of keys.
+	- hash_function – The hash function bound to the table.
+Return value:
+	- Returns `true` if the test succeeds, `false` otherwise.
+*/
+bool test_variable_length(
+	size_t number_of_elements,
+	hash_function_f hash_function
+);
+
+/*
+Test Description:
+The test generates three table shapes with HOPSCOTCH_DEFINE_TYPED (8/8, 16/32 and
+the default KEY_SIZE/VALUE_SIZE) in one process. For every shape it inserts,
+looks up (checking the values) and removes the keys and prints the
+throughput of each phase, then checks that two shapes do not share entries.
+
+Parameters:
+	- number_of_elements - Number of keys per shape, every table is created
+						   with room for 25% more.
+Return value:
+	- Returns `true` if the test succeeds, `false` otherwise.
+*/
+bool test_typed_tables(size_t number_of_elements);
+
+/*
+Test Description:
+The test binds a hash function returning 0 for every key to a table and
+fills a whole neighborhood with such keys, which must all be found and
+removed (hash 0 used to mark empty slots). It then fills two tables created
+with different seeds, checks that no key hashes the same under both seeds
+and that both tables hold every key.
+
+Parameters:
+	- number_of_elements - Number of keys of the seeded tables.
+Return value:
+	- Returns `true` if the test succeeds, `false` otherwise.
+*/
+bool test_hash_binding(size_t number_of_elements);
+
+/*
+Test Description:
+The test checks every hash kernel the CPU supports: the multi-key murmur
+kernel must give the hashes of the scalar murmur (including a tail shorter
+than a vector step) and the CRC32C the values of the software one. It prints
+the throughput of each batch kernel and of every bundled hash function on
+KEY_SIZE keys, then fills tables bound to crc32c_hash and xxh3_custom_hash
+and looks every key up.
+
+Parameters:
+	- number_of_elements - Number of keys hashed and inserted.
+Return value:
+	- Returns `true` if the test succeeds, `false` otherwise.
+*/
+bool test_hash_kernels(size_t number_of_elements);
+
+/*
+Test Description:
+The test fills a file-backed table (ht_create_mmap), closes and reopens it
+and checks that every key and value and the size survived the restart. It
+prints the time of the reopen against rebuilding a heap table by
+re-inserting every key, then removes half of the keys and checks them after
+the next reopen. A second mapping of a file still open must recover it, a
+custom hash function and a missing file must be refused.
+
+Parameters:
+	- number_of_elements - Number of keys, the table is created with room for
+						   25% more.
+	- hash_function - Bundled hash function the file is bound to.
+Return value:
+	- Returns `true` if the test succeeds, `false` otherwise.
+*/
+bool test_mmap_table(size_t number_of_elements, hash_function_f hash_function);
+
+/*
+Test Description:
+The test creates a table with every ht_create_opts placement: heap, THP,
+2MB and 1GB huge pages (THP without a reserved pool), interleaved and
+node-bound NUMA policy and parallel first touch. For each it prints the
+pages and policy the table got, the THP backed memory, the create, insert
+and scattered lookup throughput and the data TLB misses per lookup (n/a
+without perf events). A THP table is also resized and checked.
+
+Parameters:
+	- number_of_elements - Number of keys, every table is created with room
+						   for 25% more.
+	- hash_function - Hash function bound to the tables.
+Return value:
+	- Returns `true` if the test succeeds, `false` otherwise.
+*/
+bool test_alloc_options(size_t number_of_elements, hash_function_f hash_function);
+
+/*
+Test Description:
+The test checks the epoch-based reclamation: an object retired while the
+retiring thread is inside a section survives ht_epoch_collect, it is
+reclaimed by ht_epoch_barrier once the section is left. Then, for 1, 2, 4
+... max_threads threads, it measures the cost of a bare enter / exit pair,
+the lookup throughput with a section per call and with one section held
+across HT_BATCH_GROUP lookups, and prints the overhead of the per-call
+sections. Finally the table is grown and shrunk under max_threads lookups:
+every lookup must succeed and every retired array must be reclaimed.
+
+Parameters:
+	- number_of_elements - Number of keys looked up, the table is created
+						   with twice the room.
+	- hash_function - Hash function bound to the table.
+	- max_threads - Highest number of threads measured.
+Return value:
+	- Returns `true` if the test succeeds, `false` otherwise.
+*/
+bool test_epoch_reclamation(
+	size_t number_of_elements,
+	hash_function_f hash_function,
+	size_t max_threads
+);
+
+/*
+Test Description:
+The test fills a table and reads every value back four ways: ht_contains_key
+copying the whole value, ht_contains_key without a value, ht_visit reading 8
+bytes of it in place and ht_get_ref reading the same 8 bytes through the
+guard. Every read is checked against the inserted value and the throughput
+of each way is printed. Missing keys must be reported by both zero-copy
+calls.
+
+Parameters:
+	- number_of_elements - Number of keys, the table is created with twice
+						   the room.
+	- hash_function - Hash function bound to the table.
+Return value:
+	- Returns `true` if the test succeeds, `false` otherwise.
+*/
+bool test_value_access(size_t number_of_elements, hash_function_f hash_function);
+
+/*
+Test Description:
+The test checks the conditional writes under contention. First every thread
+calls ht_insert_if_absent for every key of a table created at an eighth of
+the room, so the adds race with the resizes they trigger: each key must be
+won by exactly one thread and hold that thread's value. Then half of the
+threads increment a counter per key by ht_compare_and_swap_value loops and
+the other half a second counter by ht_upsert, over a few hot keys which
+start missing. No increment may be lost. The plain outcomes of each call on
+a present and a missing key are checked as well.
+
+Parameters:
+	- number_of_elements - Number of keys of the insert race.
+	- hash_function - Hash function bound to the tables.
+	- number_of_threads - Number of worker threads.
+Return value:
+	- Returns `true` if the test succeeds, `false` otherwise.
+*/
+bool test_atomic_updates(
+	size_t number_of_elements,
+	hash_function_f hash_function,
+	size_t number_of_threads
+);
+
+/*
+Test Description:
+The test scans a table with ht_iter_begin / ht_iter_next and with
+ht_parallel_for_each. On a quiet table it prints the scan throughput of the
+iterator and of 1 to max_threads workers. Then writer threads keep adding and
+removing a quarter more keys and another thread keeps growing and shrinking
+the table while the scans run: every key present throughout must be visited
+exactly once with its value, the others at most once.
+
+Parameters:
+	- number_of_elements - Number of keys present for the whole test.
+	- hash_function - Hash function bound to the table.
+	- max_threads - Largest number of scan workers.
+Return value:
+	- Returns `true` if the test succeeds, `false` otherwise.
+*/
+bool test_table_scan(
+	size_t number_of_elements,
+	hash_function_f hash_function,
+	size_t max_threads
+);
+
+/*
+Test Description:
+The test fills 80% of a table like test_insert_remove_elements, first with one
+ht_insert per key, then with ht_bulk_build on 1 to max_threads threads, and
+prints the build rates against the insert loop. Every key must be found with
+its value. A bulk build into a table in use must be refused. A build with a
+duplicate key into a quarter of the capacity must grow the table first and
+keep the last value of the key.
+
+Parameters:
+	- capacity - Table capacity (power of two).
+	- hash_function - Hash function bound to the tables.
+	- max_threads - Largest number of build threads.
+Return value:
+	- Returns `true` if the test succeeds, `false` otherwise.
+*/
+bool test_bulk_build(size_t capacity, hash_function_f hash_function, size_t max_threads);
+
+/*
+Test Description:
+The test runs an ht_create_cache table. Four times more keys than the capacity
+are inserted while a sixteenth of the capacity is read in between: no insert
+may fail, the table must keep its capacity and the reference bits must keep
+four in five of the hot keys while most of the cold ones are evicted. Then
+half of the keys get a short TTL: after it they must be missing for lookups
+and writes, and the sweep must reclaim them. A default TTL must apply to
+plain inserts. A variable-length table and a table not made by
+ht_create_cache must refuse cache mode.
+
+Parameters:
+	- number_of_elements - Number of keys inserted.
+	- hash_function - Hash function bound to the table.
+Return value:
+	- Returns `true` if the test succeeds, `false` otherwise.
+*/
+bool test_cache_mode(size_t number_of_elements, hash_function_f hash_function);
+
+/*
+Test Description:
+The test loads a fixed table to 95%, looks every key up, removes half of them
+and checks ht_stats_json: the length it reports must match what it writes,
+a short buffer must get a terminated prefix and the object must be well
+formed. Built with HT_STATS, every key found, added or removed must be one
+probe distance sample, every add one occupancy and one relocation chain
+sample, and the table must have relocated. Without HT_STATS the counters
+must stay zero.
+
+Parameters:
+	- capacity - Table capacity (power of two).
+	- hash_function - Hash function bound to the table.
+Return value:
+	- Returns `true` if the test succeeds, `false` otherwise.
+*/
+bool test_probe_stats(size_t capacity, hash_function_f hash_function);
+
+/*
+Test Description:
+The test generates the same number of elements three times, twice from one
+seed and once from the next seed. The first two must match byte for byte and
+the third must share no key with them. Two sets from allocate_test_data in one
+run must differ from each other. The generation rate is printed.
+
+Parameters:
+	- number_of_elements - Number of key/value pairs of each set.
+Return value:
+	- Returns `true` if the test succeeds, `false` otherwise.
+*/
+bool test_data_generation(size_t number_of_elements);
+
+/*
+Test Description:
+The scenario of the task description: the table is prefilled to 3/4 of its
+capacity, but not less than 1,000,000 keys, then every thread endlessly adds
+a random key, checks that it is there with its value, removes it and checks
+one of the prefilled keys. Once per second the test prints the throughput,
+the insert failures and their rate, the missing and stale keys and the size.
+After the run no key may have been missing or stale, every prefilled key must
+be there with its value and the size must be the prefill again. Insert
+failures are reported only.
+
+Parameters:
+	- capacity - Table capacity (power of two), doubled until 3/4 of it holds
+	  1,000,000 keys.
+	- hash_function - Hash function bound to the table.
+	- number_of_threads - Number of churn threads.
+	- duration - Run time in seconds, 0 - endless.
+Return value:
+	- Returns `true` if the test succeeds, `false` otherwise.
+*/
+bool test_churn(
+	size_t capacity,
+	hash_function_f hash_function,
+	size_t number_of_threads,
+	size_t duration
+);
+
+/*
+Test Description:
+The test fills a fixed table to 95% (with displacement), removes a third of
+the keys and runs ht_validate on 1 to max_threads threads, printing the rate:
+there must be no violation and every entry must be counted. The same after a
+resize and on a variable-length table. Then the test damages the table: a
+wrong tag, a claim without a tag, a changed key, an entry moved out of its
+neighborhood, a second copy of a key, a slot left locked. Every kind must be
+reported, together with the size mismatch of the extra copy, and nothing else.
+
+Parameters:
+	- capacity - Table capacity (power of two).
+	- hash_function - Hash function bound to the tables.
+	- max_threads - Largest number of validation threads.
+Return value:
+	- Returns `true` if the test succeeds, `false` otherwise.
+*/
+bool test_validate(size_t capacity, hash_function_f hash_function, size_t max_threads);
+
 #endif // HOPSCOTCH_HT_TEST_IFACE_H
@@ -13,115 +13,126 @@ double get_current_time() {
 //------------------------------------------------------------------------------
 // Test data generation functions.
 //------------------------------------------------------------------------------
-int generate_random_pair(uint8_t *key, uint8_t *value) {
-	if(!key && !value) {
-		printf("Error: keys and values is zero");
-		return 0;
-	}
+static atomic_uint_fast64_t test_data_seed = TEST_DATA_SEED_DEFAULT;
+static atomic_uint_fast64_t test_data_sets = 0;
+static atomic_bool test_data_seed_read = false;
+
+void set_test_data_seed(uint64_t seed) {
+	atomic_store(&test_data_seed, seed);
+	atomic_store(&test_data_sets, 0);
+	atomic_store(&test_data_seed_read, true);
+}
 
-	// open  /dev/urandom.
-	int fd = open("/dev/urandom", O_RDONLY);
-	if(fd == -1) {
-		printf("Error: Unable to open /dev/urandom");
-		return 1;
+uint64_t get_test_data_seed(void) {
+	if(!atomic_exchange(&test_data_seed_read, true)) {
+		const char *env = getenv("HT_TEST_SEED");
+		if(env && *env) atomic_store(&test_data_seed, strtoull(env, NULL, 0));
 	}
+	return atomic_load(&test_data_seed);
+}
 
-	// Allocate memory.
-	unsigned char *buffer = malloc(KEY_SIZE + VALUE_SIZE);
-	if(!buffer) {
-		printf("Error: Unable to allocate memory\n");
-		close(fd);
-		return 1;
+// Key and value bytes of one element straight from the generator.
+static inline void test_data_fill(test_rng_t *rng, uint8_t *key, uint8_t *value) {
+	for(size_t i = 0; i < KEY_SIZE; i += sizeof(uint64_t)) {
+		uint64_t r = test_rng_next(rng);
+		memcpy(key + i, &r, sizeof(r));
+	}
+	for(size_t i = 0; i < VALUE_SIZE; i += sizeof(uint64_t)) {
+		uint64_t r = test_rng_next(rng);
+		memcpy(value + i, &r, sizeof(r));
 	}
+}
 
-	size_t bytes_read = read(fd, buffer, KEY_SIZE + VALUE_SIZE);
-	if(bytes_read != KEY_SIZE + VALUE_SIZE) {
-		perror("Error: Unable to read /dev/urandom\n");
-		free(buffer);
-		close(fd);
+int generate_random_pair(uint8_t *key, uint8_t *value) {
+	if(!key || !value) {
+		printf("Error: keys and values is zero");
 		return 1;
 	}
+	static _Thread_local test_rng_t rng;
+	static _Thread_local bool seeded = false;
+	if(!seeded) {
+		test_rng_seed(&rng, get_test_data_seed() ^
+			atomic_fetch_add(&test_data_sets, 1) * 0x9e3779b97f4a7c15ULL);
+		seeded = true;
+	}
+	test_data_fill(&rng, key, value);
+	return 0;
+}
 
-	memcpy(key, buffer, KEY_SIZE);
-	memcpy(value, buffer + KEY_SIZE, VALUE_SIZE);
-
-	// Release resources.
-	free(buffer);
-	close(fd);
+// Elements are generated in chunks, each from its own seed, so the data does
+// not depend on the number of threads.
+#define TEST_DATA_CHUNK (0x10000)
+#define TEST_DATA_MAX_THREADS (16)
+
+typedef struct {
+	test_data_t *pdata;
+	size_t size;
+	uint64_t seed;
+	atomic_size_t *next_chunk;
+} test_data_worker_t;
+
+static int test_data_worker(void *arg) {
+	test_data_worker_t *w = (test_data_worker_t *)arg;
+	size_t chunks = (w->size + TEST_DATA_CHUNK - 1) / TEST_DATA_CHUNK;
+	for(;;) {
+		size_t chunk = atomic_fetch_add(w->next_chunk, 1);
+		if(chunk >= chunks) break;
+		test_rng_t rng;
+		uint64_t seed = w->seed + chunk;
+		test_rng_seed(&rng, test_splitmix64(&seed));
+		size_t end = (chunk + 1) * TEST_DATA_CHUNK;
+		if(end > w->size) end = w->size;
+		for(size_t i = chunk * TEST_DATA_CHUNK; i < end; i++) {
+			test_data_fill(&rng, w->pdata[i].key, w->pdata[i].value);
+			w->pdata[i].inserted = false;
+		}
+	}
 	return 0;
 }
 
-test_data_t *allocate_test_data(size_t size) {
-	test_data_t *pdata = malloc(sizeof(test_data_t) * size);
+test_data_t *allocate_test_data_seeded(size_t size, uint64_t seed) {
+	// One block: the element array, then key and value bytes of every element.
+	size_t header = (sizeof(test_data_t) * size + 63) & ~(size_t)63;
+	test_data_t *pdata = malloc(header + (KEY_SIZE + VALUE_SIZE) * size);
 	if(!pdata) {
 		printf("Error: Unable to allocate Keys and Values\n");
 		return NULL;
 	}
-
+	uint8_t *arena = (uint8_t *)pdata + header;
 	for(size_t i = 0; i < size; i++) {
-		// Initialize current element.
-		pdata[i].key = (uint8_t *)malloc(sizeof(uint8_t) * KEY_SIZE);
-		if(pdata[i].key == NULL) {
-			printf("Error: Unable to allocate Key\n");
-			// Free all previously allocated memory before returning.
-			for(size_t j = 0; j < i; j++) {
-				free(pdata[j].key);
-				free(pdata[j].value);
-			}
-			free(pdata);
-			pdata = NULL;
-			return NULL;
-		}
-
-		pdata[i].value = (uint8_t *)malloc(sizeof(uint8_t) * VALUE_SIZE);
-		if(pdata[i].value == NULL) {
-			printf("Error: Unable to allocate Value\n");
-			free(pdata[i].key);
-			// Free all previously allocated memory before returning.
-			for(size_t j = 0; j < i; j++) {
-				free(pdata[j].key);
-				free(pdata[j].value);
-			}
-			free(pdata);
-			pdata = NULL;
-			return NULL;
-		}
+		pdata[i].key = arena + i * (KEY_SIZE + VALUE_SIZE);
+		pdata[i].value = pdata[i].key + KEY_SIZE;
+	}
 
-		if(generate_random_pair(pdata[i].key, pdata[i].value) != 0) {
-			free(pdata[i].key);
-			free(pdata[i].value);
-			// Free all previously allocated memory before returning.
-			for(size_t j = 0; j < i; j++) {
-				free(pdata[j].key);
-				free(pdata[j].value);
-			}
-			free(pdata);
-			pdata = NULL;
-			printf("Error: Unable to generate random Key-Value\n");
-			return NULL;
-		}
-		pdata[i].inserted = false;
+	size_t chunks = (size + TEST_DATA_CHUNK - 1) / TEST_DATA_CHUNK;
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t threads = cpus > 0 ? (size_t)cpus : 1;
+	if(threads > TEST_DATA_MAX_THREADS) threads = TEST_DATA_MAX_THREADS;
+	if(threads > chunks) threads = chunks;
+
+	atomic_size_t next_chunk = 0;
+	test_data_worker_t worker = { pdata, size, seed, &next_chunk };
+	thrd_t ids[TEST_DATA_MAX_THREADS];
+	size_t started = 0;
+	for(; started + 1 < threads; started++) {
+		if(thrd_create(&ids[started], test_data_worker, &worker) != thrd_success) break;
 	}
+	// The caller takes a share and whatever is left if a thread did not start.
+	test_data_worker(&worker);
+	for(size_t i = 0; i < started; i++) thrd_join(ids[i], NULL);
 	return pdata;
 }
 
-void free_test_data(test_data_t *pdata, size_t size) {
-	if(pdata == NULL) {
-		return;  // Nothing to free
-	}
+// Every set of a run gets its own seed derived from the run seed, the same
+// run seed reproduces all of them.
+test_data_t *allocate_test_data(size_t size) {
+	uint64_t seed = get_test_data_seed() +
+		atomic_fetch_add(&test_data_sets, 1) * 0x9e3779b97f4a7c15ULL;
+	return allocate_test_data_seeded(size, test_splitmix64(&seed));
+}
 
-	for(size_t i = 0; i < size; i++) {
-		if(pdata[i].key != NULL) {
-			free(pdata[i].key);
-			pdata[i].key = NULL;
-		}
-		if(pdata[i].value != NULL) {
-			free(pdata[i].value);
-			pdata[i].value = NULL;
-		}
-	}
+void free_test_data(test_data_t *pdata, size_t size __attribute__((unused))) {
 	free(pdata);
-	pdata = NULL;
 }
 
 //------------------------------------------------------------------------------
@@ -152,3 +163,35 @@ size_t round_to_power_of_two(size_t v) {
 	if(sizeof(size_t) == 4) return (size_t)round_to_power_of_two_32((uint32_t)v);
 	else return (size_t)round_to_power_of_two_64((uint64_t)v);
 }
+
+//------------------------------------------------------------------------------
+// Hardware counters.
+//------------------------------------------------------------------------------
+int tlb_counter_open(void) {
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HW_CACHE;
+	attr.config = PERF_COUNT_HW_CACHE_DTLB |
+		(PERF_COUNT_HW_CACHE_OP_READ << 8) |
+		(PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	int fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+	if(fd < 0) return -1;
+	ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+	ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+	return fd;
+}
+
+uint64_t tlb_counter_read(int fd) {
+	uint64_t count = 0;
+	if(fd < 0 || read(fd, &count, sizeof(count)) != sizeof(count)) return 0;
+	return count;
+}
+
+void tlb_counter_close(int fd) {
+	if(fd >= 0) close(fd);
+}
@@ -13,8 +13,12 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/time.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
 
 #include "hopscotch_ht.h"
+#include "hopscotch_ht_sharded.h"
 
 //------------------------------------------------------------------------------
 // Benchmark specific struct and macros.
@@ -58,18 +62,63 @@ typedef struct {
 } ht_benchmark_data_t;
 double get_current_time();
 
+//------------------------------------------------------------------------------
+// Pseudo-random numbers.
+//------------------------------------------------------------------------------
+// xoshiro256** seeded by splitmix64, the same seed gives the same sequence.
+typedef struct {
+	uint64_t s[4];
+} test_rng_t;
+
+static inline uint64_t test_splitmix64(uint64_t *x) {
+	uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+static inline void test_rng_seed(test_rng_t *rng, uint64_t seed) {
+	for(int i = 0; i < 4; i++) rng->s[i] = test_splitmix64(&seed);
+}
+
+static inline uint64_t test_rng_next(test_rng_t *rng) {
+	uint64_t *s = rng->s;
+	uint64_t r = s[1] * 5;
+	r = ((r << 7) | (r >> 57)) * 9;
+	uint64_t t = s[1] << 17;
+	s[2] ^= s[0]; s[3] ^= s[1];
+	s[1] ^= s[2]; s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = (s[3] << 45) | (s[3] >> 19);
+	return r;
+}
+
+// Uniform double in [0, 1).
+static inline double test_rng_double(test_rng_t *rng) {
+	return (test_rng_next(rng) >> 11) * 0x1.0p-53;
+}
+
 //------------------------------------------------------------------------------
 // Test data generation struct and functions.
 //------------------------------------------------------------------------------
+// Keys and values come from the generator above, filled in parallel into one
+// block with the element array, free_test_data releases it at once. The run
+// seed is HT_TEST_SEED from the environment or TEST_DATA_SEED_DEFAULT, every
+// allocate_test_data call of the run derives its own seed from it, so a run
+// is repeated by its seed.
+#define TEST_DATA_SEED_DEFAULT (0x5eedULL)
+
 typedef struct {
 	uint8_t *key;
 	uint8_t *value;
 	bool inserted;
 } test_data_t;
-test_data_t *allocate_test_data(size_t );
 
+void set_test_data_seed(uint64_t seed);
+uint64_t get_test_data_seed(void);
 int generate_random_pair(uint8_t *, uint8_t *);
 test_data_t *allocate_test_data(size_t );
+test_data_t *allocate_test_data_seeded(size_t size, uint64_t seed);
 void free_test_data(test_data_t *, size_t );
 
 //------------------------------------------------------------------------------
@@ -81,4 +130,13 @@ size_t round_to_power_of_two(size_t v);
 uint32_t round_to_power_of_two_32(uint32_t v);
 uint64_t round_to_power_of_two_64(uint64_t v);
 
+//------------------------------------------------------------------------------
+// Hardware counters.
+//------------------------------------------------------------------------------
+// Data TLB read misses of the calling thread (user space only). Open returns
+// -1 where perf events are not available, read returns 0 then.
+int tlb_counter_open(void);
+uint64_t tlb_counter_read(int fd);
+void tlb_counter_close(int fd);
+
 #endif // HOPSCOTCH_HT_TEST_H
@@ -1,5 +1,21 @@
 #include "threads_test.h"
 
+// The worker runs against a single table or a sharded front-end.
+static inline bool worker_insert(ht_thread_insert_data_t *data, test_data_t *t) {
+	return data->sharded ? ht_sharded_insert(data->sharded, t->key, t->value) :
+		ht_insert(data->ht, t->key, t->value);
+}
+
+static inline bool worker_contains(ht_thread_insert_data_t *data, test_data_t *t) {
+	return data->sharded ? ht_sharded_contains_key(data->sharded, t->key, NULL) :
+		ht_contains_key(data->ht, t->key, NULL);
+}
+
+static inline bool worker_remove(ht_thread_insert_data_t *data, test_data_t *t) {
+	return data->sharded ? ht_sharded_remove_key(data->sharded, t->key) :
+		ht_remove_key(data->ht, t->key);
+}
+
 int thread_insert_worker(void *arg) {
 	if(arg == NULL) {
 		printf("Error: Unable to process args. Args are empty\n");
@@ -24,18 +40,25 @@ int thread_insert_worker(void *arg) {
 	// Ensure no exceed test_data_size.
 	end_idx = end_idx > data->test_data_size ? data->test_data_size : end_idx;
 
+	// Keys of the shard on the node of this thread, the rest are remote.
+	if(data->sharded) {
+		size_t local_shard = ht_sharded_local_shard(data->sharded);
+		int local = 0;
+		for(size_t i = start_idx; i < end_idx; i++) {
+			if(ht_sharded_shard_of(data->sharded, data->pdata[i].key) == local_shard) {
+				local++;
+			}
+		}
+		atomic_fetch_add(data->keys_local, local);
+	}
+
 	BENCHMARK_INIT;
 	BENCHMARK_START;
 	//--------------------------------------------------------------------------
 	// INSERT.
 	//--------------------------------------------------------------------------
 	for(size_t i = start_idx; i < end_idx; i++) {
-		if(ht_insert(
-			data->ht,
-			data->hash_function,
-			data->pdata[i].key,
-			data->pdata[i].value
-		)) {
+		if(worker_insert(data, &data->pdata[i])) {
 			atomic_fetch_add(data->keys_inserted, 1);
 			data->pdata[i].inserted = true;
 		}
@@ -47,8 +70,7 @@ int thread_insert_worker(void *arg) {
 	//--------------------------------------------------------------------------
 	for(size_t i = start_idx; i < end_idx; i++) {
 		if(!data->pdata[i].inserted) continue;
-		if(ht_contains_key(data->ht, data->hash_function,
-			data->pdata[i].key, NULL)) {
+		if(worker_contains(data, &data->pdata[i])) {
 			atomic_fetch_add(data->keys_validated, 1);
 		}
 	}
@@ -59,7 +81,7 @@ int thread_insert_worker(void *arg) {
 	//--------------------------------------------------------------------------
 	for(size_t i = start_idx; i < end_idx; i++) {
 		if(!data->pdata[i].inserted) continue;
-		if(ht_remove_key(data->ht, data->hash_function, data->pdata[i].key)) {
+		if(worker_remove(data, &data->pdata[i])) {
 			atomic_fetch_add(data->keys_removed, 1);
 		}
 	}
@@ -164,7 +186,8 @@ bool test_run_concurrent(
 	size_t number_of_elements,
 	hash_function_f hash_function,
 	bool ht_twice_size,
-	size_t number_of_threads
+	size_t number_of_threads,
+	size_t shards
 ) {
 	size_t capacity = number_of_elements;
 
@@ -179,11 +202,24 @@ bool test_run_concurrent(
 	//--------------------------------------------------------------------------
 	// Memory allocation.
 	//--------------------------------------------------------------------------
-	hopscotch_hash_table_t *ht = ht_create(capacity);
-	if(ht == NULL) {
+	hopscotch_hash_table_t *ht = NULL;
+	ht_sharded_t *sharded = NULL;
+	if(shards) {
+		sharded = ht_sharded_create(capacity, shards, hash_function, 0);
+	} else {
+		ht = ht_create(capacity, hash_function, 0);
+	}
+	if(ht == NULL && sharded == NULL) {
 		printf("[TEST %s] Error: Unable to create Hash table\n", __func__);
 		return false;
 	}
+	if(sharded) {
+		printf("[TEST %s] Shards : %ld\n", __func__, sharded->shards);
+		for(size_t i = 0; i < sharded->shards; i++) {
+			printf("[TEST %s] Shard %2ld on NUMA node %u\n", __func__, i,
+				ht_sharded_node(sharded, i));
+		}
+	}
 
 	MM_DATA_INIT;
 	MM_DATA_WRITE(number_of_threads);
@@ -197,6 +233,7 @@ bool test_run_concurrent(
 		printf("[TEST %s] Error: Unable to create threads_insert_worker\n", __func__);
 		MM_DATA_FREE;
 		ht_free(ht);
+		ht_sharded_free(sharded);
 		return false;
 	}
 	memset(threads_insert_worker, 0, sizeof(thrd_t) * number_of_threads);
@@ -208,6 +245,7 @@ bool test_run_concurrent(
 		printf("[TEST %s] Error: Unable to create thread_insert_worker_data\n", __func__);
 		MM_DATA_FREE;
 		ht_free(ht);
+		ht_sharded_free(sharded);
 		return false;
 	}
 	MM_DATA_WRITE(thread_insert_worker_data);
@@ -221,6 +259,7 @@ bool test_run_concurrent(
 		printf("[TEST %s] Error: Unable to create thread_benchmark_data\n", __func__);
 		MM_DATA_FREE;
 		ht_free(ht);
+		ht_sharded_free(sharded);
 		return false;
 	}
 	MM_DATA_WRITE(thread_benchmark_data);
@@ -228,6 +267,7 @@ bool test_run_concurrent(
 	atomic_int keys_inserted = 0;
 	atomic_int keys_validated = 0;
 	atomic_int keys_removed = 0;
+	atomic_int keys_local = 0;
 	int keys_per_thread = number_of_elements / number_of_threads;
 
 	test_data_t *pdata = allocate_test_data(number_of_elements);
@@ -235,6 +275,7 @@ bool test_run_concurrent(
 		printf("[TEST %s] Error: Unable to allocate test keys and values\n", __func__);
 		MM_DATA_FREE;
 		ht_free(ht);
+		ht_sharded_free(sharded);
 		return false;
 	}
 	MM_DATA_WRITE(pdata);
@@ -249,6 +290,7 @@ bool test_run_concurrent(
 			printf("[TEST %s] Error: Unable to create progress_stage %ld\n", __func__, i);
 			MM_DATA_FREE;
 			ht_free(ht);
+			ht_sharded_free(sharded);
 			return false;
 		}
 		for(int j = 0; j < PROGRESS_STAGE_TOTAL; j++)
@@ -275,7 +317,7 @@ bool test_run_concurrent(
 	for(size_t i = 0; i < number_of_threads; i++) {
 		thread_insert_worker_data[i] = (ht_thread_insert_data_t){
 			.ht = ht,
-			.hash_function = hash_function,
+			.sharded = sharded,
 			.pdata = pdata,
 			.progress_stages = progress_stages,
 			.test_data_size = number_of_elements,
@@ -285,6 +327,7 @@ bool test_run_concurrent(
 			.keys_inserted = &keys_inserted,
 			.keys_validated = &keys_validated,
 			.keys_removed = &keys_removed,
+			.keys_local = &keys_local,
 			.benchmark_data = thread_benchmark_data
 		};
 		// Last thread gets remaining keys.
@@ -302,6 +345,7 @@ bool test_run_concurrent(
 		printf("[TEST %s] Error: Failed to create print progress thread\n", __func__);
 		MM_DATA_FREE;
 		ht_free(ht);
+		ht_sharded_free(sharded);
 		return false;
 	}
 
@@ -314,6 +358,7 @@ bool test_run_concurrent(
 			printf("[TEST %s] Error: Failed to create insert worker thread", __func__);
 			MM_DATA_FREE;
 			ht_free(ht);
+			ht_sharded_free(sharded);
 			return false;
 		}
 	}
@@ -332,13 +377,1468 @@ bool test_run_concurrent(
 	printf("[TEST %s] Total keys inserted: %d\n", __func__, atomic_load(&keys_inserted));
 	printf("[TEST %s] Total keys validated: %d\n", __func__, atomic_load(&keys_validated));
 	printf("[TEST %s] Total keys removed: %d\n", __func__, atomic_load(&keys_removed));
-	ht_print_stats(ht);
+
+	// Threads run side by side, the sum of their rates is the table's one.
+	double total_throughput = 0;
+	for(size_t i = 0; i < number_of_threads; i++) {
+		total_throughput += atomic_load(&thread_benchmark_data[i].throughput_value);
+	}
+	printf("[TEST %s] Mode: %s, total throughput: %.2f ops/sec\n", __func__,
+		sharded ? "sharded" : "single table", total_throughput);
+	if(sharded) {
+		printf("[TEST %s] Keys on the local shard: %d of %ld\n", __func__,
+			atomic_load(&keys_local), number_of_elements);
+		for(size_t i = 0; i < sharded->shards; i++) {
+			ht_print_stats(sharded->tables[i]);
+		}
+	} else {
+		ht_print_stats(ht);
+	}
 
 	//--------------------------------------------------------------------------
 	// Release data. House-keeping.
 	//--------------------------------------------------------------------------
 	MM_DATA_FREE;
 	ht_free(ht);
+	ht_sharded_free(sharded);
 	printf("[TEST %s] PASSED successfully\n", __func__);
 	return true;
 }
+
+int thread_resize_worker(void *arg) {
+	if(arg == NULL) {
+		printf("Error: Unable to process args. Args are empty\n");
+		return 1;
+	}
+	ht_thread_resize_data_t *data = (ht_thread_resize_data_t *)arg;
+
+	for(size_t i = data->start_idx; i < data->end_idx; i++) {
+		if(ht_insert(data->ht, data->pdata[i].key, data->pdata[i].value)) {
+			atomic_fetch_add(data->keys_inserted, 1);
+			data->pdata[i].inserted = true;
+		}
+	}
+
+	// Wait for all inserts, the table keeps growing in the meantime.
+	atomic_fetch_add(data->threads_inserted, 1);
+	while(atomic_load(data->threads_inserted) != data->number_of_threads) {
+		thrd_yield();
+	}
+
+	uint8_t got_value[VALUE_SIZE];
+	for(size_t i = data->start_idx; i < data->end_idx; i++) {
+		if(!data->pdata[i].inserted) continue;
+		if(ht_contains_key(data->ht, data->pdata[i].key, got_value) &&
+			memcmp(got_value, data->pdata[i].value, VALUE_SIZE) == 0) {
+			atomic_fetch_add(data->keys_validated, 1);
+		}
+	}
+
+	for(size_t i = data->start_idx; i < data->end_idx; i++) {
+		if(!data->pdata[i].inserted) continue;
+		if(ht_remove_key(data->ht, data->pdata[i].key)) {
+			atomic_fetch_add(data->keys_removed, 1);
+		}
+	}
+	return 0;
+}
+
+// Shrinks a table into half its capacity while it holds more entries than
+// that: the migration gets stuck and has to move into a bigger target, inserts
+// and a later grow must keep working. Uses the first capacity keys of pdata.
+static bool resize_stuck_shrink(
+	const char *test,
+	size_t capacity,
+	hash_function_f hash_function,
+	test_data_t *pdata
+) {
+	hopscotch_hash_table_t *ht = ht_create(capacity, hash_function, 0);
+	if(ht == NULL) {
+		printf("[TEST %s] Error: Unable to create Hash table\n", test);
+		return false;
+	}
+	ht_set_resize_policy(ht, 0, 0);
+
+	bool ret_val = true;
+	size_t filled = capacity * 3 / 4;
+	size_t total = capacity * 7 / 8;
+	for(size_t i = 0; i < filled; i++) {
+		ret_val &= ht_insert(ht, pdata[i].key, pdata[i].value);
+	}
+	if(!ht_resize(ht, capacity / 2)) {
+		printf("[TEST %s] Error: shrink of a %zu/%zu table refused\n", test, filled, capacity);
+		ret_val = false;
+	}
+	for(size_t i = filled; i < total; i++) {
+		ret_val &= ht_insert(ht, pdata[i].key, pdata[i].value);
+	}
+	ht_resize_wait(ht);
+
+	ht_stats_t stats;
+	ht_get_stats(ht, &stats);
+	printf("[TEST %s] Stuck shrink: %zu keys, capacity %zu, %zu grows, %zu shrinks\n",
+		test, ht_size_exact(ht), stats.capacity, stats.grows, stats.shrinks);
+	if(stats.resize_in_progress || stats.capacity < capacity) {
+		printf("[TEST %s] Error: stuck shrink has not moved into a big enough array\n", test);
+		ret_val = false;
+	}
+	if(!ht_resize(ht, stats.capacity * 2)) {
+		printf("[TEST %s] Error: grow after a stuck shrink refused\n", test);
+		ret_val = false;
+	}
+	ht_resize_wait(ht);
+	ht_get_stats(ht, &stats);
+	if(stats.resize_in_progress || stats.capacity < capacity * 2) {
+		printf("[TEST %s] Error: grow after a stuck shrink has not finished\n", test);
+		ret_val = false;
+	}
+
+	uint8_t value[VALUE_SIZE];
+	size_t missing = 0;
+	for(size_t i = 0; i < total; i++) {
+		if(!ht_contains_key(ht, pdata[i].key, value) ||
+			memcmp(value, pdata[i].value, VALUE_SIZE) != 0) {
+			missing++;
+		}
+	}
+	ht_validate_report_t report;
+	bool valid = ht_validate(ht, 4, &report);
+	if(!valid) ht_print_validate(&report);
+	if(missing || ht_size_exact(ht) != total || !valid) {
+		printf("[TEST %s] Error: %zu keys missing, size %zu of %zu after a stuck shrink\n",
+			test, missing, ht_size_exact(ht), total);
+		ret_val = false;
+	}
+	ht_free(ht);
+	return ret_val;
+}
+
+bool test_online_resize(
+	size_t initial_capacity,
+	size_t number_of_elements,
+	hash_function_f hash_function,
+	size_t number_of_threads
+) {
+	printf("[TEST %s] Started...\n", __func__);
+	initial_capacity = round_to_power_of_two(initial_capacity);
+	printf("[TEST %s] Initial capacity   : %ld\n", __func__, initial_capacity);
+	printf("[TEST %s] Number of elements : %ld\n", __func__, number_of_elements);
+	printf("[TEST %s] Number of threads  : %ld\n", __func__, number_of_threads);
+
+	hopscotch_hash_table_t *ht = ht_create(initial_capacity, hash_function, 0);
+	if(ht == NULL) {
+		printf("[TEST %s] Error: Unable to create Hash table\n", __func__);
+		return false;
+	}
+
+	test_data_t *pdata = allocate_test_data(number_of_elements);
+	thrd_t *threads = malloc(sizeof(thrd_t) * number_of_threads);
+	ht_thread_resize_data_t *thread_data = malloc(
+		sizeof(ht_thread_resize_data_t) * number_of_threads);
+	if(!pdata || !threads || !thread_data) {
+		printf("[TEST %s] Error: Unable to allocate test data\n", __func__);
+		free_test_data(pdata, number_of_elements);
+		free(threads);
+		free(thread_data);
+		ht_free(ht);
+		return false;
+	}
+
+	atomic_int keys_inserted = 0;
+	atomic_int keys_validated = 0;
+	atomic_int keys_removed = 0;
+	atomic_size_t threads_inserted = 0;
+	size_t per_thread = number_of_elements / number_of_threads;
+	for(size_t i = 0; i < number_of_threads; i++) {
+		thread_data[i] = (ht_thread_resize_data_t){
+			.ht = ht,
+			.pdata = pdata,
+			.start_idx = i * per_thread,
+			.end_idx = (i == number_of_threads - 1) ?
+				number_of_elements : (i + 1) * per_thread,
+			.number_of_threads = number_of_threads,
+			.threads_inserted = &threads_inserted,
+			.keys_inserted = &keys_inserted,
+			.keys_validated = &keys_validated,
+			.keys_removed = &keys_removed
+		};
+	}
+
+	BENCHMARK_INIT;
+	BENCHMARK_START;
+	size_t created = 0;
+	for(; created < number_of_threads; created++) {
+		if(thrd_create(&threads[created], thread_resize_worker,
+			&thread_data[created]) != thrd_success) {
+			printf("[TEST %s] Error: Failed to create resize worker thread\n", __func__);
+			break;
+		}
+	}
+	for(size_t i = 0; i < created; i++) {
+		thrd_join(threads[i], NULL);
+	}
+	BENCHMARK_END;
+	BENCHMARK_MEASURE_THROUGHPUT(3.0 * number_of_elements);
+
+	bool ret_val = created == number_of_threads;
+	ht_stats_t stats;
+	ht_get_stats(ht, &stats);
+	printf("[TEST %s] Total keys inserted : %d\n", __func__, atomic_load(&keys_inserted));
+	printf("[TEST %s] Total keys validated: %d\n", __func__, atomic_load(&keys_validated));
+	printf("[TEST %s] Total keys removed  : %d\n", __func__, atomic_load(&keys_removed));
+	ht_print_stats(ht);
+	ht_resize_wait(ht);
+	ht_print_stats(ht);
+	size_t grows = stats.grows;
+	ht_get_stats(ht, &stats);
+
+	if(atomic_load(&keys_inserted) != atomic_load(&keys_validated) ||
+		atomic_load(&keys_inserted) != atomic_load(&keys_removed)) {
+		printf("[TEST %s] Error: keys lost across resize\n", __func__);
+		ret_val = false;
+	}
+	if(grows == 0 || stats.shrinks == 0) {
+		printf("[TEST %s] Error: the table has not grown and shrunk\n", __func__);
+		ret_val = false;
+	}
+	if(ht_size_exact(ht) != 0 || ht_size(ht) * 64 > stats.capacity) {
+		printf("[TEST %s] Error: size %zu (approximate %zu) of an empty table\n",
+			__func__, ht_size_exact(ht), ht_size(ht));
+		ret_val = false;
+	}
+	ret_val &= resize_stuck_shrink(__func__, initial_capacity * 4, hash_function, pdata);
+
+	free_test_data(pdata, number_of_elements);
+	free(threads);
+	free(thread_data);
+	ht_free(ht);
+	if(ret_val) {
+		printf("[TEST %s] PASSED successfully ", __func__);
+		BENCHMARK_DATA_PRINT;
+	} else {
+		printf("[TEST %s] FAILED\n", __func__);
+	}
+	return ret_val;
+}
+
+static void consistency_test_visit(const uint8_t *value, size_t value_size, void *ctx) {
+	memcpy(ctx, value, value_size);
+}
+
+int thread_consistency_worker(void *arg) {
+	if(arg == NULL) {
+		printf("Error: Unable to process args. Args are empty\n");
+		return 1;
+	}
+	ht_thread_consistency_data_t *data = (ht_thread_consistency_data_t *)arg;
+	uint8_t value[VALUE_SIZE];
+
+	if(data->writer) {
+		// Every value is filled with a single byte, a torn read mixes them.
+		for(size_t r = 0; r < data->rounds; r++) {
+			for(size_t i = 0; i < data->number_of_keys; i++) {
+				memset(value, (uint8_t)(data->thread_id * 31 + r + i), VALUE_SIZE);
+				if((r + i) % 8 == 0) {
+					ht_remove_key(data->ht, data->pdata[i].key);
+				}
+				ht_insert(data->ht, data->pdata[i].key, value);
+			}
+		}
+		return 0;
+	}
+
+	// Readers take turns with the copying, the visitor and the guard lookup.
+	size_t reads = 0, torn_reads = 0;
+	int mode = data->thread_id % 3;
+	while(!atomic_load(data->writers_done)) {
+		for(size_t i = 0; i < data->number_of_keys; i++) {
+			if(mode == 0 && !ht_contains_key(data->ht, data->pdata[i].key, value)) {
+				continue;
+			}
+			if(mode == 1 && !ht_visit(data->ht, data->pdata[i].key,
+				consistency_test_visit, value))
+			{
+				continue;
+			}
+			if(mode == 2) {
+				ht_ref_t ref;
+				bool valid = false;
+				while(!valid && ht_get_ref(data->ht, data->pdata[i].key, &ref)) {
+					memcpy(value, ref.value, VALUE_SIZE);
+					valid = ht_ref_valid(&ref);
+					ht_ref_release(&ref);
+				}
+				if(!valid) continue;
+			}
+			reads++;
+			for(size_t j = 1; j < VALUE_SIZE; j++) {
+				if(value[j] != value[0]) {
+					torn_reads++;
+					break;
+				}
+			}
+		}
+	}
+	atomic_fetch_add(data->reads, reads);
+	atomic_fetch_add(data->torn_reads, torn_reads);
+	return 0;
+}
+
+bool test_consistent_reads(
+	size_t number_of_keys,
+	hash_function_f hash_function,
+	size_t number_of_threads,
+	size_t rounds
+) {
+	printf("[TEST %s] Started...\n", __func__);
+	printf("[TEST %s] Number of keys    : %ld\n", __func__, number_of_keys);
+	printf("[TEST %s] Number of threads : %ld\n", __func__, number_of_threads);
+	printf("[TEST %s] Number of rounds  : %ld\n", __func__, rounds);
+	if(number_of_threads < 2) number_of_threads = 2;
+
+	hopscotch_hash_table_t *ht = ht_create(number_of_keys * 2, hash_function, 0);
+	test_data_t *pdata = allocate_test_data(number_of_keys);
+	thrd_t *threads = malloc(sizeof(thrd_t) * number_of_threads);
+	ht_thread_consistency_data_t *thread_data = malloc(
+		sizeof(ht_thread_consistency_data_t) * number_of_threads);
+	if(!ht || !pdata || !threads || !thread_data) {
+		printf("[TEST %s] Error: Unable to allocate test data\n", __func__);
+		if(pdata) free_test_data(pdata, number_of_keys);
+		free(threads);
+		free(thread_data);
+		if(ht) ht_free(ht);
+		return false;
+	}
+
+	atomic_bool writers_done = false;
+	atomic_size_t reads = 0;
+	atomic_size_t torn_reads = 0;
+	size_t writers = number_of_threads / 2;
+	for(size_t i = 0; i < number_of_threads; i++) {
+		thread_data[i] = (ht_thread_consistency_data_t){
+			.ht = ht,
+			.pdata = pdata,
+			.number_of_keys = number_of_keys,
+			.rounds = rounds,
+			.thread_id = (int)i,
+			.writer = i < writers,
+			.writers_done = &writers_done,
+			.reads = &reads,
+			.torn_reads = &torn_reads
+		};
+	}
+
+	BENCHMARK_INIT;
+	BENCHMARK_START;
+	size_t created = 0;
+	for(; created < number_of_threads; created++) {
+		if(thrd_create(&threads[created], thread_consistency_worker,
+			&thread_data[created]) != thrd_success) {
+			printf("[TEST %s] Error: Failed to create worker thread\n", __func__);
+			break;
+		}
+	}
+	// Writers come first, readers run until all of them are done.
+	for(size_t i = 0; i < created && i < writers; i++) {
+		thrd_join(threads[i], NULL);
+	}
+	atomic_store(&writers_done, true);
+	for(size_t i = writers; i < created; i++) {
+		thrd_join(threads[i], NULL);
+	}
+	BENCHMARK_END;
+	BENCHMARK_MEASURE_THROUGHPUT((double)atomic_load(&reads));
+
+	printf("[TEST %s] Total reads      : %zu\n", __func__, atomic_load(&reads));
+	printf("[TEST %s] Total torn reads : %zu\n", __func__, atomic_load(&torn_reads));
+	bool ret_val = created == number_of_threads && atomic_load(&torn_reads) == 0;
+
+	free_test_data(pdata, number_of_keys);
+	free(threads);
+	free(thread_data);
+	ht_free(ht);
+	if(ret_val) {
+		printf("[TEST %s] PASSED successfully ", __func__);
+		BENCHMARK_DATA_PRINT;
+	} else {
+		printf("[TEST %s] FAILED\n", __func__);
+	}
+	return ret_val;
+}
+
+int thread_displacement_worker(void *arg) {
+	if(arg == NULL) {
+		printf("Error: Unable to process args. Args are empty\n");
+		return 1;
+	}
+	ht_thread_displacement_data_t *data = (ht_thread_displacement_data_t *)arg;
+
+	if(data->writer) {
+		size_t failed = 0;
+		for(size_t i = data->start_idx; i < data->end_idx; i++) {
+			data->pdata[i].inserted = ht_insert(data->ht, data->pdata[i].key, data->pdata[i].value);
+			failed += !data->pdata[i].inserted;
+		}
+		atomic_fetch_add(data->failed, failed);
+		return 0;
+	}
+
+	// Keys of the readers' range are in the table from the start, they must
+	// be found whatever the writers move around.
+	size_t missed = 0;
+	uint8_t got_value[VALUE_SIZE];
+	while(!atomic_load(data->writers_done)) {
+		for(size_t i = data->start_idx; i < data->end_idx; i++) {
+			if(!ht_contains_key(data->ht, data->pdata[i].key, got_value) ||
+				memcmp(got_value, data->pdata[i].value, VALUE_SIZE) != 0) {
+				missed++;
+			}
+		}
+	}
+	atomic_fetch_add(data->missed, missed);
+	return 0;
+}
+
+bool test_high_load_displacement(
+	size_t capacity,
+	hash_function_f hash_function,
+	size_t load_percent,
+	size_t number_of_threads
+) {
+	capacity = round_to_power_of_two(capacity);
+	size_t number_of_elements = ANY_PERCENT(capacity, load_percent);
+	size_t prefilled = ANY_PERCENT(capacity, 80);
+	if(number_of_threads < 2) number_of_threads = 2;
+	printf("[TEST %s] Started...\n", __func__);
+	printf("[TEST %s] Table capacity     : %ld\n", __func__, capacity);
+	printf("[TEST %s] Number of elements : %ld (%ld%% load)\n", __func__,
+		number_of_elements, load_percent);
+	printf("[TEST %s] Number of threads  : %ld\n", __func__, number_of_threads);
+
+	hopscotch_hash_table_t *ht = ht_create(capacity, hash_function, 0);
+	test_data_t *pdata = allocate_test_data(number_of_elements);
+	thrd_t *threads = malloc(sizeof(thrd_t) * number_of_threads);
+	ht_thread_displacement_data_t *thread_data = malloc(
+		sizeof(ht_thread_displacement_data_t) * number_of_threads);
+	if(!ht || !pdata || !threads || !thread_data) {
+		printf("[TEST %s] Error: Unable to allocate test data\n", __func__);
+		if(pdata) free_test_data(pdata, number_of_elements);
+		free(threads);
+		free(thread_data);
+		if(ht) ht_free(ht);
+		return false;
+	}
+	// The load must come from displacement, not from a bigger table.
+	ht_set_resize_policy(ht, 0, 0);
+
+	size_t failed_prefill = 0;
+	for(size_t i = 0; i < prefilled; i++) {
+		pdata[i].inserted = ht_insert(ht, pdata[i].key, pdata[i].value);
+		failed_prefill += !pdata[i].inserted;
+	}
+
+	// Writers fill the table up, readers look up the prefilled keys.
+	atomic_bool writers_done = false;
+	atomic_size_t failed = failed_prefill;
+	atomic_size_t missed = 0;
+	size_t writers = number_of_threads / 2;
+	size_t readers = number_of_threads - writers;
+	size_t per_writer = (number_of_elements - prefilled) / writers;
+	size_t per_reader = prefilled / readers;
+	for(size_t i = 0; i < number_of_threads; i++) {
+		bool writer = i < writers;
+		size_t n = writer ? i : i - writers;
+		size_t start = writer ? prefilled + n * per_writer : n * per_reader;
+		size_t end = writer ?
+			(n == writers - 1 ? number_of_elements : start + per_writer) :
+			(n == readers - 1 ? prefilled : start + per_reader);
+		thread_data[i] = (ht_thread_displacement_data_t){
+			.ht = ht,
+			.pdata = pdata,
+			.start_idx = start,
+			.end_idx = end,
+			.writer = writer,
+			.writers_done = &writers_done,
+			.failed = &failed,
+			.missed = &missed
+		};
+	}
+
+	BENCHMARK_INIT;
+	BENCHMARK_START;
+	size_t created = 0;
+	for(; created < number_of_threads; created++) {
+		if(thrd_create(&threads[created], thread_displacement_worker,
+			&thread_data[created]) != thrd_success) {
+			printf("[TEST %s] Error: Failed to create worker thread\n", __func__);
+			break;
+		}
+	}
+	for(size_t i = 0; i < created && i < writers; i++) {
+		thrd_join(threads[i], NULL);
+	}
+	atomic_store(&writers_done, true);
+	for(size_t i = writers; i < created; i++) {
+		thrd_join(threads[i], NULL);
+	}
+	BENCHMARK_END;
+	BENCHMARK_MEASURE_THROUGHPUT((double)(number_of_elements - prefilled));
+
+	size_t found = 0, inserted = 0;
+	for(size_t i = 0; i < number_of_elements; i++) {
+		if(!pdata[i].inserted) continue;
+		inserted++;
+		found += ht_contains_key(ht, pdata[i].key, NULL);
+	}
+	printf("[TEST %s] Failed inserts : %zu\n", __func__, atomic_load(&failed));
+	printf("[TEST %s] Missed lookups : %zu\n", __func__, atomic_load(&missed));
+	printf("[TEST %s] Keys found     : %zu/%zu\n", __func__, found, inserted);
+	bool ret_val = created == number_of_threads && atomic_load(&failed) == 0 &&
+		atomic_load(&missed) == 0 && found == inserted;
+
+	free_test_data(pdata, number_of_elements);
+	free(threads);
+	free(thread_data);
+	ht_free(ht);
+	if(ret_val) {
+		printf("[TEST %s] PASSED successfully ", __func__);
+		BENCHMARK_DATA_PRINT;
+	} else {
+		printf("[TEST %s] FAILED\n", __func__);
+	}
+	return ret_val;
+}
+
+int thread_epoch_worker(void *arg) {
+	if(arg == NULL) {
+		printf("Error: Unable to process args. Args are empty\n");
+		return 1;
+	}
+	ht_thread_epoch_data_t *data = (ht_thread_epoch_data_t *)arg;
+
+	// Start together, a thread created early would run alone for a while.
+	atomic_fetch_add(data->ready, 1);
+	while(atomic_load(data->ready) < data->number_of_threads) {
+		thrd_yield();
+	}
+
+	size_t found = 0;
+	for(size_t r = 0; r < data->rounds; r++) {
+		if(data->section_ops == 0) {
+			for(size_t i = data->start_idx; i < data->end_idx; i++) {
+				ht_epoch_enter();
+				ht_epoch_exit();
+			}
+			continue;
+		}
+		for(size_t i = data->start_idx; i < data->end_idx; ) {
+			size_t end = i + data->section_ops;
+			if(end > data->end_idx) end = data->end_idx;
+			// Calls inside a held section only count the nesting depth.
+			if(data->section_ops > 1) ht_epoch_enter();
+			for(; i < end; i++) {
+				found += ht_contains_key(data->ht, data->pdata[i].key, NULL);
+			}
+			if(data->section_ops > 1) ht_epoch_exit();
+		}
+	}
+	atomic_fetch_add(data->found, found);
+	return 0;
+}
+
+static void epoch_test_count_reclaim(void *ctx, void *ptr, size_t len) {
+	(void)len;
+	atomic_fetch_add((atomic_size_t *)ctx, 1);
+	free(ptr);
+}
+
+// Runs number_of_threads workers over the keys and returns the wall time,
+// a negative one if a thread could not be created.
+static double epoch_test_run(
+	hopscotch_hash_table_t *ht,
+	test_data_t *pdata,
+	size_t number_of_elements,
+	size_t number_of_threads,
+	size_t rounds,
+	size_t section_ops,
+	atomic_size_t *found,
+	bool resize
+) {
+	thrd_t threads[number_of_threads];
+	ht_thread_epoch_data_t thread_data[number_of_threads];
+	atomic_size_t ready = 0;
+	size_t per_thread = number_of_elements / number_of_threads;
+	for(size_t i = 0; i < number_of_threads; i++) {
+		thread_data[i] = (ht_thread_epoch_data_t){
+			.ht = ht,
+			.pdata = pdata,
+			.start_idx = i * per_thread,
+			.end_idx = i == number_of_threads - 1 ? number_of_elements : (i + 1) * per_thread,
+			.rounds = rounds,
+			.section_ops = section_ops,
+			.number_of_threads = number_of_threads,
+			.ready = &ready,
+			.found = found
+		};
+	}
+
+	double start_time = get_current_time();
+	size_t created = 0;
+	for(; created < number_of_threads; created++) {
+		if(thrd_create(&threads[created], thread_epoch_worker,
+			&thread_data[created]) != thrd_success) {
+			break;
+		}
+	}
+	// Arrays replaced by the resizes are retired while the lookups run.
+	if(resize && created == number_of_threads) {
+		size_t capacity = ht_capacity(ht);
+		for(size_t i = 0; i < 4; i++) {
+			ht_resize(ht, i % 2 ? capacity : capacity * 2);
+			ht_resize_wait(ht);
+		}
+	}
+	if(created < number_of_threads) atomic_store(&ready, number_of_threads);
+	for(size_t i = 0; i < created; i++) {
+		thrd_join(threads[i], NULL);
+	}
+	double elapsed = get_current_time() - start_time;
+	return created == number_of_threads ? elapsed : -1.0;
+}
+
+bool test_epoch_reclamation(
+	size_t number_of_elements,
+	hash_function_f hash_function,
+	size_t max_threads
+) {
+	printf("[TEST %s] Started...\n", __func__);
+	printf("[TEST %s] Number of keys    : %ld\n", __func__, number_of_elements);
+	printf("[TEST %s] Max threads       : %ld\n", __func__, max_threads);
+
+	//--------------------------------------------------------------------------
+	// An object retired inside a section outlives it.
+	//--------------------------------------------------------------------------
+	atomic_size_t reclaimed = 0;
+	ht_epoch_barrier();
+	ht_epoch_enter();
+	ht_epoch_retire(epoch_test_count_reclaim, &reclaimed, malloc(64), 64);
+	for(int i = 0; i < 4; i++) ht_epoch_collect();
+	bool held = atomic_load(&reclaimed) == 0;
+	ht_epoch_exit();
+	ht_epoch_barrier();
+	bool ret_val = held && atomic_load(&reclaimed) == 1 && ht_epoch_pending() == 0;
+	printf("[TEST %s] Retired in section: %s, reclaimed after barrier: %zu\n",
+		__func__, held ? "held" : "reclaimed early", atomic_load(&reclaimed));
+
+	//--------------------------------------------------------------------------
+	// Per-operation overhead.
+	//--------------------------------------------------------------------------
+	hopscotch_hash_table_t *ht = ht_create(
+		round_to_power_of_two(number_of_elements * 2), hash_function, 0);
+	test_data_t *pdata = allocate_test_data(number_of_elements);
+	if(!ht || !pdata) {
+		printf("[TEST %s] Error: Unable to allocate test data\n", __func__);
+		if(pdata) free_test_data(pdata, number_of_elements);
+		if(ht) ht_free(ht);
+		return false;
+	}
+	for(size_t i = 0; i < number_of_elements; i++) {
+		ret_val &= ht_insert(ht, pdata[i].key, pdata[i].value);
+	}
+
+	// Every thread count does the same total work.
+	size_t rounds = 4;
+	printf("[TEST %s] Threads  Enter/exit   Lookups/sec    Held/sec   Overhead\n",
+		__func__);
+	for(size_t threads = 1; threads <= max_threads; threads *= 2) {
+		atomic_size_t found = 0;
+		double bare = epoch_test_run(ht, pdata, number_of_elements, threads,
+			rounds * 16, 0, &found, false);
+		double per_call = epoch_test_run(ht, pdata, number_of_elements, threads,
+			rounds, 1, &found, false);
+		double held_section = epoch_test_run(ht, pdata, number_of_elements, threads,
+			rounds, HT_BATCH_GROUP, &found, false);
+		if(bare < 0 || per_call < 0 || held_section < 0) {
+			printf("[TEST %s] Error: Failed to create worker thread\n", __func__);
+			ret_val = false;
+			break;
+		}
+		double lookups = (double)number_of_elements * rounds;
+		ret_val &= atomic_load(&found) == 2 * (size_t)lookups;
+		printf("[TEST %s] %7zu %8.2f ns %12.0f %12.0f %9.1f%%\n", __func__, threads,
+			bare * 1e9 / (lookups * 16),
+			lookups / per_call, lookups / held_section,
+			(per_call - held_section) * 100.0 / held_section);
+	}
+
+	//--------------------------------------------------------------------------
+	// Resizes under lookups.
+	//--------------------------------------------------------------------------
+	atomic_size_t found = 0;
+	double elapsed = epoch_test_run(ht, pdata, number_of_elements, max_threads,
+		rounds, 1, &found, true);
+	ht_stats_t stats;
+	ht_get_stats(ht, &stats);
+	size_t pending = ht_epoch_pending();
+	ht_epoch_barrier();
+	printf("[TEST %s] Resizes under lookups: %zu grows, %zu shrinks, found %zu/%zu\n",
+		__func__, stats.grows, stats.shrinks, atomic_load(&found),
+		number_of_elements * rounds);
+	printf("[TEST %s] Retired arrays pending: %zu, after barrier: %zu\n",
+		__func__, pending, ht_epoch_pending());
+	ret_val &= elapsed >= 0 && atomic_load(&found) == number_of_elements * rounds &&
+		stats.grows == 2 && stats.shrinks == 2 && ht_epoch_pending() == 0;
+
+	free_test_data(pdata, number_of_elements);
+	ht_free(ht);
+	if(ret_val) {
+		printf("[TEST %s] PASSED successfully\n", __func__);
+	} else {
+		printf("[TEST %s] FAILED\n", __func__);
+	}
+	return ret_val;
+}
+
+// Counters of the conditional write test, at the start of the value.
+typedef struct {
+	uint64_t cas;
+	uint64_t upsert;
+} atomic_test_counters_t;
+
+static void atomic_test_increment(uint8_t *value, size_t value_size, bool exists, void *ctx) {
+	(void)value_size;
+	(void)exists;
+	(void)ctx;
+	atomic_test_counters_t c;
+	memcpy(&c, value, sizeof(c));
+	c.upsert++;
+	memcpy(value, &c, sizeof(c));
+}
+
+int thread_atomic_worker(void *arg) {
+	if(arg == NULL) {
+		printf("Error: Unable to process args. Args are empty\n");
+		return 1;
+	}
+	ht_thread_atomic_data_t *data = (ht_thread_atomic_data_t *)arg;
+
+	atomic_fetch_add(data->ready, 1);
+	while(atomic_load(data->ready) < data->number_of_threads) {
+		thrd_yield();
+	}
+
+	size_t retries = 0;
+	uint8_t value[VALUE_SIZE];
+	uint8_t desired[VALUE_SIZE];
+	for(size_t r = 0; r < data->rounds; r++) {
+		// Threads walk the keys from different offsets to meet on each key.
+		for(size_t n = 0; n < data->number_of_keys; n++) {
+			size_t i = (n + data->thread_id * 7919) % data->number_of_keys;
+			test_data_t *t = &data->pdata[i];
+			if(data->mode == 0) {
+				memcpy(value, t->value, VALUE_SIZE);
+				memcpy(value, &data->thread_id, sizeof(data->thread_id));
+				if(ht_insert_if_absent(data->ht, t->key, value)) {
+					atomic_fetch_add(&data->wins[i], 1);
+				}
+			} else if(data->mode == 1) {
+				for(;;) {
+					if(!ht_contains_key(data->ht, t->key, value)) {
+						memset(value, 0, VALUE_SIZE);
+						ht_insert_if_absent(data->ht, t->key, value);
+						continue;
+					}
+					atomic_test_counters_t c;
+					memcpy(&c, value, sizeof(c));
+					c.cas++;
+					memcpy(desired, value, VALUE_SIZE);
+					memcpy(desired, &c, sizeof(c));
+					if(ht_compare_and_swap_value(data->ht, t->key, value, desired)) break;
+					retries++;
+				}
+			} else {
+				if(!ht_upsert(data->ht, t->key, atomic_test_increment, NULL)) retries++;
+			}
+		}
+	}
+	atomic_fetch_add(data->retries, retries);
+	return 0;
+}
+
+// Runs the workers, mode < 0 splits them between CAS and upsert increments.
+// Returns the wall time, a negative one if a thread could not be created.
+static double atomic_test_run(
+	hopscotch_hash_table_t *ht,
+	test_data_t *pdata,
+	size_t number_of_keys,
+	size_t number_of_threads,
+	size_t rounds,
+	int mode,
+	_Atomic uint32_t *wins,
+	atomic_size_t *retries
+) {
+	thrd_t threads[number_of_threads];
+	ht_thread_atomic_data_t thread_data[number_of_threads];
+	atomic_size_t ready = 0;
+	for(size_t i = 0; i < number_of_threads; i++) {
+		thread_data[i] = (ht_thread_atomic_data_t){
+			.ht = ht,
+			.pdata = pdata,
+			.number_of_keys = number_of_keys,
+			.rounds = rounds,
+			.mode = mode < 0 ? 1 + (int)(i % 2) : mode,
+			.thread_id = (uint32_t)i,
+			.number_of_threads = number_of_threads,
+			.ready = &ready,
+			.wins = wins,
+			.retries = retries
+		};
+	}
+
+	double start_time = get_current_time();
+	size_t created = 0;
+	for(; created < number_of_threads; created++) {
+		if(thrd_create(&threads[created], thread_atomic_worker,
+			&thread_data[created]) != thrd_success) {
+			break;
+		}
+	}
+	if(created < number_of_threads) atomic_store(&ready, number_of_threads);
+	for(size_t i = 0; i < created; i++) {
+		thrd_join(threads[i], NULL);
+	}
+	double elapsed = get_current_time() - start_time;
+	return created == number_of_threads ? elapsed : -1.0;
+}
+
+bool test_atomic_updates(
+	size_t number_of_elements,
+	hash_function_f hash_function,
+	size_t number_of_threads
+) {
+	printf("[TEST %s] Started...\n", __func__);
+	printf("[TEST %s] Number of keys    : %ld\n", __func__, number_of_elements);
+	printf("[TEST %s] Number of threads : %ld\n", __func__, number_of_threads);
+
+	// The table starts small, the adds race with the resizes they trigger.
+	hopscotch_hash_table_t *ht = ht_create(
+		round_to_power_of_two(number_of_elements / 8), hash_function, 0);
+	test_data_t *pdata = allocate_test_data(number_of_elements);
+	_Atomic uint32_t *wins = calloc(number_of_elements, sizeof(*wins));
+	if(!ht || !pdata || !wins) {
+		printf("[TEST %s] Error: Unable to allocate test data\n", __func__);
+		free(wins);
+		if(pdata) free_test_data(pdata, number_of_elements);
+		if(ht) ht_free(ht);
+		return false;
+	}
+
+	//--------------------------------------------------------------------------
+	// Every thread adds every key, exactly one of them wins each key.
+	//--------------------------------------------------------------------------
+	atomic_size_t retries = 0;
+	double elapsed = atomic_test_run(ht, pdata, number_of_elements,
+		number_of_threads, 1, 0, wins, &retries);
+	bool ret_val = elapsed >= 0;
+	size_t bad_wins = 0, bad_values = 0;
+	uint8_t value[VALUE_SIZE];
+	for(size_t i = 0; i < number_of_elements; i++) {
+		if(atomic_load(&wins[i]) != 1) bad_wins++;
+		uint32_t winner = UINT32_MAX;
+		if(ht_contains_key(ht, pdata[i].key, value)) memcpy(&winner, value, sizeof(winner));
+		if(winner >= number_of_threads) bad_values++;
+	}
+	ht_stats_t stats;
+	ht_get_stats(ht, &stats);
+	printf("[TEST %s] Insert if absent: %.0f attempts/sec, %zu grows, size %zu\n",
+		__func__, (double)number_of_elements * number_of_threads / elapsed,
+		stats.grows, ht_size_exact(ht));
+	printf("[TEST %s] Keys won other than once: %zu, unreadable winners: %zu\n",
+		__func__, bad_wins, bad_values);
+	ret_val &= bad_wins == 0 && bad_values == 0 && ht_size_exact(ht) == number_of_elements;
+
+	// Plain outcomes of each call.
+	memset(value, 0, VALUE_SIZE);
+	ret_val &= !ht_insert_if_absent(ht, pdata[0].key, value);
+	ret_val &= ht_replace(ht, pdata[0].key, value);
+	ret_val &= ht_remove_key(ht, pdata[0].key);
+	ret_val &= !ht_replace(ht, pdata[0].key, value);
+	ret_val &= !ht_compare_and_swap_value(ht, pdata[0].key, value, pdata[0].value);
+	ret_val &= ht_insert_if_absent(ht, pdata[0].key, value);
+	ret_val &= !ht_compare_and_swap_value(ht, pdata[0].key, pdata[0].value, value);
+	ret_val &= ht_compare_and_swap_value(ht, pdata[0].key, value, pdata[0].value);
+	ret_val &= ht_contains_key(ht, pdata[0].key, value) &&
+		memcmp(value, pdata[0].value, VALUE_SIZE) == 0;
+	ht_free(ht);
+
+	//--------------------------------------------------------------------------
+	// Counters bumped by CAS loops and upserts on a few hot keys, from missing.
+	//--------------------------------------------------------------------------
+	size_t hot_keys = 64;
+	size_t rounds = 0x800;
+	ht = ht_create(round_to_power_of_two(hot_keys * 2), hash_function, 0);
+	if(!ht) {
+		printf("[TEST %s] Error: Unable to create hash table\n", __func__);
+		free(wins);
+		free_test_data(pdata, number_of_elements);
+		return false;
+	}
+	atomic_store(&retries, 0);
+	elapsed = atomic_test_run(ht, pdata, hot_keys, number_of_threads, rounds, -1,
+		wins, &retries);
+	ret_val &= elapsed >= 0;
+	size_t cas_threads = (number_of_threads + 1) / 2;
+	size_t upsert_threads = number_of_threads / 2;
+	size_t bad_counters = 0;
+	for(size_t i = 0; i < hot_keys; i++) {
+		atomic_test_counters_t c = { 0, 0 };
+		if(ht_contains_key(ht, pdata[i].key, value)) memcpy(&c, value, sizeof(c));
+		if(c.cas != cas_threads * rounds || c.upsert != upsert_threads * rounds) {
+			bad_counters++;
+		}
+	}
+	printf("[TEST %s] Hot counters: %.0f increments/sec, %zu CAS retries\n",
+		__func__, (double)hot_keys * rounds * number_of_threads / elapsed,
+		atomic_load(&retries));
+	printf("[TEST %s] Counters off their expected totals: %zu/%zu\n",
+		__func__, bad_counters, hot_keys);
+	ret_val &= bad_counters == 0 && ht_size_exact(ht) == hot_keys;
+
+	ht_free(ht);
+	free(wins);
+	free_test_data(pdata, number_of_elements);
+	if(ret_val) {
+		printf("[TEST %s] PASSED successfully\n", __func__);
+	} else {
+		printf("[TEST %s] FAILED\n", __func__);
+	}
+	return ret_val;
+}
+
+int thread_scan_writer(void *arg) {
+	if(arg == NULL) {
+		printf("Error: Unable to process args. Args are empty\n");
+		return 1;
+	}
+	ht_thread_scan_data_t *data = (ht_thread_scan_data_t *)arg;
+
+	size_t ops = 0;
+	size_t capacity = ht_capacity(data->ht);
+	while(!atomic_load(data->stop)) {
+		if(data->resizer) {
+			ht_resize(data->ht, ops % 2 ? capacity : capacity * 2);
+			ht_resize_wait(data->ht);
+			ops++;
+			continue;
+		}
+		for(size_t i = data->start_idx; i < data->end_idx; i++) {
+			ht_insert(data->ht, data->pdata[i].key, data->pdata[i].value);
+		}
+		for(size_t i = data->start_idx; i < data->end_idx; i++) {
+			ht_remove_key(data->ht, data->pdata[i].key);
+		}
+		ops += 2 * (data->end_idx - data->start_idx);
+	}
+	atomic_fetch_add(data->ops, ops);
+	return 0;
+}
+
+// Visits per key of the scan test, the key index is kept in the value.
+typedef struct {
+	test_data_t *pdata;
+	size_t number_of_keys;
+	_Atomic uint32_t *visits;
+	atomic_size_t wrong;
+} scan_test_ctx_t;
+
+static void scan_test_visit(const uint8_t *key, const uint8_t *value, void *ctx) {
+	scan_test_ctx_t *c = (scan_test_ctx_t *)ctx;
+	uint64_t idx;
+	memcpy(&idx, value, sizeof(idx));
+	if(idx >= c->number_of_keys ||
+		memcmp(key, c->pdata[idx].key, KEY_SIZE) != 0 ||
+		memcmp(value, c->pdata[idx].value, VALUE_SIZE) != 0)
+	{
+		atomic_fetch_add(&c->wrong, 1);
+		return;
+	}
+	atomic_fetch_add_explicit(&c->visits[idx], 1, memory_order_relaxed);
+}
+
+// Keys [0, stable) must have been visited once, the others at most once.
+static bool scan_test_check(scan_test_ctx_t *c, size_t stable, const char *mode) {
+	size_t missed = 0, twice = 0;
+	for(size_t i = 0; i < c->number_of_keys; i++) {
+		uint32_t visits = atomic_exchange(&c->visits[i], 0);
+		if(visits > 1) twice++;
+		if(i < stable && visits == 0) missed++;
+	}
+	size_t wrong = atomic_exchange(&c->wrong, 0);
+	printf("[TEST test_table_scan] %-12s missed: %zu, visited twice: %zu, wrong: %zu\n",
+		mode, missed, twice, wrong);
+	return missed == 0 && twice == 0 && wrong == 0;
+}
+
+bool test_table_scan(
+	size_t number_of_elements,
+	hash_function_f hash_function,
+	size_t max_threads
+) {
+	printf("[TEST %s] Started...\n", __func__);
+	printf("[TEST %s] Number of keys    : %ld\n", __func__, number_of_elements);
+	printf("[TEST %s] Max threads       : %ld\n", __func__, max_threads);
+
+	// Keys [0, n) stay, keys [n, n + n / 4) come and go during the scans.
+	size_t volatile_keys = number_of_elements / 4;
+	size_t total = number_of_elements + volatile_keys;
+	hopscotch_hash_table_t *ht = ht_create(
+		round_to_power_of_two(number_of_elements * 2), hash_function, 0);
+	test_data_t *pdata = allocate_test_data(total);
+	_Atomic uint32_t *visits = calloc(total, sizeof(*visits));
+	if(!ht || !pdata || !visits) {
+		printf("[TEST %s] Error: Unable to allocate test data\n", __func__);
+		free(visits);
+		if(pdata) free_test_data(pdata, total);
+		if(ht) ht_free(ht);
+		return false;
+	}
+	ht_set_resize_policy(ht, 0, 0);
+	bool ret_val = true;
+	for(size_t i = 0; i < total; i++) {
+		uint64_t idx = i;
+		memcpy(pdata[i].value, &idx, sizeof(idx));
+		if(i < number_of_elements) ret_val &= ht_insert(ht, pdata[i].key, pdata[i].value);
+	}
+	scan_test_ctx_t ctx = { .pdata = pdata, .number_of_keys = total, .visits = visits };
+
+	//--------------------------------------------------------------------------
+	// Quiet table: throughput of the iterator and of the parallel scan.
+	//--------------------------------------------------------------------------
+	double start_time = get_current_time();
+	ht_iter_t *it = ht_iter_begin(ht);
+	const uint8_t *key, *value;
+	while(ht_iter_next(it, &key, &value)) scan_test_visit(key, value, &ctx);
+	ret_val &= !ht_iter_failed(it);
+	ht_iter_end(it);
+	double elapsed = get_current_time() - start_time;
+	printf("[TEST %s] Iterator     : %.0f entries/sec\n", __func__,
+		number_of_elements / elapsed);
+	ret_val &= scan_test_check(&ctx, number_of_elements, "iterator");
+
+	for(size_t threads = 1; threads <= max_threads; threads *= 2) {
+		start_time = get_current_time();
+		bool failed;
+		size_t visited = ht_parallel_for_each(ht, threads, scan_test_visit, &ctx, &failed);
+		elapsed = get_current_time() - start_time;
+		printf("[TEST %s] %2zu thread(s) : %.0f entries/sec\n", __func__, threads,
+			visited / elapsed);
+		ret_val &= visited == number_of_elements && !failed;
+		ret_val &= scan_test_check(&ctx, number_of_elements, "parallel");
+	}
+
+	//--------------------------------------------------------------------------
+	// Scans while writers add and remove keys and the table resizes.
+	//--------------------------------------------------------------------------
+	size_t writers = 4;
+	thrd_t threads[writers + 1];
+	ht_thread_scan_data_t thread_data[writers + 1];
+	atomic_bool stop = false;
+	atomic_size_t ops = 0;
+	size_t per_writer = volatile_keys / writers;
+	for(size_t i = 0; i <= writers; i++) {
+		thread_data[i] = (ht_thread_scan_data_t){
+			.ht = ht,
+			.pdata = pdata,
+			.start_idx = number_of_elements + i * per_writer,
+			.end_idx = number_of_elements + (i + 1) * per_writer,
+			.resizer = i == writers,
+			.stop = &stop,
+			.ops = &ops
+		};
+	}
+	size_t created = 0;
+	for(; created <= writers; created++) {
+		if(thrd_create(&threads[created], thread_scan_writer,
+			&thread_data[created]) != thrd_success) {
+			printf("[TEST %s] Error: Failed to create worker thread\n", __func__);
+			ret_val = false;
+			break;
+		}
+	}
+
+	size_t rounds = 8;
+	for(size_t r = 0; r < rounds; r++) {
+		it = ht_iter_begin(ht);
+		while(ht_iter_next(it, &key, &value)) scan_test_visit(key, value, &ctx);
+		ret_val &= !ht_iter_failed(it);
+		ht_iter_end(it);
+		ret_val &= scan_test_check(&ctx, number_of_elements, "iterator");
+
+		bool failed;
+		ht_parallel_for_each(ht, max_threads, scan_test_visit, &ctx, &failed);
+		ret_val &= !failed && scan_test_check(&ctx, number_of_elements, "parallel");
+	}
+
+	atomic_store(&stop, true);
+	for(size_t i = 0; i < created; i++) {
+		thrd_join(threads[i], NULL);
+	}
+	ht_stats_t stats;
+	ht_get_stats(ht, &stats);
+	printf("[TEST %s] Writer ops during the scans: %zu, %zu grows, %zu shrinks\n",
+		__func__, atomic_load(&ops), stats.grows, stats.shrinks);
+	ret_val &= ht_iter_begin(NULL) == NULL && !ht_iter_next(NULL, &key, &value) &&
+		!ht_iter_failed(NULL);
+
+	free(visits);
+	free_test_data(pdata, total);
+	ht_free(ht);
+	if(ret_val) {
+		printf("[TEST %s] PASSED successfully\n", __func__);
+	} else {
+		printf("[TEST %s] FAILED\n", __func__);
+	}
+	return ret_val;
+}
+
+// Builds a fresh table from the pairs, returns the time it took or a negative
+// one if the build failed. The table is returned in out.
+static double bulk_test_build(
+	size_t capacity,
+	hash_function_f hash_function,
+	const uint8_t *const *keys,
+	const uint8_t *const *values,
+	size_t count,
+	size_t threads,
+	hopscotch_hash_table_t **out
+) {
+	hopscotch_hash_table_t *ht = ht_create(capacity, hash_function, 0);
+	*out = ht;
+	if(!ht) return -1.0;
+	double start_time = get_current_time();
+	bool built = ht_bulk_build(ht, keys, values, count, threads);
+	double elapsed = get_current_time() - start_time;
+	return built ? elapsed : -1.0;
+}
+
+// Every pair must be found with its value.
+static size_t bulk_test_missing(
+	hopscotch_hash_table_t *ht,
+	const uint8_t *const *keys,
+	const uint8_t *const *values,
+	size_t count
+) {
+	size_t missing = 0;
+	uint8_t value[VALUE_SIZE];
+	for(size_t i = 0; i < count; i++) {
+		if(!ht_contains_key(ht, keys[i], value) || memcmp(value, values[i], VALUE_SIZE) != 0) {
+			missing++;
+		}
+	}
+	return missing;
+}
+
+bool test_bulk_build(size_t capacity, hash_function_f hash_function, size_t max_threads) {
+	printf("[TEST %s] Started...\n", __func__);
+	printf("[TEST %s] Table capacity    : %ld\n", __func__, capacity);
+	printf("[TEST %s] Max threads       : %ld\n", __func__, max_threads);
+
+	// Same fill as test_insert_remove_elements.
+	size_t count = ANY_PERCENT(capacity, 80);
+	test_data_t *pdata = allocate_test_data(count);
+	const uint8_t **keys = malloc(count * sizeof(*keys));
+	const uint8_t **values = malloc(count * sizeof(*values));
+	if(!pdata || !keys || !values) {
+		printf("[TEST %s] Error: Unable to allocate test data\n", __func__);
+		free(keys);
+		free(values);
+		if(pdata) free_test_data(pdata, count);
+		return false;
+	}
+	for(size_t i = 0; i < count; i++) {
+		keys[i] = pdata[i].key;
+		values[i] = pdata[i].value;
+	}
+
+	//--------------------------------------------------------------------------
+	// Reference: one ht_insert per key.
+	//--------------------------------------------------------------------------
+	bool ret_val = true;
+	hopscotch_hash_table_t *ht = ht_create(capacity, hash_function, 0);
+	if(!ht) {
+		printf("[TEST %s] Error: Unable to create hash table\n", __func__);
+		free(keys);
+		free(values);
+		free_test_data(pdata, count);
+		return false;
+	}
+	double start_time = get_current_time();
+	for(size_t i = 0; i < count; i++) {
+		ret_val &= ht_insert(ht, keys[i], values[i]);
+	}
+	double insert_time = get_current_time() - start_time;
+	printf("[TEST %s] Insert loop : %.0f entries/sec\n", __func__, count / insert_time);
+
+	// A table in use is refused.
+	ret_val &= !ht_bulk_build(ht, keys, values, count, 1);
+	ht_free(ht);
+
+	//--------------------------------------------------------------------------
+	// Bulk builds.
+	//--------------------------------------------------------------------------
+	for(size_t threads = 1; threads <= max_threads; threads *= 2) {
+		double elapsed = bulk_test_build(capacity, hash_function, keys, values,
+			count, threads, &ht);
+		size_t missing = ht ? bulk_test_missing(ht, keys, values, count) : count;
+		printf("[TEST %s] %2zu thread(s): %.0f entries/sec, %.1fx the insert loop, "
+			"missing: %zu\n", __func__, threads, count / elapsed, insert_time / elapsed,
+			missing);
+		ret_val &= elapsed >= 0 && missing == 0 && ht_size_exact(ht) == count;
+		if(ht) ht_free(ht);
+	}
+
+	//--------------------------------------------------------------------------
+	// Duplicates keep the last value, a build past the capacity grows first.
+	//--------------------------------------------------------------------------
+	const uint8_t *first_value = values[0];
+	keys[count - 1] = keys[0];
+	values[0] = values[1];
+	values[count - 1] = first_value;
+	double elapsed = bulk_test_build(capacity / 4, hash_function, keys, values,
+		count, max_threads, &ht);
+	size_t missing = ht ? bulk_test_missing(ht, keys + 1, values + 1, count - 1) : count;
+	printf("[TEST %s] Duplicate key, quarter capacity: capacity %zu, size %zu, missing: %zu\n",
+		__func__, ht_capacity(ht), ht_size_exact(ht), missing);
+	ret_val &= elapsed >= 0 && missing == 0 && ht_size_exact(ht) == count - 1 &&
+		ht_capacity(ht) > capacity / 4;
+	if(ht) ht_free(ht);
+
+	free(keys);
+	free(values);
+	free_test_data(pdata, count);
+	if(ret_val) {
+		printf("[TEST %s] PASSED successfully\n", __func__);
+	} else {
+		printf("[TEST %s] FAILED\n", __func__);
+	}
+	return ret_val;
+}
+
+//------------------------------------------------------------------------------
+// Churn.
+//------------------------------------------------------------------------------
+int thread_churn_worker(void *arg) {
+	if(arg == NULL) {
+		printf("Error: Unable to process args. Args are empty\n");
+		return 1;
+	}
+	ht_thread_churn_data_t *data = (ht_thread_churn_data_t *)arg;
+	ht_churn_counters_t *c = data->counters;
+	test_rng_t rng;
+	test_rng_seed(&rng, data->seed);
+
+	uint8_t key[KEY_SIZE], value[VALUE_SIZE], got_value[VALUE_SIZE];
+	memset(value, 0, sizeof(value));
+	while(!atomic_load_explicit(data->stop, memory_order_relaxed)) {
+		for(size_t i = 0; i < KEY_SIZE; i += sizeof(uint64_t)) {
+			uint64_t r = test_rng_next(&rng);
+			memcpy(key + i, &r, sizeof(r));
+		}
+		uint64_t stamp = test_rng_next(&rng);
+		memcpy(value, &stamp, sizeof(stamp));
+
+		if(!ht_insert(data->ht, key, value)) {
+			atomic_fetch_add_explicit(&c->insert_failed, 1, memory_order_relaxed);
+		} else {
+			if(!ht_contains_key(data->ht, key, got_value)) {
+				atomic_fetch_add_explicit(&c->missing, 1, memory_order_relaxed);
+			} else if(memcmp(got_value, value, VALUE_SIZE) != 0) {
+				atomic_fetch_add_explicit(&c->stale, 1, memory_order_relaxed);
+			}
+			if(!ht_remove_key(data->ht, key)) {
+				atomic_fetch_add_explicit(&c->missing, 1, memory_order_relaxed);
+			}
+		}
+
+		// The prefilled keys stay in place while the others move around them.
+		test_data_t *t = &data->pdata[test_rng_next(&rng) % data->number_of_keys];
+		if(!ht_contains_key(data->ht, t->key, got_value)) {
+			atomic_fetch_add_explicit(&c->missing, 1, memory_order_relaxed);
+		} else if(memcmp(got_value, t->value, VALUE_SIZE) != 0) {
+			atomic_fetch_add_explicit(&c->stale, 1, memory_order_relaxed);
+		}
+		atomic_fetch_add_explicit(&c->rounds, 1, memory_order_relaxed);
+	}
+	return 0;
+}
+
+// Sum of the counters of every thread.
+typedef struct {
+	size_t rounds;
+	size_t insert_failed;
+	size_t missing;
+	size_t stale;
+} churn_test_totals_t;
+
+static churn_test_totals_t churn_test_sum(ht_churn_counters_t *counters, size_t n) {
+	churn_test_totals_t sum = { 0 };
+	for(size_t i = 0; i < n; i++) {
+		sum.rounds += atomic_load(&counters[i].rounds);
+		sum.insert_failed += atomic_load(&counters[i].insert_failed);
+		sum.missing += atomic_load(&counters[i].missing);
+		sum.stale += atomic_load(&counters[i].stale);
+	}
+	return sum;
+}
+
+// Runs the churn threads on the prefilled table, prints the timeline and the
+// totals.
+static bool churn_test_run(
+	hopscotch_hash_table_t *ht,
+	test_data_t *pdata,
+	size_t number_of_keys,
+	size_t number_of_threads,
+	size_t duration,
+	ht_churn_counters_t *counters,
+	thrd_t *threads,
+	ht_thread_churn_data_t *thread_data
+) {
+	bool ret_val = true;
+	atomic_bool stop = false;
+	uint64_t seed = get_test_data_seed();
+	memset(counters, 0, number_of_threads * sizeof(ht_churn_counters_t));
+	for(size_t i = 0; i < number_of_threads; i++) {
+		thread_data[i] = (ht_thread_churn_data_t){
+			.ht = ht,
+			.pdata = pdata,
+			.number_of_keys = number_of_keys,
+			.seed = test_splitmix64(&seed),
+			.stop = &stop,
+			.counters = &counters[i]
+		};
+	}
+	size_t created = 0;
+	for(; created < number_of_threads; created++) {
+		if(thrd_create(&threads[created], thread_churn_worker,
+			&thread_data[created]) != thrd_success) {
+			printf("[TEST test_churn] Error: Failed to create churn thread\n");
+			ret_val = false;
+			break;
+		}
+	}
+
+	churn_test_totals_t last = { 0 };
+	double start_time = get_current_time();
+	double last_time = start_time;
+	for(size_t second = 1; ret_val && (!duration || second <= duration); second++) {
+		sleep(1);
+		churn_test_totals_t now = churn_test_sum(counters, created);
+		double now_time = get_current_time();
+		size_t rounds = now.rounds - last.rounds;
+		size_t failed = now.insert_failed - last.insert_failed;
+		// A round is an insert, two lookups and a remove.
+		printf("[TEST test_churn] %4zu sec: %10.0f ops/sec, insert failures %zu "
+			"(%.4f%%), missing %zu, stale %zu, size %zu\n", second,
+			4 * rounds / (now_time - last_time), failed,
+			rounds ? 100.0 * failed / rounds : 0.0, now.missing - last.missing,
+			now.stale - last.stale, ht_size_exact(ht));
+		last = now;
+		last_time = now_time;
+	}
+	atomic_store(&stop, true);
+	for(size_t i = 0; i < created; i++) {
+		thrd_join(threads[i], NULL);
+	}
+
+	churn_test_totals_t total = churn_test_sum(counters, created);
+	printf("[TEST test_churn] Rounds: %zu, %.0f ops/sec, insert failures: %zu, "
+		"missing: %zu, stale: %zu\n", total.rounds,
+		4 * total.rounds / (get_current_time() - start_time), total.insert_failed,
+		total.missing, total.stale);
+	return ret_val && total.missing == 0 && total.stale == 0;
+}
+
+bool test_churn(
+	size_t capacity,
+	hash_function_f hash_function,
+	size_t number_of_threads,
+	size_t duration
+) {
+	printf("[TEST %s] Started...\n", __func__);
+	// Prefill 3/4 of the table, not less than 1,000,000 keys.
+	capacity = round_to_power_of_two(capacity);
+	while(ANY_PERCENT(capacity, 75) < 1000000) capacity *= 2;
+	size_t number_of_keys = ANY_PERCENT(capacity, 75);
+	printf("[TEST %s] Table capacity    : %ld\n", __func__, capacity);
+	printf("[TEST %s] Prefilled keys    : %ld\n", __func__, number_of_keys);
+	printf("[TEST %s] Number of threads : %ld\n", __func__, number_of_threads);
+	if(duration) printf("[TEST %s] Duration          : %ld sec\n", __func__, duration);
+	else printf("[TEST %s] Duration          : endless\n", __func__);
+
+	hopscotch_hash_table_t *ht = ht_create(capacity, hash_function, 0);
+	test_data_t *pdata = allocate_test_data(number_of_keys);
+	const uint8_t **keys = malloc(number_of_keys * sizeof(*keys));
+	const uint8_t **values = malloc(number_of_keys * sizeof(*values));
+	ht_churn_counters_t *counters = aligned_alloc(64,
+		number_of_threads * sizeof(ht_churn_counters_t));
+	thrd_t *threads = malloc(number_of_threads * sizeof(thrd_t));
+	ht_thread_churn_data_t *thread_data = malloc(
+		number_of_threads * sizeof(ht_thread_churn_data_t));
+	bool ret_val = ht && pdata && keys && values && counters && threads && thread_data;
+	if(!ret_val) {
+		printf("[TEST %s] Error: Unable to allocate test data\n", __func__);
+	}
+
+	//--------------------------------------------------------------------------
+	// Prefill.
+	//--------------------------------------------------------------------------
+	if(ret_val) {
+		for(size_t i = 0; i < number_of_keys; i++) {
+			keys[i] = pdata[i].key;
+			values[i] = pdata[i].value;
+		}
+		double start_time = get_current_time();
+		ret_val = ht_bulk_build(ht, keys, values, number_of_keys, number_of_threads);
+		if(ret_val) {
+			printf("[TEST %s] Prefilled in %.4f sec, load factor %.2f\n", __func__,
+				get_current_time() - start_time, (double)ht_size(ht) / ht_capacity(ht));
+		} else {
+			printf("[TEST %s] Error: Unable to prefill the table\n", __func__);
+		}
+	}
+
+	//--------------------------------------------------------------------------
+	// Churn. Afterwards every churn key must be gone and every prefilled key
+	// still there.
+	//--------------------------------------------------------------------------
+	if(ret_val) {
+		ret_val = churn_test_run(ht, pdata, number_of_keys, number_of_threads, duration,
+			counters, threads, thread_data);
+		size_t lost = 0;
+		uint8_t got_value[VALUE_SIZE];
+		for(size_t i = 0; i < number_of_keys; i++) {
+			if(!ht_contains_key(ht, pdata[i].key, got_value) ||
+				memcmp(got_value, pdata[i].value, VALUE_SIZE) != 0) lost++;
+		}
+		if(lost || ht_size_exact(ht) != number_of_keys) {
+			printf("[TEST %s] Error: %zu prefilled keys lost, size %zu\n", __func__, lost,
+				ht_size_exact(ht));
+			ret_val = false;
+		}
+		ht_print_stats(ht);
+	}
+
+	free(thread_data);
+	free(threads);
+	free(counters);
+	free(keys);
+	free(values);
+	if(pdata) free_test_data(pdata, number_of_keys);
+	if(ht) ht_free(ht);
+	if(ret_val) {
+		printf("[TEST %s] PASSED successfully\n", __func__);
+	} else {
+		printf("[TEST %s] FAILED\n", __func__);
+	}
+	return ret_val;
+}
@@ -8,7 +8,7 @@
 //------------------------------------------------------------------------------
 typedef struct {
 	hopscotch_hash_table_t *ht;
-	hash_function_f hash_function;
+	ht_sharded_t *sharded; // Sharded mode if set, ht is NULL then.
 	test_data_t *pdata;
 	atomic_char **progress_stages;
 	size_t test_data_size;
@@ -18,10 +18,134 @@ typedef struct {
 	atomic_int *keys_inserted;
 	atomic_int *keys_validated;
 	atomic_int *keys_removed;
+	atomic_int *keys_local;
 	_Atomic (ht_benchmark_data_t *) benchmark_data;
 } ht_thread_insert_data_t;
 int thread_insert_worker(void *arg);
 
+//------------------------------------------------------------------------------
+// Online resize thread data.
+//------------------------------------------------------------------------------
+typedef struct {
+	hopscotch_hash_table_t *ht;
+	test_data_t *pdata;
+	size_t start_idx;
+	size_t end_idx;
+	size_t number_of_threads;
+	atomic_size_t *threads_inserted;
+	atomic_int *keys_inserted;
+	atomic_int *keys_validated;
+	atomic_int *keys_removed;
+} ht_thread_resize_data_t;
+int thread_resize_worker(void *arg);
+
+//------------------------------------------------------------------------------
+// Consistent reads thread data.
+//------------------------------------------------------------------------------
+typedef struct {
+	hopscotch_hash_table_t *ht;
+	test_data_t *pdata;
+	size_t number_of_keys;
+	size_t rounds;
+	int thread_id;
+	bool writer;
+	atomic_bool *writers_done;
+	atomic_size_t *reads;
+	atomic_size_t *torn_reads;
+} ht_thread_consistency_data_t;
+int thread_consistency_worker(void *arg);
+
+//------------------------------------------------------------------------------
+// Displacement thread data.
+//------------------------------------------------------------------------------
+typedef struct {
+	hopscotch_hash_table_t *ht;
+	test_data_t *pdata;
+	size_t start_idx;
+	size_t end_idx;
+	bool writer;
+	atomic_bool *writers_done;
+	atomic_size_t *failed;
+	atomic_size_t *missed;
+} ht_thread_displacement_data_t;
+int thread_displacement_worker(void *arg);
+
+//------------------------------------------------------------------------------
+// Epoch overhead thread data.
+//------------------------------------------------------------------------------
+// section_ops: 0 - bare ht_epoch_enter / ht_epoch_exit pairs, 1 - lookups
+// with their own section, n - one section held across n lookups.
+typedef struct {
+	hopscotch_hash_table_t *ht;
+	test_data_t *pdata;
+	size_t start_idx;
+	size_t end_idx;
+	size_t rounds;
+	size_t section_ops;
+	size_t number_of_threads;
+	atomic_size_t *ready;
+	atomic_size_t *found;
+} ht_thread_epoch_data_t;
+int thread_epoch_worker(void *arg);
+
+//------------------------------------------------------------------------------
+// Conditional write thread data.
+//------------------------------------------------------------------------------
+// mode: 0 - ht_insert_if_absent of every key, 1 - increments of a counter
+// per key by ht_compare_and_swap_value, 2 - the same by ht_upsert.
+typedef struct {
+	hopscotch_hash_table_t *ht;
+	test_data_t *pdata;
+	size_t number_of_keys;
+	size_t rounds;
+	int mode;
+	uint32_t thread_id;
+	size_t number_of_threads;
+	atomic_size_t *ready;
+	_Atomic uint32_t *wins;
+	atomic_size_t *retries;
+} ht_thread_atomic_data_t;
+int thread_atomic_worker(void *arg);
+
+//------------------------------------------------------------------------------
+// Scan writer thread data.
+//------------------------------------------------------------------------------
+// Adds and removes keys [start_idx, end_idx) until stop is set, the resizer
+// grows and shrinks the table instead.
+typedef struct {
+	hopscotch_hash_table_t *ht;
+	test_data_t *pdata;
+	size_t start_idx;
+	size_t end_idx;
+	bool resizer;
+	atomic_bool *stop;
+	atomic_size_t *ops;
+} ht_thread_scan_data_t;
+int thread_scan_writer(void *arg);
+
+//------------------------------------------------------------------------------
+// Churn thread data.
+//------------------------------------------------------------------------------
+// Every round adds a random key, looks it up, removes it and looks up one of
+// the prefilled keys, until stop is set. The counters belong to the thread,
+// the test samples them once per second.
+typedef struct {
+	_Alignas(64) atomic_size_t rounds;
+	atomic_size_t insert_failed;
+	atomic_size_t missing;       // Keys not found while they must be there.
+	atomic_size_t stale;         // Keys found with another value.
+} ht_churn_counters_t;
+
+typedef struct {
+	hopscotch_hash_table_t *ht;
+	test_data_t *pdata;
+	size_t number_of_keys;
+	uint64_t seed;
+	atomic_bool *stop;
+	ht_churn_counters_t *counters;
+} ht_thread_churn_data_t;
+int thread_churn_worker(void *arg);
+
 //------------------------------------------------------------------------------
 // Print progress thread data.
 //------------------------------------------------------------------------------